@@ -0,0 +1,452 @@
+/**
+ * client.c
+ * Client library of the Entrylog daemon. Rows are gathered in a row set and
+ * sent to the daemon in batches, which appends them to the document for us.
+ *
+ * @author Nathan Campos <nathan@innoveworkshop.com>
+ */
+
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "eldd.h"
+
+#ifndef PATH_MAX
+	#define PATH_MAX 4096
+#endif /* !PATH_MAX */
+
+/* Error message buffer. */
+static char eldd_error_buf[256];
+
+/* Private methods. */
+el_err_t eldd_request(eldd_client_t *client, uint8_t type, const void *payload,
+					  uint32_t len);
+el_err_t eldd_rows_send(eldd_client_t *client, const el_rowset_t *set,
+						uint32_t *sent);
+void eldd_batch_shift(el_rowset_t *set, uint32_t count);
+void eldd_error_set(const char *format, ...);
+void eldd_client_free(eldd_client_t *client);
+
+/**
+ * Connects to the daemon and opens a document through it. The document must
+ * already exist, since its fields are taken from the file.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param sock_path Path to the daemon socket or NULL for the default one.
+ * @param fname     Document file path.
+ *
+ * @return Brand new client connection or NULL if an error occurred.
+ *
+ * @see eldd_close
+ */
+eldd_client_t *eldd_open(const char *sock_path, const char *fname) {
+	eldd_client_t *client;
+	struct sockaddr_un addr;
+	char path[PATH_MAX];
+	eldd_msg_t msg;
+	char *payload;
+	uint16_t flags;
+	uint8_t count;
+	uint8_t i;
+	el_err_t err;
+
+	if (sock_path == NULL)
+		sock_path = ELDD_SOCKET_PATH;
+
+	/* The daemon doesn't share our working directory. */
+	if (realpath(fname, path) == NULL) {
+		eldd_error_set("Couldn't resolve \"%s\": %s.", fname, strerror(errno));
+		return NULL;
+	}
+
+	/* Connect to the daemon. */
+	if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+		eldd_error_set("Socket path \"%s\" is too long.", sock_path);
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+
+	client = (eldd_client_t *)malloc(sizeof(eldd_client_t));
+	client->doc = NULL;
+	client->batch = NULL;
+	client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((client->fd < 0) ||
+		(connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		eldd_error_set("Couldn't connect to the daemon at \"%s\": %s.",
+					   sock_path, strerror(errno));
+		eldd_client_free(client);
+		return NULL;
+	}
+
+	/* Open the document. */
+	err = eldd_msg_send(client->fd, ELDD_MSG_OPEN, EL_OK, path,
+						(uint32_t)strlen(path) + 1);
+	if (err == EL_OK)
+		err = eldd_msg_recv(client->fd, &msg, &payload);
+	IF_EL_ERROR(err) {
+		eldd_error_set("Lost connection to the daemon.");
+		eldd_client_free(client);
+		return NULL;
+	}
+	if (msg.status != EL_OK) {
+		eldd_error_set("%s", payload);
+		free(payload);
+		eldd_client_free(client);
+		return NULL;
+	}
+
+	/* Build a local copy of the document fields to create rows with. */
+	memcpy(&flags, payload, sizeof(uint16_t));
+	count = (uint8_t)payload[sizeof(uint16_t)];
+	if (msg.len != (sizeof(uint16_t) + 1 + (sizeof(el_field_def_t) * count))) {
+		eldd_error_set("Invalid reply from the daemon.");
+		free(payload);
+		eldd_client_free(client);
+		return NULL;
+	}
+	client->doc = el_doc_new();
+	for (i = 0; (i < count) && (err == EL_OK); i++) {
+		el_field_def_t field;
+
+		memcpy(&field, payload + sizeof(uint16_t) + 1 +
+			   (sizeof(el_field_def_t) * i), sizeof(el_field_def_t));
+		err = el_doc_field_add(client->doc, field);
+	}
+	free(payload);
+	if ((err == EL_OK) && (flags & EL_EXT_NULLS))
+		err = el_doc_nullable(client->doc, true);
+	IF_EL_ERROR(err) {
+		eldd_error_set("%s", el_error_msg());
+		eldd_client_free(client);
+		return NULL;
+	}
+	client->batch = el_rowset_new(client->doc, ELDD_CLIENT_ROWS);
+
+	return client;
+}
+
+/**
+ * Queues a row to be appended to the document. Create it with el_row_new on
+ * the document of the client. Rows are sent to the daemon once the batch is
+ * full or when the client is flushed.
+ *
+ * @param client Client connection.
+ * @param row    Row to be appended.
+ *
+ * @return EL_OK if the row was queued.
+ *         EL_ERROR_ARGUMENT if the row isn't from this document.
+ *         Any error returned by eldd_flush.
+ */
+el_err_t eldd_row_add(eldd_client_t *client, const el_row_t *row) {
+	el_rowset_t *set = client->batch;
+	uint32_t pos;
+	uint8_t i;
+	el_err_t err;
+
+	if (row->cell_count != set->field_count) {
+		eldd_error_set("Row doesn't match the document fields.");
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Make room for the row. */
+	if (set->count >= set->capacity) {
+		err = eldd_flush(client);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+	el_rowset_add(set);
+	pos = set->count - 1;
+
+	/* Copy the cells into the columns. */
+	for (i = 0; i < row->cell_count; i++) {
+		const el_cell_t *cell = &(row->cells[i]);
+		char *dest = set->columns[i] + ((size_t)set->widths[i] * pos);
+
+		if (set->nulls[i] != NULL)
+			set->nulls[i][pos] = cell->null;
+
+		switch ((el_type_t)set->field_defs[i].type) {
+			case EL_FIELD_STRING:
+			case EL_FIELD_VARCHAR:
+				el_rowset_string_set(set, i, pos, (cell->value.string != NULL) ?
+									 cell->value.string : "");
+				break;
+			case EL_FIELD_FLOAT_ARRAY:
+			case EL_FIELD_INT_ARRAY:
+				memcpy(dest, cell->value.array.data, set->widths[i]);
+				break;
+			case EL_FIELD_BOOL:
+				dest[0] = cell->value.boolean;
+				break;
+			default:
+				memcpy(dest, &(cell->value), set->widths[i]);
+				break;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Sends a whole set of rows to be appended to the document. Any queued rows
+ * are sent before it.
+ *
+ * @param client Client connection.
+ * @param set    Row set created for the document of the client.
+ *
+ * @return EL_OK if the daemon took the rows.
+ *         EL_ERROR_ARGUMENT if the set doesn't match the document.
+ *         Any error returned by eldd_rows_send.
+ */
+el_err_t eldd_rowset_add(eldd_client_t *client, const el_rowset_t *set) {
+	uint32_t sent;
+	uint8_t i;
+	el_err_t err;
+
+	/* Check if the set is for this document. */
+	if (set->field_count != client->batch->field_count) {
+		eldd_error_set("Row set doesn't match the document fields.");
+		return EL_ERROR_ARGUMENT;
+	}
+	for (i = 0; i < set->field_count; i++) {
+		if ((set->widths[i] != client->batch->widths[i]) ||
+			((set->nulls[i] == NULL) != (client->batch->nulls[i] == NULL))) {
+			eldd_error_set("Field %u of the row set doesn't match the "
+						   "document.", i);
+			return EL_ERROR_ARGUMENT;
+		}
+	}
+
+	/* Keep the rows in order. */
+	err = eldd_flush(client);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	return eldd_rows_send(client, set, &sent);
+}
+
+/**
+ * Sends the queued rows to the daemon. They are written to the document in
+ * the next batch of the daemon. Rows that the daemon didn't take are kept in
+ * the queue, so that they can be sent again.
+ *
+ * @param client Client connection.
+ *
+ * @return EL_OK if the daemon took the rows.
+ *         Any error returned by eldd_rows_send.
+ */
+el_err_t eldd_flush(eldd_client_t *client) {
+	uint32_t sent;
+	el_err_t err;
+
+	err = eldd_rows_send(client, client->batch, &sent);
+	eldd_batch_shift(client->batch, sent);
+
+	return err;
+}
+
+/**
+ * Sends the queued rows to the daemon and waits until every row of the
+ * document has been written and flushed to disk.
+ *
+ * @param client Client connection.
+ *
+ * @return EL_OK if the rows are on disk.
+ *         Any error returned by the daemon, including the ones of rows it
+ *         couldn't write since the last sync.
+ */
+el_err_t eldd_sync(eldd_client_t *client) {
+	el_err_t err;
+
+	err = eldd_flush(client);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	return eldd_request(client, ELDD_MSG_SYNC, NULL, 0);
+}
+
+/**
+ * Sends the queued rows to the daemon, closes the connection and frees up the
+ * client. Rows are written by the daemon in its own time, so use eldd_sync
+ * first if they must be on disk.
+ *
+ * @param client Client connection to be free'd.
+ *
+ * @return EL_OK if the daemon took the queued rows.
+ *         Any error returned by the daemon.
+ */
+el_err_t eldd_close(eldd_client_t *client) {
+	el_err_t err;
+
+	if (client == NULL)
+		return EL_OK;
+
+	err = eldd_flush(client);
+	eldd_client_free(client);
+
+	return err;
+}
+
+/**
+ * Gets the last error message of the client library.
+ *
+ * @return Error message.
+ */
+const char *eldd_error_msg(void) {
+	return eldd_error_buf;
+}
+
+/**
+ * Sends a request to the daemon and waits for its reply.
+ *
+ * @param client  Client connection.
+ * @param type    Type of the request.
+ * @param payload Contents of the request.
+ * @param len     Length of the contents.
+ *
+ * @return Status replied by the daemon.
+ *         EL_ERROR_FILE if the connection was lost.
+ */
+el_err_t eldd_request(eldd_client_t *client, uint8_t type, const void *payload,
+					  uint32_t len) {
+	eldd_msg_t msg;
+	char *reply;
+	el_err_t err;
+
+	err = eldd_msg_send(client->fd, type, EL_OK, payload, len);
+	if (err == EL_OK)
+		err = eldd_msg_recv(client->fd, &msg, &reply);
+	IF_EL_ERROR(err) {
+		eldd_error_set("Lost connection to the daemon.");
+		return EL_ERROR_FILE;
+	}
+
+	err = (el_err_t)msg.status;
+	if (err != EL_OK)
+		eldd_error_set("%s", reply);
+	free(reply);
+
+	return err;
+}
+
+/**
+ * Sends the rows of a set to the daemon in as many messages as it takes to
+ * keep each one within ELDD_MSG_MAX.
+ *
+ * @param client Client connection.
+ * @param set    Row set created for the document of the client.
+ * @param sent   Where to place the number of rows that the daemon took.
+ *
+ * @return EL_OK if the daemon took every row.
+ *         EL_ERROR_ARGUMENT if a row is too large to fit in a message.
+ *         Any error returned by the daemon.
+ */
+el_err_t eldd_rows_send(eldd_client_t *client, const el_rowset_t *set,
+						uint32_t *sent) {
+	size_t empty = eldd_rowset_len(set, 0, 0);
+	uint32_t count;
+	size_t len;
+	char *buf;
+	el_err_t err = EL_OK;
+
+	*sent = 0;
+	while ((err == EL_OK) && (*sent < set->count)) {
+		/* Fit as many rows as we can in the message. */
+		len = empty;
+		for (count = 0; (*sent + count) < set->count; count++) {
+			size_t row = eldd_rowset_len(set, *sent + count, 1) - empty;
+
+			if ((len + row) > ELDD_MSG_MAX)
+				break;
+			len += row;
+		}
+		if (count == 0) {
+			eldd_error_set("Row %lu is too large to be sent.",
+						   (unsigned long)*sent);
+			return EL_ERROR_ARGUMENT;
+		}
+
+		buf = (char *)malloc(len);
+		eldd_rowset_encode(set, *sent, count, buf);
+		err = eldd_request(client, ELDD_MSG_APPEND, buf, (uint32_t)len);
+		free(buf);
+		if (err == EL_OK)
+			*sent += count;
+	}
+
+	return err;
+}
+
+/**
+ * Drops the rows at the front of a queue that were already sent. Their
+ * strings stay in the arena until the queue is empty.
+ *
+ * @param set   Queued rows.
+ * @param count Number of rows to be dropped.
+ */
+void eldd_batch_shift(el_rowset_t *set, uint32_t count) {
+	uint8_t i;
+
+	if (count == 0)
+		return;
+	if (count >= set->count) {
+		el_rowset_clear(set);
+		return;
+	}
+
+	set->count -= count;
+	for (i = 0; i < set->field_count; i++) {
+		memmove(set->columns[i], set->columns[i] +
+				((size_t)set->widths[i] * count),
+				(size_t)set->widths[i] * set->count);
+		if (set->nulls[i] != NULL)
+			memmove(set->nulls[i], set->nulls[i] + count, set->count);
+	}
+	memmove(set->indexes, set->indexes + count,
+			sizeof(uint32_t) * set->count);
+}
+
+/**
+ * Sets the error message of the client library.
+ *
+ * @param format Format of the message, as in printf.
+ * @param ...    Arguments of the format.
+ */
+void eldd_error_set(const char *format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(eldd_error_buf, sizeof(eldd_error_buf), format, args);
+	va_end(args);
+}
+
+/**
+ * Closes the connection and frees up a client without sending anything.
+ *
+ * @param client Client connection to be free'd.
+ */
+void eldd_client_free(eldd_client_t *client) {
+	if (client->fd >= 0)
+		close(client->fd);
+	el_rowset_free(client->batch);
+	if (client->doc != NULL) {
+		el_doc_free(client->doc);
+		free(client->doc);
+	}
+	free(client);
+}
@@ -0,0 +1,656 @@
+/**
+ * daemon.c
+ * Entrylog daemon. Owns the documents that many short-lived processes write
+ * to and gathers their rows into large batches, so that each document is only
+ * opened once and its header is saved once per batch instead of once per row.
+ *
+ * @author Nathan Campos <nathan@innoveworkshop.com>
+ */
+
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "eldd.h"
+
+/* Default number of rows written in a single batch. */
+#define ELDD_BATCH_ROWS (EL_SCAN_BLOCK_ROWS * 4)
+
+/* Default time in milliseconds that rows may wait to be written. */
+#define ELDD_INTERVAL_MS 1000
+
+/* Maximum number of clients connected at once. */
+#define ELDD_CONN_MAX 256
+
+/* Document owned by the daemon. */
+typedef struct {
+	char *fname;
+	eld_handle_t *doc;
+	el_rowset_t *pending;
+
+	el_err_t err;
+	char error[256];
+
+	uint32_t clients;
+} eldd_doc_t;
+
+/* Connection of a client. */
+typedef struct {
+	int fd;
+	eldd_doc_t *doc;
+
+	char *buf;
+	size_t len;
+	size_t capacity;
+} eldd_conn_t;
+
+/* State of the daemon. */
+typedef struct {
+	int fd;
+	uint32_t batch_rows;
+	long interval_ms;
+
+	uint16_t doc_count;
+	eldd_doc_t **docs;
+
+	uint16_t conn_count;
+	eldd_conn_t *conns[ELDD_CONN_MAX];
+} eldd_server_t;
+
+/* Set when we've been asked to stop. */
+static volatile sig_atomic_t eldd_quit = 0;
+
+/* Private methods. */
+void usage(const char *name);
+void eldd_signal(int sig);
+int eldd_listen(const char *sock_path);
+long eldd_now_ms(void);
+void eldd_accept(eldd_server_t *srv);
+bool eldd_conn_read(eldd_server_t *srv, eldd_conn_t *conn);
+bool eldd_conn_handle(eldd_server_t *srv, eldd_conn_t *conn,
+					  const eldd_msg_t *msg, const char *payload);
+void eldd_conn_close(eldd_server_t *srv, eldd_conn_t *conn);
+el_err_t eldd_conn_reply(eldd_conn_t *conn, el_err_t err, const char *msg);
+el_err_t eldd_conn_open(eldd_server_t *srv, eldd_conn_t *conn,
+						const char *fname);
+el_err_t eldd_conn_append(eldd_server_t *srv, eldd_conn_t *conn,
+						  const char *payload, uint32_t len);
+el_err_t eldd_doc_flush(eldd_doc_t *doc);
+el_err_t eldd_doc_sync(eldd_doc_t *doc);
+void eldd_doc_close(eldd_server_t *srv, eldd_doc_t *doc);
+
+int main(int argc, char **argv) {
+	eldd_server_t srv;
+	const char *sock_path = ELDD_SOCKET_PATH;
+	long last_flush;
+	int i;
+
+	/* Parse the arguments. */
+	srv.batch_rows = ELDD_BATCH_ROWS;
+	srv.interval_ms = ELDD_INTERVAL_MS;
+	for (i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc)) {
+			sock_path = argv[++i];
+		} else if ((strcmp(argv[i], "-b") == 0) && ((i + 1) < argc)) {
+			srv.batch_rows = (uint32_t)strtoul(argv[++i], NULL, 10);
+		} else if ((strcmp(argv[i], "-i") == 0) && ((i + 1) < argc)) {
+			srv.interval_ms = strtol(argv[++i], NULL, 10);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((srv.batch_rows == 0) || (srv.interval_ms <= 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Start listening. */
+	srv.fd = eldd_listen(sock_path);
+	if (srv.fd < 0)
+		return 1;
+	srv.doc_count = 0;
+	srv.docs = NULL;
+	srv.conn_count = 0;
+
+	signal(SIGINT, eldd_signal);
+	signal(SIGTERM, eldd_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Serve the clients. */
+	last_flush = eldd_now_ms();
+	while (!eldd_quit) {
+		struct timeval timeout;
+		fd_set fds;
+		int max_fd = srv.fd;
+		uint16_t j;
+
+		FD_ZERO(&fds);
+		FD_SET(srv.fd, &fds);
+		for (j = 0; j < srv.conn_count; j++) {
+			FD_SET(srv.conns[j]->fd, &fds);
+			if (srv.conns[j]->fd > max_fd)
+				max_fd = srv.conns[j]->fd;
+		}
+
+		timeout.tv_sec = srv.interval_ms / 1000;
+		timeout.tv_usec = (srv.interval_ms % 1000) * 1000;
+		if (select(max_fd + 1, &fds, NULL, NULL, &timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("eldd: select");
+			break;
+		}
+
+		/* Go through the clients backwards since they may be removed. */
+		for (j = srv.conn_count; j > 0; j--) {
+			eldd_conn_t *conn = srv.conns[j - 1];
+
+			if (FD_ISSET(conn->fd, &fds) && !eldd_conn_read(&srv, conn))
+				eldd_conn_close(&srv, conn);
+		}
+		if (FD_ISSET(srv.fd, &fds))
+			eldd_accept(&srv);
+
+		/* Write the rows that have waited long enough. */
+		if ((eldd_now_ms() - last_flush) >= srv.interval_ms) {
+			for (j = 0; j < srv.doc_count; j++)
+				eldd_doc_flush(srv.docs[j]);
+			last_flush = eldd_now_ms();
+		}
+	}
+
+	/* Write everything that's pending and clean up. */
+	while (srv.conn_count > 0)
+		eldd_conn_close(&srv, srv.conns[srv.conn_count - 1]);
+	free(srv.docs);
+	close(srv.fd);
+	unlink(sock_path);
+
+	return 0;
+}
+
+/**
+ * Prints the usage of the daemon.
+ *
+ * @param name Name of the program.
+ */
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-s socket] [-b rows] [-i ms]\n\n", name);
+	fprintf(stderr, "    -s  Path of the socket. (Default: %s)\n",
+			ELDD_SOCKET_PATH);
+	fprintf(stderr, "    -b  Rows written in a single batch. (Default: %u)\n",
+			ELDD_BATCH_ROWS);
+	fprintf(stderr, "    -i  Milliseconds that rows may wait to be written. "
+			"(Default: %u)\n", ELDD_INTERVAL_MS);
+}
+
+/**
+ * Asks the daemon to stop.
+ *
+ * @param sig Signal that was received.
+ */
+void eldd_signal(int sig) {
+	(void)sig;
+	eldd_quit = 1;
+}
+
+/**
+ * Creates the socket that the clients connect to.
+ *
+ * @param sock_path Path of the socket.
+ *
+ * @return Listening socket or -1 if an error occurred.
+ */
+int eldd_listen(const char *sock_path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "eldd: Socket path \"%s\" is too long.\n", sock_path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("eldd: socket");
+		return -1;
+	}
+
+	/* Only replace the socket of a daemon that's no longer running. */
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "eldd: Another daemon is already listening on "
+				"\"%s\".\n", sock_path);
+		close(fd);
+		return -1;
+	}
+	unlink(sock_path);
+
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+		(listen(fd, 16) != 0)) {
+		perror("eldd: bind");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Gets the current time in milliseconds.
+ *
+ * @return Milliseconds since the epoch.
+ */
+long eldd_now_ms(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000L) + (tv.tv_usec / 1000L);
+}
+
+/**
+ * Accepts a new client.
+ *
+ * @param srv Daemon state.
+ */
+void eldd_accept(eldd_server_t *srv) {
+	eldd_conn_t *conn;
+	int fd;
+
+	fd = accept(srv->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	if ((srv->conn_count >= ELDD_CONN_MAX) || (fd >= FD_SETSIZE)) {
+		fprintf(stderr, "eldd: Too many clients connected.\n");
+		close(fd);
+		return;
+	}
+
+	conn = (eldd_conn_t *)malloc(sizeof(eldd_conn_t));
+	conn->fd = fd;
+	conn->doc = NULL;
+	conn->capacity = 4096;
+	conn->buf = (char *)malloc(conn->capacity);
+	conn->len = 0;
+	srv->conns[srv->conn_count++] = conn;
+}
+
+/**
+ * Reads whatever a client has sent us and handles each complete message.
+ *
+ * @param srv  Daemon state.
+ * @param conn Client connection.
+ *
+ * @return False if the client should be disconnected.
+ */
+bool eldd_conn_read(eldd_server_t *srv, eldd_conn_t *conn) {
+	eldd_msg_t msg;
+	ssize_t got;
+	size_t pos;
+
+	/* Make room for at least a little more data. */
+	if ((conn->capacity - conn->len) < 4096) {
+		conn->capacity *= 2;
+		conn->buf = (char *)realloc(conn->buf, conn->capacity);
+	}
+
+	got = recv(conn->fd, conn->buf + conn->len, conn->capacity - conn->len, 0);
+	if (got < 0)
+		return errno == EINTR;
+	if (got == 0)
+		return false;
+	conn->len += (size_t)got;
+
+	/* Handle the complete messages. */
+	pos = 0;
+	while ((conn->len - pos) >= sizeof(eldd_msg_t)) {
+		memcpy(&msg, conn->buf + pos, sizeof(eldd_msg_t));
+		if (msg.len > ELDD_MSG_MAX) {
+			fprintf(stderr, "eldd: Client sent a message that's too large.\n");
+			return false;
+		}
+
+		/* Wait for the rest of the message. */
+		if ((conn->len - pos - sizeof(eldd_msg_t)) < msg.len) {
+			size_t needed = sizeof(eldd_msg_t) + msg.len;
+
+			if (needed > conn->capacity) {
+				while (needed > conn->capacity)
+					conn->capacity *= 2;
+				conn->buf = (char *)realloc(conn->buf, conn->capacity);
+			}
+			break;
+		}
+
+		if (!eldd_conn_handle(srv, conn, &msg,
+							  conn->buf + pos + sizeof(eldd_msg_t)))
+			return false;
+		pos += sizeof(eldd_msg_t) + msg.len;
+	}
+
+	/* Keep the beginning of the next message. */
+	conn->len -= pos;
+	memmove(conn->buf, conn->buf + pos, conn->len);
+
+	return true;
+}
+
+/**
+ * Handles a message sent by a client.
+ *
+ * @param srv     Daemon state.
+ * @param conn    Client connection.
+ * @param msg     Header of the message.
+ * @param payload Contents of the message.
+ *
+ * @return False if the client should be disconnected.
+ */
+bool eldd_conn_handle(eldd_server_t *srv, eldd_conn_t *conn,
+					  const eldd_msg_t *msg, const char *payload) {
+	el_err_t err;
+
+	/* Every message other than opening needs an open document. */
+	if ((msg->type != ELDD_MSG_OPEN) && (conn->doc == NULL))
+		return eldd_conn_reply(conn, EL_ERROR_ARGUMENT,
+							   "No document open.") == EL_OK;
+
+	switch (msg->type) {
+		case ELDD_MSG_OPEN:
+			if (conn->doc != NULL) {
+				err = eldd_conn_reply(conn, EL_ERROR_ARGUMENT,
+									  "A document is already open.");
+			} else if ((msg->len == 0) || (payload[msg->len - 1] != '\0')) {
+				err = eldd_conn_reply(conn, EL_ERROR_ARGUMENT,
+									  "Invalid document path.");
+			} else {
+				err = eldd_conn_open(srv, conn, payload);
+			}
+			break;
+		case ELDD_MSG_APPEND:
+			err = eldd_conn_append(srv, conn, payload, msg->len);
+			break;
+		case ELDD_MSG_SYNC:
+			err = eldd_doc_sync(conn->doc);
+			err = eldd_conn_reply(conn, err, conn->doc->error);
+			break;
+		default:
+			err = eldd_conn_reply(conn, EL_ERROR_NOT_IMPL,
+								  "Unknown message type.");
+			break;
+	}
+
+	return err == EL_OK;
+}
+
+/**
+ * Disconnects a client and closes its document if it was the last one using
+ * it.
+ *
+ * @param srv  Daemon state.
+ * @param conn Client connection to be free'd.
+ */
+void eldd_conn_close(eldd_server_t *srv, eldd_conn_t *conn) {
+	uint16_t i;
+
+	if (conn->doc != NULL) {
+		conn->doc->clients--;
+		if (conn->doc->clients == 0)
+			eldd_doc_close(srv, conn->doc);
+	}
+
+	for (i = 0; i < srv->conn_count; i++) {
+		if (srv->conns[i] == conn) {
+			srv->conns[i] = srv->conns[--srv->conn_count];
+			break;
+		}
+	}
+
+	close(conn->fd);
+	free(conn->buf);
+	free(conn);
+}
+
+/**
+ * Replies to a client.
+ *
+ * @param conn Client connection.
+ * @param err  Status of the request.
+ * @param msg  Error message sent when the status isn't EL_OK.
+ *
+ * @return EL_OK if the reply was sent.
+ *         EL_ERROR_FILE if the client went away.
+ */
+el_err_t eldd_conn_reply(eldd_conn_t *conn, el_err_t err, const char *msg) {
+	if (err == EL_OK)
+		return eldd_msg_send(conn->fd, ELDD_MSG_REPLY, EL_OK, NULL, 0);
+
+	return eldd_msg_send(conn->fd, ELDD_MSG_REPLY, (uint8_t)err, msg,
+						 (uint32_t)strlen(msg) + 1);
+}
+
+/**
+ * Opens a document for a client, sharing it with the other clients that are
+ * already using it, and replies with its fields.
+ *
+ * @param srv   Daemon state.
+ * @param conn  Client connection.
+ * @param fname Absolute path of the document.
+ *
+ * @return EL_OK if the reply was sent.
+ *         EL_ERROR_FILE if the client went away.
+ */
+el_err_t eldd_conn_open(eldd_server_t *srv, eldd_conn_t *conn,
+						const char *fname) {
+	eldd_doc_t *doc = NULL;
+	char *reply;
+	uint32_t len;
+	uint16_t i;
+	el_err_t err;
+
+	/* Check if the document is already open. */
+	for (i = 0; i < srv->doc_count; i++) {
+		if (strcmp(srv->docs[i]->fname, fname) == 0) {
+			doc = srv->docs[i];
+			break;
+		}
+	}
+
+	/* Open the document. */
+	if (doc == NULL) {
+		eld_handle_t *handle = el_doc_new();
+
+		err = el_doc_read(handle, fname);
+		IF_EL_ERROR(err) {
+			el_doc_free(handle);
+			free(handle);
+			return eldd_conn_reply(conn, err, el_error_msg());
+		}
+
+		doc = (eldd_doc_t *)malloc(sizeof(eldd_doc_t));
+		doc->fname = (char *)malloc(strlen(fname) + 1);
+		strcpy(doc->fname, fname);
+		doc->doc = handle;
+		doc->pending = el_rowset_new(handle, srv->batch_rows);
+		doc->err = EL_OK;
+		doc->error[0] = '\0';
+		doc->clients = 0;
+
+		srv->docs = (eldd_doc_t **)realloc(srv->docs, sizeof(eldd_doc_t *) *
+										   (srv->doc_count + 1));
+		srv->docs[srv->doc_count++] = doc;
+	}
+	conn->doc = doc;
+	doc->clients++;
+
+	/* Reply with the fields of the document. */
+	len = sizeof(uint16_t) + 1 +
+		(sizeof(el_field_def_t) * doc->doc->header.field_desc_count);
+	reply = (char *)malloc(len);
+	memcpy(reply, &(doc->doc->ext.flags), sizeof(uint16_t));
+	reply[sizeof(uint16_t)] = (char)doc->doc->header.field_desc_count;
+	memcpy(reply + sizeof(uint16_t) + 1, doc->doc->field_defs,
+		   sizeof(el_field_def_t) * doc->doc->header.field_desc_count);
+	err = eldd_msg_send(conn->fd, ELDD_MSG_REPLY, EL_OK, reply, len);
+	free(reply);
+
+	return err;
+}
+
+/**
+ * Queues the rows sent by a client, writing them out whenever the batch of
+ * the document fills up.
+ *
+ * @param srv     Daemon state.
+ * @param conn    Client connection.
+ * @param payload Encoded row set.
+ * @param len     Length of the encoded row set.
+ *
+ * @return EL_OK if the reply was sent.
+ *         EL_ERROR_FILE if the client went away.
+ */
+el_err_t eldd_conn_append(eldd_server_t *srv, eldd_conn_t *conn,
+						  const char *payload, uint32_t len) {
+	eldd_doc_t *doc = conn->doc;
+	uint32_t from = 0;
+	uint32_t count;
+	el_err_t err;
+
+	(void)srv;
+	if (!eldd_rowset_check(doc->pending, payload, len)) {
+		return eldd_conn_reply(conn, EL_ERROR_ARGUMENT,
+							   "Rows don't match the document fields.");
+	}
+
+	memcpy(&count, payload, sizeof(uint32_t));
+	while (from < count) {
+		from += eldd_rowset_decode(doc->pending, payload, from);
+
+		if (doc->pending->count >= doc->pending->capacity) {
+			err = eldd_doc_flush(doc);
+			IF_EL_ERROR(err) {
+				return eldd_conn_reply(conn, err, el_error_msg());
+			}
+		}
+	}
+
+	return eldd_conn_reply(conn, EL_OK, NULL);
+}
+
+/**
+ * Writes the pending rows of a document. Rows that couldn't be written are
+ * dropped, since they would most likely fail again, and the first error is
+ * kept until the next sync so that clients find out about it.
+ *
+ * @param doc Document owned by the daemon.
+ *
+ * @return EL_OK if the rows were written.
+ *         Any error returned by el_doc_rowset_append.
+ */
+el_err_t eldd_doc_flush(eldd_doc_t *doc) {
+	el_err_t err;
+
+	if (doc->pending->count == 0)
+		return EL_OK;
+
+	err = el_doc_rowset_append(doc->doc, doc->pending);
+	IF_EL_ERROR(err) {
+		fprintf(stderr, "eldd: Dropped %lu rows of \"%s\": %s\n",
+				(unsigned long)doc->pending->count, doc->fname,
+				el_error_msg());
+		if (doc->err == EL_OK) {
+			doc->err = err;
+			snprintf(doc->error, sizeof(doc->error), "Dropped %lu rows: %s",
+					 (unsigned long)doc->pending->count, el_error_msg());
+		}
+	}
+	el_rowset_clear(doc->pending);
+
+	return err;
+}
+
+/**
+ * Writes the pending rows of a document and makes sure that they reached the
+ * disk. Fails if any rows were dropped since the last sync.
+ *
+ * @param doc Document owned by the daemon. Its error message is set when
+ *            something went wrong.
+ *
+ * @return EL_OK if the rows are on disk.
+ *         EL_ERROR_FILE if the document couldn't be flushed.
+ *         Any error returned by el_doc_rowset_append since the last sync.
+ */
+el_err_t eldd_doc_sync(eldd_doc_t *doc) {
+	el_err_t err;
+	int fd;
+
+	/* Report the rows that were dropped since the last time only once. */
+	eldd_doc_flush(doc);
+	err = doc->err;
+	doc->err = EL_OK;
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Flush the document and its string heap. */
+	fd = open(doc->fname, O_RDONLY);
+	if ((fd < 0) || (fsync(fd) != 0)) {
+		snprintf(doc->error, sizeof(doc->error), "Couldn't flush \"%s\" to "
+				 "disk: %s.", doc->fname, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return EL_ERROR_FILE;
+	}
+	close(fd);
+	if (doc->doc->heap != NULL) {
+		if ((fflush(doc->doc->heap) != 0) ||
+			(fsync(fileno(doc->doc->heap)) != 0)) {
+			snprintf(doc->error, sizeof(doc->error), "Couldn't flush the "
+					 "string heap of \"%s\" to disk: %s.", doc->fname,
+					 strerror(errno));
+			return EL_ERROR_FILE;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Writes the pending rows of a document and closes it.
+ *
+ * @param srv Daemon state.
+ * @param doc Document to be free'd.
+ */
+void eldd_doc_close(eldd_server_t *srv, eldd_doc_t *doc) {
+	uint16_t i;
+
+	eldd_doc_flush(doc);
+
+	for (i = 0; i < srv->doc_count; i++) {
+		if (srv->docs[i] == doc) {
+			srv->docs[i] = srv->docs[--srv->doc_count];
+			break;
+		}
+	}
+
+	el_rowset_free(doc->pending);
+	el_doc_free(doc->doc);
+	free(doc->doc);
+	free(doc->fname);
+	free(doc);
+}
@@ -0,0 +1,82 @@
+/**
+ * eldd.h
+ * Client library and wire protocol of the Entrylog daemon, a local server that
+ * owns the open documents and turns the rows sent by many processes into a few
+ * large appends.
+ *
+ * @author Nathan Campos <nathan@innoveworkshop.com>
+ */
+
+#ifndef _ELDD_H
+#define _ELDD_H
+
+#include "../src/entrylog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default path of the daemon socket. */
+#define ELDD_SOCKET_PATH "/tmp/eldd.sock"
+
+/* Rows kept by a client before they're sent to the daemon. */
+#define ELDD_CLIENT_ROWS 256
+
+/* Largest payload of a single message. */
+#define ELDD_MSG_MAX (16UL * 1024UL * 1024UL)
+
+/* Message types. */
+typedef enum {
+	ELDD_MSG_OPEN = 1,
+	ELDD_MSG_APPEND,
+	ELDD_MSG_SYNC,
+	ELDD_MSG_REPLY
+} eldd_msg_type_t;
+
+/* Message header. (Followed by len bytes of payload)
+
+   OPEN carries the absolute path of the document and is answered with the
+   header extension flags (uint16_t), the number of fields (uint8_t) and the
+   field definitions. APPEND carries a row set encoded by eldd_rowset_encode.
+   SYNC asks for every pending row to be written and flushed to disk, and fails
+   if any rows of the document were dropped since the last SYNC. Replies
+   carry an el_err_t in status and an error message when it isn't EL_OK. */
+typedef struct {
+	uint8_t type;
+	uint8_t status;
+	uint16_t reserved;
+	uint32_t len;
+} eldd_msg_t;
+
+/* Connection to the daemon for a single document. */
+typedef struct {
+	int fd;
+
+	eld_handle_t *doc;
+	el_rowset_t *batch;
+} eldd_client_t;
+
+/* Client operations. */
+eldd_client_t *eldd_open(const char *sock_path, const char *fname);
+el_err_t eldd_row_add(eldd_client_t *client, const el_row_t *row);
+el_err_t eldd_rowset_add(eldd_client_t *client, const el_rowset_t *set);
+el_err_t eldd_flush(eldd_client_t *client);
+el_err_t eldd_sync(eldd_client_t *client);
+el_err_t eldd_close(eldd_client_t *client);
+const char *eldd_error_msg(void);
+
+/* Wire protocol. */
+el_err_t eldd_msg_send(int fd, uint8_t type, uint8_t status,
+					   const void *payload, uint32_t len);
+el_err_t eldd_msg_recv(int fd, eldd_msg_t *msg, char **payload);
+size_t eldd_rowset_len(const el_rowset_t *set, uint32_t from, uint32_t count);
+void eldd_rowset_encode(const el_rowset_t *set, uint32_t from, uint32_t count,
+						char *buf);
+bool eldd_rowset_check(const el_rowset_t *set, const char *buf, size_t len);
+uint32_t eldd_rowset_decode(el_rowset_t *set, const char *buf, uint32_t from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ELDD_H */
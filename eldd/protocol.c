@@ -0,0 +1,379 @@
+/**
+ * protocol.c
+ * Wire protocol shared by the Entrylog daemon and its clients.
+ *
+ * @author Nathan Campos <nathan@innoveworkshop.com>
+ */
+
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "eldd.h"
+
+/* Don't get killed when the other end goes away. */
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif /* !MSG_NOSIGNAL */
+
+/* Private methods. */
+el_err_t eldd_send_all(int fd, const char *buf, size_t len);
+el_err_t eldd_recv_all(int fd, char *buf, size_t len);
+size_t eldd_rowset_row_len(const el_rowset_t *set);
+
+/**
+ * Sends a message.
+ *
+ * @param fd      Socket to send the message through.
+ * @param type    Type of the message.
+ * @param status  Status of a reply.
+ * @param payload Contents of the message. (Ignored if len is 0)
+ * @param len     Length of the payload.
+ *
+ * @return EL_OK if the message was sent.
+ *         EL_ERROR_FILE if the socket failed.
+ */
+el_err_t eldd_msg_send(int fd, uint8_t type, uint8_t status,
+					   const void *payload, uint32_t len) {
+	eldd_msg_t msg;
+	el_err_t err;
+
+	msg.type = type;
+	msg.status = status;
+	msg.reserved = 0;
+	msg.len = len;
+
+	err = eldd_send_all(fd, (const char *)&msg, sizeof(eldd_msg_t));
+	if ((err != EL_OK) || (len == 0))
+		return err;
+
+	return eldd_send_all(fd, (const char *)payload, len);
+}
+
+/**
+ * Waits for a whole message to arrive.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param fd      Socket to receive the message from.
+ * @param msg     Header of the message.
+ * @param payload Contents of the message, always NULL terminated.
+ *
+ * @return EL_OK if a message was received.
+ *         EL_ERROR_FILE if the socket failed or was closed.
+ *         EL_ERROR_ARGUMENT if the message is too large.
+ */
+el_err_t eldd_msg_recv(int fd, eldd_msg_t *msg, char **payload) {
+	el_err_t err;
+
+	*payload = NULL;
+	err = eldd_recv_all(fd, (char *)msg, sizeof(eldd_msg_t));
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	if (msg->len > ELDD_MSG_MAX)
+		return EL_ERROR_ARGUMENT;
+
+	*payload = (char *)malloc(msg->len + 1);
+	(*payload)[msg->len] = '\0';
+	err = eldd_recv_all(fd, *payload, msg->len);
+	IF_EL_ERROR(err) {
+		free(*payload);
+		*payload = NULL;
+	}
+
+	return err;
+}
+
+/**
+ * Sends a whole buffer through a socket.
+ *
+ * @param fd  Socket.
+ * @param buf Data to be sent.
+ * @param len Length of the data.
+ *
+ * @return EL_OK if everything was sent.
+ *         EL_ERROR_FILE if the socket failed.
+ */
+el_err_t eldd_send_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return EL_ERROR_FILE;
+		}
+
+		buf += sent;
+		len -= (size_t)sent;
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Receives a whole buffer from a socket.
+ *
+ * @param fd  Socket.
+ * @param buf Where to place the data.
+ * @param len Length of the data.
+ *
+ * @return EL_OK if everything was received.
+ *         EL_ERROR_FILE if the socket failed or was closed.
+ */
+el_err_t eldd_recv_all(int fd, char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t got = recv(fd, buf, len, 0);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return EL_ERROR_FILE;
+		} else if (got == 0) {
+			return EL_ERROR_FILE;
+		}
+
+		buf += got;
+		len -= (size_t)got;
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Calculates the number of bytes that each row of a set takes on the wire.
+ *
+ * @param set Row set.
+ *
+ * @return Bytes taken by each row, without the string arena.
+ */
+size_t eldd_rowset_row_len(const el_rowset_t *set) {
+	size_t len = 0;
+	uint8_t i;
+
+	for (i = 0; i < set->field_count; i++) {
+		len += set->widths[i];
+		if (set->nulls[i] != NULL)
+			len++;
+	}
+
+	return len;
+}
+
+/**
+ * Calculates the length of a range of rows of a set once encoded.
+ *
+ * @param set   Row set.
+ * @param from  Position of the first row.
+ * @param count Number of rows.
+ *
+ * @return Number of bytes needed by eldd_rowset_encode.
+ *
+ * @see eldd_rowset_encode
+ */
+size_t eldd_rowset_len(const el_rowset_t *set, uint32_t from, uint32_t count) {
+	size_t len;
+	uint32_t i;
+	uint8_t j;
+
+	/* Only the strings of the rows are sent, after an empty one. */
+	len = (sizeof(uint32_t) * 2) + (eldd_rowset_row_len(set) * count) + 1;
+	for (j = 0; j < set->field_count; j++) {
+		if (set->field_defs[j].type != EL_FIELD_VARCHAR)
+			continue;
+
+		for (i = from; i < (from + count); i++)
+			len += strlen(el_rowset_string(set, j, i)) + 1;
+	}
+
+	return len;
+}
+
+/**
+ * Encodes a range of rows of a set for the wire. The row count and the length
+ * of the string arena come first, followed by each column, the null flags of
+ * each field and finally the arena itself, so that the daemon can copy whole
+ * columns. The arena only carries the strings of the rows that are encoded.
+ *
+ * @param set   Row set.
+ * @param from  Position of the first row.
+ * @param count Number of rows.
+ * @param buf   Buffer with at least eldd_rowset_len bytes.
+ *
+ * @see eldd_rowset_len
+ */
+void eldd_rowset_encode(const el_rowset_t *set, uint32_t from, uint32_t count,
+						char *buf) {
+	char *head = buf;
+	char *arena;
+	uint32_t arena_len = 1;
+	uint32_t i;
+	uint8_t j;
+
+	/* Locate the arena. */
+	buf += sizeof(uint32_t) * 2;
+	arena = buf + (eldd_rowset_row_len(set) * count);
+	arena[0] = '\0';
+
+	/* Copy the columns, moving the strings to the new arena. */
+	for (j = 0; j < set->field_count; j++) {
+		size_t width = set->widths[j];
+
+		if (set->field_defs[j].type == EL_FIELD_VARCHAR) {
+			for (i = 0; i < count; i++) {
+				const char *str = el_rowset_string(set, j, from + i);
+				size_t len = strlen(str) + 1;
+
+				memcpy(buf + (width * i), &arena_len, sizeof(uint32_t));
+				memcpy(arena + arena_len, str, len);
+				arena_len += (uint32_t)len;
+			}
+		} else {
+			memcpy(buf, set->columns[j] + (width * from), width * count);
+		}
+
+		buf += width * count;
+	}
+	for (j = 0; j < set->field_count; j++) {
+		if (set->nulls[j] != NULL) {
+			memcpy(buf, set->nulls[j] + from, count);
+			buf += count;
+		}
+	}
+
+	/* Now that we know how large the arena is. */
+	memcpy(head, &count, sizeof(uint32_t));
+	memcpy(head + sizeof(uint32_t), &arena_len, sizeof(uint32_t));
+}
+
+/**
+ * Checks if an encoded row set matches the layout of a set and that all of
+ * its strings are within its arena.
+ *
+ * @param set Row set that the rows will be decoded into.
+ * @param buf Encoded row set.
+ * @param len Length of the encoded row set.
+ *
+ * @return True if the encoded row set is safe to decode.
+ */
+bool eldd_rowset_check(const el_rowset_t *set, const char *buf, size_t len) {
+	const char *column;
+	const char *arena;
+	uint32_t count;
+	uint32_t arena_len;
+	uint32_t i;
+	uint8_t j;
+
+	/* Check the lengths. */
+	if (len < (sizeof(uint32_t) * 2))
+		return false;
+	memcpy(&count, buf, sizeof(uint32_t));
+	memcpy(&arena_len, buf + sizeof(uint32_t), sizeof(uint32_t));
+	if ((count > len) || (arena_len == 0) ||
+		(len != ((sizeof(uint32_t) * 2) +
+				 (eldd_rowset_row_len(set) * count) + arena_len)))
+		return false;
+
+	/* Make sure the arena ends with a NULL terminator. */
+	arena = buf + (len - arena_len);
+	if (arena[arena_len - 1] != '\0')
+		return false;
+
+	/* Check the offsets of the variable-length strings. */
+	column = buf + (sizeof(uint32_t) * 2);
+	for (j = 0; j < set->field_count; j++) {
+		if (set->field_defs[j].type == EL_FIELD_VARCHAR) {
+			for (i = 0; i < count; i++) {
+				uint32_t offset;
+
+				memcpy(&offset, column + (sizeof(uint32_t) * i),
+					   sizeof(uint32_t));
+				if (offset >= arena_len)
+					return false;
+			}
+		}
+
+		column += (size_t)set->widths[j] * count;
+	}
+
+	return true;
+}
+
+/**
+ * Decodes rows from an encoded row set into the end of a set, for as long as
+ * there's room in it.
+ *
+ * @param set  Row set to add the rows to.
+ * @param buf  Encoded row set that was already checked.
+ * @param from Position of the first encoded row to decode.
+ *
+ * @return Number of rows that were decoded.
+ *
+ * @see eldd_rowset_check
+ */
+uint32_t eldd_rowset_decode(el_rowset_t *set, const char *buf, uint32_t from) {
+	const char *column;
+	const char *nulls;
+	const char *arena;
+	uint32_t count;
+	uint32_t n;
+	uint32_t i;
+	uint8_t j;
+
+	/* Figure out how many rows we can take. */
+	memcpy(&count, buf, sizeof(uint32_t));
+	if (from >= count)
+		return 0;
+	n = count - from;
+	if (n > (set->capacity - set->count))
+		n = set->capacity - set->count;
+	if (n == 0)
+		return 0;
+
+	/* Locate the null flags and the arena. */
+	column = buf + (sizeof(uint32_t) * 2);
+	nulls = column;
+	for (j = 0; j < set->field_count; j++)
+		nulls += (size_t)set->widths[j] * count;
+	arena = nulls;
+	for (j = 0; j < set->field_count; j++) {
+		if (set->nulls[j] != NULL)
+			arena += count;
+	}
+
+	/* Copy the columns over. */
+	for (j = 0; j < set->field_count; j++) {
+		uint16_t width = set->widths[j];
+
+		if (set->field_defs[j].type == EL_FIELD_VARCHAR) {
+			for (i = 0; i < n; i++) {
+				uint32_t offset;
+
+				memcpy(&offset, column + ((size_t)width * (from + i)),
+					   sizeof(uint32_t));
+				el_rowset_string_set(set, j, set->count + i, arena + offset);
+			}
+		} else {
+			memcpy(set->columns[j] + ((size_t)width * set->count),
+				   column + ((size_t)width * from), (size_t)width * n);
+		}
+
+		if (set->nulls[j] != NULL) {
+			memcpy(set->nulls[j] + set->count, nulls + from, n);
+			nulls += count;
+		}
+		column += (size_t)width * count;
+	}
+
+	for (i = 0; i < n; i++)
+		set->indexes[set->count + i] = 0;
+	set->count += n;
+
+	return n;
+}
@@ -5,19 +5,34 @@
  * @author Nathan Campos <nathan@innoveworkshop.com>
  */
 
+#ifdef __linux__
+	#define _GNU_SOURCE
+	#define _FILE_OFFSET_BITS 64
+#endif /* __linux__ */
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifdef __MSDOS__
 #include <io.h>
 #else
 #include <unistd.h>
 #endif /* __MSDOS__ */
+#ifdef __linux__
+#include <fcntl.h>
+#endif /* __linux__ */
 
 #include "entrylog.h"
 
+/* Marker of documents that have a header extension. */
+#define EL_HEADER_EXT '+'
+
+/* Length flag of variable-length strings that live in the heap sidecar. */
+#define EL_VARCHAR_HEAP 0x8000
+
 /* Ensure that we have F_OK defined. */
 #ifndef F_OK
 	#define F_OK 0
@@ -40,14 +55,435 @@
 	#define VSNPRINTF_MAX_LEN 255 /* Horrible, I know... */
 #endif /* vsnprintf */
 
+/* Window operation types. */
+typedef enum {
+	EL_WINDOW_MOVING_AVG = 0,
+	EL_WINDOW_EWMA,
+	EL_WINDOW_RATE,
+	EL_WINDOW_DELTA
+} el_window_op_t;
+
+/* Incremental state of a window operation. */
+typedef struct {
+	el_window_op_t op;
+	const el_field_def_t *field;
+	const el_field_def_t *time_field;
+	uint8_t field_index;
+	uint8_t time_index;
+	size_t offset;
+	size_t time_offset;
+
+	double *out;
+	double *ring;
+	uint32_t window_rows;
+	uint32_t seen;
+	double alpha;
+	double sum;
+	double last;
+	el_number_t last_time;
+} el_window_t;
+
+/* Array reduction types. */
+typedef enum {
+	EL_ARRAY_RMS = 0,
+	EL_ARRAY_PEAK
+} el_array_op_t;
+
+/* State of an array reduction. */
+typedef struct {
+	el_array_op_t op;
+	const el_field_def_t *field;
+	size_t offset;
+
+	double *out;
+} el_array_t;
+
+/* Filter expression parser state. */
+typedef struct {
+	const eld_handle_t *doc;
+	const char *src;
+	const char *pos;
+
+	el_expr_t *expr;
+	uint8_t depth;
+} el_expr_parser_t;
+
+/* State of a filtered document scan. */
+typedef struct {
+	const el_expr_t *expr;
+	el_scan_cb_t cb;
+	void *arg;
+
+	el_row_t *row;
+	uint16_t *sel;
+	uint8_t *stack;
+
+	const el_bitmap_t *rows;
+	el_bitmap_t *matches;
+} el_scan_t;
+
+/* Blocks holding the rows of a bitmap handed to a scan. */
+typedef struct {
+	uint8_t *wanted;
+	uint32_t row_base;
+	uint32_t row_count;
+} el_scan_mark_t;
+
+/* State of a row set read. */
+typedef struct {
+	el_rowset_t *set;
+	size_t *offsets;
+	uint32_t limit;
+} el_rowset_reader_t;
+
+/* State of the filter operator. */
+typedef struct {
+	const el_expr_t *expr;
+	uint8_t *stack;
+} el_op_filter_t;
+
+/* State of the projection operator. */
+typedef struct {
+	uint8_t *fields;
+	uint8_t count;
+} el_op_project_t;
+
+/* State of the limit operator. */
+typedef struct {
+	uint32_t limit;
+	uint32_t seen;
+} el_op_limit_t;
+
+/* State of the row output operator. */
+typedef struct {
+	el_scan_cb_t cb;
+	void *arg;
+	el_row_t *row;
+} el_op_output_t;
+
+/* State of the hash aggregate operator. */
+typedef struct {
+	int group_field;
+	uint8_t field;
+
+	el_group_t *groups;
+	uint32_t count;
+	uint32_t *table;
+	uint32_t table_len;
+} el_op_aggregate_t;
+
+/* State of a query pipeline run. */
+typedef struct {
+	el_batch_t batch;
+	el_op_t *pipeline;
+} el_query_t;
+
+/* Hash of a block of rows in a replication cursor. */
+#ifdef EL_HAS_INT64
+typedef uint64_t el_repl_hash_t;
+#else
+typedef uint32_t el_repl_hash_t;
+#endif /* EL_HAS_INT64 */
+
+/* Position in a file. (Past 2 GiB where the platform allows it) */
+#ifdef EL_HAS_INT64
+typedef int64_t el_off_t;
+#else
+typedef long el_off_t;
+#endif /* EL_HAS_INT64 */
+
+/* State of a hash join. */
+typedef struct {
+	eld_handle_t *build;
+	const el_field_def_t *build_def;
+	uint8_t build_key;
+	size_t build_offset;
+	char *rows;
+	uint32_t *hashes;
+	uint32_t *heads;
+	uint32_t *next;
+	uint32_t mask;
+	uint32_t base;
+
+	const el_field_def_t *probe_def;
+	uint8_t probe_key;
+	size_t probe_offset;
+	el_row_t *build_row;
+	el_row_t *probe_row;
+	bool swapped;
+
+	el_join_cb_t cb;
+	void *arg;
+} el_join_t;
+
+/* State of a Bloom filter sidecar being built. */
+typedef struct {
+	FILE *fh;
+	const el_field_def_t *field;
+	size_t offset;
+	uint32_t words[EL_BLOOM_BUCKETS * 8];
+} el_bloom_t;
+
+/* State of a string index being built. */
+typedef struct {
+	size_t offset;
+	uint16_t key_len;
+	uint32_t base;
+	char *keys;
+
+	el_progress_cb_t progress;
+	void *arg;
+	bool cancelled;
+} el_index_build_t;
+
+/* State of a string index delta being merged. */
+typedef struct {
+	uint16_t key_len;
+	uint16_t entry_len;
+	uint32_t key_count;
+	uint32_t row_count;
+
+	char *entries;
+	uint32_t *postings;
+} el_index_merge_t;
+
+/* State of a document being compacted. */
+typedef struct {
+	FILE *fh;
+	uint16_t *sel;
+	bool failed;
+
+	el_progress_cb_t progress;
+	void *arg;
+} el_compact_t;
+
+/* Bitmap set operations. */
+typedef enum {
+	EL_BITMAP_AND = 0,
+	EL_BITMAP_OR,
+	EL_BITMAP_ANDNOT
+} el_bitmap_op_t;
+
+/* Callback for each block of raw rows read during a scan. */
+typedef bool (*el_scan_block_cb_t)(eld_handle_t *doc, const char *block,
+								   uint32_t first, uint32_t count, void *arg);
+
+/* Salts used to pick the bits set in each word of a Bloom filter bucket. */
+static const uint32_t el_bloom_salts[8] = {
+	0x47B6137BUL, 0x44974D91UL, 0x8824AD5BUL, 0xA2B7289DUL,
+	0x705495C7UL, 0x2DF1424BUL, 0x9EFC4947UL, 0x5C6BFB31UL
+};
+
 /* Private variables. */
 static char *el_error_msg_buf = NULL;
 
 /* Private methods. */
 el_err_t el_doc_header_read(eld_handle_t *doc);
+el_err_t el_doc_tomb_load(eld_handle_t *doc);
+bool el_doc_compact_block(eld_handle_t *doc, const char *block, uint32_t first,
+						  uint32_t count, void *arg);
+bool el_doc_compact_dead(uint32_t value, void *arg);
+bool el_repl_load(const char *dst_path, el_repl_header_t *cursor,
+				  el_repl_hash_t **hashes);
+el_err_t el_repl_save(const char *dst_path, const el_repl_header_t *cursor,
+					  const el_repl_hash_t *hashes);
+el_repl_hash_t el_repl_hash(const char *buf, size_t len);
+el_err_t el_repl_copy(const eld_handle_t *src, const char *dst_path,
+					  const char *suffix, el_off_t from, el_off_t *len);
+el_err_t el_doc_tomb_clear(eld_handle_t *doc, uint32_t index);
+el_err_t el_doc_schema_set(eld_handle_t *doc, el_field_def_t *field_defs,
+						   uint8_t count, uint16_t flags);
+void el_doc_field_hash(eld_handle_t *doc);
+int el_doc_field_find(const eld_handle_t *doc, const char *name, size_t len);
+uint32_t el_doc_slot(const eld_handle_t *doc, uint32_t index);
+int el_doc_time_field(const eld_handle_t *doc);
+size_t el_doc_row_offset(const eld_handle_t *doc, uint32_t index);
+el_err_t el_schema_load(eld_handle_t *doc);
+el_err_t el_schema_save(const eld_handle_t *doc);
+void el_schema_push(eld_handle_t *doc, uint32_t first_row, size_t offset);
+void el_schema_free(eld_handle_t *doc);
+const el_schema_t *el_schema_find(const eld_handle_t *doc, uint32_t index,
+								  uint32_t *end);
+void el_schema_adapt(const eld_handle_t *doc, const el_schema_t *schema,
+					 const char *raw, uint32_t count, char *out);
+uint16_t el_doc_sel_live(const eld_handle_t *doc, uint32_t first,
+						 uint16_t *sel, uint16_t sel_count);
+el_err_t el_doc_scan_blocks(eld_handle_t *doc, uint32_t start, uint32_t count,
+							const uint8_t *blocks, el_scan_block_cb_t cb,
+							void *arg);
+el_row_t *el_row_alloc(const eld_handle_t *doc, const uint8_t *fields,
+						uint8_t count);
+size_t el_util_align(size_t len);
+el_err_t el_rowset_check(const eld_handle_t *doc, const el_rowset_t *set);
+bool el_rowset_block(eld_handle_t *doc, const char *block, uint32_t first,
+					 uint32_t count, void *arg);
+void el_rowset_row(const el_rowset_t *set, uint32_t pos, el_row_t *row);
 bool el_row_seek(eld_handle_t *doc, uint32_t index);
 el_err_t el_row_read(el_row_t *row, eld_handle_t *doc, uint32_t index);
 el_err_t el_doc_row_write(eld_handle_t *doc, const el_row_t *row);
+#ifdef EL_HAS_INT64
+void el_doc_row_stamp(eld_handle_t *doc, el_row_t *row);
+#endif /* EL_HAS_INT64 */
+void el_row_decode(const eld_handle_t *doc, el_row_t *row, const char *raw);
+void el_cell_decode(const eld_handle_t *doc, el_cell_t *cell, const char *raw,
+					uint32_t index);
+void el_doc_field_pack(el_field_def_t *field_defs, uint8_t count);
+el_err_t el_doc_scan_run(eld_handle_t *doc, const el_expr_t *expr,
+						 const el_bitmap_t *rows, el_scan_cb_t cb, void *arg,
+						 el_bitmap_t *matches);
+bool el_doc_scan_block(eld_handle_t *doc, const char *block, uint32_t first,
+					   uint32_t count, void *arg);
+bool el_doc_scan_rows_mark(uint32_t value, void *arg);
+bool el_bitmap_find(const el_bitmap_t *bm, uint16_t key, uint32_t *pos);
+uint32_t el_bitmap_lower(const uint16_t *array, uint32_t count, uint16_t value);
+void el_bitmap_fill(const el_bitmap_container_t *c, uint32_t *words);
+void el_bitmap_to_bits(el_bitmap_container_t *c);
+void el_bitmap_normalize(el_bitmap_container_t *c);
+void el_bitmap_copy(el_bitmap_container_t *dst,
+					const el_bitmap_container_t *src);
+void el_bitmap_combine(el_bitmap_container_t *out,
+					   const el_bitmap_container_t *a,
+					   const el_bitmap_container_t *b, el_bitmap_op_t op);
+void el_bitmap_push(el_bitmap_t *bm, el_bitmap_container_t *c);
+el_bitmap_t *el_bitmap_op(const el_bitmap_t *a, const el_bitmap_t *b,
+						  el_bitmap_op_t op);
+bool el_index_rows_add(const char *key, const uint32_t *rows, uint32_t count,
+					   void *arg);
+bool el_expr_parse_or(el_expr_parser_t *p);
+bool el_expr_parse_and(el_expr_parser_t *p);
+bool el_expr_parse_unary(el_expr_parser_t *p);
+bool el_expr_parse_cmp(el_expr_parser_t *p);
+bool el_expr_accept(el_expr_parser_t *p, const char *token);
+void el_expr_emit(el_expr_parser_t *p, el_expr_inst_t inst);
+void el_expr_error(const el_expr_parser_t *p, const char *msg);
+void el_expr_split(el_expr_t *expr, const eld_handle_t *doc);
+uint16_t el_expr_subtree(const el_expr_t *expr, uint16_t end);
+uint16_t el_expr_filter(const el_expr_t *expr, const eld_handle_t *doc,
+						const char *block, uint32_t first, uint16_t *sel,
+						uint16_t sel_count, uint8_t *stack);
+uint8_t *el_expr_eval(const el_expr_t *expr, uint16_t from, uint16_t to,
+					  const eld_handle_t *doc, const char *block,
+					  uint32_t first, const uint16_t *sel, uint16_t sel_count,
+					  uint8_t *stack);
+el_err_t el_query_check(const eld_handle_t *doc, const el_op_t *pipeline);
+bool el_query_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg);
+bool el_join_build_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg);
+bool el_join_probe_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg);
+bool el_op_next(el_op_t *op, el_batch_t *batch);
+bool el_op_filter_push(el_op_t *op, el_batch_t *batch);
+void el_op_filter_free(el_op_t *op);
+bool el_op_project_push(el_op_t *op, el_batch_t *batch);
+void el_op_project_free(el_op_t *op);
+bool el_op_limit_push(el_op_t *op, el_batch_t *batch);
+bool el_op_output_push(el_op_t *op, el_batch_t *batch);
+void el_op_output_free(el_op_t *op);
+bool el_op_aggregate_push(el_op_t *op, el_batch_t *batch);
+void el_op_aggregate_free(el_op_t *op);
+el_group_t *el_op_aggregate_find(el_op_aggregate_t *agg, const el_batch_t *batch,
+								 uint16_t pos);
+uint32_t el_op_aggregate_hash(const el_field_def_t *def,
+							  const el_number_t *key, const char *str);
+uint32_t el_util_hash(const char *buf, size_t len);
+const char *el_intern_find(el_intern_t *pool, const char *str, size_t len);
+void el_intern_free(el_intern_t *pool);
+uint32_t el_util_popcount(uint32_t word);
+uint32_t el_util_key_hash(const el_field_def_t *field, const char *raw);
+uint32_t el_util_number_hash(const el_number_t *value);
+bool el_util_key_equal(const el_field_def_t *a_field, const char *a,
+					   const el_field_def_t *b_field, const char *b);
+el_err_t el_bloom_load(eld_handle_t *doc);
+el_err_t el_bloom_sync(eld_handle_t *doc, uint8_t field);
+bool el_bloom_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg);
+el_err_t el_bloom_update(eld_handle_t *doc, const el_row_t *row);
+uint8_t *el_bloom_candidates(eld_handle_t *doc, const el_expr_t *expr);
+void el_bloom_insert(uint32_t *words, uint32_t hash);
+bool el_bloom_check(const uint32_t *words, uint32_t hash);
+bool el_index_build_block(eld_handle_t *doc, const char *block, uint32_t first,
+						  uint32_t count, void *arg);
+void el_index_sort(uint32_t *rows, uint32_t count, const char *keys,
+				   uint16_t key_len);
+el_err_t el_index_save(const eld_handle_t *doc, const el_index_t *idx);
+el_index_t *el_index_create(eld_handle_t *doc, uint8_t field,
+						   el_progress_cb_t progress, void *arg);
+el_err_t el_index_load(eld_handle_t *doc);
+bool el_index_load_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg);
+bool el_index_load_dead(uint32_t value, void *arg);
+el_err_t el_index_row(eld_handle_t *doc, const el_row_t *row, bool replace);
+void el_index_delta_add(el_index_t *idx, uint32_t row, const char *key);
+void el_index_delta_remove(el_index_t *idx, uint32_t row);
+void el_index_hide(el_index_t *idx, uint32_t row);
+el_err_t el_index_remap(const eld_handle_t *doc, el_index_t *idx,
+						const uint32_t *dead, uint32_t dead_count,
+						uint32_t base, bool shift);
+uint32_t el_index_posting_count(const el_index_t *idx);
+el_err_t el_index_merge_one(eld_handle_t *doc, el_index_t *idx);
+bool el_index_merge_key(const char *key, const uint32_t *rows, uint32_t count,
+						void *arg);
+uint32_t el_index_lower(const char *entries, uint16_t entry_len,
+						uint32_t count, const char *key, size_t len);
+uint32_t el_index_prefix_end(const char *entries, uint16_t entry_len,
+							 uint32_t from, uint32_t count, const char *prefix,
+							 size_t len);
+el_err_t el_index_walk(const el_index_t *idx, uint32_t from, uint32_t to,
+					   uint32_t dfrom, uint32_t dto, el_index_cb_t cb,
+					   void *arg);
+el_err_t el_window_run(eld_handle_t *doc, el_window_t *win, uint8_t field);
+bool el_window_block(eld_handle_t *doc, const char *block, uint32_t first,
+					 uint32_t count, void *arg);
+double el_window_current(const el_window_t *win);
+el_err_t el_array_run(eld_handle_t *doc, el_array_op_t op, uint8_t field,
+					  double *out);
+bool el_array_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg);
+double el_array_reduce(const el_field_def_t *field, const char *raw,
+					   el_array_op_t op);
+size_t el_util_field_offset(const eld_handle_t *doc, uint8_t field);
+double el_util_raw_number(const el_field_def_t *field, const char *raw);
+double el_doc_raw_number(const eld_handle_t *doc, const el_field_def_t *field,
+						 const char *raw, uint32_t index);
+void el_util_raw_exact(const el_field_def_t *field, const char *raw,
+					   el_number_t *num);
+void el_doc_raw_exact(const eld_handle_t *doc, const el_field_def_t *field,
+					  const char *raw, uint32_t index, el_number_t *num);
+void el_util_number_set(el_number_t *num, double value);
+const char *el_util_number_parse(el_number_t *num, const char *str);
+int el_util_number_cmp(const el_number_t *a, const el_number_t *b);
+bool el_util_number_equal(const el_number_t *a, const el_number_t *b);
+double el_util_number_sub(const el_number_t *a, const el_number_t *b);
+bool el_util_field_implicit(const el_field_def_t *field);
+uint16_t el_util_null_len(uint16_t flags, uint8_t count);
+bool el_doc_raw_null(const eld_handle_t *doc, const char *row, uint8_t field);
+void el_util_raw_number_set(const el_field_def_t *field, char *raw,
+							double value);
+bool el_util_is_string(const el_field_def_t *field);
+bool el_util_is_array(const el_field_def_t *field);
+#ifdef EL_HAS_INT64
+int64_t el_util_decimal_factor(const el_field_def_t *field);
+#endif /* EL_HAS_INT64 */
+el_err_t el_heap_open(eld_handle_t *doc, bool create);
+uint32_t el_heap_append(eld_handle_t *doc, const char *str, uint16_t len);
+el_err_t el_heap_cell_write(eld_handle_t *doc, const el_field_def_t *field,
+							const char *str);
+char *el_heap_read(const eld_handle_t *doc, const el_field_def_t *field,
+				   const char *raw);
+int el_heap_cmp(const eld_handle_t *doc, const el_field_def_t *field,
+				const char *raw, const char *str);
+char *el_util_sidecar_name(const eld_handle_t *doc, const char *suffix);
+char *el_util_path_suffix(const char *fname, const char *suffix);
+FILE *el_util_sidecar_fopen(const eld_handle_t *doc, const char *suffix,
+							const char *fmode);
+bool el_util_sidecar_owned(const eld_handle_t *doc, uint32_t doc_id);
+void el_util_sidecar_drop(const eld_handle_t *doc, const char *suffix,
+						  FILE *fh);
+void el_util_sidecars_remove(const eld_handle_t *doc);
+int el_util_fseek(FILE *fh, el_off_t offset, int whence);
+el_off_t el_util_ftell(FILE *fh);
+uint32_t el_util_doc_id(const eld_handle_t *doc);
 size_t el_util_strcpy(char **dest, const char *src);
 size_t el_util_strstrcpy(char **dest, const char *start, const char *end);
 void el_util_calc_header_len(eld_handle_t *doc);
@@ -74,11 +510,12 @@ eld_handle_t *el_doc_new(void) {
 	doc->fname = NULL;
 	doc->fh = NULL;
 	memset(doc->fmode, '\0', 4);
+	doc->heap = NULL;
 
 	/* Reset header definition. */
 	doc->header.magic[0] = 'E';
 	doc->header.magic[1] = 'L';
-	doc->header.reserved[0] = '-';
+	doc->header.reserved[0] = EL_HEADER_EXT;
 	doc->header.reserved[1] = '-';
 	doc->header.reserved[2] = '-';
 	doc->header.reserved[3] = '-';
@@ -86,6 +523,22 @@ eld_handle_t *el_doc_new(void) {
 	doc->header.field_desc_count = 0;
 	doc->header.row_count = 0;
 	doc->field_defs = NULL;
+	doc->field_hash_len = 0;
+	doc->field_hash = NULL;
+	memset(&(doc->ext), 0, sizeof(eld_header_ext_t));
+	doc->ext.ext_len = sizeof(eld_header_ext_t);
+#ifdef EL_HAS_INT64
+	doc->time_last = 0;
+#endif /* EL_HAS_INT64 */
+	doc->ext.doc_id = el_util_doc_id(doc);
+	doc->bloom_count = 0;
+	doc->bloom_fields = NULL;
+	doc->index_count = 0;
+	doc->indexes = NULL;
+	doc->deleted = NULL;
+	doc->interns = NULL;
+	doc->schema_count = 0;
+	doc->schemas = NULL;
 
 	/* Calculate lengths. */
 	el_util_calc_header_len(doc);
@@ -170,6 +623,7 @@ el_err_t el_doc_fclose(eld_handle_t *doc) {
  */
 el_err_t el_doc_free(eld_handle_t *doc) {
 	el_err_t err;
+	uint8_t i;
 
 	/* Start by closing the file handle. */
 	err = el_doc_fclose(doc);
@@ -177,6 +631,31 @@ el_err_t el_doc_free(eld_handle_t *doc) {
 		return err;
 	}
 
+	/* Make sure the changes to the string indexes are persisted. */
+	err = el_index_merge(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	for (i = 0; i < doc->index_count; i++)
+		el_index_free(doc->indexes[i]);
+	free(doc->indexes);
+	doc->indexes = NULL;
+	doc->index_count = 0;
+
+	/* Free the deleted rows. */
+	el_bitmap_free(doc->deleted);
+	doc->deleted = NULL;
+
+	/* Free the interned strings. */
+	el_intern_free(doc->interns);
+	doc->interns = NULL;
+
+	/* Close the string heap. */
+	if (doc->heap != NULL) {
+		fclose(doc->heap);
+		doc->heap = NULL;
+	}
+
 	/* Free file name. */
 	free(doc->fname);
 
@@ -184,6 +663,15 @@ el_err_t el_doc_free(eld_handle_t *doc) {
 	free(doc->field_defs);
 	doc->field_defs = NULL;
 	doc->header.field_desc_count = 0;
+	free(doc->field_hash);
+	doc->field_hash = NULL;
+	doc->field_hash_len = 0;
+	el_schema_free(doc);
+
+	/* Free the list of fields with Bloom filters. */
+	free(doc->bloom_fields);
+	doc->bloom_fields = NULL;
+	doc->bloom_count = 0;
 
 	return EL_OK;
 }
@@ -212,13 +700,44 @@ el_err_t el_doc_read(eld_handle_t *doc, const char *fname) {
 		return err;
 	}
 
-	/* Close the document and return. */
+	/* Close the document. */
 	err = el_doc_fclose(doc);
-	return err;
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Look for the schemas that older rows were written with. */
+	err = el_schema_load(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Look for deleted rows. */
+	err = el_doc_tomb_load(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Look for Bloom filter sidecars. */
+	err = el_bloom_load(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Open the heap of variable-length strings. */
+	err = el_heap_open(doc, false);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Look for string index sidecars. */
+	return el_index_load(doc);
 }
 
 /**
- * Saves changes to a document header to a file.
+ * Saves changes to a document header to a file. The first time a brand new
+ * document is saved, any sidecars left behind by a document that used to be at
+ * the same path are removed.
  *
  * @param doc   Pointer to a Entrylog document handle object.
  * @param fname Document file path or NULL if we should re-use the stored one.
@@ -229,6 +748,9 @@ el_err_t el_doc_read(eld_handle_t *doc, const char *fname) {
  * @see el_doc_free
  */
 el_err_t el_doc_save(eld_handle_t *doc, const char *fname) {
+	eld_header_t header;
+	el_field_def_t *field_defs;
+	bool fresh = doc->fname == NULL;
 	el_err_t err;
 
 	/* Open the document. */
@@ -241,16 +763,40 @@ el_err_t el_doc_save(eld_handle_t *doc, const char *fname) {
 		}
 	}
 
+	/* Documents whose schema has changed keep the one they were created with
+	   in the file. */
+	header = doc->header;
+	field_defs = doc->field_defs;
+	if (doc->schema_count > 0) {
+		header.row_len = doc->schemas[0].header.row_len;
+		header.field_desc_count = doc->schemas[0].header.field_count;
+		field_defs = doc->schemas[0].field_defs;
+	}
+
 	/* Write the header to the file. */
-	fwrite(&(doc->header), sizeof(eld_header_t), 1, doc->fh);
+	fwrite(&header, sizeof(eld_header_t), 1, doc->fh);
 
 	/* Write field definitions to the file. */
-	fwrite(doc->field_defs, sizeof(el_field_def_t),
-		   doc->header.field_desc_count, doc->fh);
+	fwrite(field_defs, sizeof(el_field_def_t), header.field_desc_count,
+		   doc->fh);
 
-	/* Close the document and return. */
+	/* Write the header extension without going past the one in the file. */
+	if (doc->header.reserved[0] == EL_HEADER_EXT) {
+		fwrite(&(doc->ext), (doc->ext.ext_len < sizeof(eld_header_ext_t)) ?
+			   doc->ext.ext_len : sizeof(eld_header_ext_t), 1, doc->fh);
+	}
+
+	/* Close the document. */
 	err = el_doc_fclose(doc);
-	return err;
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Sidecars of a document that used to be here aren't ours. */
+	if (fresh)
+		el_util_sidecars_remove(doc);
+
+	return EL_OK;
 }
 
 /**
@@ -270,30 +816,391 @@ el_err_t el_doc_header_read(eld_handle_t *doc) {
 		doc->field_defs, sizeof(el_field_def_t) * doc->header.field_desc_count);
 	fread(doc->field_defs, sizeof(el_field_def_t),
 		  doc->header.field_desc_count, doc->fh);
+	el_doc_field_hash(doc);
+
+	/* Read the header extension. Fields it doesn't have are left zeroed. */
+	memset(&(doc->ext), 0, sizeof(eld_header_ext_t));
+	if (doc->header.reserved[0] == EL_HEADER_EXT) {
+		fread(&(doc->ext.ext_len), sizeof(uint16_t), 1, doc->fh);
+		if (doc->ext.ext_len > sizeof(eld_header_ext_t)) {
+			fread(((char *)&(doc->ext)) + sizeof(uint16_t),
+				  sizeof(eld_header_ext_t) - sizeof(uint16_t), 1, doc->fh);
+		} else if (doc->ext.ext_len > sizeof(uint16_t)) {
+			fread(((char *)&(doc->ext)) + sizeof(uint16_t),
+				  doc->ext.ext_len - sizeof(uint16_t), 1, doc->fh);
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Reads the tombstone sidecar of a document that was just read, if there's
+ * one, to find out which rows were deleted.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ */
+el_err_t el_doc_tomb_load(eld_handle_t *doc) {
+	el_tomb_header_t header;
+	uint32_t words[256];
+	uint32_t base = 0;
+	uint32_t ring = doc->ext.ring_rows;
+	uint32_t last = doc->header.row_count - 1;
+	size_t n;
+	FILE *fh;
+
+	/* Check if there's a sidecar. */
+	el_bitmap_free(doc->deleted);
+	doc->deleted = NULL;
+	fh = el_util_sidecar_fopen(doc, ".ts", "rb");
+	if (fh == NULL)
+		return EL_OK;
+	if ((fread(&header, sizeof(el_tomb_header_t), 1, fh) != 1) ||
+		(header.count == 0)) {
+		fclose(fh);
+		return EL_OK;
+	}
+	if (!el_util_sidecar_owned(doc, header.doc_id)) {
+		el_util_sidecar_drop(doc, ".ts", fh);
+		return EL_OK;
+	}
+
+	/* Add the rows whose bits are set to the bitmap. */
+	doc->deleted = el_bitmap_new();
+	while ((n = fread(words, sizeof(uint32_t), 256, fh)) > 0) {
+		size_t i;
+
+		for (i = 0; i < n; i++, base += 32) {
+			uint32_t word = words[i];
+			uint8_t bit;
+
+			for (bit = 0; word != 0; bit++, word >>= 1) {
+				uint32_t index = base + bit;
+
+				if (!(word & 1))
+					continue;
+
+				/* Rings store the slot of the row that currently holds it. */
+				if (ring > 0) {
+					index = last - ((el_doc_slot(doc, last) + ring - index) %
+									ring);
+				}
+				el_bitmap_add(doc->deleted, index);
+			}
+		}
+	}
+	fclose(fh);
 
 	return EL_OK;
 }
 
 /**
- * Append a field definition to the document header.
+ * Append a field definition to the document header. If the document already
+ * has rows a new schema version is started instead of rewriting them, and the
+ * older rows get the new field zeroed, or null if the document has a null
+ * bitmap, when they're read.
  *
  * @param doc   Document handle.
  * @param field Field definition to be appended to the document.
  *
  * @return EL_OK if the operation was successful.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_schema_set
  */
 el_err_t el_doc_field_add(eld_handle_t *doc, el_field_def_t field) {
-	/* Make room for our new field definition. */
-	doc->header.field_desc_count++;
-	doc->field_defs = (el_field_def_t *)realloc(
-		doc->field_defs, sizeof(el_field_def_t) * doc->header.field_desc_count);
+	el_field_def_t *field_defs;
+	uint8_t count = doc->header.field_desc_count;
 
-	/* Copy the field over. */
-	doc->field_defs[doc->header.field_desc_count - 1] = field;
+	/* Copy the definitions with our new field at the end. */
+	field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) *
+										  (count + 1));
+	if (count > 0)
+		memcpy(field_defs, doc->field_defs, sizeof(el_field_def_t) * count);
+	field_defs[count] = field;
 
-	/* Re-calculate lengths. */
-	el_util_calc_header_len(doc);
+	return el_doc_schema_set(doc, field_defs, count + 1, doc->ext.flags);
+}
+
+/**
+ * Finds a field by its name.
+ *
+ * @param doc  Document handle.
+ * @param name Name of the field.
+ *
+ * @return Index of the field or -1 if it wasn't found.
+ */
+int el_doc_field_index(const eld_handle_t *doc, const char *name) {
+	return el_doc_field_find(doc, name, strlen(name));
+}
+
+/**
+ * Finds a field by its name in the hash table of field names.
+ *
+ * @param doc  Document handle.
+ * @param name Name of the field. (Doesn't need to be NULL terminated)
+ * @param len  Length of the name.
+ *
+ * @return Index of the field or -1 if it wasn't found.
+ */
+int el_doc_field_find(const eld_handle_t *doc, const char *name, size_t len) {
+	uint16_t mask = doc->field_hash_len - 1;
+	uint16_t slot;
+
+	/* Check if the name would even fit in a field. */
+	if ((len == 0) || (len > EL_FIELD_NAME_LEN) || (doc->field_hash == NULL))
+		return -1;
+
+	/* Probe until we find it or hit an empty slot. */
+	for (slot = (uint16_t)(el_util_hash(name, len) & mask);
+			doc->field_hash[slot] != 0; slot = (slot + 1) & mask) {
+		const char *other = doc->field_defs[doc->field_hash[slot] - 1].name;
+
+		if ((strncmp(other, name, len) == 0) && (other[len] == '\0'))
+			return doc->field_hash[slot] - 1;
+	}
+
+	return -1;
+}
+
+/**
+ * Rebuilds the hash table of field names after the field definitions of a
+ * document have changed. The table uses open addressing with linear probing
+ * and is kept at most half full, with each slot holding the index of the field
+ * plus one, or 0 if it's empty.
+ *
+ * @param doc Document handle.
+ */
+void el_doc_field_hash(eld_handle_t *doc) {
+	uint16_t mask;
+	uint8_t i;
+
+	/* Size the table. */
+	for (doc->field_hash_len = 16;
+			doc->field_hash_len < (2 * doc->header.field_desc_count);
+			doc->field_hash_len <<= 1)
+		;
+	mask = doc->field_hash_len - 1;
+	free(doc->field_hash);
+	doc->field_hash = (uint8_t *)calloc(doc->field_hash_len, sizeof(uint8_t));
+
+	/* Add the fields. The first one with a name wins. */
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		const char *name = doc->field_defs[i].name;
+		size_t len = 0;
+		uint16_t slot;
+
+		while ((len < EL_FIELD_NAME_LEN) && (name[len] != '\0'))
+			len++;
+		if (el_doc_field_find(doc, name, len) >= 0)
+			continue;
+		for (slot = (uint16_t)(el_util_hash(name, len) & mask);
+				doc->field_hash[slot] != 0; slot = (slot + 1) & mask)
+			;
+		doc->field_hash[slot] = i + 1;
+	}
+}
+
+/**
+ * Removes a field from the document. Rows that were already written keep its
+ * data in the file until the document is compacted.
+ * @warning Fields after the dropped one move back by one, so fields with string
+ *          indexes or Bloom filters can't be moved.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the field to be removed.
+ *
+ * @return EL_OK if the operation was successful.
+ *         EL_ERROR_ARGUMENT if the field doesn't exist or a field that would be
+ *         moved has a string index or Bloom filter.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_schema_set
+ */
+el_err_t el_doc_field_drop(eld_handle_t *doc, uint8_t field) {
+	el_field_def_t *field_defs;
+	uint8_t count = doc->header.field_desc_count;
+	uint8_t i;
+
+	/* Check if the field can be dropped. */
+	if (field >= count) {
+		el_error_msg_format(EMSG("Field %u doesn't exist."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	for (i = 0; i < doc->index_count; i++) {
+		if (doc->indexes[i]->header.field >= field) {
+			el_error_msg_format(EMSG("Field %u has a string index."),
+								doc->indexes[i]->header.field);
+			return EL_ERROR_ARGUMENT;
+		}
+	}
+	for (i = 0; i < doc->bloom_count; i++) {
+		if (doc->bloom_fields[i] >= field) {
+			el_error_msg_format(EMSG("Field %u has a Bloom filter."),
+								doc->bloom_fields[i]);
+			return EL_ERROR_ARGUMENT;
+		}
+	}
+
+	/* Copy the definitions without the field. */
+	field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) * count);
+	memcpy(field_defs, doc->field_defs, sizeof(el_field_def_t) * field);
+	memcpy(field_defs + field, doc->field_defs + field + 1,
+		   sizeof(el_field_def_t) * (count - field - 1));
+
+	return el_doc_schema_set(doc, field_defs, count - 1, doc->ext.flags);
+}
+
+/**
+ * Makes a string field longer. Rows that were already written are padded when
+ * they're read.
+ *
+ * @param doc    Document handle.
+ * @param field  Index of the string field.
+ * @param length New length of the field. (Just like in el_field_def_new)
+ *
+ * @return EL_OK if the operation was successful.
+ *         EL_ERROR_ARGUMENT if the field isn't a string, has a string index or
+ *         would get shorter.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_schema_set
+ */
+el_err_t el_doc_field_widen(eld_handle_t *doc, uint8_t field, uint16_t length) {
+	el_field_def_t *field_defs;
+	uint8_t count = doc->header.field_desc_count;
+
+	/* Check if the field can be widened. */
+	if ((field >= count) || (doc->field_defs[field].type != EL_FIELD_STRING)) {
+		el_error_msg_format(EMSG("Field %u isn't a string field."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (el_doc_index(doc, field) != NULL) {
+		el_error_msg_format(EMSG("Field %u has a string index."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if ((length + 1) < doc->field_defs[field].size_bytes) {
+		el_error_msg_format(EMSG("Field %u can't be made shorter."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Copy the definitions with the new length. */
+	field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) * count);
+	memcpy(field_defs, doc->field_defs, sizeof(el_field_def_t) * count);
+	field_defs[field].size_bytes = length + 1;
+
+	return el_doc_schema_set(doc, field_defs, count, doc->ext.flags);
+}
+
+/**
+ * Packs consecutive boolean fields into shared bytes, 8 to a byte.
+ *
+ * @param field_defs Field definitions.
+ * @param count      Number of field definitions.
+ */
+void el_doc_field_pack(el_field_def_t *field_defs, uint8_t count) {
+	uint8_t i;
+
+	for (i = 0; i < count; i++) {
+		el_field_def_t *field = &(field_defs[i]);
+
+		if (field->type != EL_FIELD_BOOL)
+			continue;
+
+		if ((i > 0) && (field_defs[i - 1].type == EL_FIELD_BOOL) &&
+			(field_defs[i - 1].reserved < 7)) {
+			field->reserved = field_defs[i - 1].reserved + 1;
+			field->size_bytes = 0;
+		} else {
+			field->reserved = 0;
+			field->size_bytes = sizeof(uint8_t);
+		}
+	}
+}
+
+/**
+ * Replaces the field definitions and row layout flags of a document. Documents
+ * without rows simply get their header changed. Otherwise the rows already in
+ * the file are left untouched: the schema they were written with is recorded
+ * in a versions sidecar along with the row it applies from, and they're
+ * adapted to the current schema whenever they're read, matching fields by
+ * name. Rows are only rewritten with the current schema when the document is
+ * compacted, except in ring documents, which are compacted right away since
+ * all of their slots must be the same size.
+ *
+ * @param doc        Document handle.
+ * @param field_defs New field definitions. (Taken over by the document)
+ * @param count      Number of field definitions.
+ * @param flags      New header extension flags.
+ *
+ * @return EL_OK if the operation was successful.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_compact
+ */
+el_err_t el_doc_schema_set(eld_handle_t *doc, el_field_def_t *field_defs,
+						   uint8_t count, uint16_t flags) {
+	el_schema_t *schema;
+	el_err_t err;
+
+	/* Pack the booleans into as few bytes as possible. */
+	el_doc_field_pack(field_defs, count);
+
+	/* Documents without rows only need their header changed. */
+	if (doc->header.row_count == 0) {
+		free(doc->field_defs);
+		doc->field_defs = field_defs;
+		doc->header.field_desc_count = count;
+		doc->ext.flags = flags;
+		el_doc_field_hash(doc);
+		el_util_calc_header_len(doc);
+		el_util_calc_row_len(doc);
+
+		return EL_OK;
+	}
+
+	/* Make sure the rows of a ring are in order in the file. */
+	if (doc->ext.ring_rows > 0) {
+		err = el_doc_compact(doc, NULL, NULL);
+		IF_EL_ERROR(err) {
+			free(field_defs);
+			return err;
+		}
+	}
+
+	/* Remember the schema the rows in the file were written with. */
+	if (doc->schema_count == 0)
+		el_schema_push(doc, 0, doc->header.header_len);
+	schema = &(doc->schemas[doc->schema_count - 1]);
+	if (schema->header.first_row < doc->header.row_count) {
+		el_schema_push(doc, doc->header.row_count,
+					   el_doc_row_offset(doc, doc->header.row_count));
+	}
+
+	/* Switch to the new schema. */
+	free(doc->field_defs);
+	doc->field_defs = field_defs;
+	doc->header.field_desc_count = count;
+	doc->ext.flags = flags;
+	el_doc_field_hash(doc);
 	el_util_calc_row_len(doc);
+	schema = &(doc->schemas[doc->schema_count - 1]);
+	schema->header.row_len = doc->header.row_len;
+	schema->header.field_count = count;
+	schema->header.flags = (uint8_t)(flags & EL_EXT_NULLS);
+	schema->field_defs = (el_field_def_t *)realloc(schema->field_defs,
+		sizeof(el_field_def_t) * (count + 1));
+	memcpy(schema->field_defs, field_defs, sizeof(el_field_def_t) * count);
+
+	/* Save the versions and rewrite rings straight away. */
+	err = el_schema_save(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	if (doc->ext.ring_rows > 0)
+		return el_doc_compact(doc, NULL, NULL);
 
 	return EL_OK;
 }
@@ -305,11 +1212,35 @@ el_err_t el_doc_field_add(eld_handle_t *doc, el_field_def_t field) {
  * @param row Row to be written to the file.
  *
  * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the row is interned.
  *         EL_ERROR_FILE if an error occurred while operating on the file.
  */
 el_err_t el_doc_row_write(eld_handle_t *doc, const el_row_t *row) {
+	uint16_t null_len;
 	uint8_t i;
 
+	/* Shared strings are only as long as their value, not their field. */
+	if (row->interned) {
+		el_error_msg_set(EMSG("Interned rows are read-only."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Write the null bitmap. */
+	null_len = el_util_null_len(doc->ext.flags, row->cell_count);
+	if (null_len > 0) {
+		uint8_t nulls[32];
+
+		memset(nulls, 0, null_len);
+		for (i = 0; i < row->cell_count; i++) {
+			const el_cell_t *cell = &(row->cells[i]);
+
+			if (cell->null && !el_util_field_implicit(cell->field))
+				nulls[i >> 3] |= 1 << (i & 7);
+		}
+
+		fwrite(nulls, null_len, 1, doc->fh);
+	}
+
 	/* Go through the cells writing them. */
 	for (i = 0; i < row->cell_count; i++) {
 		size_t len;
@@ -318,15 +1249,38 @@ el_err_t el_doc_row_write(eld_handle_t *doc, const el_row_t *row) {
 		/* Write the cell. */
 		len = cell.field->size_bytes;
 		switch ((el_type_t)cell.field->type) {
-			case EL_FIELD_INT:
-				fwrite(&(cell.value.integer), len, 1, doc->fh);
-				break;
-			case EL_FIELD_FLOAT:
-				fwrite(&(cell.value.number), len, 1, doc->fh);
-				break;
 			case EL_FIELD_STRING:
 				fwrite(cell.value.string, len, 1, doc->fh);
 				break;
+			case EL_FIELD_FLOAT_ARRAY:
+			case EL_FIELD_INT_ARRAY:
+				fwrite(cell.value.array.data, len, 1, doc->fh);
+				break;
+			case EL_FIELD_VARCHAR:
+				if (el_heap_cell_write(doc, cell.field,
+									   cell.value.string) != EL_OK)
+					return EL_ERROR_FILE;
+				break;
+			case EL_FIELD_BOOL:
+				/* Gather the booleans that share this byte. */
+				if (len > 0) {
+					uint8_t byte = 0;
+					uint8_t j = i;
+
+					do {
+						if (row->cells[j].value.boolean)
+							byte |= 1 << row->cells[j].field->reserved;
+						j++;
+					} while ((j < row->cell_count) &&
+							 (row->cells[j].field->type == EL_FIELD_BOOL) &&
+							 (row->cells[j].field->size_bytes == 0));
+
+					fwrite(&byte, sizeof(uint8_t), 1, doc->fh);
+				}
+				break;
+			default:
+				fwrite(&(cell.value), len, 1, doc->fh);
+				break;
 		}
 
 		/* Check if the write operation was successful. */
@@ -343,20 +1297,53 @@ el_err_t el_doc_row_write(eld_handle_t *doc, const el_row_t *row) {
 }
 
 /**
- * Appends a new row to the end of the file.
+ * Appends a new row to the end of the file. In a ring document that is already
+ * full the oldest row is dropped and its slot is overwritten instead.
  *
  * @param doc Document object.
  * @param row Row to be appended to the file.
  *
  * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the row is interned.
  *         EL_ERROR_FILE if an error occurred while operating on the file.
+ *
+ * @see el_doc_ring
  */
 el_err_t el_doc_row_add(eld_handle_t *doc, el_row_t *row) {
+	bool wrapped;
 	el_err_t err;
 
+	/* Interned rows are read-only. */
+	if (row->interned) {
+		el_error_msg_set(EMSG("Interned rows are read-only."));
+		return EL_ERROR_ARGUMENT;
+	}
+
 	/* Update the new row index and the header row count. */
 	row->index = doc->header.row_count;
 	doc->header.row_count++;
+#ifdef EL_HAS_INT64
+	el_doc_row_stamp(doc, row);
+#endif /* EL_HAS_INT64 */
+
+	/* Drop the oldest row of a full ring. */
+	wrapped = (doc->ext.ring_rows > 0) && (row->index >= doc->ext.ring_rows);
+	if (wrapped) {
+		uint32_t evicted = row->index - doc->ext.ring_rows;
+		uint8_t i;
+
+		if (doc->ext.row_base <= evicted)
+			doc->ext.row_base = evicted + 1;
+		for (i = 0; i < doc->index_count; i++)
+			el_index_hide(doc->indexes[i], evicted);
+		if ((doc->deleted != NULL) &&
+			el_bitmap_contains(doc->deleted, evicted)) {
+			err = el_doc_tomb_clear(doc, evicted);
+			IF_EL_ERROR(err) {
+				return err;
+			}
+		}
+	}
 
 	/* Save the header changes. */
 	err = el_doc_save(doc, NULL);
@@ -364,11 +1351,15 @@ el_err_t el_doc_row_add(eld_handle_t *doc, el_row_t *row) {
 		return err;
 	}
 
-	/* Open the document for appending. */
-	err = el_doc_fopen(doc, NULL, "a+b");
+	/* Open the document for appending or go to the slot being reused. */
+	err = el_doc_fopen(doc, NULL, (wrapped) ? "r+b" : "a+b");
 	IF_EL_ERROR(err) {
 		return err;
 	}
+	if (wrapped && !el_row_seek(doc, row->index)) {
+		el_doc_fclose(doc);
+		return EL_ERROR_FILE;
+	}
 
 	/* Write row to the file. */
 	err = el_doc_row_write(doc, row);
@@ -376,23 +1367,103 @@ el_err_t el_doc_row_add(eld_handle_t *doc, el_row_t *row) {
 		return err;
 	}
 
-	/* Close the document and return. */
+	/* Close the document. */
 	err = el_doc_fclose(doc);
-	return err;
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Build the Bloom filters of the block this row has just filled. */
+	if ((doc->bloom_count > 0) &&
+		((doc->header.row_count % EL_SCAN_BLOCK_ROWS) == 0)) {
+		uint8_t i;
+
+		for (i = 0; i < doc->bloom_count; i++) {
+			err = el_bloom_sync(doc, doc->bloom_fields[i]);
+			IF_EL_ERROR(err) {
+				return err;
+			}
+		}
+	}
+
+	/* Add the row to the string indexes. */
+	return el_index_row(doc, row, false);
 }
 
+#ifdef EL_HAS_INT64
 /**
- * Updates an existing row in the file.
+ * Fills in the timestamps of a row that is about to be appended. Implicit
+ * timestamps get the time of the row and stored ones that were left at 0 get
+ * the current time, which never goes backwards in a document handle even if
+ * the system clock does.
  *
  * @param doc Document object.
- * @param row Row to be updated in the file.
- *
+ * @param row Row that is about to be appended.
+ */
+void el_doc_row_stamp(eld_handle_t *doc, el_row_t *row) {
+	int64_t now = 0;
+	uint8_t i;
+
+	for (i = 0; i < row->cell_count; i++) {
+		el_cell_t *cell = &(row->cells[i]);
+
+		if (cell->field->type != EL_FIELD_TIMESTAMP)
+			continue;
+
+		/* Implicit timestamps are worked out from the row index. */
+		if (el_util_field_implicit(cell->field)) {
+			cell->value.timestamp = el_doc_row_time(doc, row->index);
+			continue;
+		}
+
+		/* Capture the time only once for the whole row. */
+		if (cell->value.timestamp != 0)
+			continue;
+		if (now == 0) {
+			now = el_util_time_now();
+			if (now <= doc->time_last)
+				now = doc->time_last + 1;
+			doc->time_last = now;
+		}
+		cell->value.timestamp = now;
+	}
+}
+#endif /* EL_HAS_INT64 */
+
+/**
+ * Updates an existing row in the file.
+ *
+ * @param doc Document object.
+ * @param row Row to be updated in the file.
+ *
  * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the row is interned, was deleted or was
+ *         written with an older schema.
  *         EL_ERROR_FILE if an error occurred while operating on the file.
  */
 el_err_t el_doc_row_update(eld_handle_t *doc, const el_row_t *row) {
+	uint32_t end;
 	el_err_t err;
 
+	/* Interned rows are read-only. */
+	if (row->interned) {
+		el_error_msg_set(EMSG("Interned rows are read-only."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Deleted rows can't be brought back. */
+	if (el_doc_row_deleted(doc, row->index)) {
+		el_error_msg_format(EMSG("Row %lu was deleted."), row->index);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Rows written with an older schema don't have room for the current one. */
+	if (el_schema_find(doc, row->index, &end) != NULL) {
+		el_error_msg_format(EMSG("Row %lu was written with an older schema. "
+								 "Compact the document first."), row->index);
+		return EL_ERROR_ARGUMENT;
+	}
+
 	/* Open the document for updating. */
 	err = el_doc_fopen(doc, NULL, "r+b");
 	IF_EL_ERROR(err) {
@@ -410,283 +1481,8008 @@ el_err_t el_doc_row_update(eld_handle_t *doc, const el_row_t *row) {
 		return err;
 	}
 
-	/* Close the document and return. */
+	/* Close the document. */
 	err = el_doc_fclose(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Make sure the Bloom filters know about the new values. */
+	err = el_bloom_update(doc, row);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Move the row to its new key in the string indexes. */
+	return el_index_row(doc, row, true);
+}
+
+/**
+ * Deletes a row from the document. The row is only marked as deleted in a
+ * tombstone sidecar, so scans skip it and el_row_get refuses to read it, but
+ * it keeps its space in the file and the other rows keep their indexes until
+ * el_doc_compact is called.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row to be deleted.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the row doesn't exist.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ *
+ * @see el_doc_compact
+ */
+el_err_t el_doc_row_delete(eld_handle_t *doc, uint32_t index) {
+	el_tomb_header_t header;
+	uint32_t word = 0;
+	uint32_t slot;
+	long offset;
+	uint8_t i;
+	FILE *fh;
+
+	/* Check if the row exists. */
+	if (index >= doc->header.row_count) {
+		el_error_msg_format(EMSG("Requested index %lu is greater than the "
+								 "number of rows (%lu) in the document."),
+							index, doc->header.row_count);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (el_doc_row_deleted(doc, index))
+		return EL_OK;
+
+	/* Open the sidecar or create a brand new one. */
+	fh = el_util_sidecar_fopen(doc, ".ts", "r+b");
+	if ((fh == NULL) ||
+		(fread(&header, sizeof(el_tomb_header_t), 1, fh) != 1) ||
+		!el_util_sidecar_owned(doc, header.doc_id)) {
+		if (fh != NULL)
+			fclose(fh);
+		fh = el_util_sidecar_fopen(doc, ".ts", "w+b");
+		if (fh == NULL) {
+			el_error_msg_format(EMSG("Couldn't create the tombstones of "
+									 "\"%s\": %s."), doc->fname,
+								strerror(errno));
+			return EL_ERROR_FILE;
+		}
+
+		header.magic[0] = 'E';
+		header.magic[1] = 'T';
+		header.reserved[0] = '-';
+		header.reserved[1] = '-';
+		header.count = 0;
+		header.doc_id = doc->ext.doc_id;
+	}
+
+	/* Set the bit of the row. */
+	slot = el_doc_slot(doc, index);
+	offset = sizeof(el_tomb_header_t) + ((slot / 32) * sizeof(uint32_t));
+	if ((fseek(fh, offset, SEEK_SET) != 0) ||
+		(fread(&word, sizeof(uint32_t), 1, fh) != 1))
+		word = 0;
+	word |= 1UL << (slot % 32);
+	fseek(fh, offset, SEEK_SET);
+	fwrite(&word, sizeof(uint32_t), 1, fh);
+
+	/* Update the header. */
+	header.count++;
+	fseek(fh, 0, SEEK_SET);
+	fwrite(&header, sizeof(el_tomb_header_t), 1, fh);
+	if (ferror(fh)) {
+		el_error_msg_format(EMSG("Couldn't write the tombstones of \"%s\": "
+								 "%s."), doc->fname, strerror(errno));
+		fclose(fh);
+		return EL_ERROR_FILE;
+	}
+	fclose(fh);
+
+	/* Keep track of it in memory and hide it from the string indexes. */
+	if (doc->deleted == NULL)
+		doc->deleted = el_bitmap_new();
+	el_bitmap_add(doc->deleted, index);
+	for (i = 0; i < doc->index_count; i++)
+		el_index_hide(doc->indexes[i], index);
+
+	return EL_OK;
+}
+
+/**
+ * Checks if a row of the document was deleted or truncated.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ *
+ * @return Was the row deleted?
+ */
+bool el_doc_row_deleted(const eld_handle_t *doc, uint32_t index) {
+	if (index < doc->ext.row_base)
+		return true;
+	if (doc->deleted == NULL)
+		return false;
+
+	return el_bitmap_contains(doc->deleted, index);
+}
+
+/**
+ * Clears the tombstone of a deleted row whose slot in a ring document is about
+ * to be reused.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the deleted row.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_doc_tomb_clear(eld_handle_t *doc, uint32_t index) {
+	el_tomb_header_t header;
+	uint32_t slot = el_doc_slot(doc, index);
+	uint32_t word;
+	long offset;
+	FILE *fh;
+
+	/* Open the sidecar. */
+	fh = el_util_sidecar_fopen(doc, ".ts", "r+b");
+	if (fh == NULL)
+		return EL_OK;
+
+	/* Clear the bit of the slot and update the header. */
+	offset = sizeof(el_tomb_header_t) + ((slot / 32) * sizeof(uint32_t));
+	if ((fread(&header, sizeof(el_tomb_header_t), 1, fh) == 1) &&
+		(fseek(fh, offset, SEEK_SET) == 0) &&
+		(fread(&word, sizeof(uint32_t), 1, fh) == 1)) {
+		word &= ~(1UL << (slot % 32));
+		fseek(fh, offset, SEEK_SET);
+		fwrite(&word, sizeof(uint32_t), 1, fh);
+
+		if (header.count > 0)
+			header.count--;
+		fseek(fh, 0, SEEK_SET);
+		fwrite(&header, sizeof(el_tomb_header_t), 1, fh);
+	}
+	if (ferror(fh)) {
+		el_error_msg_format(EMSG("Couldn't write the tombstones of \"%s\": "
+								 "%s."), doc->fname, strerror(errno));
+		fclose(fh);
+		return EL_ERROR_FILE;
+	}
+	fclose(fh);
+
+	return EL_OK;
+}
+
+/**
+ * Rewrites the document without the rows that were deleted or truncated. The
+ * remaining rows are streamed into a new file that then replaces the original
+ * one and get renumbered starting from 0, the string indexes have their
+ * posting lists remapped to the new row indexes and the Bloom filters are
+ * rebuilt. Rows that were written with older schemas are migrated to the
+ * current one along the way.
+ *
+ * @param doc      Document handle.
+ * @param progress Function called after every block of rows is copied, or
+ *                 NULL.
+ * @param arg      Opaque pointer passed along to the progress callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the compaction was cancelled or deleted rows
+ *         would shift an implicit timestamp.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_doc_compact(eld_handle_t *doc, el_progress_cb_t progress,
+						void *arg) {
+	el_compact_t compact;
+	eld_header_t header;
+	eld_header_ext_t ext;
+	uint32_t base;
+	uint32_t *dead;
+	uint32_t *next;
+	uint32_t dead_count;
+	char suffix[8];
+	char *tmp;
+	el_err_t err;
+	uint8_t i;
+
+	/* Check if there's anything to do. */
+	if ((doc->deleted == NULL) && (doc->ext.row_base == 0) &&
+		(doc->header.reserved[0] == EL_HEADER_EXT) &&
+		(doc->ext.ext_len >= sizeof(eld_header_ext_t)) &&
+		(doc->schema_count == 0))
+		return EL_OK;
+
+	/* Get the deleted rows that weren't truncated in order. */
+	dead_count = 0;
+	dead = NULL;
+	if (doc->deleted != NULL) {
+		uint32_t j;
+
+		dead = (uint32_t *)malloc(sizeof(uint32_t) *
+			(el_bitmap_cardinality(doc->deleted) + 1));
+		next = dead;
+		el_bitmap_foreach(doc->deleted, el_doc_compact_dead, &next);
+		for (j = 0; j < (uint32_t)(next - dead); j++) {
+			if (dead[j] >= doc->ext.row_base)
+				dead[dead_count++] = dead[j];
+		}
+	}
+
+	/* Dropping rows would shift the time of the ones after them. */
+	if ((dead_count > 0) && (el_doc_time_field(doc) >= 0)) {
+		el_error_msg_set(EMSG("Deleted rows can't be dropped from a document "
+							  "with an implicit timestamp."));
+		free(dead);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Get the pending changes of the string indexes out of the way. */
+	err = el_index_merge(doc);
+	IF_EL_ERROR(err) {
+		free(dead);
+		return err;
+	}
+
+	/* Create the new file with an updated header. */
+	tmp = el_util_sidecar_name(doc, ".tmp");
+	compact.fh = fopen(tmp, "wb");
+	if (compact.fh == NULL) {
+		el_error_msg_format(EMSG("Couldn't create \"%s\": %s."), tmp,
+							strerror(errno));
+		free(dead);
+		free(tmp);
+		return EL_ERROR_FILE;
+	}
+	header = doc->header;
+	header.row_count -= doc->ext.row_base + dead_count;
+	header.reserved[0] = EL_HEADER_EXT;
+	ext = doc->ext;
+	ext.ext_len = sizeof(eld_header_ext_t);
+	ext.row_base = 0;
+#ifdef EL_HAS_INT64
+	ext.time_start = el_doc_row_time(doc, doc->ext.row_base);
+#endif /* EL_HAS_INT64 */
+	header.header_len = (sizeof(el_field_def_t) *
+						 doc->header.field_desc_count) +
+		sizeof(eld_header_t) + sizeof(eld_header_ext_t);
+	fwrite(&header, sizeof(eld_header_t), 1, compact.fh);
+	fwrite(doc->field_defs, sizeof(el_field_def_t),
+		   doc->header.field_desc_count, compact.fh);
+	fwrite(&ext, sizeof(eld_header_ext_t), 1, compact.fh);
+
+	/* Copy the rows that are still alive. */
+	compact.sel = (uint16_t *)malloc(sizeof(uint16_t) * EL_SCAN_BLOCK_ROWS);
+	compact.failed = false;
+	compact.progress = progress;
+	compact.arg = arg;
+	err = el_doc_scan_blocks(doc, 0, doc->header.row_count, NULL,
+							 el_doc_compact_block, &compact);
+	free(compact.sel);
+	if (ferror(compact.fh)) {
+		el_error_msg_format(EMSG("Couldn't write \"%s\": %s."), tmp,
+							strerror(errno));
+		err = EL_ERROR_FILE;
+	} else if (compact.failed) {
+		el_error_msg_set(EMSG("Compaction was cancelled."));
+		err = EL_ERROR_ARGUMENT;
+	}
+	fclose(compact.fh);
+
+	/* Replace the original file in one go, only falling back to removing it
+	   first where rename can't overwrite files. */
+	if ((err == EL_OK) && (rename(tmp, doc->fname) != 0)) {
+		if (remove(doc->fname) != 0) {
+			el_error_msg_format(EMSG("Couldn't replace \"%s\": %s."),
+								doc->fname, strerror(errno));
+			err = EL_ERROR_FILE;
+		} else if (rename(tmp, doc->fname) != 0) {
+			/* The compacted file is the only copy left, so keep it. */
+			el_error_msg_format(EMSG("Couldn't rename \"%s\" to \"%s\": "
+									 "%s."), tmp, doc->fname, strerror(errno));
+			free(dead);
+			free(tmp);
+			return EL_ERROR_FILE;
+		}
+	}
+	IF_EL_ERROR(err) {
+		remove(tmp);
+		free(dead);
+		free(tmp);
+		return err;
+	}
+	free(tmp);
+
+	/* Remap the string indexes to the new row indexes. */
+	base = doc->ext.row_base;
+	doc->header = header;
+	doc->ext = ext;
+	for (i = 0; (err == EL_OK) && (i < doc->header.field_desc_count); i++) {
+		el_index_t *idx = (el_index_t *)el_doc_index(doc, i);
+		FILE *fh;
+
+		/* Indexes that aren't being maintained have to be remapped too. */
+		if (idx == NULL) {
+			sprintf(suffix, ".ix%u", i);
+			fh = el_util_sidecar_fopen(doc, suffix, "rb");
+			if (fh == NULL)
+				continue;
+			fclose(fh);
+
+			idx = el_index_open(doc, i);
+			if (idx == NULL) {
+				err = EL_ERROR_FILE;
+				break;
+			}
+			err = el_index_remap(doc, idx, dead, dead_count, base, true);
+			el_index_free(idx);
+			continue;
+		}
+
+		err = el_index_remap(doc, idx, dead, dead_count, base, true);
+	}
+	free(dead);
+
+	/* Forget about the deleted rows and older schemas. */
+	el_bitmap_free(doc->deleted);
+	doc->deleted = NULL;
+	tmp = el_util_sidecar_name(doc, ".ts");
+	remove(tmp);
+	free(tmp);
+	el_schema_free(doc);
+	tmp = el_util_sidecar_name(doc, ".sv");
+	remove(tmp);
+	free(tmp);
+
+	/* Rebuild the Bloom filters. */
+	for (i = 0; (err == EL_OK) && (i < doc->bloom_count); i++) {
+		sprintf(suffix, ".bf%u", doc->bloom_fields[i]);
+		tmp = el_util_sidecar_name(doc, suffix);
+		remove(tmp);
+		free(tmp);
+
+		err = el_bloom_sync(doc, doc->bloom_fields[i]);
+	}
+
 	return err;
 }
 
 /**
- * Creates a brand new field definition.
+ * Copies the rows of a block that are still alive to a document being
+ * compacted.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Compaction state.
+ *
+ * @return False if the user cancelled the compaction.
+ */
+bool el_doc_compact_block(eld_handle_t *doc, const char *block, uint32_t first,
+						  uint32_t count, void *arg) {
+	el_compact_t *compact = (el_compact_t *)arg;
+	uint16_t sel_count;
+	uint16_t i;
+
+	/* Find the rows that are alive. */
+	for (i = 0; i < count; i++)
+		compact->sel[i] = i;
+	sel_count = el_doc_sel_live(doc, first, compact->sel, (uint16_t)count);
+
+	/* Copy them over. */
+	if (sel_count == count) {
+		fwrite(block, doc->header.row_len, count, compact->fh);
+	} else {
+		for (i = 0; i < sel_count; i++) {
+			fwrite(block + ((size_t)doc->header.row_len * compact->sel[i]),
+				   doc->header.row_len, 1, compact->fh);
+		}
+	}
+
+	/* Let the user know how far along we are. */
+	if ((compact->progress != NULL) &&
+		!compact->progress(first + count, doc->header.row_count,
+						   compact->arg)) {
+		compact->failed = true;
+		return false;
+	}
+
+	return !ferror(compact->fh);
+}
+
+/**
+ * Appends a deleted row to a sorted list of them.
+ *
+ * @param value Index of the deleted row.
+ * @param arg   Pointer to the next free position of the list.
+ *
+ * @return Always true since we need every row.
+ */
+bool el_doc_compact_dead(uint32_t value, void *arg) {
+	uint32_t **next = (uint32_t **)arg;
+
+	*((*next)++) = value;
+	return true;
+}
+
+/**
+ * Drops the oldest rows of the document without rewriting it. The first row
+ * that is still alive is recorded in the header extension and the remaining
+ * rows keep their indexes, so the Bloom filters and tombstones stay valid and
+ * the string indexes only need their old rows removed. Where the filesystem
+ * supports it the space of the dropped rows is given back by punching a hole
+ * in the file.
+ * @warning Documents that were created without a header extension can't
+ *          record where they start, so they are compacted instead, which
+ *          renumbers their rows starting from 0.
+ *
+ * @param doc    Document handle.
+ * @param n_rows Number of rows to be dropped from the front of the document.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_compact
+ */
+el_err_t el_doc_truncate_front(eld_handle_t *doc, uint32_t n_rows) {
+	uint32_t old_base = doc->ext.row_base;
+	uint32_t base;
+	el_err_t err;
+	uint8_t i;
+
+	/* Work out where the document will start. */
+	base = old_base + n_rows;
+	if ((base < old_base) || (base > doc->header.row_count))
+		base = doc->header.row_count;
+	if (base == old_base)
+		return EL_OK;
+
+	/* Older documents have to be rewritten. */
+	if (doc->header.reserved[0] != EL_HEADER_EXT) {
+		doc->ext.row_base = base;
+		return el_doc_compact(doc, NULL, NULL);
+	}
+
+	/* Get the pending changes of the string indexes out of the way. */
+	err = el_index_merge(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Record the new start of the document. */
+	doc->ext.row_base = base;
+	err = el_doc_save(doc, NULL);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	/* Give the space back to the filesystem. Failing is harmless. Rings are
+	   about to reuse it anyway. */
+	if ((doc->ext.ring_rows == 0) &&
+		(el_doc_fopen(doc, NULL, "r+b") == EL_OK)) {
+		off_t offset = (off_t)el_doc_row_offset(doc, old_base);
+
+		fallocate(fileno(doc->fh), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				  offset, (off_t)el_doc_row_offset(doc, base) - offset);
+		el_doc_fclose(doc);
+	}
+#endif /* __linux__ && FALLOC_FL_PUNCH_HOLE */
+
+	/* Remove the dropped rows from the string indexes. */
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		el_index_t *idx = (el_index_t *)el_doc_index(doc, i);
+		char suffix[8];
+		FILE *fh;
+
+		/* Indexes that aren't being maintained have to be fixed too. */
+		if (idx == NULL) {
+			sprintf(suffix, ".ix%u", i);
+			fh = el_util_sidecar_fopen(doc, suffix, "rb");
+			if (fh == NULL)
+				continue;
+			fclose(fh);
+
+			idx = el_index_open(doc, i);
+			if (idx == NULL)
+				return EL_ERROR_FILE;
+			err = el_index_remap(doc, idx, NULL, 0, base, false);
+			el_index_free(idx);
+		} else {
+			err = el_index_remap(doc, idx, NULL, 0, base, false);
+		}
+
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Turns the document into a ring that holds at most a fixed number of rows.
+ * Once it's full every row that is added overwrites the oldest one in the
+ * file, which is dropped just like el_doc_truncate_front would do, so row
+ * indexes keep growing and scans still go through the rows in the order they
+ * were added while the file never grows past the size of the ring.
+ * @warning Bloom filters can't be used with ring documents since they would
+ *          keep growing.
+ *
+ * @param doc  Document handle.
+ * @param rows Maximum number of rows in the document or 0 to make it a regular
+ *             document again.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the document already has more rows than that,
+ *         has Bloom filters or has already wrapped around its ring.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_row_add
+ */
+el_err_t el_doc_ring(eld_handle_t *doc, uint32_t rows) {
+	el_err_t err;
+
+	/* Check if the rows in the file are still in order. */
+	if ((rows > 0) && (doc->header.row_count > rows)) {
+		el_error_msg_format(EMSG("Document already has more than %lu rows."),
+							rows);
+		return EL_ERROR_ARGUMENT;
+	}
+	if ((doc->ext.ring_rows > 0) &&
+		(doc->header.row_count > doc->ext.ring_rows)) {
+		el_error_msg_set(EMSG("Document has already wrapped around its ring. "
+							  "Compact it before resizing it."));
+		return EL_ERROR_ARGUMENT;
+	}
+	if ((rows > 0) && (doc->bloom_count > 0)) {
+		el_error_msg_set(EMSG("Ring documents can't have Bloom filters."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Documents that aren't in a file yet only need the header changed. */
+	doc->ext.ring_rows = rows;
+	if (doc->fname == NULL)
+		return EL_OK;
+
+	/* Older documents need a larger header extension and all of the rows in
+	   a ring must be the same size. */
+	if ((doc->header.reserved[0] != EL_HEADER_EXT) ||
+		(doc->ext.ext_len < sizeof(eld_header_ext_t)) ||
+		((rows > 0) && (doc->schema_count > 0))) {
+		err = el_doc_compact(doc, NULL, NULL);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	return el_doc_save(doc, NULL);
+}
+
+/**
+ * Brings a follower copy of a document up to date. Only the rows appended
+ * since the last time are copied, along with the blocks of rows that changed
+ * since then, which are found by comparing the hash of each block with the one
+ * kept in a replication cursor next to the follower. The header is written
+ * after the rows, so a follower that was interrupted only ever counts rows
+ * that are there, and its sidecars are copied last. The whole document is
+ * copied again if its layout changed, if it shrank after a compaction or if
+ * it's a different document than the one that was replicated there.
+ *
+ * @param src      Document handle to be replicated.
+ * @param dst_path Path of the follower document.
+ *
+ * @return EL_OK if the follower is up to date.
+ *         EL_ERROR_ARGUMENT if the document was never saved.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_doc_replicate(eld_handle_t *src, const char *dst_path) {
+	el_repl_header_t cursor;
+	el_repl_header_t last;
+	eld_header_t header;
+	el_repl_hash_t *hashes;
+	el_repl_hash_t *last_hashes;
+	el_off_t heap_len;
+	size_t block_len;
+	char *buf;
+	FILE *in;
+	FILE *out;
+	el_off_t size;
+	uint32_t i;
+	char suffix[8];
+	el_err_t err;
+
+	if (src->fname == NULL) {
+		el_error_msg_set(EMSG("Document must be saved before being "
+							  "replicated."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Make sure that everything is in the files. */
+	err = el_index_merge(src);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	if (src->heap != NULL)
+		fflush(src->heap);
+
+	/* Go by the header in the file since it's the layout of the rows. */
+	in = fopen(src->fname, "rb");
+	if (in == NULL) {
+		el_error_msg_format(EMSG("Couldn't open file \"%s\": %s."),
+							src->fname, strerror(errno));
+		return EL_ERROR_FILE;
+	}
+	el_util_fseek(in, 0, SEEK_END);
+	size = el_util_ftell(in);
+	el_util_fseek(in, 0, SEEK_SET);
+	if ((fread(&header, sizeof(eld_header_t), 1, in) != 1) ||
+		(size < (el_off_t)header.header_len)) {
+		el_error_msg_format(EMSG("Invalid header in \"%s\"."), src->fname);
+		fclose(in);
+		return EL_ERROR_FILE;
+	}
+
+	/* Start over if the rows have moved since the last time. */
+	memset(&cursor, 0, sizeof(el_repl_header_t));
+	cursor.magic[0] = 'E';
+	cursor.magic[1] = 'R';
+	cursor.header_len = header.header_len;
+	cursor.row_len = header.row_len;
+	cursor.doc_id = src->ext.doc_id;
+	cursor.data_len = size - header.header_len;
+	block_len = (size_t)EL_SCAN_BLOCK_ROWS *
+		((header.row_len > 0) ? header.row_len : 1);
+	cursor.block_count = (uint32_t)((cursor.data_len + block_len - 1) /
+									block_len);
+	if (!el_repl_load(dst_path, &last, &last_hashes) ||
+		(last.doc_id != cursor.doc_id) ||
+		(last.header_len != cursor.header_len) ||
+		(last.row_len != cursor.row_len) ||
+		(last.data_len > cursor.data_len) ||
+		(last.block_count != ((last.data_len + block_len - 1) / block_len))) {
+		memset(&last, 0, sizeof(el_repl_header_t));
+		free(last_hashes);
+		last_hashes = NULL;
+	}
+
+	/* Open the follower. */
+	out = fopen(dst_path, (last.data_len > 0) ? "r+b" : "wb");
+	if (out == NULL) {
+		el_error_msg_format(EMSG("Couldn't open file \"%s\": %s."),
+							dst_path, strerror(errno));
+		free(last_hashes);
+		fclose(in);
+		return EL_ERROR_FILE;
+	}
+
+	/* Copy the blocks of rows that have changed or are new. */
+	hashes = (el_repl_hash_t *)malloc(sizeof(el_repl_hash_t) *
+									  (cursor.block_count + 1));
+	buf = (char *)malloc((block_len > header.header_len) ? block_len :
+						 header.header_len);
+	for (i = 0; i < cursor.block_count; i++) {
+		el_off_t offset = (el_off_t)i * block_len;
+		size_t len = block_len;
+		size_t same = 0;
+
+		if ((cursor.data_len - offset) < block_len)
+			len = (size_t)(cursor.data_len - offset);
+		el_util_fseek(in, header.header_len + offset, SEEK_SET);
+		if (fread(buf, 1, len, in) != len) {
+			el_error_msg_format(EMSG("Couldn't read rows from file \"%s\"."),
+								src->fname);
+			err = EL_ERROR_FILE;
+			break;
+		}
+
+		/* Only the part that was copied last time can be skipped. */
+		if (offset < (el_off_t)last.data_len) {
+			same = len;
+			if ((last.data_len - offset) < len)
+				same = (size_t)(last.data_len - offset);
+			if (el_repl_hash(buf, same) != last_hashes[i])
+				same = 0;
+		}
+
+		if (same < len) {
+			el_util_fseek(out, header.header_len + offset + same, SEEK_SET);
+			fwrite(buf + same, 1, len - same, out);
+		}
+		hashes[i] = el_repl_hash(buf, len);
+	}
+	free(last_hashes);
+
+	/* Only count the rows once they are in place. */
+	if (err == EL_OK) {
+		fseek(in, 0, SEEK_SET);
+		if (fread(buf, 1, header.header_len, in) != header.header_len) {
+			el_error_msg_format(EMSG("Invalid header in \"%s\"."),
+								src->fname);
+			err = EL_ERROR_FILE;
+		} else {
+			fseek(out, 0, SEEK_SET);
+			fwrite(buf, 1, header.header_len, out);
+		}
+	}
+	free(buf);
+	fclose(in);
+	if (ferror(out) && (err == EL_OK)) {
+		el_error_msg_format(EMSG("Couldn't write to file \"%s\": %s."),
+							dst_path, strerror(errno));
+		err = EL_ERROR_FILE;
+	}
+	if ((fclose(out) != 0) && (err == EL_OK)) {
+		el_error_msg_format(EMSG("Couldn't close file \"%s\": %s."),
+							dst_path, strerror(errno));
+		err = EL_ERROR_FILE;
+	}
+	IF_EL_ERROR(err) {
+		free(hashes);
+		return err;
+	}
+
+	/* Strings are only ever appended to the heap. */
+	err = el_repl_copy(src, dst_path, ".vh",
+					   (last.data_len > 0) ? (el_off_t)last.heap_len : 0,
+					   &heap_len);
+	cursor.heap_len = heap_len;
+
+	/* The other sidecars are small enough to be copied whole. */
+	if (err == EL_OK)
+		err = el_repl_copy(src, dst_path, ".ts", 0, NULL);
+	if (err == EL_OK)
+		err = el_repl_copy(src, dst_path, ".sv", 0, NULL);
+	for (i = 0; (err == EL_OK) && (i < src->header.field_desc_count); i++) {
+		sprintf(suffix, ".bf%u", (unsigned int)i);
+		err = el_repl_copy(src, dst_path, suffix, 0, NULL);
+		if (err == EL_OK) {
+			sprintf(suffix, ".ix%u", (unsigned int)i);
+			err = el_repl_copy(src, dst_path, suffix, 0, NULL);
+		}
+	}
+
+	/* Remember where we left off. */
+	if (err == EL_OK)
+		err = el_repl_save(dst_path, &cursor, hashes);
+	free(hashes);
+
+	return err;
+}
+
+/**
+ * Loads the replication cursor of a follower document.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param dst_path Path of the follower document.
+ * @param cursor   Where to place the header of the cursor.
+ * @param hashes   Hashes of the blocks that were copied.
+ *
+ * @return True if the follower and a valid cursor exist.
+ */
+bool el_repl_load(const char *dst_path, el_repl_header_t *cursor,
+				  el_repl_hash_t **hashes) {
+	char *fname;
+	FILE *fh;
+	bool valid;
+
+	*hashes = NULL;
+
+	/* A cursor without its follower is of no use. */
+	fh = fopen(dst_path, "rb");
+	if (fh == NULL)
+		return false;
+	fclose(fh);
+
+	/* Open the cursor. */
+	fname = el_util_path_suffix(dst_path, ".rc");
+	fh = fopen(fname, "rb");
+	free(fname);
+	if (fh == NULL)
+		return false;
+
+	/* Read it. */
+	valid = (fread(cursor, sizeof(el_repl_header_t), 1, fh) == 1) &&
+		(cursor->magic[0] == 'E') && (cursor->magic[1] == 'R');
+	if (valid) {
+		*hashes = (el_repl_hash_t *)malloc(sizeof(el_repl_hash_t) *
+										   (cursor->block_count + 1));
+		valid = fread(*hashes, sizeof(el_repl_hash_t), cursor->block_count,
+					  fh) == cursor->block_count;
+	}
+	fclose(fh);
+
+	if (!valid) {
+		free(*hashes);
+		*hashes = NULL;
+	}
+
+	return valid;
+}
+
+/**
+ * Saves the replication cursor of a follower document.
+ *
+ * @param dst_path Path of the follower document.
+ * @param cursor   Header of the cursor.
+ * @param hashes   Hashes of the blocks that were copied.
+ *
+ * @return EL_OK if the cursor was saved.
+ *         EL_ERROR_FILE if an error occurred while writing the cursor.
+ */
+el_err_t el_repl_save(const char *dst_path, const el_repl_header_t *cursor,
+					  const el_repl_hash_t *hashes) {
+	char *fname;
+	FILE *fh;
+
+	fname = el_util_path_suffix(dst_path, ".rc");
+	fh = fopen(fname, "wb");
+	if (fh == NULL) {
+		el_error_msg_format(EMSG("Couldn't create \"%s\": %s."), fname,
+							strerror(errno));
+		free(fname);
+		return EL_ERROR_FILE;
+	}
+
+	fwrite(cursor, sizeof(el_repl_header_t), 1, fh);
+	fwrite(hashes, sizeof(el_repl_hash_t), cursor->block_count, fh);
+	if (ferror(fh) | (fclose(fh) != 0)) {
+		el_error_msg_format(EMSG("Couldn't write \"%s\"."), fname);
+		free(fname);
+		return EL_ERROR_FILE;
+	}
+	free(fname);
+
+	return EL_OK;
+}
+
+/**
+ * Copies a sidecar of a document to its follower. Sidecars that the document
+ * doesn't have are removed from the follower.
+ *
+ * @param src      Document handle.
+ * @param dst_path Path of the follower document.
+ * @param suffix   Suffix of the sidecar.
+ * @param from     Offset from which the sidecar has changed. (Ignored if it's
+ *                 past the end of the sidecar)
+ * @param len      Where to place the length of the sidecar. (Can be NULL)
+ *
+ * @return EL_OK if the sidecar was copied.
+ *         EL_ERROR_FILE if an error occurred while copying the sidecar.
+ */
+el_err_t el_repl_copy(const eld_handle_t *src, const char *dst_path,
+					  const char *suffix, el_off_t from, el_off_t *len) {
+	char buf[4096];
+	char *fname;
+	FILE *in;
+	FILE *out = NULL;
+	el_off_t size;
+	size_t n;
+	el_err_t err = EL_OK;
+
+	if (len != NULL)
+		*len = 0;
+	fname = el_util_path_suffix(dst_path, suffix);
+
+	/* Make sure the follower doesn't have a sidecar that went away. */
+	in = el_util_sidecar_fopen(src, suffix, "rb");
+	if (in == NULL) {
+		remove(fname);
+		free(fname);
+		return EL_OK;
+	}
+	el_util_fseek(in, 0, SEEK_END);
+	size = el_util_ftell(in);
+	if (len != NULL)
+		*len = size;
+
+	/* Pick up where we left off if we can. */
+	if (from > size)
+		from = 0;
+	if (from > 0)
+		out = fopen(fname, "r+b");
+	if (out == NULL) {
+		from = 0;
+		out = fopen(fname, "wb");
+	}
+	if (out == NULL) {
+		el_error_msg_format(EMSG("Couldn't create \"%s\": %s."), fname,
+							strerror(errno));
+		fclose(in);
+		free(fname);
+		return EL_ERROR_FILE;
+	}
+
+	/* Copy the part that has changed. */
+	el_util_fseek(in, from, SEEK_SET);
+	el_util_fseek(out, from, SEEK_SET);
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		fwrite(buf, 1, n, out);
+	if (ferror(in) || ferror(out)) {
+		el_error_msg_format(EMSG("Couldn't copy \"%s\"."), fname);
+		err = EL_ERROR_FILE;
+	}
+
+	fclose(in);
+	fclose(out);
+	free(fname);
+
+	return err;
+}
+
+/**
+ * Hashes a block of rows for a replication cursor. Blocks are only copied
+ * again when their hash changes, so it's 64-bit FNV-1a where we can afford it
+ * to keep collisions out of the picture.
+ *
+ * @param buf Block of rows.
+ * @param len Length of the block.
+ *
+ * @return Hash of the block.
+ */
+el_repl_hash_t el_repl_hash(const char *buf, size_t len) {
+#ifdef EL_HAS_INT64
+	uint64_t hash = ((uint64_t)0xcbf29ce4UL << 32) | 0x84222325UL;
+	uint64_t prime = ((uint64_t)0x100UL << 32) | 0x1b3UL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)buf[i];
+		hash *= prime;
+	}
+
+	return hash;
+#else
+	return el_util_hash(buf, len);
+#endif /* EL_HAS_INT64 */
+}
+
+/**
+ * Turns the null bitmap of a document on or off. Documents with a null bitmap
+ * start each row with a bit for every field that tells if the cell is null,
+ * which is set from and handed over in the null member of the cells. Rows that
+ * were already written keep their layout until the document is compacted,
+ * and fields that are added later on are null in them.
+ *
+ * @param doc      Document handle.
+ * @param nullable Should the rows have a null bitmap?
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_schema_set
+ */
+el_err_t el_doc_nullable(eld_handle_t *doc, bool nullable) {
+	el_field_def_t *field_defs;
+	uint8_t count = doc->header.field_desc_count;
+	uint16_t flags;
+	el_err_t err;
+
+	/* Check if there's anything to do. */
+	flags = (nullable) ? (doc->ext.flags | EL_EXT_NULLS) :
+		(doc->ext.flags & ~EL_EXT_NULLS);
+	if (flags == doc->ext.flags)
+		return EL_OK;
+
+	/* Older documents need a header extension to store the flags. */
+	if ((doc->fname != NULL) && (doc->header.reserved[0] != EL_HEADER_EXT)) {
+		err = el_doc_compact(doc, NULL, NULL);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	/* Change the row layout. */
+	field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) *
+										  (count + 1));
+	if (count > 0)
+		memcpy(field_defs, doc->field_defs, sizeof(el_field_def_t) * count);
+	err = el_doc_schema_set(doc, field_defs, count, flags);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Documents that aren't in a file yet only need the header changed. */
+	if (doc->fname == NULL)
+		return EL_OK;
+
+	return el_doc_save(doc, NULL);
+}
+
+#ifdef EL_HAS_INT64
+/**
+ * Adds an implicit timestamp field to a document whose rows are sampled at a
+ * fixed interval. Only the start time and interval are stored, in the header,
+ * so the field takes no space in the rows, but it can still be read, filtered
+ * and aggregated just like any other field.
+ * @warning Compacting a document with an implicit timestamp can't drop deleted
+ *          rows, since that would shift the time of every row after them.
+ *
+ * @param doc      Document handle.
+ * @param name     Name of the timestamp field.
+ * @param start    Time of the first row in nanoseconds.
+ * @param interval Time between rows in nanoseconds.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the interval isn't positive or the document
+ *         already has an implicit timestamp.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_row_time
+ */
+el_err_t el_doc_time_implicit(eld_handle_t *doc, const char *name,
+							  int64_t start, int64_t interval) {
+	el_field_def_t field;
+	el_err_t err;
+
+	/* Check if the timestamp makes sense. */
+	if (interval <= 0) {
+		el_error_msg_set(EMSG("Implicit timestamps must have a positive "
+							  "interval."));
+		return EL_ERROR_ARGUMENT;
+	}
+	if (el_doc_time_field(doc) >= 0) {
+		el_error_msg_format(EMSG("Field %d is already an implicit timestamp."),
+							el_doc_time_field(doc));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Add the field without any space in the rows and store the time base. */
+	field = el_field_def_new(EL_FIELD_TIMESTAMP, name, 0);
+	err = el_doc_field_add(doc, field);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	doc->ext.time_start = start;
+	doc->ext.time_interval = interval;
+
+	/* Documents that aren't in a file yet only need the header changed. */
+	if (doc->fname == NULL)
+		return EL_OK;
+
+	/* Older documents need a larger header extension. */
+	if ((doc->header.reserved[0] != EL_HEADER_EXT) ||
+		(doc->ext.ext_len < sizeof(eld_header_ext_t))) {
+		err = el_doc_compact(doc, NULL, NULL);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	return el_doc_save(doc, NULL);
+}
+
+/**
+ * Gets the implicit timestamp of a row.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ *
+ * @return Time of the row in nanoseconds.
+ *
+ * @see el_doc_time_implicit
+ */
+int64_t el_doc_row_time(const eld_handle_t *doc, uint32_t index) {
+	return doc->ext.time_start + ((int64_t)index * doc->ext.time_interval);
+}
+#endif /* EL_HAS_INT64 */
+
+/**
+ * Finds the implicit timestamp field of a document.
+ *
+ * @param doc Document handle.
+ *
+ * @return Index of the field or -1 if the document doesn't have one.
+ */
+int el_doc_time_field(const eld_handle_t *doc) {
+	uint8_t i;
+
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		if (el_util_field_implicit(&(doc->field_defs[i])))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Reads the schema versions sidecar of a document that was just read, if
+ * there's one, and switches the document to its latest schema.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if the sidecar is corrupted.
+ */
+el_err_t el_schema_load(eld_handle_t *doc) {
+	el_schema_t *schema;
+	char magic[2];
+	uint16_t count;
+	uint32_t doc_id;
+	uint16_t i;
+	FILE *fh;
+
+	/* Check if there's a sidecar. */
+	el_schema_free(doc);
+	fh = el_util_sidecar_fopen(doc, ".sv", "rb");
+	if (fh == NULL)
+		return EL_OK;
+	if ((fread(magic, sizeof(char), 2, fh) != 2) ||
+		(fread(&count, sizeof(uint16_t), 1, fh) != 1) ||
+		(fread(&doc_id, sizeof(uint32_t), 1, fh) != 1) ||
+		(magic[0] != 'E') || (magic[1] != 'S')) {
+		el_error_msg_format(EMSG("Invalid schema versions for \"%s\"."),
+							doc->fname);
+		fclose(fh);
+		return EL_ERROR_FILE;
+	}
+	if (!el_util_sidecar_owned(doc, doc_id)) {
+		el_util_sidecar_drop(doc, ".sv", fh);
+		return EL_OK;
+	}
+
+	/* Read every version. */
+	doc->schemas = (el_schema_t *)malloc(sizeof(el_schema_t) * (count + 1));
+	for (i = 0; i < count; i++) {
+		schema = &(doc->schemas[i]);
+		if (fread(&(schema->header), sizeof(el_schema_header_t), 1, fh) != 1)
+			break;
+
+		schema->field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) *
+			(schema->header.field_count + 1));
+		doc->schema_count++;
+		if (fread(schema->field_defs, sizeof(el_field_def_t),
+				  schema->header.field_count, fh) != schema->header.field_count)
+			break;
+	}
+	fclose(fh);
+	if (i < count) {
+		el_error_msg_format(EMSG("Schema version %u of \"%s\" is truncated."),
+							i, doc->fname);
+		el_schema_free(doc);
+		return EL_ERROR_FILE;
+	}
+	if (doc->schema_count == 0)
+		return EL_OK;
+
+	/* Rows are handed over with the latest schema. */
+	schema = &(doc->schemas[doc->schema_count - 1]);
+	doc->field_defs = (el_field_def_t *)realloc(doc->field_defs,
+		sizeof(el_field_def_t) * (schema->header.field_count + 1));
+	memcpy(doc->field_defs, schema->field_defs,
+		   sizeof(el_field_def_t) * schema->header.field_count);
+	doc->header.field_desc_count = schema->header.field_count;
+	doc->ext.flags = (doc->ext.flags & ~EL_EXT_NULLS) |
+		(schema->header.flags & EL_EXT_NULLS);
+	el_doc_field_hash(doc);
+	el_util_calc_row_len(doc);
+
+	return EL_OK;
+}
+
+/**
+ * Writes the schema versions of a document to its sidecar.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_schema_save(const eld_handle_t *doc) {
+	uint16_t i;
+	FILE *fh;
+
+	fh = el_util_sidecar_fopen(doc, ".sv", "wb");
+	if (fh == NULL) {
+		el_error_msg_format(EMSG("Couldn't create the schema versions of "
+								 "\"%s\": %s."), doc->fname,
+							strerror(errno));
+		return EL_ERROR_FILE;
+	}
+
+	fwrite("ES", sizeof(char), 2, fh);
+	fwrite(&(doc->schema_count), sizeof(uint16_t), 1, fh);
+	fwrite(&(doc->ext.doc_id), sizeof(uint32_t), 1, fh);
+	for (i = 0; i < doc->schema_count; i++) {
+		fwrite(&(doc->schemas[i].header), sizeof(el_schema_header_t), 1, fh);
+		fwrite(doc->schemas[i].field_defs, sizeof(el_field_def_t),
+			   doc->schemas[i].header.field_count, fh);
+	}
+	if (ferror(fh)) {
+		el_error_msg_format(EMSG("Couldn't write the schema versions of "
+								 "\"%s\": %s."), doc->fname,
+							strerror(errno));
+		fclose(fh);
+		return EL_ERROR_FILE;
+	}
+	fclose(fh);
+
+	return EL_OK;
+}
+
+/**
+ * Appends a new schema version with the current field definitions to a
+ * document.
+ *
+ * @param doc       Document handle.
+ * @param first_row Index of the first row written with this schema.
+ * @param offset    Offset of the first row in the file.
+ */
+void el_schema_push(eld_handle_t *doc, uint32_t first_row, size_t offset) {
+	el_schema_t *schema;
+
+	doc->schema_count++;
+	doc->schemas = (el_schema_t *)realloc(doc->schemas,
+		sizeof(el_schema_t) * doc->schema_count);
+	schema = &(doc->schemas[doc->schema_count - 1]);
+
+	schema->header.first_row = first_row;
+	schema->header.offset = offset;
+	schema->header.row_len = doc->header.row_len;
+	schema->header.field_count = doc->header.field_desc_count;
+	schema->header.flags = (uint8_t)(doc->ext.flags & EL_EXT_NULLS);
+	schema->field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) *
+		(doc->header.field_desc_count + 1));
+	memcpy(schema->field_defs, doc->field_defs,
+		   sizeof(el_field_def_t) * doc->header.field_desc_count);
+}
+
+/**
+ * Frees the schema versions of a document.
+ *
+ * @param doc Document handle.
+ */
+void el_schema_free(eld_handle_t *doc) {
+	uint16_t i;
+
+	for (i = 0; i < doc->schema_count; i++)
+		free(doc->schemas[i].field_defs);
+	free(doc->schemas);
+	doc->schemas = NULL;
+	doc->schema_count = 0;
+}
+
+/**
+ * Finds the older schema that a row was written with.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ * @param end   Gets the index of the first row after the ones written with the
+ *              schema.
+ *
+ * @return Schema of the row or NULL if it was written with the current one.
+ */
+const el_schema_t *el_schema_find(const eld_handle_t *doc, uint32_t index,
+								  uint32_t *end) {
+	uint16_t i;
+
+	/* Check if the row was written with the current schema. */
+	if ((doc->schema_count == 0) ||
+		(index >= doc->schemas[doc->schema_count - 1].header.first_row))
+		return NULL;
+
+	/* Go back until we find it. (The first one always starts at row 0) */
+	for (i = doc->schema_count - 1; i > 0; i--) {
+		if (doc->schemas[i - 1].header.first_row <= index)
+			break;
+	}
+	*end = doc->schemas[i].header.first_row;
+
+	return &(doc->schemas[i - 1]);
+}
+
+/**
+ * Converts raw rows that were written with an older schema to the current one.
+ * Fields are matched by name. Fields that didn't exist back then are zeroed,
+ * and also marked as null if there's a null bitmap, strings are padded or cut
+ * and numbers are converted between types.
+ *
+ * @param doc    Document handle.
+ * @param schema Schema the rows were written with.
+ * @param raw    Raw rows as they were written.
+ * @param count  Number of rows.
+ * @param out    Where the converted rows get placed.
+ */
+void el_schema_adapt(const eld_handle_t *doc, const el_schema_t *schema,
+					 const char *raw, uint32_t count, char *out) {
+	const el_field_def_t **sources;
+	size_t *offsets;
+	uint16_t src_nulls;
+	uint16_t dest_nulls;
+	uint32_t row;
+	uint8_t i;
+	uint8_t j;
+
+	/* Find where each field was in the older rows. */
+	src_nulls = el_util_null_len(schema->header.flags,
+								 schema->header.field_count);
+	dest_nulls = el_util_null_len(doc->ext.flags,
+								  doc->header.field_desc_count);
+	sources = (const el_field_def_t **)malloc(sizeof(el_field_def_t *) *
+		(doc->header.field_desc_count + 1));
+	offsets = (size_t *)malloc(sizeof(size_t) *
+							   (doc->header.field_desc_count + 1));
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		sources[i] = NULL;
+		offsets[i] = src_nulls;
+		for (j = 0; j < schema->header.field_count; j++) {
+			const el_field_def_t *src = &(schema->field_defs[j]);
+
+			if (strncmp(src->name, doc->field_defs[i].name,
+						EL_FIELD_NAME_LEN) == 0) {
+				sources[i] = src;
+				if ((src->type == EL_FIELD_BOOL) && (src->size_bytes == 0))
+					offsets[i]--;
+				break;
+			}
+			offsets[i] += src->size_bytes;
+		}
+	}
+
+	/* Convert the rows. */
+	for (row = 0; row < count; row++) {
+		/* Carry the null bits over. Fields older rows didn't have are null. */
+		if (dest_nulls > 0) {
+			memset(out, 0, dest_nulls);
+			for (i = 0; i < doc->header.field_desc_count; i++) {
+				const el_field_def_t *src = sources[i];
+				bool null = (src == NULL);
+
+				if (!null && (src_nulls > 0)) {
+					j = (uint8_t)(src - schema->field_defs);
+					null = ((uint8_t)raw[j >> 3] >> (j & 7)) & 1;
+				}
+				if (null && !el_util_field_implicit(&(doc->field_defs[i])))
+					out[i >> 3] |= 1 << (i & 7);
+			}
+			out += dest_nulls;
+		}
+
+		for (i = 0; i < doc->header.field_desc_count; i++) {
+			const el_field_def_t *def = &(doc->field_defs[i]);
+			const el_field_def_t *src = sources[i];
+			const char *cell = raw + offsets[i];
+			char *dest = out;
+
+			/* Booleans without a size live in the byte before them. */
+			if ((def->type == EL_FIELD_BOOL) && (def->size_bytes == 0))
+				dest--;
+
+			memset(out, 0, def->size_bytes);
+			if ((src != NULL) && (src->type == def->type) &&
+				(def->type != EL_FIELD_BOOL) &&
+				((def->type != EL_FIELD_DECIMAL) ||
+				 (src->reserved == def->reserved))) {
+				memcpy(out, cell, (src->size_bytes < def->size_bytes) ?
+					   src->size_bytes : def->size_bytes);
+				if (def->type == EL_FIELD_STRING)
+					out[def->size_bytes - 1] = '\0';
+
+				/* Inline strings are cut when their field gets narrower. */
+				if (def->type == EL_FIELD_VARCHAR) {
+					uint16_t len;
+
+					memcpy(&len, out, sizeof(uint16_t));
+					if (!(len & EL_VARCHAR_HEAP) &&
+						(len > def->size_bytes - sizeof(uint16_t))) {
+						len = def->size_bytes - sizeof(uint16_t);
+						memcpy(out, &len, sizeof(uint16_t));
+					}
+				}
+			} else if ((src != NULL) && !el_util_is_string(src) &&
+					   !el_util_is_string(def) && !el_util_is_array(src) &&
+					   !el_util_is_array(def)) {
+				el_util_raw_number_set(def, dest,
+									   el_util_raw_number(src, cell));
+			}
+
+			out += def->size_bytes;
+		}
+
+		raw += schema->header.row_len;
+	}
+
+	free(sources);
+	free(offsets);
+}
+
+/**
+ * Creates a brand new field definition.
+ *
+ * @param type   Type of the field data.
+ * @param name   Name of the field.
+ * @param length Length of the field. Set to 1 always, except for strings and
+ *               decimals, where it's the number of decimal places. (Up to 18)
+ *
+ * @return A populated field definition structure.
+ */
+el_field_def_t el_field_def_new(el_type_t type, const char *name, uint16_t length) {
+	el_field_def_t field;
+
+	/* Set the basics. */
+	field.reserved = '@';
+	field.type = (uint8_t)type;
+	field.size_bytes = el_util_sizeof(type) * length;
+
+	/* Make sure we allocate enough space for strings. */
+	if (field.type == EL_FIELD_STRING)
+		field.size_bytes += el_util_sizeof(type);
+
+	/* Variable-length strings have a length and room for a heap offset. */
+	if (field.type == EL_FIELD_VARCHAR) {
+		if (field.size_bytes < sizeof(uint32_t))
+			field.size_bytes = sizeof(uint32_t);
+		field.size_bytes += sizeof(uint16_t);
+	}
+
+	/* Decimals keep their number of places instead of a length. */
+	if (field.type == EL_FIELD_DECIMAL) {
+		field.reserved = (char)((length > 18) ? 18 : length);
+		field.size_bytes = el_util_sizeof(type);
+	}
+
+	/* Booleans are single bits that get packed when added to a document. */
+	if (field.type == EL_FIELD_BOOL) {
+		field.reserved = 0;
+		field.size_bytes = el_util_sizeof(type);
+	}
+
+	/* Copy the name over. */
+	memset(field.name, '\0', EL_FIELD_NAME_LEN + 1);
+	strncpy(field.name, name, EL_FIELD_NAME_LEN);
+
+	return field;
+}
+
+/**
+ * Creates a brand new allocated row object.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc Document handle.
+ *
+ * @return Brand new allocated row object.
+ *
+ * @see el_row_get
+ */
+el_row_t *el_row_new(const eld_handle_t *doc) {
+	el_row_t *row;
+
+	row = el_row_alloc(doc, NULL, doc->header.field_desc_count);
+	row->index = doc->header.row_count;
+
+	return row;
+}
+
+/**
+ * Allocates a row object for some of the fields of a document. The cells and
+ * the storage of fixed-length strings and arrays all live in the same block of
+ * memory as the row itself, so only variable-length strings are allocated on
+ * their own.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc    Document handle.
+ * @param fields Indexes of the fields of the row or NULL for all of them.
+ * @param count  Number of fields in the row.
+ *
+ * @return Brand new allocated row object with empty cells.
+ *
+ * @see el_row_free
+ */
+el_row_t *el_row_alloc(const eld_handle_t *doc, const uint8_t *fields,
+					   uint8_t count) {
+	el_row_t *row;
+	size_t len;
+	char *storage;
+	uint8_t i;
+
+	/* Work out how much space the row needs. */
+	len = el_util_align(sizeof(el_row_t)) + (sizeof(el_cell_t) * count);
+	for (i = 0; i < count; i++) {
+		const el_field_def_t *field =
+			&(doc->field_defs[(fields == NULL) ? i : fields[i]]);
+
+		if ((field->type == EL_FIELD_STRING) || el_util_is_array(field))
+			len += el_util_align(field->size_bytes);
+	}
+
+	/* Allocate everything in one go. */
+	row = (el_row_t *)calloc(1, len);
+	row->index = 0;
+	row->cell_count = count;
+	row->interned = false;
+	row->cells = (el_cell_t *)((char *)row + el_util_align(sizeof(el_row_t)));
+	storage = (char *)(row->cells + count);
+
+	/* Prepare the cells to receive data. */
+	for (i = 0; i < count; i++) {
+		el_cell_t *cell = &(row->cells[i]);
+
+		/* Populate the field definition. */
+		cell->field = &(doc->field_defs[(fields == NULL) ? i : fields[i]]);
+		cell->null = false;
+		cell->interned = false;
+
+		/* Hand out the space for types that need it. */
+		switch (cell->field->type) {
+			case EL_FIELD_STRING:
+				cell->value.string = storage;
+				storage += el_util_align(cell->field->size_bytes);
+				break;
+			case EL_FIELD_VARCHAR:
+				cell->value.string = (char *)calloc(1, sizeof(char));
+				break;
+			case EL_FIELD_FLOAT_ARRAY:
+			case EL_FIELD_INT_ARRAY:
+				cell->value.array.data = storage;
+				cell->value.array.len = cell->field->size_bytes /
+					el_util_sizeof((el_type_t)cell->field->type);
+				storage += el_util_align(cell->field->size_bytes);
+				break;
+			default:
+				/* Zeroed timestamps get stamped when the row is added. */
+				memset(&(cell->value), 0, sizeof(cell->value));
+				break;
+		}
+	}
+
+	return row;
+}
+
+/**
+ * Seeks to the beginning of a row in the file given its index.
+ *
+ * @param doc   Opened document object.
+ * @param index Index of the row to seek to.
+ *
+ * @return TRUE if the operation was successful.
+ *         FALSE otherwise (check ferror for more information).
+ */
+bool el_row_seek(eld_handle_t *doc, uint32_t index) {
+	/* Determine the offset that the row is located at. */
+	size_t offset = el_doc_row_offset(doc, index);
+
+	/* Try to seek to the row offset. */
+	if (fseek(doc->fh, offset, SEEK_SET) != 0) {
+		el_error_msg_format(
+			EMSG("Couldn't seek in file \"%s\": %s."),
+			doc->fname, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Gets the position of a row in the file, which in a ring document wraps
+ * around its size.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ *
+ * @return Position of the row counting from the first one in the file.
+ */
+uint32_t el_doc_slot(const eld_handle_t *doc, uint32_t index) {
+	if (doc->ext.ring_rows == 0)
+		return index;
+
+	return index % doc->ext.ring_rows;
+}
+
+/**
+ * Gets the offset of a row in the file, taking into account the size of the
+ * rows that were written with older schemas.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ *
+ * @return Offset in bytes of the row from the beginning of the file.
+ */
+size_t el_doc_row_offset(const eld_handle_t *doc, uint32_t index) {
+	const el_schema_t *schema;
+	uint16_t i;
+
+	/* Every row has the same size if the schema has never changed. */
+	if (doc->schema_count == 0) {
+		return doc->header.header_len +
+			((size_t)doc->header.row_len * el_doc_slot(doc, index));
+	}
+
+	/* Find the schema the row was written with. */
+	for (i = doc->schema_count - 1; i > 0; i--) {
+		if (doc->schemas[i].header.first_row <= index)
+			break;
+	}
+	schema = &(doc->schemas[i]);
+
+	return schema->header.offset + ((size_t)schema->header.row_len *
+									(index - schema->header.first_row));
+}
+
+/**
+ * Reads the contents of a row from the file into a row object.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param row   Prepared row object.
+ * @param doc   Document object.
+ * @param index Index of the row to be read.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ *
+ * @see el_row_get
+ */
+el_err_t el_row_read(el_row_t *row, eld_handle_t *doc, uint32_t index) {
+	const el_schema_t *schema;
+	uint32_t end;
+	size_t len;
+	char *raw;
+	el_err_t err;
+
+	/* Open the document. */
+	err = el_doc_fopen(doc, NULL, "rb");
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Seek to the beginning of the rows section. */
+	if (!el_row_seek(doc, index))
+		return EL_ERROR_FILE;
+
+	/* Read the row as it was written. */
+	schema = el_schema_find(doc, index, &end);
+	len = (schema == NULL) ? doc->header.row_len : schema->header.row_len;
+	raw = (char *)malloc(len + doc->header.row_len);
+	if (fread(raw, len, 1, doc->fh) != 1) {
+		if (feof(doc->fh)) {
+			/* EOF reached. */
+			el_error_msg_format(
+				EMSG("End-of-file reached before we could finish reading "
+						"row %lu."), index);
+		} else {
+			/* Error reading. */
+			el_error_msg_format(
+				EMSG("Error occurred while trying to read row %lu: %s."),
+				index, strerror(errno));
+		}
+
+		free(raw);
+		return EL_ERROR_FILE;
+	}
+
+	/* Populate the cells, adapting older rows to the current schema. */
+	if (schema != NULL) {
+		el_schema_adapt(doc, schema, raw, 1, raw + len);
+		el_row_decode(doc, row, raw + len);
+	} else {
+		el_row_decode(doc, row, raw);
+	}
+	free(raw);
+
+	/* Close the document and return. */
+	err = el_doc_fclose(doc);
+	return err;
+}
+
+/**
+ * Gets a row from a document at a specified index.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc   Document handle.
+ * @param index Index of the row.
+ *
+ * @return Requested row (allocated memory) or NULL if one wasn't found or was
+ *         deleted.
+ *
+ * @see el_row_new
+ */
+el_row_t *el_row_get(eld_handle_t *doc, uint32_t index) {
+	el_err_t err;
+	el_row_t *row;
+
+	/* Check if the index is valid. */
+	if (index >= doc->header.row_count) {
+		el_error_msg_format(EMSG("Requested index %lu is greater than the "
+								 "number of rows (%lu) in the document."),
+							index, doc->header.row_count);
+		return NULL;
+	}
+
+	/* Check if the row was deleted. */
+	if (el_doc_row_deleted(doc, index)) {
+		el_error_msg_format(EMSG("Row %lu was deleted."), index);
+		return NULL;
+	}
+
+	/* Create a new row object and set its index. */
+	row = el_row_new(doc);
+	row->index = index;
+
+	/* Populate the row object with cells. */
+	err = el_row_read(row, doc, index);
+	IF_EL_ERROR(err) {
+		el_row_free(row);
+		return NULL;
+	}
+
+	/* Point the strings to their shared copies. */
+	if (doc->interns != NULL) {
+		uint8_t i;
+
+		for (i = 0; i < row->cell_count; i++) {
+			el_cell_t *cell = &(row->cells[i]);
+			const char *end;
+			size_t len;
+
+			if (!el_util_is_string(cell->field))
+				continue;
+
+			if (cell->field->type == EL_FIELD_VARCHAR) {
+				len = strlen(cell->value.string);
+			} else {
+				end = (const char *)memchr(cell->value.string, '\0',
+										   cell->field->size_bytes);
+				len = (end == NULL) ? cell->field->size_bytes :
+					(size_t)(end - cell->value.string);
+			}
+			end = el_intern_find(doc->interns, cell->value.string, len);
+
+			if (cell->field->type == EL_FIELD_VARCHAR)
+				free(cell->value.string);
+			cell->value.string = (char *)end;
+			cell->interned = true;
+		}
+
+		row->interned = true;
+	}
+
+	return row;
+}
+
+/**
+ * Turns the string interning of el_row_get on or off. While it's on the
+ * strings of the rows it returns are shared between every row with the same
+ * value, so they take up memory only once and can be compared by pointer.
+ * Rows returned while interning is on are read-only.
+ * @warning Turning interning off frees the shared strings, so free every row
+ *          that was read while it was on before doing it.
+ *
+ * @param doc    Document handle.
+ * @param enable Should strings be interned?
+ *
+ * @see el_doc_intern_string
+ */
+void el_doc_intern(eld_handle_t *doc, bool enable) {
+	if (enable && (doc->interns == NULL)) {
+		doc->interns = (el_intern_t *)malloc(sizeof(el_intern_t));
+		doc->interns->count = 0;
+		doc->interns->capacity = 256;
+		doc->interns->strings = (char **)calloc(doc->interns->capacity,
+												sizeof(char *));
+	} else if (!enable) {
+		el_intern_free(doc->interns);
+		doc->interns = NULL;
+	}
+}
+
+/**
+ * Gets the shared copy of a string, which can be compared by pointer against
+ * the strings of interned rows.
+ *
+ * @param doc Document handle.
+ * @param str String to look for.
+ *
+ * @return Shared copy of the string or NULL if interning isn't on.
+ *
+ * @see el_doc_intern
+ */
+const char *el_doc_intern_string(eld_handle_t *doc, const char *str) {
+	if (doc->interns == NULL)
+		return NULL;
+
+	return el_intern_find(doc->interns, str, strlen(str));
+}
+
+/**
+ * Finds a string in an intern pool, adding it if it isn't there yet. The
+ * shared copies are only as long as the string itself and are handed to many
+ * rows at once, so they must never be written to.
+ *
+ * @param pool Intern pool.
+ * @param str  String to look for. (Doesn't need to be terminated)
+ * @param len  Length of the string.
+ *
+ * @return Shared copy of the string.
+ */
+const char *el_intern_find(el_intern_t *pool, const char *str, size_t len) {
+	uint32_t slot;
+	uint32_t i;
+	char *copy;
+
+	/* Look for the string. */
+	slot = el_util_hash(str, len) & (pool->capacity - 1);
+	while (pool->strings[slot] != NULL) {
+		if ((strncmp(pool->strings[slot], str, len) == 0) &&
+			(pool->strings[slot][len] == '\0'))
+			return pool->strings[slot];
+
+		slot = (slot + 1) & (pool->capacity - 1);
+	}
+
+	/* Add a copy of it. */
+	copy = (char *)malloc((len + 1) * sizeof(char));
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	pool->strings[slot] = copy;
+	pool->count++;
+
+	/* Keep the table at most half full. */
+	if ((pool->count * 2) > pool->capacity) {
+		char **old = pool->strings;
+		uint32_t old_capacity = pool->capacity;
+
+		pool->capacity *= 2;
+		pool->strings = (char **)calloc(pool->capacity, sizeof(char *));
+		for (i = 0; i < old_capacity; i++) {
+			if (old[i] == NULL)
+				continue;
+
+			slot = el_util_hash(old[i], strlen(old[i])) &
+				(pool->capacity - 1);
+			while (pool->strings[slot] != NULL)
+				slot = (slot + 1) & (pool->capacity - 1);
+			pool->strings[slot] = old[i];
+		}
+		free(old);
+	}
+
+	return copy;
+}
+
+/**
+ * Frees up an intern pool and all of its strings.
+ *
+ * @param pool Intern pool to be free'd.
+ */
+void el_intern_free(el_intern_t *pool) {
+	uint32_t i;
+
+	if (pool == NULL)
+		return;
+
+	for (i = 0; i < pool->capacity; i++)
+		free(pool->strings[i]);
+	free(pool->strings);
+	free(pool);
+}
+
+/**
+ * Gets a cell of a row by the name of its field.
+ *
+ * @param doc  Document handle the row belongs to.
+ * @param row  Row object.
+ * @param name Name of the field.
+ *
+ * @return Cell of the field or NULL if there isn't a field with that name.
+ */
+el_cell_t *el_row_cell(const eld_handle_t *doc, el_row_t *row,
+					   const char *name) {
+	int field = el_doc_field_index(doc, name);
+
+	if ((field < 0) || (field >= row->cell_count))
+		return NULL;
+
+	return &(row->cells[field]);
+}
+
+/**
+ * Frees up any resources allocated by a row object.
+ *
+ * @param row Row object to be free'd.
+ */
+void el_row_free(el_row_t *row) {
+	uint8_t i;
+
+	/* Should we do anything? */
+	if (row == NULL)
+		return;
+
+	/* Variable-length strings are the only ones allocated on their own. */
+	for (i = 0; (i < row->cell_count) && !row->interned; i++) {
+		if (row->cells[i].field->type == EL_FIELD_VARCHAR) {
+			free(row->cells[i].value.string);
+			row->cells[i].value.string = NULL;
+		}
+	}
+
+	/* Ensure that all of our counters are reset. */
+	row->index = 0;
+	row->cell_count = 0;
+	row->cells = NULL;
+
+	/* Free ourselves along with the cells and their storage. */
+	free(row);
+	row = NULL;
+}
+
+/**
+ * Sets the contents of a string cell. Fixed-length strings are cut to fit
+ * their field while variable-length ones grow as needed.
+ *
+ * @param cell String cell to be set.
+ * @param str  New contents of the cell.
+ *
+ * @return EL_OK if the cell was set.
+ *         EL_ERROR_ARGUMENT if the cell belongs to an interned row.
+ */
+el_err_t el_cell_string_set(el_cell_t *cell, const char *str) {
+	/* The string is shared with every other row that has the same value. */
+	if (cell->interned) {
+		el_error_msg_set(EMSG("Cells of interned rows are read-only."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	switch (cell->field->type) {
+		case EL_FIELD_STRING:
+			strncpy(cell->value.string, str, cell->field->size_bytes - 1);
+			cell->value.string[cell->field->size_bytes - 1] = '\0';
+			break;
+		case EL_FIELD_VARCHAR:
+			el_util_strcpy(&(cell->value.string), str);
+			break;
+		default:
+			break;
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Creates a brand new set of rows laid out as one array per field, which
+ * moves many rows through the library at once without a row object and its
+ * cells for each one of them.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc      Document whose fields the set will hold.
+ * @param capacity Maximum number of rows in the set.
+ *
+ * @return Brand new empty row set.
+ *
+ * @see el_rowset_free
+ */
+el_rowset_t *el_rowset_new(const eld_handle_t *doc, uint32_t capacity) {
+	el_rowset_t *set;
+	uint8_t i;
+
+	set = (el_rowset_t *)malloc(sizeof(el_rowset_t));
+	set->capacity = capacity;
+	set->count = 0;
+	set->indexes = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+
+	/* Keep our own copy of the fields in case the document changes. */
+	set->field_count = doc->header.field_desc_count;
+	set->field_defs = (el_field_def_t *)malloc(sizeof(el_field_def_t) *
+											   (set->field_count + 1));
+	memcpy(set->field_defs, doc->field_defs,
+		   sizeof(el_field_def_t) * set->field_count);
+
+	/* Allocate the columns. */
+	set->widths = (uint16_t *)malloc(sizeof(uint16_t) * (set->field_count + 1));
+	set->columns = (char **)malloc(sizeof(char *) * (set->field_count + 1));
+	set->nulls = (uint8_t **)calloc(set->field_count + 1, sizeof(uint8_t *));
+	for (i = 0; i < set->field_count; i++) {
+		const el_field_def_t *field = &(set->field_defs[i]);
+
+		switch ((el_type_t)field->type) {
+			case EL_FIELD_BOOL:
+				set->widths[i] = sizeof(uint8_t);
+				break;
+			case EL_FIELD_TIMESTAMP:
+				set->widths[i] = el_util_sizeof(EL_FIELD_TIMESTAMP);
+				break;
+			case EL_FIELD_VARCHAR:
+				set->widths[i] = sizeof(uint32_t);
+				break;
+			default:
+				set->widths[i] = field->size_bytes;
+				break;
+		}
+
+		set->columns[i] = (char *)calloc(capacity, set->widths[i]);
+		if (doc->ext.flags & EL_EXT_NULLS)
+			set->nulls[i] = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+	}
+
+	/* Start with an empty string at the beginning of the arena. */
+	set->arena_capacity = 256;
+	set->arena = (char *)calloc(set->arena_capacity, sizeof(char));
+	set->arena_len = 1;
+
+	return set;
+}
+
+/**
+ * Empties a set of rows so that it can be reused.
+ *
+ * @param set Row set.
+ */
+void el_rowset_clear(el_rowset_t *set) {
+	set->count = 0;
+	set->arena_len = 1;
+}
+
+/**
+ * Adds an empty row to the end of a set of rows. Fill it through the columns
+ * at position count - 1.
+ *
+ * @param set Row set.
+ *
+ * @return EL_OK if the row was added.
+ *         EL_ERROR_ARGUMENT if the set is already full.
+ */
+el_err_t el_rowset_add(el_rowset_t *set) {
+	uint8_t i;
+
+	if (set->count >= set->capacity) {
+		el_error_msg_format(EMSG("Row set is already full with %lu rows."),
+							set->capacity);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Clear the new row. */
+	for (i = 0; i < set->field_count; i++) {
+		memset(set->columns[i] + ((size_t)set->widths[i] * set->count), 0,
+			   set->widths[i]);
+		if (set->nulls[i] != NULL)
+			set->nulls[i][set->count] = 0;
+	}
+	set->indexes[set->count] = 0;
+	set->count++;
+
+	return EL_OK;
+}
+
+/**
+ * Reads a range of rows into a set of rows, replacing its contents. Rows that
+ * were deleted or truncated are skipped, so check the indexes of the set to
+ * know which rows were read.
+ *
+ * @param doc   Document handle.
+ * @param start Index of the first row to be read.
+ * @param n     Number of rows in the range. (Up to the capacity of the set)
+ * @param set   Row set created for this document.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the set doesn't match the document.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_rowset_read(eld_handle_t *doc, uint32_t start, uint32_t n,
+						el_rowset_t *set) {
+	el_rowset_reader_t reader;
+	el_err_t err;
+	uint8_t i;
+
+	/* Check if the set is for this document. */
+	err = el_rowset_check(doc, set);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Locate the fields in the rows. */
+	reader.set = set;
+	reader.limit = (n < set->capacity) ? n : set->capacity;
+	reader.offsets = (size_t *)malloc(sizeof(size_t) * (set->field_count + 1));
+	for (i = 0; i < set->field_count; i++)
+		reader.offsets[i] = el_util_field_offset(doc, i);
+
+	/* Go through the rows. */
+	el_rowset_clear(set);
+	err = el_doc_scan_blocks(doc, start, reader.limit, NULL, el_rowset_block,
+							 &reader);
+	free(reader.offsets);
+
+	return err;
+}
+
+/**
+ * Checks if a set of rows was created for a document, with the same types and
+ * sizes in each of its fields.
+ *
+ * @param doc Document handle.
+ * @param set Row set.
+ *
+ * @return EL_OK if the set matches the document.
+ *         EL_ERROR_ARGUMENT if the set doesn't match the document.
+ */
+el_err_t el_rowset_check(const eld_handle_t *doc, const el_rowset_t *set) {
+	uint8_t i;
+
+	if (set->field_count != doc->header.field_desc_count) {
+		el_error_msg_set(EMSG("Row set doesn't match the document fields."));
+		return EL_ERROR_ARGUMENT;
+	}
+	for (i = 0; i < set->field_count; i++) {
+		if ((set->field_defs[i].type != doc->field_defs[i].type) ||
+			(set->field_defs[i].size_bytes != doc->field_defs[i].size_bytes)) {
+			el_error_msg_format(EMSG("Field %u of the row set doesn't match "
+									 "the document."), i);
+			return EL_ERROR_ARGUMENT;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Copies a block of rows into the columns of a row set.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Row set reader state.
+ *
+ * @return Always true since the range was already limited.
+ */
+bool el_rowset_block(eld_handle_t *doc, const char *block, uint32_t first,
+					 uint32_t count, void *arg) {
+	el_rowset_reader_t *reader = (el_rowset_reader_t *)arg;
+	el_rowset_t *set = reader->set;
+	uint16_t sel[EL_SCAN_BLOCK_ROWS];
+	uint16_t sel_count;
+	uint16_t i;
+	uint8_t j;
+
+	/* Skip the deleted rows. */
+	for (i = 0; i < count; i++)
+		sel[i] = i;
+	sel_count = el_doc_sel_live(doc, first, sel, (uint16_t)count);
+
+	/* Copy the fields over one column at a time. */
+	for (j = 0; j < set->field_count; j++) {
+		const el_field_def_t *field = &(set->field_defs[j]);
+		uint16_t width = set->widths[j];
+		char *column = set->columns[j] + ((size_t)width * set->count);
+
+		for (i = 0; i < sel_count; i++) {
+			const char *row = block + ((size_t)doc->header.row_len * sel[i]);
+			const char *raw = row + reader->offsets[j];
+
+			if (set->nulls[j] != NULL)
+				set->nulls[j][set->count + i] = el_doc_raw_null(doc, row, j);
+
+			switch ((el_type_t)field->type) {
+				case EL_FIELD_BOOL:
+					column[i] = ((uint8_t)raw[0] >> field->reserved) & 1;
+					break;
+				case EL_FIELD_VARCHAR: {
+					char *str = el_heap_read(doc, field, raw);
+					el_rowset_string_set(set, j, set->count + i, str);
+					free(str);
+					break;
+				}
+#ifdef EL_HAS_INT64
+				case EL_FIELD_TIMESTAMP:
+					if (el_util_field_implicit(field)) {
+						int64_t stamp = el_doc_row_time(doc, first + sel[i]);
+						memcpy(column + ((size_t)width * i), &stamp, width);
+						break;
+					}
+					memcpy(column + ((size_t)width * i), raw, width);
+					break;
+#endif /* EL_HAS_INT64 */
+				default:
+					memcpy(column + ((size_t)width * i), raw, width);
+					break;
+			}
+		}
+	}
+
+	for (i = 0; i < sel_count; i++)
+		set->indexes[set->count + i] = first + sel[i];
+	set->count += sel_count;
+
+	return true;
+}
+
+/**
+ * Appends every row in a set of rows to the end of a document. The header is
+ * saved and the file opened only once for the whole set.
+ *
+ * @param doc Document handle.
+ * @param set Row set with the same fields as the document.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the set doesn't match the document.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_doc_rowset_append(eld_handle_t *doc, const el_rowset_t *set) {
+	el_row_t *row;
+	uint32_t first;
+	uint32_t i;
+	el_err_t err = EL_OK;
+
+	/* Check if the set is for this document. */
+	err = el_rowset_check(doc, set);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+	if (set->count == 0)
+		return EL_OK;
+
+	/* Rings may have to wrap around in the middle, so go row by row. */
+	row = el_row_new(doc);
+	if (doc->ext.ring_rows > 0) {
+		for (i = 0; (i < set->count) && (err == EL_OK); i++) {
+			el_rowset_row(set, i, row);
+			err = el_doc_row_add(doc, row);
+		}
+
+		el_row_free(row);
+		return err;
+	}
+
+	/* Save the header with all of the new rows. */
+	first = doc->header.row_count;
+	doc->header.row_count += set->count;
+	err = el_doc_save(doc, NULL);
+	IF_EL_ERROR(err) {
+		el_row_free(row);
+		return err;
+	}
+
+	/* Write the rows in one go. */
+	err = el_doc_fopen(doc, NULL, "a+b");
+	IF_EL_ERROR(err) {
+		el_row_free(row);
+		return err;
+	}
+	for (i = 0; (i < set->count) && (err == EL_OK); i++) {
+		el_rowset_row(set, i, row);
+		row->index = first + i;
+#ifdef EL_HAS_INT64
+		el_doc_row_stamp(doc, row);
+#endif /* EL_HAS_INT64 */
+
+		err = el_doc_row_write(doc, row);
+		if (err == EL_OK)
+			err = el_index_row(doc, row, false);
+	}
+	el_row_free(row);
+	if (err != EL_OK) {
+		el_doc_fclose(doc);
+		return err;
+	}
+	err = el_doc_fclose(doc);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Build the Bloom filters of the blocks that were filled. */
+	if ((first / EL_SCAN_BLOCK_ROWS) !=
+		(doc->header.row_count / EL_SCAN_BLOCK_ROWS)) {
+		uint8_t j;
+
+		for (j = 0; j < doc->bloom_count; j++) {
+			err = el_bloom_sync(doc, doc->bloom_fields[j]);
+			IF_EL_ERROR(err) {
+				return err;
+			}
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Fills a row object with a row from a set of rows.
+ *
+ * @param set Row set.
+ * @param pos Position of the row in the set.
+ * @param row Row object created for a document with the same fields.
+ */
+void el_rowset_row(const el_rowset_t *set, uint32_t pos, el_row_t *row) {
+	uint8_t i;
+
+	for (i = 0; i < row->cell_count; i++) {
+		el_cell_t *cell = &(row->cells[i]);
+		const char *raw = set->columns[i] + ((size_t)set->widths[i] * pos);
+
+		cell->null = (set->nulls[i] != NULL) && set->nulls[i][pos];
+		switch ((el_type_t)cell->field->type) {
+			case EL_FIELD_STRING:
+				memcpy(cell->value.string, raw, set->widths[i]);
+				cell->value.string[set->widths[i] - 1] = '\0';
+				break;
+			case EL_FIELD_VARCHAR:
+				el_util_strcpy(&(cell->value.string),
+							   el_rowset_string(set, i, pos));
+				break;
+			case EL_FIELD_FLOAT_ARRAY:
+			case EL_FIELD_INT_ARRAY:
+				memcpy(cell->value.array.data, raw, set->widths[i]);
+				break;
+			case EL_FIELD_BOOL:
+				cell->value.boolean = raw[0] != 0;
+				break;
+			default:
+				memcpy(&(cell->value), raw, set->widths[i]);
+				break;
+		}
+	}
+}
+
+/**
+ * Gets the column of a field in a set of rows. Cast it to an array of the C
+ * type of the field. (uint8_t for booleans and int64_t for timestamps)
+ *
+ * @param set   Row set.
+ * @param field Index of the field.
+ *
+ * @return Column of the field or NULL if it doesn't exist.
+ */
+void *el_rowset_column(const el_rowset_t *set, uint8_t field) {
+	if (field >= set->field_count)
+		return NULL;
+
+	return set->columns[field];
+}
+
+/**
+ * Gets a string from a set of rows.
+ *
+ * @param set   Row set.
+ * @param field Index of the string field.
+ * @param row   Position of the row in the set.
+ *
+ * @return String owned by the set or NULL if the field isn't a string.
+ */
+const char *el_rowset_string(const el_rowset_t *set, uint8_t field,
+							 uint32_t row) {
+	uint32_t offset;
+
+	if ((field >= set->field_count) ||
+		!el_util_is_string(&(set->field_defs[field])))
+		return NULL;
+
+	/* Fixed-length strings live in their column. */
+	if (set->field_defs[field].type == EL_FIELD_STRING)
+		return set->columns[field] + ((size_t)set->widths[field] * row);
+
+	memcpy(&offset, set->columns[field] + (sizeof(uint32_t) * row),
+		   sizeof(uint32_t));
+	return set->arena + offset;
+}
+
+/**
+ * Sets a string in a set of rows. Variable-length strings are appended to the
+ * arena, so replacing them often wastes space until the set is cleared.
+ *
+ * @param set   Row set.
+ * @param field Index of the string field.
+ * @param row   Position of the row in the set.
+ * @param str   New contents of the string.
+ */
+void el_rowset_string_set(el_rowset_t *set, uint8_t field, uint32_t row,
+						  const char *str) {
+	char *dest;
+	uint32_t offset;
+	size_t len;
+
+	if ((field >= set->field_count) || (row >= set->capacity))
+		return;
+
+	switch (set->field_defs[field].type) {
+		case EL_FIELD_STRING:
+			dest = set->columns[field] + ((size_t)set->widths[field] * row);
+			strncpy(dest, str, set->widths[field] - 1);
+			dest[set->widths[field] - 1] = '\0';
+			break;
+		case EL_FIELD_VARCHAR:
+			/* Grow the arena if needed. */
+			len = strlen(str) + 1;
+			while ((set->arena_len + len) > set->arena_capacity) {
+				set->arena_capacity *= 2;
+				set->arena = (char *)realloc(set->arena, set->arena_capacity);
+			}
+
+			/* Append the string and point the row to it. */
+			offset = (uint32_t)set->arena_len;
+			memcpy(set->arena + offset, str, len);
+			set->arena_len += len;
+			memcpy(set->columns[field] + (sizeof(uint32_t) * row), &offset,
+				   sizeof(uint32_t));
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Checks if a value in a set of rows is null.
+ *
+ * @param set   Row set.
+ * @param field Index of the field.
+ * @param row   Position of the row in the set.
+ *
+ * @return True if the value is null.
+ */
+bool el_rowset_null(const el_rowset_t *set, uint8_t field, uint32_t row) {
+	return (field < set->field_count) && (set->nulls[field] != NULL) &&
+		set->nulls[field][row];
+}
+
+/**
+ * Frees up a set of rows.
+ *
+ * @param set Row set to be free'd.
+ */
+void el_rowset_free(el_rowset_t *set) {
+	uint8_t i;
+
+	if (set == NULL)
+		return;
+
+	for (i = 0; i < set->field_count; i++) {
+		free(set->columns[i]);
+		free(set->nulls[i]);
+	}
+	free(set->columns);
+	free(set->nulls);
+	free(set->widths);
+	free(set->field_defs);
+	free(set->indexes);
+	free(set->arena);
+	free(set);
+}
+
+/**
+ * Reads a range of rows from the file in large blocks, handing each block of
+ * raw row bytes to a callback. This avoids the per-row open/seek/read cycle of
+ * el_row_get when a lot of rows need to be visited. Blocks are aligned to
+ * multiples of EL_SCAN_BLOCK_ROWS, so only the first and last ones can be
+ * partial. The rows of ring documents are handed over in the order they were
+ * added and the ones that were written with older schemas are adapted to the
+ * current one.
+ *
+ * @param doc    Document handle.
+ * @param start  Index of the first row to be read.
+ * @param count  Number of rows to be read.
+ * @param blocks Array indexed by block number with a non-zero value for the
+ *               blocks that should be read or NULL to read all of them.
+ * @param cb     Function called for every block read. Return false from it to
+ *               stop the scan early.
+ * @param arg    Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_doc_scan_blocks(eld_handle_t *doc, uint32_t start, uint32_t count,
+							const uint8_t *blocks, el_scan_block_cb_t cb,
+							void *arg) {
+	el_err_t err;
+	char *block;
+	char *old = NULL;
+	uint32_t end;
+	uint32_t done;
+	uint32_t piece;
+	bool seek = true;
+
+	/* Clamp the range to the rows that actually exist. */
+	if (start >= doc->header.row_count)
+		return EL_OK;
+	end = doc->header.row_count;
+	if (count < (end - start))
+		end = start + count;
+	if (start < doc->ext.row_base)
+		start = doc->ext.row_base;
+	if (start >= end)
+		return EL_OK;
+
+	/* Open the document. */
+	err = el_doc_fopen(doc, NULL, "rb");
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Go through the rows a block at a time. */
+	block = (char *)malloc((size_t)doc->header.row_len * EL_SCAN_BLOCK_ROWS);
+	while (start < end) {
+		uint32_t rows = EL_SCAN_BLOCK_ROWS - (start % EL_SCAN_BLOCK_ROWS);
+		if (rows > (end - start))
+			rows = end - start;
+
+		/* Skip the blocks we were told to. */
+		if ((blocks != NULL) && !blocks[start / EL_SCAN_BLOCK_ROWS]) {
+			start += rows;
+			seek = true;
+			continue;
+		}
+
+		/* Read the block, going back to the start of a ring and adapting the
+		   rows written with older schemas when needed. */
+		for (done = 0; done < rows; done += piece) {
+			const el_schema_t *schema;
+			uint32_t slot = el_doc_slot(doc, start + done);
+			uint32_t schema_end;
+			char *dest = block + ((size_t)doc->header.row_len * done);
+			char *buf = dest;
+			size_t len = doc->header.row_len;
+
+			piece = rows - done;
+			if ((doc->ext.ring_rows > 0) &&
+				(piece > (doc->ext.ring_rows - slot)))
+				piece = doc->ext.ring_rows - slot;
+			schema = el_schema_find(doc, start + done, &schema_end);
+			if (schema != NULL) {
+				if (piece > (schema_end - (start + done)))
+					piece = schema_end - (start + done);
+
+				len = schema->header.row_len;
+				old = (char *)realloc(old, len * EL_SCAN_BLOCK_ROWS);
+				buf = old;
+			}
+
+			if (seek && !el_row_seek(doc, start + done)) {
+				free(block);
+				free(old);
+				el_doc_fclose(doc);
+				return EL_ERROR_FILE;
+			}
+			seek = (doc->ext.ring_rows > 0) &&
+				(el_doc_slot(doc, start + done + piece) == 0);
+			if (fread(buf, len, piece, doc->fh) != piece) {
+				el_error_msg_format(
+					EMSG("Couldn't read rows %lu to %lu from file \"%s\"."),
+					start, start + rows - 1, doc->fname);
+				free(block);
+				free(old);
+				el_doc_fclose(doc);
+				return EL_ERROR_FILE;
+			}
+			if (schema != NULL)
+				el_schema_adapt(doc, schema, buf, piece, dest);
+		}
+
+		/* Hand it over. */
+		if (!cb(doc, block, start, rows, arg))
+			break;
+		start += rows;
+	}
+	free(block);
+	free(old);
+
+	/* Close the document and return. */
+	err = el_doc_fclose(doc);
+	return err;
+}
+
+/**
+ * Decodes the raw bytes of a row, as stored in the file, into a prepared row
+ * object.
+ *
+ * @param doc Document handle.
+ * @param row Prepared row object with its index set.
+ * @param raw Raw bytes of the row.
+ */
+void el_row_decode(const eld_handle_t *doc, el_row_t *row, const char *raw) {
+	const char *nulls = raw;
+	uint8_t i;
+
+	/* Skip the null bitmap. */
+	raw += el_util_null_len(doc->ext.flags, row->cell_count);
+
+	for (i = 0; i < row->cell_count; i++) {
+		el_cell_t *cell = &(row->cells[i]);
+
+		cell->null = el_doc_raw_null(doc, nulls, i);
+
+		/* Booleans without a size live in the byte before them. */
+		if ((cell->field->type == EL_FIELD_BOOL) &&
+			(cell->field->size_bytes == 0)) {
+			el_cell_decode(doc, cell, raw - 1, row->index);
+			continue;
+		}
+
+		el_cell_decode(doc, cell, raw, row->index);
+		raw += cell->field->size_bytes;
+	}
+}
+
+/**
+ * Decodes the raw bytes of a single cell into a prepared cell object.
+ *
+ * @param doc   Document handle.
+ * @param cell  Prepared cell object.
+ * @param raw   Raw bytes of the cell. (The shared byte for booleans)
+ * @param index Index of the row the cell belongs to.
+ */
+void el_cell_decode(const eld_handle_t *doc, el_cell_t *cell, const char *raw,
+					uint32_t index) {
+	switch ((el_type_t)cell->field->type) {
+		case EL_FIELD_STRING:
+			memcpy(cell->value.string, raw, cell->field->size_bytes);
+			break;
+		case EL_FIELD_VARCHAR:
+			free(cell->value.string);
+			cell->value.string = el_heap_read(doc, cell->field, raw);
+			break;
+		case EL_FIELD_FLOAT_ARRAY:
+		case EL_FIELD_INT_ARRAY:
+			memcpy(cell->value.array.data, raw, cell->field->size_bytes);
+			break;
+		case EL_FIELD_BOOL:
+			cell->value.boolean = ((uint8_t)raw[0] >> cell->field->reserved) & 1;
+			break;
+#ifdef EL_HAS_INT64
+		case EL_FIELD_TIMESTAMP:
+			if (el_util_field_implicit(cell->field)) {
+				cell->value.timestamp = el_doc_row_time(doc, index);
+			} else {
+				memcpy(&(cell->value), raw, cell->field->size_bytes);
+			}
+			break;
+#endif /* EL_HAS_INT64 */
+		default:
+			memcpy(&(cell->value), raw, cell->field->size_bytes);
+			break;
+	}
+}
+
+/**
+ * Opens the heap sidecar where the variable-length strings that don't fit in
+ * their rows are kept. The handle stays open until the document is freed.
+ *
+ * @param doc    Document handle.
+ * @param create Should the heap be created if it doesn't exist yet?
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while opening the heap.
+ */
+el_err_t el_heap_open(eld_handle_t *doc, bool create) {
+	char *fname;
+
+	/* Do we even have anything to do? */
+	if (doc->heap != NULL)
+		return EL_OK;
+
+	/* Open the heap for appending and reading. */
+	fname = el_util_sidecar_name(doc, ".vh");
+	if (create || el_util_file_exists(fname)) {
+		doc->heap = fopen(fname, "a+b");
+		if (doc->heap == NULL) {
+			el_error_msg_format(EMSG("Couldn't open string heap \"%s\": %s."),
+								fname, strerror(errno));
+			free(fname);
+			return EL_ERROR_FILE;
+		}
+	}
+	free(fname);
+
+	/* Throw away a heap that was left behind by another document. */
+	if (doc->heap != NULL) {
+		char magic[4];
+		uint32_t doc_id;
+
+		fseek(doc->heap, 0, SEEK_SET);
+		if ((fread(magic, 4, 1, doc->heap) == 1) &&
+			(fread(&doc_id, sizeof(uint32_t), 1, doc->heap) == 1) &&
+			!el_util_sidecar_owned(doc, doc_id)) {
+			el_util_sidecar_drop(doc, ".vh", doc->heap);
+			doc->heap = NULL;
+
+			return el_heap_open(doc, create);
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Appends a string to the heap of a document.
+ *
+ * @param doc Document handle.
+ * @param str String to be appended. (Doesn't need to be terminated)
+ * @param len Length of the string.
+ *
+ * @return Offset of the string in the heap or 0 if it couldn't be written.
+ */
+uint32_t el_heap_append(eld_handle_t *doc, const char *str, uint16_t len) {
+	long offset;
+
+	/* Make sure the heap is open. */
+	if (el_heap_open(doc, true) != EL_OK)
+		return 0;
+
+	/* Brand new heaps start with their magic. */
+	fseek(doc->heap, 0, SEEK_END);
+	offset = ftell(doc->heap);
+	if (offset == 0) {
+		fwrite("EH--", 4, 1, doc->heap);
+		fwrite(&(doc->ext.doc_id), sizeof(uint32_t), 1, doc->heap);
+		offset = 4 + sizeof(uint32_t);
+	}
+
+	/* Append the string and make sure it gets to disk before its row. */
+	fwrite(str, len, 1, doc->heap);
+	fflush(doc->heap);
+	if (ferror(doc->heap) || (offset < 0)) {
+		el_error_msg_format(EMSG("Couldn't append to the string heap of "
+								 "\"%s\": %s."), doc->fname, strerror(errno));
+		clearerr(doc->heap);
+		return 0;
+	}
+
+	return (uint32_t)offset;
+}
+
+/**
+ * Writes a variable-length string cell to the document at the current
+ * position. Strings that don't fit in the cell are appended to the heap and
+ * the cell stores their offset instead.
+ *
+ * @param doc   Document handle.
+ * @param field Field definition of the cell.
+ * @param str   Contents of the cell. (Cut at 32767 characters)
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while writing the string.
+ */
+el_err_t el_heap_cell_write(eld_handle_t *doc, const el_field_def_t *field,
+							const char *str) {
+	uint16_t room;
+	uint16_t len;
+	size_t slen;
+
+	/* Get the length of the string. */
+	room = field->size_bytes - sizeof(uint16_t);
+	slen = strlen(str);
+	len = (slen < EL_VARCHAR_HEAP) ? (uint16_t)slen : EL_VARCHAR_HEAP - 1;
+
+	if (len <= room) {
+		/* Short strings live in the row. */
+		fwrite(&len, sizeof(uint16_t), 1, doc->fh);
+		fwrite(str, len, 1, doc->fh);
+	} else {
+		uint32_t offset;
+
+		/* Long ones go to the heap. */
+		offset = el_heap_append(doc, str, len);
+		if (offset == 0)
+			return EL_ERROR_FILE;
+
+		len |= EL_VARCHAR_HEAP;
+		fwrite(&len, sizeof(uint16_t), 1, doc->fh);
+		fwrite(&offset, sizeof(uint32_t), 1, doc->fh);
+		len = sizeof(uint32_t);
+	}
+
+	/* Pad the rest of the cell. */
+	for (; len < room; len++)
+		fputc('\0', doc->fh);
+
+	return EL_OK;
+}
+
+/**
+ * Reads the contents of a variable-length string cell.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc   Document handle.
+ * @param field Field definition of the cell.
+ * @param raw   Raw bytes of the cell.
+ *
+ * @return Contents of the cell. (Empty if its heap couldn't be read)
+ */
+char *el_heap_read(const eld_handle_t *doc, const el_field_def_t *field,
+				   const char *raw) {
+	uint16_t len;
+	char *str;
+
+	memcpy(&len, raw, sizeof(uint16_t));
+	str = (char *)malloc(((len & ~EL_VARCHAR_HEAP) + 1) * sizeof(char));
+
+	if (len & EL_VARCHAR_HEAP) {
+		uint32_t offset;
+
+		/* Fetch the string from the heap. */
+		len &= ~EL_VARCHAR_HEAP;
+		memcpy(&offset, raw + sizeof(uint16_t), sizeof(uint32_t));
+		if ((doc->heap == NULL) ||
+			(fseek(doc->heap, offset, SEEK_SET) != 0) ||
+			(fread(str, len, 1, doc->heap) != 1)) {
+			len = 0;
+		}
+	} else {
+		/* Never trust the length more than the size of the field. */
+		if (len > field->size_bytes - sizeof(uint16_t))
+			len = field->size_bytes - sizeof(uint16_t);
+		memcpy(str, raw + sizeof(uint16_t), len);
+	}
+
+	str[len] = '\0';
+	return str;
+}
+
+/**
+ * Compares a variable-length string cell with a string. Strings that live in
+ * the row are compared without being copied.
+ *
+ * @param doc   Document handle.
+ * @param field Field definition of the cell.
+ * @param raw   Raw bytes of the cell.
+ * @param str   String to compare against.
+ *
+ * @return Less than, equal to or greater than zero like strcmp.
+ */
+int el_heap_cmp(const eld_handle_t *doc, const el_field_def_t *field,
+				const char *raw, const char *str) {
+	uint16_t len;
+	size_t slen;
+	int sign;
+
+	/* Strings in the heap have to be fetched first. */
+	memcpy(&len, raw, sizeof(uint16_t));
+	if (len & EL_VARCHAR_HEAP) {
+		char *heap = el_heap_read(doc, field, raw);
+
+		sign = strcmp(heap, str);
+		free(heap);
+
+		return sign;
+	}
+
+	/* Compare the common part and then the lengths. */
+	if (len > field->size_bytes - sizeof(uint16_t))
+		len = field->size_bytes - sizeof(uint16_t);
+	slen = strlen(str);
+	sign = memcmp(raw + sizeof(uint16_t), str, (len < slen) ? len : slen);
+	if (sign == 0)
+		sign = (len > slen) - (len < slen);
+
+	return sign;
+}
+
+/**
+ * Goes through the rows of a document calling a function for every row that
+ * matches a filter expression. The expression is evaluated a block of rows at a
+ * time and only the matching rows are decoded, so string fields are only
+ * copied for the rows that are handed over. Blocks are skipped entirely when
+ * the Bloom filters of the document show that an equality comparison can't
+ * match any of their rows.
+ * @warning The document is kept open during the scan, so don't try to use
+ *          el_row_get or any of the writing functions inside the callback.
+ *
+ * @param doc  Document handle.
+ * @param expr Compiled filter expression or NULL to go through every row.
+ * @param cb   Function called for every matching row. The row object is reused
+ *             between calls, so copy anything you want to keep.
+ * @param arg  Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ *
+ * @see el_expr_compile
+ */
+el_err_t el_doc_scan(eld_handle_t *doc, const el_expr_t *expr, el_scan_cb_t cb,
+					 void *arg) {
+	return el_doc_scan_run(doc, expr, NULL, cb, arg, NULL);
+}
+
+/**
+ * Goes through a set of rows of a document calling a function for each one of
+ * them. Only the blocks that contain rows in the set are read.
+ * @warning The document is kept open during the scan, so don't try to use
+ *          el_row_get or any of the writing functions inside the callback.
+ *
+ * @param doc  Document handle.
+ * @param rows Rows to go through.
+ * @param cb   Function called for every row, in ascending order. The row object
+ *             is reused between calls, so copy anything you want to keep.
+ * @param arg  Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_doc_scan_rows(eld_handle_t *doc, const el_bitmap_t *rows,
+						  el_scan_cb_t cb, void *arg) {
+	return el_doc_scan_run(doc, NULL, rows, cb, arg, NULL);
+}
+
+/**
+ * Finds all the rows of a document that match a filter expression.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc  Document handle.
+ * @param expr Compiled filter expression.
+ *
+ * @return Bitmap of the matching rows or NULL if an error occurred.
+ *
+ * @see el_bitmap_free
+ */
+el_bitmap_t *el_doc_filter(eld_handle_t *doc, const el_expr_t *expr) {
+	el_bitmap_t *matches;
+	el_err_t err;
+
+	matches = el_bitmap_new();
+	err = el_doc_scan_run(doc, expr, NULL, NULL, NULL, matches);
+	IF_EL_ERROR(err) {
+		el_bitmap_free(matches);
+		return NULL;
+	}
+
+	return matches;
+}
+
+/**
+ * Goes through the rows of a document that match a filter expression and are
+ * in a set of rows, either calling a function for each one of them or
+ * collecting them in a bitmap.
+ *
+ * @param doc     Document handle.
+ * @param expr    Compiled filter expression or NULL to go through every row.
+ * @param rows    Rows to go through or NULL to go through every row.
+ * @param cb      Function called for every matching row.
+ * @param arg     Opaque pointer passed along to the callback.
+ * @param matches Bitmap to collect the matching rows or NULL to call the
+ *                function instead.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_doc_scan_run(eld_handle_t *doc, const el_expr_t *expr,
+						 const el_bitmap_t *rows, el_scan_cb_t cb, void *arg,
+						 el_bitmap_t *matches) {
+	el_scan_t scan;
+	uint8_t *blocks = NULL;
+	el_err_t err;
+
+	/* Use the Bloom filters to skip blocks that can't possibly match. */
+	if ((expr != NULL) && (doc->bloom_count > 0))
+		blocks = el_bloom_candidates(doc, expr);
+
+	/* Skip the blocks that don't have any of the rows we want. */
+	if (rows != NULL) {
+		uint32_t nblocks = (doc->header.row_count + EL_SCAN_BLOCK_ROWS - 1) /
+			EL_SCAN_BLOCK_ROWS;
+		uint8_t *wanted = (uint8_t *)calloc(nblocks + 1, sizeof(uint8_t));
+		el_scan_mark_t mark;
+		uint32_t i;
+
+		/* Rows outside of the document may come from stale results. */
+		mark.wanted = wanted;
+		mark.row_base = doc->ext.row_base;
+		mark.row_count = doc->header.row_count;
+		el_bitmap_foreach(rows, el_doc_scan_rows_mark, &mark);
+		if (blocks != NULL) {
+			for (i = 0; i < nblocks; i++)
+				wanted[i] &= blocks[i];
+			free(blocks);
+		}
+		blocks = wanted;
+	}
+
+	/* Set up the scan state. */
+	scan.expr = expr;
+	scan.cb = cb;
+	scan.arg = arg;
+	scan.rows = rows;
+	scan.matches = matches;
+	scan.row = (matches == NULL) ? el_row_new(doc) : NULL;
+	scan.sel = (uint16_t *)malloc(sizeof(uint16_t) * EL_SCAN_BLOCK_ROWS);
+	scan.stack = NULL;
+	if (expr != NULL)
+		scan.stack = (uint8_t *)malloc((size_t)expr->depth * EL_SCAN_BLOCK_ROWS);
+
+	/* Go through the document. */
+	err = el_doc_scan_blocks(doc, 0, doc->header.row_count, blocks,
+							 el_doc_scan_block, &scan);
+
+	/* Clean up and return. */
+	free(scan.stack);
+	free(scan.sel);
+	free(blocks);
+	el_row_free(scan.row);
+	return err;
+}
+
+/**
+ * Marks the block that a row belongs to as one that needs to be read. Rows
+ * that were truncated or are past the end of the document are ignored.
+ *
+ * @param value Index of the row.
+ * @param arg   Blocks to be read and the range of rows in the document.
+ *
+ * @return False once we're past the end of the document.
+ */
+bool el_doc_scan_rows_mark(uint32_t value, void *arg) {
+	el_scan_mark_t *mark = (el_scan_mark_t *)arg;
+
+	if (value >= mark->row_count)
+		return false;
+	if (value >= mark->row_base)
+		mark->wanted[value / EL_SCAN_BLOCK_ROWS] = 1;
+
+	return true;
+}
+
+/**
+ * Filters a block of rows and hands the matching ones to the user.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Scan state.
+ *
+ * @return False if the user requested the scan to be stopped.
+ */
+bool el_doc_scan_block(eld_handle_t *doc, const char *block, uint32_t first,
+					   uint32_t count, void *arg) {
+	el_scan_t *scan = (el_scan_t *)arg;
+	uint16_t sel_count = 0;
+	uint16_t i;
+
+	/* Select the rows we were asked for. */
+	if (scan->rows != NULL) {
+		const el_bitmap_container_t *c;
+		uint16_t low = (uint16_t)(first & 0xFFFF);
+		uint32_t pos;
+
+		/* Blocks never cross containers. */
+		if (!el_bitmap_find(scan->rows, (uint16_t)(first >> 16), &pos))
+			return true;
+		c = &(scan->rows->containers[pos]);
+
+		if (c->array != NULL) {
+			for (pos = el_bitmap_lower(c->array, c->cardinality, low);
+				 (pos < c->cardinality) &&
+				 ((uint32_t)c->array[pos] < (low + count)); pos++) {
+				scan->sel[sel_count++] = c->array[pos] - low;
+			}
+		} else {
+			for (i = 0; i < count; i++) {
+				uint16_t bit = low + i;
+				if (c->bits[bit >> 5] & (1UL << (bit & 31)))
+					scan->sel[sel_count++] = i;
+			}
+		}
+	} else {
+		for (i = 0; i < count; i++)
+			scan->sel[i] = i;
+		sel_count = (uint16_t)count;
+	}
+
+	/* Skip the rows that were deleted. */
+	sel_count = el_doc_sel_live(doc, first, scan->sel, sel_count);
+
+	/* Filter the block. */
+	if (scan->expr != NULL) {
+		sel_count = el_expr_filter(scan->expr, doc, block, first, scan->sel,
+								   sel_count, scan->stack);
+	}
+
+	/* Collect the matching rows if that's what we were asked for. */
+	if (scan->matches != NULL) {
+		for (i = 0; i < sel_count; i++)
+			el_bitmap_add(scan->matches, first + scan->sel[i]);
+
+		return true;
+	}
+
+	/* Only decode the rows that matched. */
+	for (i = 0; i < sel_count; i++) {
+		scan->row->index = first + scan->sel[i];
+		el_row_decode(doc, scan->row,
+					  block + ((size_t)doc->header.row_len * scan->sel[i]));
+		if (!scan->cb(doc, scan->row, scan->arg))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Removes the rows that were deleted from the selection vector of a block.
+ *
+ * @param doc       Document handle.
+ * @param first     Index of the first row in the block.
+ * @param sel       Positions of the selected rows inside the block.
+ * @param sel_count Number of selected rows.
+ *
+ * @return Number of selected rows that are still alive.
+ */
+uint16_t el_doc_sel_live(const eld_handle_t *doc, uint32_t first,
+						 uint16_t *sel, uint16_t sel_count) {
+	uint16_t count = 0;
+	uint32_t pos;
+	uint16_t i;
+
+	/* Blocks never cross containers, so check if this one has any. */
+	if ((doc->deleted == NULL) ||
+		!el_bitmap_find(doc->deleted, (uint16_t)(first >> 16), &pos))
+		return sel_count;
+
+	for (i = 0; i < sel_count; i++) {
+		if (!el_bitmap_contains(doc->deleted, first + sel[i]))
+			sel[count++] = sel[i];
+	}
+
+	return count;
+}
+
+/**
+ * Allocates a brand new empty bitmap. Bitmaps are roaring bitmaps: values are
+ * split by their upper 16 bits into containers that are either a sorted array
+ * (up to EL_BITMAP_ARRAY_MAX values) or a plain 65536 bit bitmap.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @return Brand new empty bitmap.
+ *
+ * @see el_bitmap_free
+ */
+el_bitmap_t *el_bitmap_new(void) {
+	el_bitmap_t *bm;
+
+	bm = (el_bitmap_t *)malloc(sizeof(el_bitmap_t));
+	bm->count = 0;
+	bm->containers = NULL;
+
+	return bm;
+}
+
+/**
+ * Frees up any resources allocated by a bitmap.
+ *
+ * @param bm Bitmap to be free'd.
+ */
+void el_bitmap_free(el_bitmap_t *bm) {
+	uint32_t i;
+
+	if (bm == NULL)
+		return;
+
+	for (i = 0; i < bm->count; i++) {
+		free(bm->containers[i].array);
+		free(bm->containers[i].bits);
+	}
+	free(bm->containers);
+	free(bm);
+}
+
+/**
+ * Adds a value to a bitmap. Adding values in ascending order is the fastest.
+ *
+ * @param bm    Bitmap.
+ * @param value Value to be added.
+ */
+void el_bitmap_add(el_bitmap_t *bm, uint32_t value) {
+	el_bitmap_container_t *c;
+	uint16_t low = (uint16_t)(value & 0xFFFF);
+	uint32_t pos;
+
+	/* Get the container or create it. */
+	if (!el_bitmap_find(bm, (uint16_t)(value >> 16), &pos)) {
+		bm->count++;
+		bm->containers = (el_bitmap_container_t *)realloc(bm->containers,
+			sizeof(el_bitmap_container_t) * bm->count);
+		memmove(&(bm->containers[pos + 1]), &(bm->containers[pos]),
+				sizeof(el_bitmap_container_t) * (bm->count - pos - 1));
+
+		c = &(bm->containers[pos]);
+		c->key = (uint16_t)(value >> 16);
+		c->cardinality = 0;
+		c->capacity = 0;
+		c->array = NULL;
+		c->bits = NULL;
+	}
+	c = &(bm->containers[pos]);
+
+	/* Bitmap containers just need their bit set. */
+	if (c->bits != NULL) {
+		if (!(c->bits[low >> 5] & (1UL << (low & 31)))) {
+			c->bits[low >> 5] |= 1UL << (low & 31);
+			c->cardinality++;
+		}
+
+		return;
+	}
+
+	/* Find where the value goes in the array. */
+	pos = c->cardinality;
+	if ((c->cardinality > 0) && (c->array[c->cardinality - 1] >= low)) {
+		pos = el_bitmap_lower(c->array, c->cardinality, low);
+		if (c->array[pos] == low)
+			return;
+	}
+
+	/* Make room for it. */
+	if (c->cardinality == c->capacity) {
+		c->capacity = (c->capacity == 0) ? 4 : (c->capacity * 2);
+		c->array = (uint16_t *)realloc(c->array,
+									   sizeof(uint16_t) * c->capacity);
+	}
+	memmove(&(c->array[pos + 1]), &(c->array[pos]),
+			sizeof(uint16_t) * (c->cardinality - pos));
+	c->array[pos] = low;
+	c->cardinality++;
+
+	/* Switch to a bitmap once the array becomes too large. */
+	if (c->cardinality > EL_BITMAP_ARRAY_MAX)
+		el_bitmap_to_bits(c);
+}
+
+/**
+ * Checks if a value is in a bitmap.
+ *
+ * @param bm    Bitmap.
+ * @param value Value to look for.
+ *
+ * @return Is the value in the bitmap?
+ */
+bool el_bitmap_contains(const el_bitmap_t *bm, uint32_t value) {
+	const el_bitmap_container_t *c;
+	uint16_t low = (uint16_t)(value & 0xFFFF);
+	uint32_t pos;
+
+	if (!el_bitmap_find(bm, (uint16_t)(value >> 16), &pos))
+		return false;
+	c = &(bm->containers[pos]);
+
+	if (c->bits != NULL)
+		return (c->bits[low >> 5] & (1UL << (low & 31))) != 0;
+
+	pos = el_bitmap_lower(c->array, c->cardinality, low);
+	return (pos < c->cardinality) && (c->array[pos] == low);
+}
+
+/**
+ * Gets the number of values in a bitmap.
+ *
+ * @param bm Bitmap.
+ *
+ * @return Number of values in the bitmap.
+ */
+uint32_t el_bitmap_cardinality(const el_bitmap_t *bm) {
+	uint32_t total = 0;
+	uint32_t i;
+
+	for (i = 0; i < bm->count; i++)
+		total += bm->containers[i].cardinality;
+
+	return total;
+}
+
+/**
+ * Intersects two bitmaps.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param a First bitmap.
+ * @param b Second bitmap.
+ *
+ * @return Brand new bitmap with the values that are in both bitmaps.
+ */
+el_bitmap_t *el_bitmap_and(const el_bitmap_t *a, const el_bitmap_t *b) {
+	return el_bitmap_op(a, b, EL_BITMAP_AND);
+}
+
+/**
+ * Unites two bitmaps.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param a First bitmap.
+ * @param b Second bitmap.
+ *
+ * @return Brand new bitmap with the values that are in either bitmap.
+ */
+el_bitmap_t *el_bitmap_or(const el_bitmap_t *a, const el_bitmap_t *b) {
+	return el_bitmap_op(a, b, EL_BITMAP_OR);
+}
+
+/**
+ * Subtracts a bitmap from another.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param a Bitmap to subtract from.
+ * @param b Bitmap to be subtracted.
+ *
+ * @return Brand new bitmap with the values of the first bitmap that aren't in
+ *         the second one.
+ */
+el_bitmap_t *el_bitmap_andnot(const el_bitmap_t *a, const el_bitmap_t *b) {
+	return el_bitmap_op(a, b, EL_BITMAP_ANDNOT);
+}
+
+/**
+ * Calls a function for every value in a bitmap in ascending order.
+ *
+ * @param bm  Bitmap.
+ * @param cb  Function called for every value.
+ * @param arg Opaque pointer passed along to the callback.
+ *
+ * @return False if the callback stopped the iteration.
+ */
+bool el_bitmap_foreach(const el_bitmap_t *bm, el_bitmap_cb_t cb, void *arg) {
+	uint32_t i;
+	uint32_t j;
+
+	for (i = 0; i < bm->count; i++) {
+		const el_bitmap_container_t *c = &(bm->containers[i]);
+		uint32_t high = (uint32_t)c->key << 16;
+
+		/* Arrays are already sorted. */
+		if (c->array != NULL) {
+			for (j = 0; j < c->cardinality; j++) {
+				if (!cb(high | c->array[j], arg))
+					return false;
+			}
+
+			continue;
+		}
+
+		/* Go through the bits that are set in each word. */
+		for (j = 0; j < EL_BITMAP_WORDS; j++) {
+			uint32_t word = c->bits[j];
+			uint8_t bit;
+
+			for (bit = 0; word != 0; bit++, word >>= 1) {
+				if ((word & 1) && !cb(high | (j << 5) | bit, arg))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Finds the container of a bitmap that holds the values with some upper bits.
+ *
+ * @param bm  Bitmap.
+ * @param key Upper 16 bits of the values.
+ * @param pos Pointer to store the position of the container or where it should
+ *            be inserted.
+ *
+ * @return TRUE if the container exists.
+ */
+bool el_bitmap_find(const el_bitmap_t *bm, uint16_t key, uint32_t *pos) {
+	uint32_t lo = 0;
+	uint32_t hi = bm->count;
+
+	/* Values are usually added in ascending order. */
+	if ((bm->count > 0) && (bm->containers[bm->count - 1].key < key)) {
+		*pos = bm->count;
+		return false;
+	}
+
+	while (lo < hi) {
+		uint32_t mid = lo + ((hi - lo) / 2);
+
+		if (bm->containers[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*pos = lo;
+	return (lo < bm->count) && (bm->containers[lo].key == key);
+}
+
+/**
+ * Finds the first value of a sorted array that isn't smaller than a value.
+ *
+ * @param array Sorted array.
+ * @param count Number of values in the array.
+ * @param value Value to look for.
+ *
+ * @return Position of the first value that isn't smaller.
+ */
+uint32_t el_bitmap_lower(const uint16_t *array, uint32_t count, uint16_t value) {
+	uint32_t lo = 0;
+	uint32_t hi = count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + ((hi - lo) / 2);
+
+		if (array[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * Writes the values of a container as a plain bitmap.
+ *
+ * @param c     Container.
+ * @param words Array of EL_BITMAP_WORDS words to store the bitmap.
+ */
+void el_bitmap_fill(const el_bitmap_container_t *c, uint32_t *words) {
+	uint32_t i;
+
+	if (c->bits != NULL) {
+		memcpy(words, c->bits, sizeof(uint32_t) * EL_BITMAP_WORDS);
+		return;
+	}
+
+	memset(words, 0, sizeof(uint32_t) * EL_BITMAP_WORDS);
+	for (i = 0; i < c->cardinality; i++)
+		words[c->array[i] >> 5] |= 1UL << (c->array[i] & 31);
+}
+
+/**
+ * Converts an array container into a bitmap container.
+ *
+ * @param c Container to be converted.
+ */
+void el_bitmap_to_bits(el_bitmap_container_t *c) {
+	uint32_t *bits;
+
+	bits = (uint32_t *)malloc(sizeof(uint32_t) * EL_BITMAP_WORDS);
+	el_bitmap_fill(c, bits);
+
+	c->bits = bits;
+	free(c->array);
+	c->array = NULL;
+	c->capacity = 0;
+}
+
+/**
+ * Converts a bitmap container back into an array container if it has become
+ * small enough.
+ *
+ * @param c Container to be checked.
+ */
+void el_bitmap_normalize(el_bitmap_container_t *c) {
+	uint32_t i;
+	uint32_t n = 0;
+
+	if ((c->bits == NULL) || (c->cardinality > EL_BITMAP_ARRAY_MAX))
+		return;
+
+	c->capacity = (c->cardinality > 0) ? c->cardinality : 1;
+	c->array = (uint16_t *)malloc(sizeof(uint16_t) * c->capacity);
+	for (i = 0; i < (EL_BITMAP_WORDS * 32UL); i++) {
+		if (c->bits[i >> 5] & (1UL << (i & 31)))
+			c->array[n++] = (uint16_t)i;
+	}
+
+	free(c->bits);
+	c->bits = NULL;
+}
+
+/**
+ * Copies a container.
+ *
+ * @param dst Container to copy to. (Its contents will be allocated)
+ * @param src Container to copy from.
+ */
+void el_bitmap_copy(el_bitmap_container_t *dst,
+					const el_bitmap_container_t *src) {
+	*dst = *src;
+
+	if (src->bits != NULL) {
+		dst->bits = (uint32_t *)malloc(sizeof(uint32_t) * EL_BITMAP_WORDS);
+		memcpy(dst->bits, src->bits, sizeof(uint32_t) * EL_BITMAP_WORDS);
+	} else {
+		dst->capacity = (src->cardinality > 0) ? src->cardinality : 1;
+		dst->array = (uint16_t *)malloc(sizeof(uint16_t) * dst->capacity);
+		memcpy(dst->array, src->array, sizeof(uint16_t) * src->cardinality);
+	}
+}
+
+/**
+ * Combines two containers with the same key. Two arrays are merged directly,
+ * anything else is combined a word at a time as plain bitmaps.
+ *
+ * @param out Container to store the result. (Its contents will be allocated)
+ * @param a   First container.
+ * @param b   Second container.
+ * @param op  Set operation.
+ */
+void el_bitmap_combine(el_bitmap_container_t *out,
+					   const el_bitmap_container_t *a,
+					   const el_bitmap_container_t *b, el_bitmap_op_t op) {
+	uint32_t *wa;
+	uint32_t *wb;
+	uint32_t i;
+	uint32_t j;
+	uint32_t n = 0;
+
+	out->key = a->key;
+	out->array = NULL;
+	out->bits = NULL;
+
+	/* Merge two sorted arrays. */
+	if ((a->array != NULL) && (b->array != NULL)) {
+		out->capacity = a->cardinality + b->cardinality + 1;
+		out->array = (uint16_t *)malloc(sizeof(uint16_t) * out->capacity);
+
+		i = 0;
+		j = 0;
+		while ((i < a->cardinality) && (j < b->cardinality)) {
+			if (a->array[i] < b->array[j]) {
+				if (op != EL_BITMAP_AND)
+					out->array[n++] = a->array[i];
+				i++;
+			} else if (a->array[i] > b->array[j]) {
+				if (op == EL_BITMAP_OR)
+					out->array[n++] = b->array[j];
+				j++;
+			} else {
+				if (op != EL_BITMAP_ANDNOT)
+					out->array[n++] = a->array[i];
+				i++;
+				j++;
+			}
+		}
+		while ((op != EL_BITMAP_AND) && (i < a->cardinality))
+			out->array[n++] = a->array[i++];
+		while ((op == EL_BITMAP_OR) && (j < b->cardinality))
+			out->array[n++] = b->array[j++];
+
+		out->cardinality = n;
+		if (n > EL_BITMAP_ARRAY_MAX)
+			el_bitmap_to_bits(out);
+
+		return;
+	}
+
+	/* Combine them as plain bitmaps. */
+	wa = (uint32_t *)malloc(sizeof(uint32_t) * EL_BITMAP_WORDS);
+	wb = (uint32_t *)malloc(sizeof(uint32_t) * EL_BITMAP_WORDS);
+	el_bitmap_fill(a, wa);
+	el_bitmap_fill(b, wb);
+	switch (op) {
+		case EL_BITMAP_AND:
+			for (i = 0; i < EL_BITMAP_WORDS; i++)
+				wa[i] &= wb[i];
+			break;
+		case EL_BITMAP_OR:
+			for (i = 0; i < EL_BITMAP_WORDS; i++)
+				wa[i] |= wb[i];
+			break;
+		case EL_BITMAP_ANDNOT:
+			for (i = 0; i < EL_BITMAP_WORDS; i++)
+				wa[i] &= ~wb[i];
+			break;
+	}
+	for (i = 0; i < EL_BITMAP_WORDS; i++)
+		n += el_util_popcount(wa[i]);
+	free(wb);
+
+	out->bits = wa;
+	out->capacity = 0;
+	out->cardinality = n;
+	el_bitmap_normalize(out);
+}
+
+/**
+ * Appends a container to a bitmap being built, unless it's empty.
+ *
+ * @param bm Bitmap being built.
+ * @param c  Container to be appended. (Ownership of its contents is taken)
+ */
+void el_bitmap_push(el_bitmap_t *bm, el_bitmap_container_t *c) {
+	if (c->cardinality == 0) {
+		free(c->array);
+		free(c->bits);
+		return;
+	}
+
+	bm->count++;
+	bm->containers = (el_bitmap_container_t *)realloc(bm->containers,
+		sizeof(el_bitmap_container_t) * bm->count);
+	bm->containers[bm->count - 1] = *c;
+}
+
+/**
+ * Performs a set operation between two bitmaps one container at a time.
+ *
+ * @param a  First bitmap.
+ * @param b  Second bitmap.
+ * @param op Set operation.
+ *
+ * @return Brand new bitmap with the result.
+ */
+el_bitmap_t *el_bitmap_op(const el_bitmap_t *a, const el_bitmap_t *b,
+						  el_bitmap_op_t op) {
+	el_bitmap_container_t c;
+	el_bitmap_t *out;
+	uint32_t i = 0;
+	uint32_t j = 0;
+
+	out = el_bitmap_new();
+	while ((i < a->count) || (j < b->count)) {
+		if ((j >= b->count) ||
+			((i < a->count) && (a->containers[i].key < b->containers[j].key))) {
+			/* Only in the first bitmap. */
+			if (op != EL_BITMAP_AND) {
+				el_bitmap_copy(&c, &(a->containers[i]));
+				el_bitmap_push(out, &c);
+			}
+			i++;
+		} else if ((i >= a->count) ||
+				   (a->containers[i].key > b->containers[j].key)) {
+			/* Only in the second bitmap. */
+			if (op == EL_BITMAP_OR) {
+				el_bitmap_copy(&c, &(b->containers[j]));
+				el_bitmap_push(out, &c);
+			}
+			j++;
+		} else {
+			/* In both of them. */
+			el_bitmap_combine(&c, &(a->containers[i]), &(b->containers[j]), op);
+			el_bitmap_push(out, &c);
+			i++;
+			j++;
+		}
+	}
+
+	return out;
+}
+
+/**
+ * Compiles a filter expression into a program bound to the field offsets of a
+ * document. Expressions are comparisons between a field and a literal value
+ * (field == 'string', field >= 1.5, etc.) that can be combined with &&, || and
+ * ! and grouped with parenthesis. Null cells never match a comparison, but can
+ * be checked with field == NULL and field != NULL. Field names containing
+ * characters other than letters, numbers and underscores must be enclosed in
+ * double quotes.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc Document handle.
+ * @param src Filter expression source.
+ *
+ * @return Compiled expression or NULL if the expression is invalid.
+ *
+ * @see el_expr_free
+ */
+el_expr_t *el_expr_compile(const eld_handle_t *doc, const char *src) {
+	el_expr_parser_t p;
+
+	/* Set up the parser. */
+	p.doc = doc;
+	p.src = src;
+	p.pos = src;
+	p.depth = 0;
+	p.expr = (el_expr_t *)malloc(sizeof(el_expr_t));
+	p.expr->len = 0;
+	p.expr->depth = 0;
+	p.expr->code = NULL;
+	p.expr->term_count = 0;
+	p.expr->terms = NULL;
+
+	/* Parse the expression and make sure nothing was left behind. */
+	if (!el_expr_parse_or(&p))
+		goto fail;
+	el_expr_accept(&p, "");
+	if (*p.pos != '\0') {
+		el_expr_error(&p, "Unexpected character");
+		goto fail;
+	}
+
+	/* Order the terms from the cheapest to the most expensive. */
+	el_expr_split(p.expr, doc);
+
+	return p.expr;
+
+fail:
+	el_expr_free(p.expr);
+	return NULL;
+}
+
+/**
+ * Frees up any resources allocated by a compiled filter expression.
+ *
+ * @param expr Compiled filter expression to be free'd.
+ */
+void el_expr_free(el_expr_t *expr) {
+	uint16_t i;
+
+	/* Should we do anything? */
+	if (expr == NULL)
+		return;
+
+	/* Free the string literals. */
+	for (i = 0; i < expr->len; i++) {
+		free(expr->code[i].string);
+	}
+
+	/* Free the program and ourselves. */
+	free(expr->terms);
+	free(expr->code);
+	free(expr);
+}
+
+/**
+ * Parses a sequence of expressions joined by the || operator.
+ *
+ * @param p Parser state.
+ *
+ * @return TRUE if the expression was parsed successfully.
+ */
+bool el_expr_parse_or(el_expr_parser_t *p) {
+	el_expr_inst_t inst;
+
+	if (!el_expr_parse_and(p))
+		return false;
+
+	memset(&inst, 0, sizeof(el_expr_inst_t));
+	inst.code = EL_EXPR_OR;
+	while (el_expr_accept(p, "||")) {
+		if (!el_expr_parse_and(p))
+			return false;
+		el_expr_emit(p, inst);
+	}
+
+	return true;
+}
+
+/**
+ * Parses a sequence of expressions joined by the && operator.
+ *
+ * @param p Parser state.
+ *
+ * @return TRUE if the expression was parsed successfully.
+ */
+bool el_expr_parse_and(el_expr_parser_t *p) {
+	el_expr_inst_t inst;
+
+	if (!el_expr_parse_unary(p))
+		return false;
+
+	memset(&inst, 0, sizeof(el_expr_inst_t));
+	inst.code = EL_EXPR_AND;
+	while (el_expr_accept(p, "&&")) {
+		if (!el_expr_parse_unary(p))
+			return false;
+		el_expr_emit(p, inst);
+	}
+
+	return true;
+}
+
+/**
+ * Parses a negated expression, an expression inside parenthesis or a simple
+ * comparison.
+ *
+ * @param p Parser state.
+ *
+ * @return TRUE if the expression was parsed successfully.
+ */
+bool el_expr_parse_unary(el_expr_parser_t *p) {
+	el_expr_inst_t inst;
+
+	/* Negation. */
+	if (el_expr_accept(p, "!")) {
+		if (!el_expr_parse_unary(p))
+			return false;
+
+		memset(&inst, 0, sizeof(el_expr_inst_t));
+		inst.code = EL_EXPR_NOT;
+		el_expr_emit(p, inst);
+
+		return true;
+	}
+
+	/* Grouping. */
+	if (el_expr_accept(p, "(")) {
+		if (!el_expr_parse_or(p))
+			return false;
+		if (!el_expr_accept(p, ")")) {
+			el_expr_error(p, "Expected a closing parenthesis");
+			return false;
+		}
+
+		return true;
+	}
+
+	return el_expr_parse_cmp(p);
+}
+
+/**
+ * Parses a comparison between a field and a literal value.
+ *
+ * @param p Parser state.
+ *
+ * @return TRUE if the comparison was parsed successfully.
+ */
+bool el_expr_parse_cmp(el_expr_parser_t *p) {
+	static const char *ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+	static const el_cmp_t cmps[] = { EL_CMP_EQ, EL_CMP_NE, EL_CMP_LE, EL_CMP_GE,
+									 EL_CMP_LT, EL_CMP_GT };
+	el_expr_inst_t inst;
+	const char *name;
+	size_t len;
+	int field;
+	uint8_t i;
+
+	/* Get the field name. */
+	el_expr_accept(p, "");
+	name = p->pos;
+	if (*p->pos == '"') {
+		name++;
+		p->pos++;
+		while ((*p->pos != '"') && (*p->pos != '\0'))
+			p->pos++;
+		if (*p->pos != '"') {
+			el_expr_error(p, "Unterminated field name");
+			return false;
+		}
+		len = p->pos - name;
+		p->pos++;
+	} else {
+		while ((*p->pos == '_') || ((*p->pos >= '0') && (*p->pos <= '9')) ||
+			   ((*p->pos >= 'A') && (*p->pos <= 'Z')) ||
+			   ((*p->pos >= 'a') && (*p->pos <= 'z')))
+			p->pos++;
+		len = p->pos - name;
+	}
+
+	/* Find the field. */
+	field = el_doc_field_find(p->doc, name, len);
+	if (field < 0) {
+		el_expr_error(p, "Unknown field");
+		return false;
+	}
+	memset(&inst, 0, sizeof(el_expr_inst_t));
+	inst.code = EL_EXPR_CMP;
+	inst.field = (uint8_t)field;
+	inst.offset = (uint16_t)el_util_field_offset(p->doc, inst.field);
+
+	/* Get the comparison operator. */
+	for (i = 0; i < 6; i++) {
+		if (el_expr_accept(p, ops[i]))
+			break;
+	}
+	if (i == 6) {
+		el_expr_error(p, "Expected a comparison operator");
+		return false;
+	}
+	inst.cmp = (uint8_t)cmps[i];
+
+	/* Check for nulls. */
+	if (el_expr_accept(p, "NULL")) {
+		if ((inst.cmp != EL_CMP_EQ) && (inst.cmp != EL_CMP_NE)) {
+			el_expr_error(p, "Nulls can only be checked with == or !=");
+			return false;
+		}
+
+		inst.cmp = (inst.cmp == EL_CMP_EQ) ? EL_CMP_IS_NULL : EL_CMP_NOT_NULL;
+		el_expr_emit(p, inst);
+		return true;
+	}
+
+	/* Arrays can only be checked for nulls. */
+	if (el_util_is_array(&(p->doc->field_defs[field]))) {
+		el_expr_error(p, "Arrays can't be compared");
+		return false;
+	}
+
+	/* Get the literal value. */
+	el_expr_accept(p, "");
+	if (el_util_is_string(&(p->doc->field_defs[field]))) {
+		const char *start;
+
+		/* String literal. */
+		if (*p->pos != '\'') {
+			el_expr_error(p, "Expected a string literal");
+			return false;
+		}
+		start = ++p->pos;
+		while ((*p->pos != '\'') && (*p->pos != '\0'))
+			p->pos++;
+		if (*p->pos != '\'') {
+			el_expr_error(p, "Unterminated string literal");
+			return false;
+		}
+		if (p->pos == start) {
+			el_util_strcpy(&(inst.string), "");
+		} else {
+			el_util_strstrcpy(&(inst.string), start, p->pos - 1);
+		}
+		p->pos++;
+	} else {
+		const char *end;
+
+		/* Numeric literal. */
+		end = el_util_number_parse(&(inst.number), p->pos);
+		if (end == p->pos) {
+			el_expr_error(p, "Expected a numeric literal");
+			return false;
+		}
+		p->pos = end;
+	}
+
+	el_expr_emit(p, inst);
+	return true;
+}
+
+/**
+ * Skips any whitespace and consumes a token if it's next in the expression.
+ *
+ * @param p     Parser state.
+ * @param token Token to be consumed or an empty string to only skip whitespace.
+ *
+ * @return TRUE if the token was consumed.
+ */
+bool el_expr_accept(el_expr_parser_t *p, const char *token) {
+	size_t len = strlen(token);
+
+	while ((*p->pos == ' ') || (*p->pos == '\t') || (*p->pos == '\n') ||
+		   (*p->pos == '\r'))
+		p->pos++;
+
+	if ((len == 0) || (strncmp(p->pos, token, len) != 0))
+		return false;
+
+	p->pos += len;
+	return true;
+}
+
+/**
+ * Appends an instruction to the expression being compiled and keeps track of
+ * the evaluation stack depth it requires.
+ *
+ * @param p    Parser state.
+ * @param inst Instruction to be appended.
+ */
+void el_expr_emit(el_expr_parser_t *p, el_expr_inst_t inst) {
+	el_expr_t *expr = p->expr;
+
+	/* Append the instruction. */
+	expr->len++;
+	expr->code = (el_expr_inst_t *)realloc(
+		expr->code, sizeof(el_expr_inst_t) * expr->len);
+	expr->code[expr->len - 1] = inst;
+
+	/* Comparisons push a result and the binary operators pop one. */
+	switch (inst.code) {
+		case EL_EXPR_CMP:
+			p->depth++;
+			if (p->depth > expr->depth)
+				expr->depth = p->depth;
+			break;
+		case EL_EXPR_AND:
+		case EL_EXPR_OR:
+			p->depth--;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Sets the error message for a problem found while compiling an expression.
+ *
+ * @param p   Parser state.
+ * @param msg Description of the problem.
+ */
+void el_expr_error(const el_expr_parser_t *p, const char *msg) {
+	el_error_msg_format(EMSG("%s at position %u of expression \"%s\"."), msg,
+						(unsigned int)(p->pos - p->src), p->src);
+}
+
+/**
+ * Splits the top level && chain of a compiled expression into separate terms
+ * and reorders them so that the ones that only compare numeric fields come
+ * first. This allows the string fields to only be looked at for the rows that
+ * survived the cheaper comparisons.
+ *
+ * @param expr Compiled filter expression.
+ * @param doc  Document handle.
+ */
+void el_expr_split(el_expr_t *expr, const eld_handle_t *doc) {
+	el_expr_inst_t *code;
+	uint16_t *starts;
+	uint16_t *ends;
+	uint16_t *pending;
+	uint16_t count = 0;
+	uint16_t npending = 0;
+	uint16_t len = 0;
+	uint16_t i;
+	uint8_t pass;
+
+	/* Find the terms by walking the && operators from the end. */
+	starts = (uint16_t *)malloc(sizeof(uint16_t) * expr->len);
+	ends = (uint16_t *)malloc(sizeof(uint16_t) * expr->len);
+	pending = (uint16_t *)malloc(sizeof(uint16_t) * expr->len);
+	pending[npending++] = expr->len - 1;
+	while (npending > 0) {
+		uint16_t end = pending[--npending];
+
+		if (expr->code[end].code == EL_EXPR_AND) {
+			/* Visit the left side first to keep the original order. */
+			pending[npending++] = end - 1;
+			pending[npending++] = el_expr_subtree(expr, end - 1) - 1;
+		} else {
+			starts[count] = el_expr_subtree(expr, end);
+			ends[count++] = end + 1;
+		}
+	}
+
+	/* Rebuild the program with the numeric terms first. */
+	code = (el_expr_inst_t *)malloc(sizeof(el_expr_inst_t) * expr->len);
+	expr->terms = (uint16_t *)malloc(sizeof(uint16_t) * count);
+	expr->term_count = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < count; i++) {
+			uint16_t pc;
+			uint8_t strings = 0;
+
+			/* Check if the term has to look at any strings. */
+			for (pc = starts[i]; pc < ends[i]; pc++) {
+				if ((expr->code[pc].code == EL_EXPR_CMP) &&
+					el_util_is_string(
+						&(doc->field_defs[expr->code[pc].field])))
+					strings = 1;
+			}
+			if (strings != pass)
+				continue;
+
+			/* Copy it over. */
+			for (pc = starts[i]; pc < ends[i]; pc++)
+				code[len++] = expr->code[pc];
+			expr->terms[expr->term_count++] = len;
+		}
+	}
+
+	/* Replace the program. */
+	free(expr->code);
+	expr->code = code;
+	expr->len = len;
+
+	free(pending);
+	free(starts);
+	free(ends);
+}
+
+/**
+ * Finds where the sub-expression that ends at an instruction starts.
+ *
+ * @param expr Compiled filter expression.
+ * @param end  Index of the last instruction of the sub-expression.
+ *
+ * @return Index of the first instruction of the sub-expression.
+ */
+uint16_t el_expr_subtree(const el_expr_t *expr, uint16_t end) {
+	uint16_t needed = 1;
+
+	while (true) {
+		needed--;
+		switch (expr->code[end].code) {
+			case EL_EXPR_AND:
+			case EL_EXPR_OR:
+				needed += 2;
+				break;
+			case EL_EXPR_NOT:
+				needed++;
+				break;
+			default:
+				break;
+		}
+
+		if (needed == 0)
+			return end;
+		end--;
+	}
+}
+
+/**
+ * Narrows down a selection of rows to the ones that match a compiled
+ * expression. Each term of the expression is only evaluated for the rows that
+ * passed the ones before it.
+ *
+ * @param expr      Compiled filter expression.
+ * @param doc       Document handle.
+ * @param block     Raw rows to be evaluated.
+ * @param sel       Positions of the selected rows inside the block. Will be
+ *                  updated in place.
+ * @param sel_count Number of selected rows.
+ * @param stack     Evaluation stack with room for depth blocks of results.
+ *
+ * @return Number of rows still selected.
+ */
+uint16_t el_expr_filter(const el_expr_t *expr, const eld_handle_t *doc,
+						const char *block, uint32_t first, uint16_t *sel,
+						uint16_t sel_count, uint8_t *stack) {
+	uint16_t from = 0;
+	uint16_t t;
+
+	for (t = 0; (t < expr->term_count) && (sel_count > 0); t++) {
+		uint16_t n = 0;
+		uint16_t i;
+
+		/* Evaluate the term and compact the selection. */
+		el_expr_eval(expr, from, expr->terms[t], doc, block, first, sel,
+					 sel_count, stack);
+		for (i = 0; i < sel_count; i++) {
+			sel[n] = sel[i];
+			n += stack[i];
+		}
+
+		sel_count = n;
+		from = expr->terms[t];
+	}
+
+	return sel_count;
+}
+
+/**
+ * Evaluates part of a compiled expression over the selected rows of a block,
+ * one instruction at a time for all of them.
+ *
+ * @param expr      Compiled filter expression.
+ * @param from      Index of the first instruction to be evaluated.
+ * @param to        Index after the last instruction to be evaluated.
+ * @param doc       Document handle.
+ * @param block     Raw rows to be evaluated.
+ * @param sel       Positions of the selected rows inside the block.
+ * @param sel_count Number of selected rows.
+ * @param stack     Evaluation stack with room for depth blocks of results.
+ *
+ * @return Array with a non-zero value for each matching selected row.
+ */
+uint8_t *el_expr_eval(const el_expr_t *expr, uint16_t from, uint16_t to,
+					  const eld_handle_t *doc, const char *block,
+					  uint32_t first, const uint16_t *sel, uint16_t sel_count,
+					  uint8_t *stack) {
+	/* Comparison results indexed by the sign of the difference plus one. */
+	static const uint8_t matches[] = { 2, 5, 1, 3, 4, 6 };
+	size_t row_len = doc->header.row_len;
+	bool nullable = (doc->ext.flags & EL_EXT_NULLS) != 0;
+	uint8_t *a;
+	uint8_t *b;
+	uint16_t pc;
+	uint8_t sp = 0;
+	uint16_t i;
+
+	for (pc = from; pc < to; pc++) {
+		const el_expr_inst_t *inst = &(expr->code[pc]);
+		const el_field_def_t *field;
+		const char *raw;
+
+		switch (inst->code) {
+			case EL_EXPR_CMP:
+				a = stack + ((size_t)sp * EL_SCAN_BLOCK_ROWS);
+				field = &(doc->field_defs[inst->field]);
+				raw = block + inst->offset;
+				for (i = 0; i < sel_count; i++) {
+					const char *cell = raw + (row_len * sel[i]);
+					bool null = nullable && el_doc_raw_null(doc,
+						block + (row_len * sel[i]), inst->field);
+					int sign;
+
+					/* Nulls only match the null checks. */
+					if (inst->cmp >= EL_CMP_IS_NULL) {
+						a[i] = null == (inst->cmp == EL_CMP_IS_NULL);
+						continue;
+					} else if (null) {
+						a[i] = 0;
+						continue;
+					}
+
+					if (field->type == EL_FIELD_STRING) {
+						sign = strncmp(cell, inst->string, field->size_bytes);
+						sign = (sign > 0) - (sign < 0);
+					} else if (field->type == EL_FIELD_VARCHAR) {
+						sign = el_heap_cmp(doc, field, cell, inst->string);
+						sign = (sign > 0) - (sign < 0);
+					} else {
+						el_number_t value;
+
+						el_doc_raw_exact(doc, field, cell, first + sel[i],
+										 &value);
+						sign = el_util_number_cmp(&value, &(inst->number));
+					}
+
+					a[i] = (matches[inst->cmp] >> (sign + 1)) & 1;
+				}
+				sp++;
+				break;
+			case EL_EXPR_AND:
+			case EL_EXPR_OR:
+				sp--;
+				a = stack + ((size_t)(sp - 1) * EL_SCAN_BLOCK_ROWS);
+				b = stack + ((size_t)sp * EL_SCAN_BLOCK_ROWS);
+				if (inst->code == EL_EXPR_AND) {
+					for (i = 0; i < sel_count; i++)
+						a[i] &= b[i];
+				} else {
+					for (i = 0; i < sel_count; i++)
+						a[i] |= b[i];
+				}
+				break;
+			case EL_EXPR_NOT:
+				a = stack + ((size_t)(sp - 1) * EL_SCAN_BLOCK_ROWS);
+				for (i = 0; i < sel_count; i++)
+					a[i] = !a[i];
+				break;
+		}
+	}
+
+	return stack;
+}
+
+/**
+ * Builds Bloom filters for a field of the document. Each full block of
+ * EL_SCAN_BLOCK_ROWS rows gets its own split-block Bloom filter, stored in a
+ * sidecar file next to the document, which is kept up to date as rows are
+ * added or updated. Scans use them to skip the blocks that can't match an
+ * equality comparison on the field.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the field to be indexed.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field doesn't exist or isn't stored in
+ *         the rows.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_bloom_add(eld_handle_t *doc, uint8_t field) {
+	uint8_t i;
+
+	/* Check if the field exists. */
+	if (field >= doc->header.field_desc_count) {
+		el_error_msg_format(EMSG("Field %u doesn't exist."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (el_util_field_implicit(&(doc->field_defs[field]))) {
+		el_error_msg_format(EMSG("Field %u isn't stored in the rows."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (doc->field_defs[field].type == EL_FIELD_VARCHAR) {
+		el_error_msg_format(EMSG("Field %u has variable-length strings."),
+							field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (el_util_is_array(&(doc->field_defs[field]))) {
+		el_error_msg_format(EMSG("Field %u is an array."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+	if (doc->ext.ring_rows > 0) {
+		el_error_msg_set(EMSG("Ring documents can't have Bloom filters."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Add the field to the list if it isn't already there. */
+	for (i = 0; i < doc->bloom_count; i++) {
+		if (doc->bloom_fields[i] == field)
+			break;
+	}
+	if (i == doc->bloom_count) {
+		doc->bloom_count++;
+		doc->bloom_fields = (uint8_t *)realloc(doc->bloom_fields,
+											   doc->bloom_count);
+		doc->bloom_fields[i] = field;
+	}
+
+	/* Build the filters for the blocks that are already full. */
+	return el_bloom_sync(doc, field);
+}
+
+/**
+ * Looks for the Bloom filter sidecars of a document that was just read.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ */
+el_err_t el_bloom_load(eld_handle_t *doc) {
+	char suffix[8];
+	uint8_t i;
+
+	doc->bloom_count = 0;
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		el_bloom_header_t header;
+		FILE *fh;
+
+		/* Check if there's a sidecar for this field. */
+		sprintf(suffix, ".bf%u", i);
+		fh = el_util_sidecar_fopen(doc, suffix, "rb");
+		if (fh == NULL)
+			continue;
+		if ((fread(&header, sizeof(el_bloom_header_t), 1, fh) == 1) &&
+			!el_util_sidecar_owned(doc, header.doc_id)) {
+			el_util_sidecar_drop(doc, suffix, fh);
+			continue;
+		}
+		fclose(fh);
+
+		/* Add it to the list. */
+		doc->bloom_count++;
+		doc->bloom_fields = (uint8_t *)realloc(doc->bloom_fields,
+											   doc->bloom_count);
+		doc->bloom_fields[doc->bloom_count - 1] = i;
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Builds the Bloom filters of the full blocks of a field that haven't been
+ * added to its sidecar yet.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the field.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_bloom_sync(eld_handle_t *doc, uint8_t field) {
+	el_bloom_header_t header;
+	el_bloom_t bloom;
+	uint32_t full;
+	char suffix[8];
+	el_err_t err = EL_OK;
+
+	/* Open the sidecar or create a brand new one. */
+	sprintf(suffix, ".bf%u", field);
+	bloom.fh = el_util_sidecar_fopen(doc, suffix, "r+b");
+	if ((bloom.fh == NULL) ||
+		(fread(&header, sizeof(el_bloom_header_t), 1, bloom.fh) != 1) ||
+		!el_util_sidecar_owned(doc, header.doc_id)) {
+		if (bloom.fh != NULL)
+			fclose(bloom.fh);
+		bloom.fh = el_util_sidecar_fopen(doc, suffix, "w+b");
+		if (bloom.fh == NULL) {
+			el_error_msg_format(EMSG("Couldn't create the Bloom filter of "
+									 "field %u: %s."), field, strerror(errno));
+			return EL_ERROR_FILE;
+		}
+
+		header.magic[0] = 'E';
+		header.magic[1] = 'B';
+		header.field = field;
+		header.buckets = EL_BLOOM_BUCKETS;
+		header.block_rows = EL_SCAN_BLOCK_ROWS;
+		header.block_count = 0;
+		header.doc_id = doc->ext.doc_id;
+	}
+
+	/* Build the filters of the blocks that are missing. */
+	full = doc->header.row_count / EL_SCAN_BLOCK_ROWS;
+	if (header.block_count < full) {
+		bloom.field = &(doc->field_defs[field]);
+		bloom.offset = el_util_field_offset(doc, field);
+
+		err = el_doc_scan_blocks(doc, header.block_count * EL_SCAN_BLOCK_ROWS,
+								 (full - header.block_count) *
+								 EL_SCAN_BLOCK_ROWS, NULL, el_bloom_block,
+								 &bloom);
+		if (err == EL_OK)
+			header.block_count = full;
+	}
+
+	/* Save the header. */
+	fseek(bloom.fh, 0, SEEK_SET);
+	fwrite(&header, sizeof(el_bloom_header_t), 1, bloom.fh);
+	if (ferror(bloom.fh)) {
+		el_error_msg_format(EMSG("Couldn't write the Bloom filter of field "
+								 "%u: %s."), field, strerror(errno));
+		err = EL_ERROR_FILE;
+	}
+	fclose(bloom.fh);
+
+	return err;
+}
+
+/**
+ * Builds the Bloom filter of a full block of rows and writes it to its place
+ * in the sidecar. Blocks that were truncated are never read, so their filters
+ * are left empty.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Bloom filter state.
+ *
+ * @return False if the filter couldn't be written.
+ */
+bool el_bloom_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg) {
+	el_bloom_t *bloom = (el_bloom_t *)arg;
+	const char *raw = block + bloom->offset;
+	uint32_t i;
+
+	/* Build the filter. */
+	memset(bloom->words, 0, sizeof(bloom->words));
+	for (i = 0; i < count; i++) {
+		el_bloom_insert(bloom->words, el_util_key_hash(bloom->field, raw));
+		raw += doc->header.row_len;
+	}
+
+	/* Write it to the sidecar. */
+	fseek(bloom->fh, sizeof(el_bloom_header_t) +
+		  ((first / EL_SCAN_BLOCK_ROWS) * sizeof(bloom->words)), SEEK_SET);
+	return fwrite(bloom->words, sizeof(bloom->words), 1, bloom->fh) == 1;
+}
+
+/**
+ * Adds the values of a row that was just updated to the Bloom filters of its
+ * block. Old values are left behind since they only cause false positives.
+ *
+ * @param doc Document handle.
+ * @param row Row that was updated.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_bloom_update(eld_handle_t *doc, const el_row_t *row) {
+	uint32_t block = row->index / EL_SCAN_BLOCK_ROWS;
+	uint8_t i;
+
+	for (i = 0; i < doc->bloom_count; i++) {
+		const el_cell_t *cell = &(row->cells[doc->bloom_fields[i]]);
+		el_bloom_header_t header;
+		uint32_t words[EL_BLOOM_BUCKETS * 8];
+		uint32_t hash;
+		char suffix[8];
+		FILE *fh;
+
+		/* Open the sidecar. */
+		sprintf(suffix, ".bf%u", doc->bloom_fields[i]);
+		fh = el_util_sidecar_fopen(doc, suffix, "r+b");
+		if (fh == NULL)
+			continue;
+
+		/* Only full blocks have filters. */
+		if ((fread(&header, sizeof(el_bloom_header_t), 1, fh) != 1) ||
+			(block >= header.block_count)) {
+			fclose(fh);
+			continue;
+		}
+
+		/* Add the value to the filter. */
+		if (cell->field->type == EL_FIELD_STRING) {
+			hash = el_util_key_hash(cell->field, cell->value.string);
+		} else if (cell->field->type == EL_FIELD_BOOL) {
+			el_number_t value;
+
+			el_util_number_set(&value, cell->value.boolean ? 1 : 0);
+			hash = el_util_number_hash(&value);
+		} else {
+			hash = el_util_key_hash(cell->field, (const char *)&(cell->value));
+		}
+		fseek(fh, sizeof(el_bloom_header_t) + (block * sizeof(words)),
+			  SEEK_SET);
+		fread(words, sizeof(words), 1, fh);
+		el_bloom_insert(words, hash);
+		fseek(fh, sizeof(el_bloom_header_t) + (block * sizeof(words)),
+			  SEEK_SET);
+		fwrite(words, sizeof(words), 1, fh);
+
+		/* Check if everything went fine. */
+		if (ferror(fh)) {
+			el_error_msg_format(EMSG("Couldn't update the Bloom filter of "
+									 "field %u: %s."), doc->bloom_fields[i],
+								strerror(errno));
+			fclose(fh);
+			return EL_ERROR_FILE;
+		}
+		fclose(fh);
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Checks the equality comparisons of an expression against the Bloom filters
+ * of the document to find out which blocks may contain matching rows.
+ *
+ * @param doc  Document handle.
+ * @param expr Compiled filter expression.
+ *
+ * @return Array indexed by block number with a non-zero value for the blocks
+ *         that need to be read or NULL if none of the filters could be used.
+ */
+uint8_t *el_bloom_candidates(eld_handle_t *doc, const el_expr_t *expr) {
+	uint32_t words[EL_BLOOM_BUCKETS * 8];
+	uint8_t *blocks = NULL;
+	uint32_t nblocks;
+	uint16_t from = 0;
+	uint16_t t;
+
+	nblocks = (doc->header.row_count + EL_SCAN_BLOCK_ROWS - 1) /
+		EL_SCAN_BLOCK_ROWS;
+	for (t = 0; t < expr->term_count; from = expr->terms[t++]) {
+		const el_expr_inst_t *inst = &(expr->code[from]);
+		const el_field_def_t *field;
+		el_bloom_header_t header;
+		uint32_t hash;
+		uint32_t b;
+		char suffix[8];
+		FILE *fh;
+
+		/* Only terms that are a single equality comparison can be used. */
+		if ((expr->terms[t] != (from + 1)) || (inst->cmp != EL_CMP_EQ))
+			continue;
+
+		/* Open the sidecar of the field if it has one. */
+		sprintf(suffix, ".bf%u", inst->field);
+		fh = el_util_sidecar_fopen(doc, suffix, "rb");
+		if (fh == NULL)
+			continue;
+		if (fread(&header, sizeof(el_bloom_header_t), 1, fh) != 1) {
+			fclose(fh);
+			continue;
+		}
+
+		/* Hash the value we are looking for. */
+		field = &(doc->field_defs[inst->field]);
+		if (field->type == EL_FIELD_STRING) {
+			size_t len = strlen(inst->string);
+			hash = el_util_hash(inst->string, (len < field->size_bytes) ?
+								len : field->size_bytes);
+		} else {
+			hash = el_util_number_hash(&(inst->number));
+		}
+
+		/* Check the filter of every full block. */
+		if (blocks == NULL) {
+			blocks = (uint8_t *)malloc(nblocks + 1);
+			memset(blocks, 1, nblocks + 1);
+		}
+		for (b = 0; (b < header.block_count) && (b < nblocks); b++) {
+			if (fread(words, sizeof(words), 1, fh) != 1)
+				break;
+			if (!el_bloom_check(words, hash))
+				blocks[b] = 0;
+		}
+		fclose(fh);
+	}
+
+	return blocks;
+}
+
+/**
+ * Sets the bits of a hash in a split-block Bloom filter. The hash selects a
+ * 256-bit bucket and one bit is set in each of its 8 words.
+ *
+ * @param words Words of the filter.
+ * @param hash  Hash of the value.
+ */
+void el_bloom_insert(uint32_t *words, uint32_t hash) {
+	uint32_t *bucket;
+	uint8_t i;
+
+	bucket = words + ((((uint32_t)(hash * 0x9E3779B1UL)) >> 16) %
+					  EL_BLOOM_BUCKETS) * 8;
+	for (i = 0; i < 8; i++) {
+		bucket[i] |= 1UL << (((uint32_t)(hash * el_bloom_salts[i])) >> 27);
+	}
+}
+
+/**
+ * Checks if a hash may have been added to a split-block Bloom filter.
+ *
+ * @param words Words of the filter.
+ * @param hash  Hash of the value.
+ *
+ * @return False if the value was definitely never added to the filter.
+ */
+bool el_bloom_check(const uint32_t *words, uint32_t hash) {
+	const uint32_t *bucket;
+	uint32_t missing = 0;
+	uint8_t i;
+
+	bucket = words + ((((uint32_t)(hash * 0x9E3779B1UL)) >> 16) %
+					  EL_BLOOM_BUCKETS) * 8;
+	for (i = 0; i < 8; i++) {
+		missing |= ~bucket[i] &
+			(1UL << (((uint32_t)(hash * el_bloom_salts[i])) >> 27));
+	}
+
+	return missing == 0;
+}
+
+/**
+ * Builds an index over a string field that maps every distinct value to the
+ * rows it appears in. Keys are sorted, so the index can answer prefix and range
+ * queries with a binary search. The index is saved to a sidecar file next to
+ * the document with fixed size entries, so it can be searched in place.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the string field.
+ *
+ * @return Brand new index or NULL if an error occurred.
+ *
+ * @see el_index_free
+ */
+el_index_t *el_index_build(eld_handle_t *doc, uint8_t field) {
+	return el_index_create(doc, field, NULL, NULL);
+}
+
+/**
+ * Builds an index over a string field that the document keeps up to date as
+ * rows are added or updated. New keys go into a small sorted delta in memory
+ * that lookups consult alongside the persisted index, and the delta is merged
+ * into the sidecar once it has EL_INDEX_DELTA_ROWS entries, when
+ * el_index_merge is called or when the document is free'd.
+ *
+ * @param doc      Document handle.
+ * @param field    Index of the string field.
+ * @param progress Function called after every block of rows is read while
+ *                 building the index, or NULL.
+ * @param arg      Opaque pointer passed along to the progress callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field isn't a string field or the build was
+ *         cancelled.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ *
+ * @see el_doc_index
+ */
+el_err_t el_index_add(eld_handle_t *doc, uint8_t field,
+					  el_progress_cb_t progress, void *arg) {
+	el_index_t *idx;
+	uint8_t i;
+
+	/* Build the index. */
+	idx = el_index_create(doc, field, progress, arg);
+	if (idx == NULL)
+		return EL_ERROR_ARGUMENT;
+
+	/* Replace the one we had or add it to the list. */
+	for (i = 0; i < doc->index_count; i++) {
+		if (doc->indexes[i]->header.field == field) {
+			el_index_free(doc->indexes[i]);
+			doc->indexes[i] = idx;
+			return EL_OK;
+		}
+	}
+	doc->index_count++;
+	doc->indexes = (el_index_t **)realloc(doc->indexes,
+		sizeof(el_index_t *) * doc->index_count);
+	doc->indexes[doc->index_count - 1] = idx;
+
+	return EL_OK;
+}
+
+/**
+ * Gets the string index of a field that's being kept up to date by the
+ * document.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the string field.
+ *
+ * @return String index owned by the document or NULL if the field isn't
+ *         indexed.
+ *
+ * @see el_index_add
+ */
+const el_index_t *el_doc_index(const eld_handle_t *doc, uint8_t field) {
+	uint8_t i;
+
+	for (i = 0; i < doc->index_count; i++) {
+		if (doc->indexes[i]->header.field == field)
+			return doc->indexes[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Merges the deltas of all the string indexes of a document into their
+ * sidecars.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_index_merge(eld_handle_t *doc) {
+	uint8_t i;
+
+	for (i = 0; i < doc->index_count; i++) {
+		el_err_t err;
+
+		if ((doc->indexes[i]->delta_count == 0) &&
+			(doc->indexes[i]->stale == NULL))
+			continue;
+
+		err = el_index_merge_one(doc, doc->indexes[i]);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Builds a string index and saves it to its sidecar.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc      Document handle.
+ * @param field    Index of the string field.
+ * @param progress Function called after every block of rows is read, or NULL.
+ * @param arg      Opaque pointer passed along to the progress callback.
+ *
+ * @return Brand new index or NULL if an error occurred.
+ */
+el_index_t *el_index_create(eld_handle_t *doc, uint8_t field,
+						   el_progress_cb_t progress, void *arg) {
+	el_index_build_t build;
+	el_index_t *idx;
+	uint32_t *rows;
+	uint32_t total;
+	uint32_t i;
+	uint32_t n;
+	uint32_t first;
+	el_err_t err;
+
+	/* Check if the field can be indexed. */
+	if ((field >= doc->header.field_desc_count) ||
+		(doc->field_defs[field].type != EL_FIELD_STRING)) {
+		el_error_msg_format(EMSG("Field %u isn't a string field."), field);
+		return NULL;
+	}
+
+	/* Gather the keys of every row that wasn't truncated. */
+	build.offset = el_util_field_offset(doc, field);
+	build.key_len = doc->field_defs[field].size_bytes;
+	build.base = doc->ext.row_base;
+	build.progress = progress;
+	build.arg = arg;
+	build.cancelled = false;
+	total = doc->header.row_count - build.base;
+	build.keys = (char *)malloc((size_t)build.key_len * (total + 1));
+	err = el_doc_scan_blocks(doc, 0, doc->header.row_count, NULL,
+							 el_index_build_block, &build);
+	if (build.cancelled) {
+		el_error_msg_format(EMSG("Index build of field %u was cancelled."),
+							field);
+		err = EL_ERROR_ARGUMENT;
+	}
+	IF_EL_ERROR(err) {
+		free(build.keys);
+		return NULL;
+	}
+
+	/* Sort the rows by their keys. (Counting from the base for now) */
+	rows = (uint32_t *)malloc(sizeof(uint32_t) * (total + 1));
+	for (i = 0; i < total; i++)
+		rows[i] = i;
+	el_index_sort(rows, total, build.keys, build.key_len);
+
+	/* Set up the index. */
+	idx = (el_index_t *)malloc(sizeof(el_index_t));
+	idx->header.magic[0] = 'E';
+	idx->header.magic[1] = 'I';
+	idx->header.field = field;
+	idx->header.reserved = 0;
+	idx->header.key_len = build.key_len;
+	idx->header.entry_len = build.key_len + (2 * sizeof(uint32_t));
+	idx->header.key_count = 0;
+	idx->header.row_count = doc->header.row_count;
+	idx->header.doc_id = doc->ext.doc_id;
+	idx->postings = rows;
+	idx->delta_count = 0;
+	idx->delta_capacity = 0;
+	idx->delta = NULL;
+	idx->stale = NULL;
+	idx->entries = (char *)malloc((size_t)idx->header.entry_len *
+								  (total + 1));
+
+	/* Group the live rows with the same key into entries. */
+	for (i = 0, n = 0; i < total; i++) {
+		const char *key = build.keys + ((size_t)build.key_len * rows[i]);
+		char *entry;
+		uint32_t count;
+
+		if (el_doc_row_deleted(doc, build.base + rows[i]))
+			continue;
+		rows[n++] = build.base + rows[i];
+
+		/* Check if this is just another row of the previous key. */
+		entry = idx->entries + ((size_t)idx->header.entry_len *
+								idx->header.key_count);
+		if ((idx->header.key_count > 0) &&
+			(strncmp(entry - idx->header.entry_len, key, build.key_len) == 0)) {
+			entry -= idx->header.entry_len;
+			memcpy(&count, entry + build.key_len + sizeof(uint32_t),
+				   sizeof(uint32_t));
+			count++;
+			memcpy(entry + build.key_len + sizeof(uint32_t), &count,
+				   sizeof(uint32_t));
+			continue;
+		}
+
+		/* Start a new entry. */
+		count = 1;
+		first = n - 1;
+		memcpy(entry, key, build.key_len);
+		memcpy(entry + build.key_len, &first, sizeof(uint32_t));
+		memcpy(entry + build.key_len + sizeof(uint32_t), &count,
+			   sizeof(uint32_t));
+		idx->header.key_count++;
+	}
+	free(build.keys);
+
+	/* Save it. */
+	err = el_index_save(doc, idx);
+	IF_EL_ERROR(err) {
+		el_index_free(idx);
+		return NULL;
+	}
+
+	return idx;
+}
+
+/**
+ * Copies the keys of a block of rows while building a string index.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Index build state.
+ *
+ * @return False if the user cancelled the build.
+ */
+bool el_index_build_block(eld_handle_t *doc, const char *block, uint32_t first,
+						  uint32_t count, void *arg) {
+	el_index_build_t *build = (el_index_build_t *)arg;
+	char *key = build->keys + ((size_t)build->key_len * (first - build->base));
+	uint32_t i;
+
+	block += build->offset;
+	for (i = 0; i < count; i++) {
+		memcpy(key, block, build->key_len);
+		key += build->key_len;
+		block += doc->header.row_len;
+	}
+
+	/* Let the user know how far along we are. */
+	if ((build->progress != NULL) &&
+		!build->progress(first + count, doc->header.row_count, build->arg)) {
+		build->cancelled = true;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Sorts a list of rows by their keys. The sort is stable, so rows with the same
+ * key stay in ascending order.
+ *
+ * @param rows    Rows to be sorted.
+ * @param count   Number of rows.
+ * @param keys    Keys of every row in the document.
+ * @param key_len Length of each key.
+ */
+void el_index_sort(uint32_t *rows, uint32_t count, const char *keys,
+				   uint16_t key_len) {
+	uint32_t *tmp;
+	uint32_t *src;
+	uint32_t *dst;
+	uint32_t width;
+
+	/* Bottom-up merge sort. */
+	tmp = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+	src = rows;
+	dst = tmp;
+	for (width = 1; width < count; width *= 2) {
+		uint32_t lo;
+		uint32_t *swap;
+
+		for (lo = 0; lo < count; lo += 2 * width) {
+			uint32_t mid = ((lo + width) < count) ? (lo + width) : count;
+			uint32_t hi = ((mid + width) < count) ? (mid + width) : count;
+			uint32_t a = lo;
+			uint32_t b = mid;
+			uint32_t k = lo;
+
+			while ((a < mid) && (b < hi)) {
+				if (strncmp(keys + ((size_t)key_len * src[b]),
+							keys + ((size_t)key_len * src[a]), key_len) < 0) {
+					dst[k++] = src[b++];
+				} else {
+					dst[k++] = src[a++];
+				}
+			}
+			while (a < mid)
+				dst[k++] = src[a++];
+			while (b < hi)
+				dst[k++] = src[b++];
+		}
+
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	/* Make sure the sorted rows end up in the right place. */
+	if (src != rows)
+		memcpy(rows, src, sizeof(uint32_t) * count);
+	free(tmp);
+}
+
+/**
+ * Saves a string index to its sidecar file.
+ *
+ * @param doc Document handle.
+ * @param idx String index.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_index_save(const eld_handle_t *doc, const el_index_t *idx) {
+	char suffix[8];
+	FILE *fh;
+
+	/* Open the sidecar. */
+	sprintf(suffix, ".ix%u", idx->header.field);
+	fh = el_util_sidecar_fopen(doc, suffix, "wb");
+	if (fh == NULL) {
+		el_error_msg_format(EMSG("Couldn't create the index of field %u: %s."),
+							idx->header.field, strerror(errno));
+		return EL_ERROR_FILE;
+	}
+
+	/* Write the header, entries and posting lists. */
+	fwrite(&(idx->header), sizeof(el_index_header_t), 1, fh);
+	fwrite(idx->entries, idx->header.entry_len, idx->header.key_count, fh);
+	fwrite(idx->postings, sizeof(uint32_t), el_index_posting_count(idx), fh);
+	if (ferror(fh)) {
+		el_error_msg_format(EMSG("Couldn't write the index of field %u: %s."),
+							idx->header.field, strerror(errno));
+		fclose(fh);
+		return EL_ERROR_FILE;
+	}
+
+	fclose(fh);
+	return EL_OK;
+}
+
+/**
+ * Opens the string index of a field that was previously built.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the string field.
+ *
+ * @return String index or NULL if it couldn't be read.
+ *
+ * @see el_index_build
+ */
+el_index_t *el_index_open(const eld_handle_t *doc, uint8_t field) {
+	el_index_t *idx;
+	uint32_t count;
+	char suffix[8];
+	FILE *fh;
+
+	/* Open the sidecar. */
+	sprintf(suffix, ".ix%u", field);
+	fh = el_util_sidecar_fopen(doc, suffix, "rb");
+	if (fh == NULL) {
+		el_error_msg_format(EMSG("Couldn't open the index of field %u: %s."),
+							field, strerror(errno));
+		return NULL;
+	}
+
+	/* Read the header. */
+	idx = (el_index_t *)malloc(sizeof(el_index_t));
+	idx->entries = NULL;
+	idx->postings = NULL;
+	idx->delta_count = 0;
+	idx->delta_capacity = 0;
+	idx->delta = NULL;
+	idx->stale = NULL;
+	if ((fread(&(idx->header), sizeof(el_index_header_t), 1, fh) != 1) ||
+		(idx->header.magic[0] != 'E') || (idx->header.magic[1] != 'I') ||
+		(idx->header.field != field) ||
+		!el_util_sidecar_owned(doc, idx->header.doc_id)) {
+		el_error_msg_format(EMSG("Invalid index file for field %u."), field);
+		goto fail;
+	}
+
+	/* Read the entries. */
+	idx->entries = (char *)malloc((size_t)idx->header.entry_len *
+								  (idx->header.key_count + 1));
+	if (fread(idx->entries, idx->header.entry_len, idx->header.key_count,
+			  fh) != idx->header.key_count) {
+		el_error_msg_format(EMSG("Index file for field %u is truncated."),
+							field);
+		goto fail;
+	}
+
+	/* Read the posting lists. */
+	count = el_index_posting_count(idx);
+	idx->postings = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+	if (fread(idx->postings, sizeof(uint32_t), count, fh) != count) {
+		el_error_msg_format(EMSG("Index file for field %u is truncated."),
+							field);
+		goto fail;
+	}
+
+	fclose(fh);
+	return idx;
+
+fail:
+	fclose(fh);
+	el_index_free(idx);
+	return NULL;
+}
+
+/**
+ * Frees up any resources allocated by a string index.
+ *
+ * @param idx String index to be free'd.
+ */
+void el_index_free(el_index_t *idx) {
+	if (idx == NULL)
+		return;
+
+	free(idx->entries);
+	free(idx->postings);
+	free(idx->delta);
+	el_bitmap_free(idx->stale);
+	free(idx);
+}
+
+/**
+ * Gets the number of rows in the posting lists of a string index. Deleted rows
+ * aren't in them, so this may be less than the rows the index covers.
+ *
+ * @param idx String index.
+ *
+ * @return Number of rows in the posting lists.
+ */
+uint32_t el_index_posting_count(const el_index_t *idx) {
+	const char *entry;
+	uint32_t first;
+	uint32_t count;
+
+	if (idx->header.key_count == 0)
+		return 0;
+
+	entry = idx->entries + ((size_t)idx->header.entry_len *
+							(idx->header.key_count - 1));
+	memcpy(&first, entry + idx->header.key_len, sizeof(uint32_t));
+	memcpy(&count, entry + idx->header.key_len + sizeof(uint32_t),
+		   sizeof(uint32_t));
+
+	return first + count;
+}
+
+/**
+ * Remaps the posting lists of a string index after rows were removed from the
+ * document and saves it to its sidecar. Keys that only had removed rows are
+ * dropped.
+ *
+ * @param doc        Document handle. (Already compacted or truncated)
+ * @param idx        String index without a delta.
+ * @param dead       Sorted list of the rows after the base that were removed.
+ * @param dead_count Number of rows after the base that were removed.
+ * @param base       Rows before this one were removed.
+ * @param shift      Should the remaining rows be renumbered from 0?
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_index_remap(const eld_handle_t *doc, el_index_t *idx,
+						const uint32_t *dead, uint32_t dead_count,
+						uint32_t base, bool shift) {
+	uint16_t key_len = idx->header.key_len;
+	uint32_t key_count = 0;
+	uint32_t n = 0;
+	uint32_t k;
+
+	for (k = 0; k < idx->header.key_count; k++) {
+		const char *entry = idx->entries + ((size_t)idx->header.entry_len * k);
+		uint32_t first;
+		uint32_t count;
+		uint32_t start = n;
+		uint32_t i;
+
+		memcpy(&first, entry + key_len, sizeof(uint32_t));
+		memcpy(&count, entry + key_len + sizeof(uint32_t), sizeof(uint32_t));
+
+		/* Shift every row back by the number of rows removed before it. */
+		for (i = first; i < (first + count); i++) {
+			uint32_t row = idx->postings[i];
+			uint32_t lo = 0;
+			uint32_t hi = dead_count;
+
+			if (row < base)
+				continue;
+
+			while (lo < hi) {
+				uint32_t mid = lo + ((hi - lo) / 2);
+
+				if (dead[mid] < row) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			if ((lo < dead_count) && (dead[lo] == row))
+				continue;
+
+			idx->postings[n++] = shift ? (row - base - lo) : row;
+		}
+
+		/* Keep the key if it still has any rows. */
+		if (n > start) {
+			char *dest = idx->entries + ((size_t)idx->header.entry_len *
+										 key_count++);
+
+			count = n - start;
+			memmove(dest, entry, key_len);
+			memcpy(dest + key_len, &start, sizeof(uint32_t));
+			memcpy(dest + key_len + sizeof(uint32_t), &count,
+				   sizeof(uint32_t));
+		}
+	}
+
+	idx->header.key_count = key_count;
+	idx->header.row_count = doc->header.row_count;
+	return el_index_save(doc, idx);
+}
+
+/**
+ * Opens the string index sidecars of a document that was just read and adds
+ * the rows that were appended after they were last merged to their deltas.
+ *
+ * @param doc Document handle.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_index_load(eld_handle_t *doc) {
+	uint8_t i;
+
+	doc->index_count = 0;
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		el_index_header_t header;
+		el_index_t *idx;
+		char suffix[8];
+		uint32_t count;
+		uint32_t j;
+		FILE *fh;
+		el_err_t err;
+
+		/* Check if there's a sidecar for this field. */
+		sprintf(suffix, ".ix%u", i);
+		fh = el_util_sidecar_fopen(doc, suffix, "rb");
+		if (fh == NULL)
+			continue;
+		if ((fread(&header, sizeof(el_index_header_t), 1, fh) == 1) &&
+			!el_util_sidecar_owned(doc, header.doc_id)) {
+			el_util_sidecar_drop(doc, suffix, fh);
+			continue;
+		}
+		fclose(fh);
+
+		/* Open it. */
+		idx = el_index_open(doc, i);
+		if (idx == NULL)
+			return EL_ERROR_FILE;
+		doc->index_count++;
+		doc->indexes = (el_index_t **)realloc(doc->indexes,
+			sizeof(el_index_t *) * doc->index_count);
+		doc->indexes[doc->index_count - 1] = idx;
+
+		/* Hide the rows that were deleted or dropped since it was merged. */
+		if (doc->deleted != NULL)
+			el_bitmap_foreach(doc->deleted, el_index_load_dead, idx);
+		count = el_index_posting_count(idx);
+		for (j = 0; j < count; j++) {
+			if (idx->postings[j] < doc->ext.row_base)
+				el_index_hide(idx, idx->postings[j]);
+		}
+
+		/* Catch up with the rows it's missing. */
+		if (idx->header.row_count < doc->header.row_count) {
+			err = el_doc_scan_blocks(doc, idx->header.row_count,
+									 doc->header.row_count -
+									 idx->header.row_count, NULL,
+									 el_index_load_block, idx);
+			IF_EL_ERROR(err) {
+				return err;
+			}
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Hides a deleted row from a string index that was just opened.
+ *
+ * @param value Index of the deleted row.
+ * @param arg   String index.
+ *
+ * @return Always true since we need every row.
+ */
+bool el_index_load_dead(uint32_t value, void *arg) {
+	el_index_t *idx = (el_index_t *)arg;
+
+	if (value < idx->header.row_count)
+		el_index_hide(idx, value);
+
+	return true;
+}
+
+/**
+ * Adds the keys of a block of rows to the delta of a string index.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   String index.
+ *
+ * @return Always true since we need every row.
+ */
+bool el_index_load_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg) {
+	el_index_t *idx = (el_index_t *)arg;
+	uint32_t i;
+
+	block += el_util_field_offset(doc, idx->header.field);
+	for (i = 0; i < count; i++) {
+		if (!el_doc_row_deleted(doc, first + i))
+			el_index_delta_add(idx, first + i, block);
+		block += doc->header.row_len;
+	}
+
+	return true;
+}
+
+/**
+ * Adds a row that was just written to the deltas of the string indexes of a
+ * document, merging the ones that have grown too large.
+ *
+ * @param doc     Document handle.
+ * @param row     Row that was written.
+ * @param replace Was the row updated instead of appended?
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_index_row(eld_handle_t *doc, const el_row_t *row, bool replace) {
+	uint8_t i;
+
+	for (i = 0; i < doc->index_count; i++) {
+		el_index_t *idx = doc->indexes[i];
+		el_err_t err;
+
+		/* Hide the old key of an updated row. */
+		if (replace)
+			el_index_hide(idx, row->index);
+
+		/* Add the new key. */
+		el_index_delta_add(idx, row->index,
+						   row->cells[idx->header.field].value.string);
+		if (idx->delta_count < EL_INDEX_DELTA_ROWS)
+			continue;
+
+		/* Merge the delta into the index once it's large enough. */
+		err = el_index_merge_one(doc, idx);
+		IF_EL_ERROR(err) {
+			return err;
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Inserts a key into the delta of a string index. The delta is kept sorted by
+ * key and then by row.
+ *
+ * @param idx String index.
+ * @param row Index of the row.
+ * @param key Key of the row. (Up to the width of the field)
+ */
+void el_index_delta_add(el_index_t *idx, uint32_t row, const char *key) {
+	size_t len = (size_t)idx->header.key_len + sizeof(uint32_t);
+	uint32_t lo = 0;
+	uint32_t hi = idx->delta_count;
+	char *entry;
+
+	/* Make room for it. */
+	if (idx->delta_count == idx->delta_capacity) {
+		idx->delta_capacity = (idx->delta_capacity == 0) ? 64 :
+			(idx->delta_capacity * 2);
+		idx->delta = (char *)realloc(idx->delta, len * idx->delta_capacity);
+	}
+
+	/* Find where it goes. Appended rows usually go near the end. */
+	while (lo < hi) {
+		uint32_t mid = lo + ((hi - lo) / 2);
+		uint32_t other;
+		int cmp;
+
+		entry = idx->delta + (len * mid);
+		cmp = strncmp(entry, key, idx->header.key_len);
+		memcpy(&other, entry + idx->header.key_len, sizeof(uint32_t));
+		if ((cmp < 0) || ((cmp == 0) && (other < row))) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	/* Insert it. */
+	entry = idx->delta + (len * lo);
+	memmove(entry + len, entry, len * (idx->delta_count - lo));
+	strncpy(entry, key, idx->header.key_len);
+	memcpy(entry + idx->header.key_len, &row, sizeof(uint32_t));
+	idx->delta_count++;
+}
+
+/**
+ * Hides the current key of a row from the lookups of a string index.
+ *
+ * @param idx String index.
+ * @param row Index of the row.
+ */
+void el_index_hide(el_index_t *idx, uint32_t row) {
+	/* Rows from the delta can simply be removed. */
+	if ((row >= idx->header.row_count) ||
+		((idx->stale != NULL) && el_bitmap_contains(idx->stale, row))) {
+		el_index_delta_remove(idx, row);
+		return;
+	}
+
+	/* Rows in the posting lists are left out until the next merge. */
+	if (idx->stale == NULL)
+		idx->stale = el_bitmap_new();
+	el_bitmap_add(idx->stale, row);
+}
+
+/**
+ * Removes a row from the delta of a string index.
+ *
+ * @param idx String index.
+ * @param row Index of the row.
+ */
+void el_index_delta_remove(el_index_t *idx, uint32_t row) {
+	size_t len = (size_t)idx->header.key_len + sizeof(uint32_t);
+	uint32_t i;
+
+	for (i = 0; i < idx->delta_count; i++) {
+		char *entry = idx->delta + (len * i);
+		uint32_t other;
+
+		memcpy(&other, entry + idx->header.key_len, sizeof(uint32_t));
+		if (other == row) {
+			memmove(entry, entry + len, len * (idx->delta_count - i - 1));
+			idx->delta_count--;
+			return;
+		}
+	}
+}
+
+/**
+ * Merges the delta of a string index into it and saves it to its sidecar.
+ *
+ * @param doc Document handle.
+ * @param idx String index.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_index_merge_one(eld_handle_t *doc, el_index_t *idx) {
+	el_index_merge_t merge;
+
+	/* Walk through every key, just like a lookup would. */
+	merge.key_len = idx->header.key_len;
+	merge.entry_len = idx->header.entry_len;
+	merge.key_count = 0;
+	merge.row_count = 0;
+	merge.entries = (char *)malloc((size_t)merge.entry_len *
+		(idx->header.key_count + idx->delta_count + 1));
+	merge.postings = (uint32_t *)malloc(sizeof(uint32_t) *
+		(el_index_posting_count(idx) + idx->delta_count + 1));
+	el_index_walk(idx, 0, idx->header.key_count, 0, idx->delta_count,
+				  el_index_merge_key, &merge);
+
+	/* Swap the index contents. */
+	free(idx->entries);
+	free(idx->postings);
+	free(idx->delta);
+	el_bitmap_free(idx->stale);
+	idx->entries = merge.entries;
+	idx->postings = merge.postings;
+	idx->header.key_count = merge.key_count;
+	idx->header.row_count = doc->header.row_count;
+	idx->delta_count = 0;
+	idx->delta_capacity = 0;
+	idx->delta = NULL;
+	idx->stale = NULL;
+
+	return el_index_save(doc, idx);
+}
+
+/**
+ * Appends a key to a string index being merged.
+ *
+ * @param key   Key.
+ * @param rows  Rows that have the key.
+ * @param count Number of rows.
+ * @param arg   Merge state.
+ *
+ * @return Always true since we want every key.
+ */
+bool el_index_merge_key(const char *key, const uint32_t *rows, uint32_t count,
+						void *arg) {
+	el_index_merge_t *merge = (el_index_merge_t *)arg;
+	char *entry;
+
+	entry = merge->entries + ((size_t)merge->entry_len * merge->key_count);
+	memcpy(entry, key, merge->key_len);
+	memcpy(entry + merge->key_len, &(merge->row_count), sizeof(uint32_t));
+	memcpy(entry + merge->key_len + sizeof(uint32_t), &count,
+		   sizeof(uint32_t));
+	memcpy(merge->postings + merge->row_count, rows, sizeof(uint32_t) * count);
+
+	merge->key_count++;
+	merge->row_count += count;
+
+	return true;
+}
+
+/**
+ * Looks up all the keys that start with a prefix.
+ *
+ * @param idx    String index.
+ * @param prefix Prefix of the keys.
+ * @param cb     Function called for every matching key, in ascending order,
+ *               with its list of rows.
+ * @param arg    Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ */
+el_err_t el_index_prefix(const el_index_t *idx, const char *prefix,
+						 el_index_cb_t cb, void *arg) {
+	uint16_t delta_len = idx->header.key_len + sizeof(uint32_t);
+	size_t len = strlen(prefix);
+	uint32_t from;
+	uint32_t to;
+	uint32_t dfrom;
+	uint32_t dto;
+
+	/* Don't compare past the width of the field. */
+	if (len > idx->header.key_len)
+		len = idx->header.key_len;
+
+	/* Find the keys that start with the prefix in the index and its delta. */
+	from = el_index_lower(idx->entries, idx->header.entry_len,
+						  idx->header.key_count, prefix, len);
+	to = el_index_prefix_end(idx->entries, idx->header.entry_len, from,
+							 idx->header.key_count, prefix, len);
+	dfrom = el_index_lower(idx->delta, delta_len, idx->delta_count, prefix,
+						   len);
+	dto = el_index_prefix_end(idx->delta, delta_len, dfrom, idx->delta_count,
+							  prefix, len);
+
+	return el_index_walk(idx, from, to, dfrom, dto, cb, arg);
+}
+
+/**
+ * Looks up all the keys in a lexicographic range.
+ *
+ * @param idx String index.
+ * @param lo  First key of the range (inclusive) or NULL to start at the first
+ *            key.
+ * @param hi  Last key of the range (exclusive) or NULL to go until the last key.
+ * @param cb  Function called for every matching key, in ascending order, with
+ *            its list of rows.
+ * @param arg Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ */
+el_err_t el_index_range(const el_index_t *idx, const char *lo, const char *hi,
+						el_index_cb_t cb, void *arg) {
+	uint16_t delta_len = idx->header.key_len + sizeof(uint32_t);
+	uint32_t from = 0;
+	uint32_t to = idx->header.key_count;
+	uint32_t dfrom = 0;
+	uint32_t dto = idx->delta_count;
+
+	if (lo != NULL) {
+		from = el_index_lower(idx->entries, idx->header.entry_len,
+							  idx->header.key_count, lo, idx->header.key_len);
+		dfrom = el_index_lower(idx->delta, delta_len, idx->delta_count, lo,
+							   idx->header.key_len);
+	}
+	if (hi != NULL) {
+		to = el_index_lower(idx->entries, idx->header.entry_len,
+							idx->header.key_count, hi, idx->header.key_len);
+		dto = el_index_lower(idx->delta, delta_len, idx->delta_count, hi,
+							 idx->header.key_len);
+	}
+
+	return el_index_walk(idx, from, to, dfrom, dto, cb, arg);
+}
+
+/**
+ * Gets the rows of all the keys that start with a prefix.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param idx    String index.
+ * @param prefix Prefix of the keys.
+ *
+ * @return Bitmap of the matching rows.
+ */
+el_bitmap_t *el_index_prefix_rows(const el_index_t *idx, const char *prefix) {
+	el_bitmap_t *rows = el_bitmap_new();
+
+	el_index_prefix(idx, prefix, el_index_rows_add, rows);
+	return rows;
+}
+
+/**
+ * Gets the rows of all the keys in a lexicographic range.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param idx String index.
+ * @param lo  First key of the range (inclusive) or NULL to start at the first
+ *            key.
+ * @param hi  Last key of the range (exclusive) or NULL to go until the last key.
+ *
+ * @return Bitmap of the matching rows.
+ */
+el_bitmap_t *el_index_range_rows(const el_index_t *idx, const char *lo,
+								 const char *hi) {
+	el_bitmap_t *rows = el_bitmap_new();
+
+	el_index_range(idx, lo, hi, el_index_rows_add, rows);
+	return rows;
+}
+
+/**
+ * Adds the posting list of a key to a bitmap.
+ *
+ * @param key   Key.
+ * @param rows  Rows that have the key.
+ * @param count Number of rows.
+ * @param arg   Bitmap.
+ *
+ * @return Always true since we want every key.
+ */
+bool el_index_rows_add(const char *key, const uint32_t *rows, uint32_t count,
+					   void *arg) {
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+		el_bitmap_add((el_bitmap_t *)arg, rows[i]);
+
+	return true;
+}
+
+/**
+ * Finds the first key that isn't smaller than a value.
+ *
+ * @param entries   Sorted entries that start with their keys.
+ * @param entry_len Length of each entry.
+ * @param count     Number of entries.
+ * @param key       Value to look for.
+ * @param len       Maximum number of characters to compare.
+ *
+ * @return Position of the first key that isn't smaller than the value.
+ */
+uint32_t el_index_lower(const char *entries, uint16_t entry_len,
+						uint32_t count, const char *key, size_t len) {
+	uint32_t lo = 0;
+	uint32_t hi = count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + ((hi - lo) / 2);
+
+		if (strncmp(entries + ((size_t)entry_len * mid), key, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * Finds the first key that doesn't start with a prefix anymore.
+ *
+ * @param entries   Sorted entries that start with their keys.
+ * @param entry_len Length of each entry.
+ * @param from      Position of the first key that starts with the prefix.
+ * @param count     Number of entries.
+ * @param prefix    Prefix of the keys.
+ * @param len       Length of the prefix.
+ *
+ * @return Position after the last key that starts with the prefix.
+ */
+uint32_t el_index_prefix_end(const char *entries, uint16_t entry_len,
+							 uint32_t from, uint32_t count, const char *prefix,
+							 size_t len) {
+	for (; from < count; from++) {
+		if (strncmp(entries + ((size_t)entry_len * from), prefix, len) != 0)
+			break;
+	}
+
+	return from;
+}
+
+/**
+ * Hands a range of keys of an index and its delta over to the user. Rows that
+ * were updated are left out of the posting lists of the index and the rows in
+ * the delta are merged into them.
+ *
+ * @param idx   String index.
+ * @param from  Position of the first key.
+ * @param to    Position after the last key.
+ * @param dfrom Position of the first key in the delta.
+ * @param dto   Position after the last key in the delta.
+ * @param cb    Function called for every key with its list of rows.
+ * @param arg   Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ */
+el_err_t el_index_walk(const el_index_t *idx, uint32_t from, uint32_t to,
+					   uint32_t dfrom, uint32_t dto, el_index_cb_t cb,
+					   void *arg) {
+	uint16_t key_len = idx->header.key_len;
+	size_t delta_len = (size_t)key_len + sizeof(uint32_t);
+	uint32_t *rows = NULL;
+	uint32_t capacity = 0;
+	char *key;
+
+	/* Keys may use the entire width of the field, so terminate them. */
+	key = (char *)malloc(key_len + 1);
+	key[key_len] = '\0';
+
+	while ((from < to) || (dfrom < dto)) {
+		const char *entry = NULL;
+		const uint32_t *base = NULL;
+		uint32_t base_count = 0;
+		uint32_t dend = dfrom;
+		uint32_t count = 0;
+		uint32_t i = 0;
+		int cmp;
+
+		/* Pick the smallest key out of the index and the delta. */
+		if (from >= to) {
+			cmp = 1;
+		} else if (dfrom >= dto) {
+			cmp = -1;
+		} else {
+			cmp = strncmp(idx->entries + ((size_t)idx->header.entry_len * from),
+						  idx->delta + (delta_len * dfrom), key_len);
+		}
+
+		/* Get its rows from the index. */
+		if (cmp <= 0) {
+			uint32_t first;
+
+			entry = idx->entries + ((size_t)idx->header.entry_len * from++);
+			memcpy(&first, entry + key_len, sizeof(uint32_t));
+			memcpy(&base_count, entry + key_len + sizeof(uint32_t),
+				   sizeof(uint32_t));
+			base = idx->postings + first;
+		}
+
+		/* Get its rows from the delta. */
+		if (cmp >= 0) {
+			entry = idx->delta + (delta_len * dfrom);
+			while ((dend < dto) &&
+				   (strncmp(idx->delta + (delta_len * dend), entry,
+							key_len) == 0))
+				dend++;
+		}
+		memcpy(key, entry, key_len);
+
+		/* Keys that weren't touched are handed over straight from the index. */
+		if ((dend == dfrom) && (idx->stale == NULL)) {
+			if (!cb(key, base, base_count, arg))
+				break;
+			continue;
+		}
+
+		/* Merge the rows that are still valid with the ones in the delta. */
+		if (capacity < (base_count + (dend - dfrom))) {
+			capacity = base_count + (dend - dfrom);
+			rows = (uint32_t *)realloc(rows, sizeof(uint32_t) * capacity);
+		}
+		while ((i < base_count) || (dfrom < dend)) {
+			uint32_t row = 0;
+
+			if (dfrom < dend) {
+				memcpy(&row, idx->delta + (delta_len * dfrom) + key_len,
+					   sizeof(uint32_t));
+			}
+
+			if ((dfrom >= dend) || ((i < base_count) && (base[i] < row))) {
+				if ((idx->stale == NULL) ||
+					!el_bitmap_contains(idx->stale, base[i]))
+					rows[count++] = base[i];
+				i++;
+			} else {
+				rows[count++] = row;
+				dfrom++;
+			}
+		}
+
+		/* Keys whose rows were all updated are gone. */
+		if ((count > 0) && !cb(key, rows, count, arg))
+			break;
+	}
+
+	free(rows);
+	free(key);
+	return EL_OK;
+}
+
+/**
+ * Joins the rows of two documents that have the same value in a key field. A
+ * hash table is built in memory with the rows of the smaller document and the
+ * larger one is then streamed through it a block at a time. Keys must be both
+ * numeric or both strings and strings of different widths can be joined.
+ * @warning Both documents are kept open during the join, so don't try to use
+ *          el_row_get or any of the writing functions inside the callback.
+ *
+ * @param left      First document handle.
+ * @param left_key  Index of the key field in the first document.
+ * @param right     Second document handle.
+ * @param right_key Index of the key field in the second document.
+ * @param cb        Function called for every pair of matching rows. Rows are
+ *                  always handed over in the same order as the documents were
+ *                  passed to this function and are reused between calls.
+ * @param arg       Opaque pointer passed along to the callback.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the key fields can't be compared.
+ *         EL_ERROR_FILE if an error occurred while operating on the files.
+ */
+el_err_t el_doc_hash_join(eld_handle_t *left, uint8_t left_key,
+						  eld_handle_t *right, uint8_t right_key,
+						  el_join_cb_t cb, void *arg) {
+	el_join_t join;
+	eld_handle_t *probe;
+	uint8_t build_key;
+	uint8_t probe_key;
+	uint32_t buckets;
+	uint32_t rows;
+	el_err_t err;
+
+	/* Check if the keys can be compared. */
+	if ((left_key >= left->header.field_desc_count) ||
+		(right_key >= right->header.field_desc_count) ||
+		((left->field_defs[left_key].type == EL_FIELD_STRING) !=
+		 (right->field_defs[right_key].type == EL_FIELD_STRING)) ||
+		(left->field_defs[left_key].type == EL_FIELD_VARCHAR) ||
+		(right->field_defs[right_key].type == EL_FIELD_VARCHAR) ||
+		el_util_is_array(&(left->field_defs[left_key])) ||
+		el_util_is_array(&(right->field_defs[right_key])) ||
+		el_util_field_implicit(&(left->field_defs[left_key])) ||
+		el_util_field_implicit(&(right->field_defs[right_key]))) {
+		el_error_msg_format(EMSG("Can't join field %u with field %u."),
+							left_key, right_key);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Build the table with the smaller document. */
+	join.swapped = right->header.row_count < left->header.row_count;
+	join.build = (join.swapped) ? right : left;
+	build_key = (join.swapped) ? right_key : left_key;
+	probe = (join.swapped) ? left : right;
+	probe_key = (join.swapped) ? left_key : right_key;
+
+	/* Set up the join state. */
+	join.build_def = &(join.build->field_defs[build_key]);
+	join.build_key = build_key;
+	join.build_offset = el_util_field_offset(join.build, build_key);
+	join.probe_def = &(probe->field_defs[probe_key]);
+	join.probe_key = probe_key;
+	join.probe_offset = el_util_field_offset(probe, probe_key);
+	join.cb = cb;
+	join.arg = arg;
+	join.base = join.build->ext.row_base;
+	rows = join.build->header.row_count - join.base;
+	for (buckets = 16; buckets < rows; buckets <<= 1)
+		;
+	join.mask = buckets - 1;
+	join.rows = (char *)malloc((size_t)join.build->header.row_len *
+							   (rows + 1));
+	join.hashes = (uint32_t *)malloc(sizeof(uint32_t) * (rows + 1));
+	join.next = (uint32_t *)malloc(sizeof(uint32_t) * (rows + 1));
+	join.heads = (uint32_t *)calloc(buckets, sizeof(uint32_t));
+	join.build_row = el_row_new(join.build);
+	join.probe_row = el_row_new(probe);
+
+	/* Build the table and probe it. */
+	err = el_doc_scan_blocks(join.build, 0, join.build->header.row_count,
+							 NULL, el_join_build_block, &join);
+	if (err == EL_OK) {
+		err = el_doc_scan_blocks(probe, 0, probe->header.row_count, NULL,
+								 el_join_probe_block, &join);
+	}
+
+	/* Clean up and return. */
+	el_row_free(join.build_row);
+	el_row_free(join.probe_row);
+	free(join.rows);
+	free(join.hashes);
+	free(join.next);
+	free(join.heads);
+
+	return err;
+}
+
+/**
+ * Adds a block of rows of the smaller document to the join hash table.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Join state.
+ *
+ * @return Always true since we need the entire document.
+ */
+bool el_join_build_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg) {
+	el_join_t *join = (el_join_t *)arg;
+	size_t row_len = doc->header.row_len;
+	uint32_t i;
+
+	/* Keep a copy of the rows. (Counting from the first one not truncated) */
+	first -= join->base;
+	memcpy(join->rows + (row_len * first), block, row_len * count);
+
+	/* Chain them into their buckets. */
+	for (i = first; i < (first + count); i++) {
+		uint32_t hash;
+		uint32_t bucket;
+
+		/* Deleted rows and null keys never match. */
+		if (el_doc_row_deleted(doc, join->base + i) ||
+			el_doc_raw_null(doc, join->rows + (row_len * i), join->build_key))
+			continue;
+
+		hash = el_util_key_hash(join->build_def, join->rows + (row_len * i) +
+								join->build_offset);
+		bucket = hash & join->mask;
+
+		join->hashes[i] = hash;
+		join->next[i] = join->heads[bucket];
+		join->heads[bucket] = i + 1;
+	}
+
+	return true;
+}
+
+/**
+ * Looks up a block of rows of the larger document in the join hash table.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Join state.
+ *
+ * @return False if the user requested the join to be stopped.
+ */
+bool el_join_probe_block(eld_handle_t *doc, const char *block, uint32_t first,
+						 uint32_t count, void *arg) {
+	el_join_t *join = (el_join_t *)arg;
+	size_t build_len = join->build->header.row_len;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		const char *raw = block + ((size_t)doc->header.row_len * i);
+		const char *key = raw + join->probe_offset;
+		uint32_t hash = el_util_key_hash(join->probe_def, key);
+		uint32_t pos;
+		bool decoded = false;
+
+		/* Deleted rows and null keys never match. */
+		if (el_doc_row_deleted(doc, first + i) ||
+			el_doc_raw_null(doc, raw, join->probe_key))
+			continue;
+
+		for (pos = join->heads[hash & join->mask]; pos != 0;
+				pos = join->next[pos - 1]) {
+			const char *match = join->rows + (build_len * (pos - 1));
+
+			/* Check if it's really a match. */
+			if ((join->hashes[pos - 1] != hash) ||
+				!el_util_key_equal(join->build_def, match + join->build_offset,
+								   join->probe_def, key))
+				continue;
+
+			/* Decode the rows and hand them over. */
+			if (!decoded) {
+				join->probe_row->index = first + i;
+				el_row_decode(doc, join->probe_row, raw);
+				decoded = true;
+			}
+			join->build_row->index = join->base + pos - 1;
+			el_row_decode(join->build, join->build_row, match);
+			if (join->swapped) {
+				if (!join->cb(join->probe_row, join->build_row, join->arg))
+					return false;
+			} else {
+				if (!join->cb(join->build_row, join->probe_row, join->arg))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Pushes a range of rows of a document through a query pipeline in batches of
+ * up to EL_SCAN_BLOCK_ROWS rows. Ranges make it possible to split a large
+ * query into partitions that can be run with separate document handles.
+ * @warning The document is kept open while the query is running, so don't try
+ *          to use el_row_get or any of the writing functions inside operators.
+ *
+ * @param doc      Document handle.
+ * @param start    Index of the first row to be queried.
+ * @param count    Number of rows to be queried.
+ * @param pipeline First operator of the query pipeline.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if an operator refers to a field that doesn't exist
+ *         or can't be used by it.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_query_run(eld_handle_t *doc, uint32_t start, uint32_t count,
+					  el_op_t *pipeline) {
+	el_query_t query;
+	el_batch_t *batch = &(query.batch);
+	size_t *offsets;
+	el_err_t err;
+	uint8_t i;
+
+	/* Make sure the operators fit the document before reading anything. */
+	err = el_query_check(doc, pipeline);
+	IF_EL_ERROR(err) {
+		return err;
+	}
+
+	/* Locate the fields inside a row. */
+	offsets = (size_t *)malloc(sizeof(size_t) *
+							   (doc->header.field_desc_count + 1));
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		offsets[i] = el_util_field_offset(doc, i);
+	}
+
+	/* Prepare the batch that'll be reused for every block. */
+	memset(batch, 0, sizeof(el_batch_t));
+	batch->doc = doc;
+	batch->offsets = offsets;
+	batch->sel = (uint16_t *)malloc(sizeof(uint16_t) * EL_SCAN_BLOCK_ROWS);
+	batch->columns = (double **)calloc(doc->header.field_desc_count + 1,
+									   sizeof(double *));
+	batch->nulls = (uint8_t **)calloc(doc->header.field_desc_count + 1,
+									  sizeof(uint8_t *));
+	batch->decoded = (uint8_t *)malloc(doc->header.field_desc_count + 1);
+	query.pipeline = pipeline;
+
+	/* Run the query. */
+	err = el_doc_scan_blocks(doc, start, count, NULL, el_query_block, &query);
+
+	/* Clean up and return. */
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		free(batch->columns[i]);
+		free(batch->nulls[i]);
+	}
+	free(batch->columns);
+	free(batch->nulls);
+	free(batch->decoded);
+	free(batch->sel);
+	free(offsets);
+
+	return err;
+}
+
+/**
+ * Checks if the fields used by the operators of a pipeline exist in a document
+ * and are of a type that they can handle.
+ *
+ * @param doc      Document handle.
+ * @param pipeline First operator of the query pipeline.
+ *
+ * @return EL_OK if the pipeline can be run on the document.
+ *         EL_ERROR_ARGUMENT if an operator can't be run on the document.
+ */
+el_err_t el_query_check(const eld_handle_t *doc, const el_op_t *pipeline) {
+	const el_op_t *op;
+	uint8_t fields = doc->header.field_desc_count;
+	uint8_t i;
+
+	for (op = pipeline; op != NULL; op = op->next) {
+		if (op->push == el_op_project_push) {
+			const el_op_project_t *project = (el_op_project_t *)op->state;
+
+			for (i = 0; i < project->count; i++) {
+				if (project->fields[i] >= fields) {
+					el_error_msg_format(EMSG("Projected field %u doesn't "
+											 "exist."), project->fields[i]);
+					return EL_ERROR_ARGUMENT;
+				}
+			}
+		} else if (op->push == el_op_aggregate_push) {
+			const el_op_aggregate_t *agg = (el_op_aggregate_t *)op->state;
+			const el_field_def_t *def;
+
+			if ((agg->group_field < -1) || (agg->group_field >= fields)) {
+				el_error_msg_format(EMSG("Group field %d doesn't exist."),
+									agg->group_field);
+				return EL_ERROR_ARGUMENT;
+			}
+			if (agg->field >= fields) {
+				el_error_msg_format(EMSG("Aggregated field %u doesn't exist."),
+									agg->field);
+				return EL_ERROR_ARGUMENT;
+			}
+
+			/* Only numbers can be summed up. */
+			def = &(doc->field_defs[agg->field]);
+			if (el_util_is_string(def) || el_util_is_array(def)) {
+				el_error_msg_format(EMSG("Aggregated field \"%s\" isn't "
+										 "numeric."), def->name);
+				return EL_ERROR_ARGUMENT;
+			}
+		}
+	}
+
+	return EL_OK;
+}
+
+/**
+ * Turns a block of raw rows into a batch and pushes it into the pipeline.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Query state.
+ *
+ * @return False if the pipeline requested the query to be stopped.
+ */
+bool el_query_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg) {
+	el_query_t *query = (el_query_t *)arg;
+	el_batch_t *batch = &(query->batch);
+	uint16_t i;
+
+	/* Reset the batch. */
+	batch->first = first;
+	batch->count = (uint16_t)count;
+	batch->raw = block;
+	batch->fields = NULL;
+	batch->field_count = 0;
+	for (i = 0; i < batch->count; i++) {
+		batch->sel[i] = i;
+	}
+	batch->sel_count = el_doc_sel_live(doc, first, batch->sel, batch->count);
+	memset(batch->decoded, 0, doc->header.field_desc_count);
+
+	return query->pipeline->push(query->pipeline, batch);
+}
+
+/**
+ * Gets the values of a numeric field for the selected rows of a batch. The
+ * column is decoded the first time it's requested in a batch.
+ *
+ * @param batch Batch of rows.
+ * @param field Index of the numeric field.
+ *
+ * @return Column of values indexed by the row position inside the batch. Only
+ *         the positions in the selection vector are valid.
+ */
+const double *el_batch_column(el_batch_t *batch, uint8_t field) {
+	const el_field_def_t *def = &(batch->doc->field_defs[field]);
+	const char *raw = batch->raw + batch->offsets[field];
+	size_t row_len = batch->doc->header.row_len;
+	double *column;
+	uint16_t i;
+
+	/* Allocate the column the first time around. */
+	if (batch->columns[field] == NULL) {
+		batch->columns[field] = (double *)malloc(sizeof(double) *
+												 EL_SCAN_BLOCK_ROWS);
+	}
+	column = batch->columns[field];
+
+	/* Decode the selected rows. */
+	if (!(batch->decoded[field] & 1)) {
+		for (i = 0; i < batch->sel_count; i++) {
+			uint16_t pos = batch->sel[i];
+			column[pos] = el_doc_raw_number(batch->doc, def,
+											raw + (row_len * pos),
+											batch->first + pos);
+		}
+
+		batch->decoded[field] |= 1;
+	}
+
+	return column;
+}
+
+/**
+ * Gets the null flags of a field for the selected rows of a batch. The flags
+ * are decoded the first time they're requested in a batch.
+ *
+ * @param batch Batch of rows.
+ * @param field Index of the field.
+ *
+ * @return Non-zero values for the null cells indexed by the row position
+ *         inside the batch, or NULL if the document doesn't have null bitmaps.
+ *         Only the positions in the selection vector are valid.
+ */
+const uint8_t *el_batch_nulls(el_batch_t *batch, uint8_t field) {
+	const eld_handle_t *doc = batch->doc;
+	size_t row_len = doc->header.row_len;
+	uint8_t *nulls;
+	uint16_t i;
+
+	/* Documents without a null bitmap don't have nulls. */
+	if (!(doc->ext.flags & EL_EXT_NULLS))
+		return NULL;
+
+	/* Allocate the flags the first time around. */
+	if (batch->nulls[field] == NULL)
+		batch->nulls[field] = (uint8_t *)malloc(EL_SCAN_BLOCK_ROWS);
+	nulls = batch->nulls[field];
+
+	/* Decode the selected rows. */
+	if (!(batch->decoded[field] & 2)) {
+		for (i = 0; i < batch->sel_count; i++) {
+			uint16_t pos = batch->sel[i];
+			nulls[pos] = el_doc_raw_null(doc, batch->raw + (row_len * pos),
+										 field);
+		}
+
+		batch->decoded[field] |= 2;
+	}
+
+	return nulls;
+}
+
+/**
+ * Creates a new query pipeline operator. Use this to plug your own operators
+ * into a pipeline.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param push  Function that processes a batch and pushes it to the next
+ *              operator.
+ * @param free  Function that frees the state of the operator or NULL if it
+ *              only needs to be passed to free().
+ * @param state Opaque pointer to the state of the operator.
+ *
+ * @return Brand new operator.
+ *
+ * @see el_op_free
+ */
+el_op_t *el_op_new(bool (*push)(el_op_t *op, el_batch_t *batch),
+				   void (*free)(el_op_t *op), void *state) {
+	el_op_t *op;
+
+	op = (el_op_t *)malloc(sizeof(el_op_t));
+	op->push = push;
+	op->free = free;
+	op->next = NULL;
+	op->state = state;
+
+	return op;
+}
+
+/**
+ * Appends an operator to the end of a pipeline.
+ *
+ * @param op   First operator of the pipeline.
+ * @param next Operator to be appended.
+ *
+ * @return The first operator of the pipeline.
+ */
+el_op_t *el_op_then(el_op_t *op, el_op_t *next) {
+	el_op_t *last = op;
+
+	while (last->next != NULL)
+		last = last->next;
+	last->next = next;
+
+	return op;
+}
+
+/**
+ * Pushes a batch into the operator that follows another one. Operators at the
+ * end of a pipeline act as a sink.
+ *
+ * @param op    Operator that's done with the batch.
+ * @param batch Batch of rows.
+ *
+ * @return What the next operator returned or true if there isn't one.
+ */
+bool el_op_next(el_op_t *op, el_batch_t *batch) {
+	if (op->next == NULL)
+		return true;
+
+	return op->next->push(op->next, batch);
+}
+
+/**
+ * Frees up an entire pipeline starting from an operator.
+ *
+ * @param op First operator of the pipeline to be free'd.
+ */
+void el_op_free(el_op_t *op) {
+	while (op != NULL) {
+		el_op_t *next = op->next;
+
+		if (op->free != NULL) {
+			op->free(op);
+		} else {
+			free(op->state);
+		}
+		free(op);
+
+		op = next;
+	}
+}
+
+/**
+ * Creates an operator that only lets through the rows that match a filter.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param expr Compiled filter expression. (Must outlive the operator)
+ *
+ * @return Brand new operator.
+ */
+el_op_t *el_op_filter(const el_expr_t *expr) {
+	el_op_filter_t *filter;
+
+	filter = (el_op_filter_t *)malloc(sizeof(el_op_filter_t));
+	filter->expr = expr;
+	filter->stack = (uint8_t *)malloc((size_t)expr->depth * EL_SCAN_BLOCK_ROWS);
+
+	return el_op_new(el_op_filter_push, el_op_filter_free, filter);
+}
+
+/**
+ * Filters the selected rows of a batch.
+ *
+ * @param op    Filter operator.
+ * @param batch Batch of rows.
+ *
+ * @return What the next operator returned.
+ */
+bool el_op_filter_push(el_op_t *op, el_batch_t *batch) {
+	el_op_filter_t *filter = (el_op_filter_t *)op->state;
+
+	/* Narrow down the selection. */
+	batch->sel_count = el_expr_filter(filter->expr, batch->doc, batch->raw,
+									  batch->first, batch->sel,
+									  batch->sel_count, filter->stack);
+
+	return el_op_next(op, batch);
+}
+
+/**
+ * Frees up the state of a filter operator.
+ *
+ * @param op Filter operator.
+ */
+void el_op_filter_free(el_op_t *op) {
+	el_op_filter_t *filter = (el_op_filter_t *)op->state;
+
+	free(filter->stack);
+	free(filter);
+}
+
+/**
+ * Creates an operator that restricts the fields that are handed to the user.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param fields Indexes of the fields to be kept.
+ * @param count  Number of fields to be kept.
+ *
+ * @return Brand new operator.
+ */
+el_op_t *el_op_project(const uint8_t *fields, uint8_t count) {
+	el_op_project_t *project;
+
+	project = (el_op_project_t *)malloc(sizeof(el_op_project_t));
+	project->count = count;
+	project->fields = (uint8_t *)malloc(count);
+	memcpy(project->fields, fields, count);
+
+	return el_op_new(el_op_project_push, el_op_project_free, project);
+}
+
+/**
+ * Sets the projected fields of a batch.
+ *
+ * @param op    Projection operator.
+ * @param batch Batch of rows.
+ *
+ * @return What the next operator returned.
+ */
+bool el_op_project_push(el_op_t *op, el_batch_t *batch) {
+	el_op_project_t *project = (el_op_project_t *)op->state;
+
+	batch->fields = project->fields;
+	batch->field_count = project->count;
+
+	return el_op_next(op, batch);
+}
+
+/**
+ * Frees up the state of a projection operator.
+ *
+ * @param op Projection operator.
+ */
+void el_op_project_free(el_op_t *op) {
+	el_op_project_t *project = (el_op_project_t *)op->state;
+
+	free(project->fields);
+	free(project);
+}
+
+/**
+ * Creates an operator that stops the query after a number of rows went
+ * through it.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param limit Maximum number of rows to let through.
+ *
+ * @return Brand new operator.
+ */
+el_op_t *el_op_limit(uint32_t limit) {
+	el_op_limit_t *state;
+
+	state = (el_op_limit_t *)malloc(sizeof(el_op_limit_t));
+	state->limit = limit;
+	state->seen = 0;
+
+	return el_op_new(el_op_limit_push, NULL, state);
+}
+
+/**
+ * Trims the selection of a batch to the rows still allowed through.
+ *
+ * @param op    Limit operator.
+ * @param batch Batch of rows.
+ *
+ * @return False once the limit has been reached.
+ */
+bool el_op_limit_push(el_op_t *op, el_batch_t *batch) {
+	el_op_limit_t *state = (el_op_limit_t *)op->state;
+
+	/* Trim the selection. */
+	if (batch->sel_count > (state->limit - state->seen))
+		batch->sel_count = (uint16_t)(state->limit - state->seen);
+	state->seen += batch->sel_count;
+
+	/* Push what's left. */
+	if ((batch->sel_count > 0) && !el_op_next(op, batch))
+		return false;
+
+	return state->seen < state->limit;
+}
+
+/**
+ * Creates an operator that hands every selected row to a callback.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param cb  Function called for every row. The row object is reused between
+ *            calls and only contains the projected fields.
+ * @param arg Opaque pointer passed along to the callback.
+ *
+ * @return Brand new operator.
+ */
+el_op_t *el_op_output(el_scan_cb_t cb, void *arg) {
+	el_op_output_t *output;
+
+	output = (el_op_output_t *)malloc(sizeof(el_op_output_t));
+	output->cb = cb;
+	output->arg = arg;
+	output->row = NULL;
+
+	return el_op_new(el_op_output_push, el_op_output_free, output);
+}
+
+/**
+ * Decodes the projected fields of the selected rows and hands them over.
+ *
+ * @param op    Output operator.
+ * @param batch Batch of rows.
+ *
+ * @return False if the callback requested the query to be stopped.
+ */
+bool el_op_output_push(el_op_t *op, el_batch_t *batch) {
+	el_op_output_t *output = (el_op_output_t *)op->state;
+	el_row_t *row;
+	uint16_t i;
+	uint8_t j;
+
+	/* Prepare the row object for the projected fields. */
+	if (output->row == NULL) {
+		output->row = el_row_alloc(batch->doc, batch->fields,
+			(batch->fields == NULL) ? batch->doc->header.field_desc_count :
+			batch->field_count);
+	}
+	row = output->row;
+
+	/* Hand over the selected rows. */
+	for (i = 0; i < batch->sel_count; i++) {
+		const char *raw = batch->raw +
+			((size_t)batch->doc->header.row_len * batch->sel[i]);
+
+		row->index = batch->first + batch->sel[i];
+		for (j = 0; j < row->cell_count; j++) {
+			uint8_t field = (batch->fields == NULL) ? j : batch->fields[j];
+			el_cell_t *cell = &(row->cells[j]);
+
+			cell->null = el_doc_raw_null(batch->doc, raw, field);
+			el_cell_decode(batch->doc, cell, raw + batch->offsets[field],
+						   row->index);
+		}
+
+		if (!output->cb(batch->doc, row, output->arg))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Frees up the state of an output operator.
+ *
+ * @param op Output operator.
+ */
+void el_op_output_free(el_op_t *op) {
+	el_op_output_t *output = (el_op_output_t *)op->state;
+
+	el_row_free(output->row);
+	free(output);
+}
+
+/**
+ * Creates an operator that aggregates a numeric field of the selected rows,
+ * optionally grouping them by the value of another field.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param group_field Index of the field to group the rows by or -1 to aggregate
+ *                    all of them together.
+ * @param field       Index of the numeric field to be aggregated.
+ *
+ * @return Brand new operator.
+ *
+ * @see el_op_aggregate_groups
+ */
+el_op_t *el_op_aggregate(int group_field, uint8_t field) {
+	el_op_aggregate_t *agg;
+
+	agg = (el_op_aggregate_t *)malloc(sizeof(el_op_aggregate_t));
+	agg->group_field = group_field;
+	agg->field = field;
+	agg->groups = NULL;
+	agg->count = 0;
+	agg->table_len = 64;
+	agg->table = (uint32_t *)calloc(agg->table_len, sizeof(uint32_t));
+
+	return el_op_new(el_op_aggregate_push, el_op_aggregate_free, agg);
+}
+
+/**
+ * Accumulates the selected rows of a batch into their groups.
+ *
+ * @param op    Aggregate operator.
+ * @param batch Batch of rows.
+ *
+ * @return True unless the next operator requested the query to be stopped.
+ */
+bool el_op_aggregate_push(el_op_t *op, el_batch_t *batch) {
+	el_op_aggregate_t *agg = (el_op_aggregate_t *)op->state;
+	const double *values;
+	const uint8_t *nulls;
+	uint16_t i;
+#ifdef EL_HAS_INT64
+	const char *raw = batch->raw + batch->offsets[agg->field];
+	int64_t factor = 0;
+
+	/* Decimals are also summed as integers so that the sum stays exact. */
+	if (batch->doc->field_defs[agg->field].type == EL_FIELD_DECIMAL)
+		factor = el_util_decimal_factor(&(batch->doc->field_defs[agg->field]));
+#endif /* EL_HAS_INT64 */
+
+	values = el_batch_column(batch, agg->field);
+	nulls = el_batch_nulls(batch, agg->field);
+	for (i = 0; i < batch->sel_count; i++) {
+		uint16_t pos = batch->sel[i];
+		el_group_t *group;
+
+		/* Null values still make up their group but aren't accumulated. */
+		group = el_op_aggregate_find(agg, batch, pos);
+		if ((nulls != NULL) && nulls[pos])
+			continue;
+		if ((group->count == 0) || (values[pos] < group->min))
+			group->min = values[pos];
+		if ((group->count == 0) || (values[pos] > group->max))
+			group->max = values[pos];
+		group->sum += values[pos];
+		group->count++;
+
+#ifdef EL_HAS_INT64
+		if (factor > 0) {
+			int64_t value;
+
+			memcpy(&value, raw + ((size_t)batch->doc->header.row_len * pos),
+				   sizeof(int64_t));
+			group->decimal_sum += value;
+			group->sum = (double)group->decimal_sum / (double)factor;
+		}
+#endif /* EL_HAS_INT64 */
+	}
+
+	/* Aggregates are a sink unless something else was plugged after it. */
+	return el_op_next(op, batch);
+}
+
+/**
+ * Finds the group that a row belongs to, creating it if needed.
+ *
+ * @param agg   Aggregate operator state.
+ * @param batch Batch of rows.
+ * @param pos   Position of the row inside the batch.
+ *
+ * @return Group of the row.
+ */
+el_group_t *el_op_aggregate_find(el_op_aggregate_t *agg, const el_batch_t *batch,
+								 uint16_t pos) {
+	const char *raw = batch->raw + ((size_t)batch->doc->header.row_len * pos);
+	const el_field_def_t *def = NULL;
+	el_group_t *group;
+	char *str = NULL;
+	uint32_t slot;
+	el_number_t key;
+	bool null = false;
+	uint32_t i;
+
+	el_util_number_set(&key, 0);
+
+	/* Get the key. (Null keys are all hashed as the rows without a key) */
+	if (agg->group_field >= 0) {
+		def = &(batch->doc->field_defs[agg->group_field]);
+		null = el_doc_raw_null(batch->doc, raw, (uint8_t)agg->group_field);
+		raw += batch->offsets[agg->group_field];
+		if (!null && (def->type == EL_FIELD_VARCHAR)) {
+			str = el_heap_read(batch->doc, def, raw);
+			raw = str;
+		} else if (!null && (def->type != EL_FIELD_STRING)) {
+			el_doc_raw_exact(batch->doc, def, raw, batch->first + pos,
+							 &key);
+		}
+	}
+
+	/* Look for it in the table. */
+	slot = el_op_aggregate_hash((null) ? NULL : def, &key, raw) &
+		(agg->table_len - 1);
+	while (agg->table[slot] != 0) {
+		bool found;
+
+		group = &(agg->groups[agg->table[slot] - 1]);
+		if ((def == NULL) || null) {
+			found = group->key_null == null;
+		} else if (group->key_null) {
+			found = false;
+		} else if (def->type == EL_FIELD_STRING) {
+			found = strncmp(group->key_string, raw, def->size_bytes) == 0;
+		} else if (def->type == EL_FIELD_VARCHAR) {
+			found = strcmp(group->key_string, raw) == 0;
+		} else {
+			found = el_util_number_equal(&(group->key), &key);
+		}
+
+		if (found) {
+			free(str);
+			return group;
+		}
+
+		slot = (slot + 1) & (agg->table_len - 1);
+	}
+
+	/* Create a new group. */
+	agg->count++;
+	agg->groups = (el_group_t *)realloc(agg->groups,
+										sizeof(el_group_t) * agg->count);
+	group = &(agg->groups[agg->count - 1]);
+	memset(group, 0, sizeof(el_group_t));
+	group->key = key;
+	group->key_null = null;
+	if ((def != NULL) && !null && (def->type == EL_FIELD_STRING)) {
+		group->key_string = (char *)calloc(def->size_bytes + 1, sizeof(char));
+		memcpy(group->key_string, raw, def->size_bytes);
+	} else if (str != NULL) {
+		group->key_string = str;
+	}
+	agg->table[slot] = agg->count;
+
+	/* Keep the table at most half full. */
+	if ((agg->count * 2) > agg->table_len) {
+		free(agg->table);
+		agg->table_len *= 2;
+		agg->table = (uint32_t *)calloc(agg->table_len, sizeof(uint32_t));
+
+		for (i = 0; i < agg->count; i++) {
+			el_group_t *g = &(agg->groups[i]);
+
+			slot = el_op_aggregate_hash((g->key_null) ? NULL : def,
+										&(g->key), g->key_string) &
+				(agg->table_len - 1);
+			while (agg->table[slot] != 0)
+				slot = (slot + 1) & (agg->table_len - 1);
+			agg->table[slot] = i + 1;
+		}
+	}
+
+	return group;
+}
+
+/**
+ * Calculates the hash of a group key.
+ *
+ * @param def Definition of the field used to group the rows or NULL if they
+ *            aren't grouped.
+ * @param key Key of the group if the field is numeric.
+ * @param str Key of the group if the field is a string.
+ *
+ * @return Hash of the key.
+ */
+uint32_t el_op_aggregate_hash(const el_field_def_t *def,
+							  const el_number_t *key, const char *str) {
+	const char *end;
+
+	/* Ungrouped rows all live in the same slot. */
+	if (def == NULL)
+		return 0;
+
+	/* Only hash the actual contents of strings. */
+	if (def->type == EL_FIELD_STRING) {
+		end = (const char *)memchr(str, '\0', def->size_bytes);
+		return el_util_hash(str, (end == NULL) ? def->size_bytes : (end - str));
+	} else if (def->type == EL_FIELD_VARCHAR) {
+		return el_util_hash(str, strlen(str));
+	}
+
+	return el_util_number_hash(key);
+}
+
+/**
+ * Gets the groups accumulated by an aggregate operator.
+ *
+ * @param op    Aggregate operator.
+ * @param count Pointer to store the number of groups.
+ *
+ * @return Array of groups in the order they were first seen. Owned by the
+ *         operator.
+ */
+const el_group_t *el_op_aggregate_groups(const el_op_t *op, uint32_t *count) {
+	const el_op_aggregate_t *agg = (const el_op_aggregate_t *)op->state;
+
+	*count = agg->count;
+	return agg->groups;
+}
+
+/**
+ * Frees up the state of an aggregate operator.
+ *
+ * @param op Aggregate operator.
+ */
+void el_op_aggregate_free(el_op_t *op) {
+	el_op_aggregate_t *agg = (el_op_aggregate_t *)op->state;
+	uint32_t i;
+
+	for (i = 0; i < agg->count; i++) {
+		free(agg->groups[i].key_string);
+	}
+	free(agg->groups);
+	free(agg->table);
+	free(agg);
+}
+
+/**
+ * Calculates a moving average of a numeric field over a fixed number of rows.
+ * Rows before the window is full are averaged over the rows seen so far.
+ * Null values are left out of the window and their rows get the current
+ * average.
+ *
+ * @param doc         Document handle.
+ * @param field       Index of the numeric field.
+ * @param window_rows Number of rows in the window.
+ * @param out         Array of at least row_count elements to store the results,
+ *                    indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field or window are invalid.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_window_moving_avg(eld_handle_t *doc, uint8_t field,
+							  uint32_t window_rows, double *out) {
+	el_window_t win;
+	el_err_t err;
+
+	/* Check if the window makes sense. */
+	if (window_rows == 0) {
+		el_error_msg_set(EMSG("Moving average window must have at least one "
+							  "row."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Set up the state and run the operation. */
+	memset(&win, 0, sizeof(el_window_t));
+	win.op = EL_WINDOW_MOVING_AVG;
+	win.out = out;
+	win.window_rows = window_rows;
+	win.ring = (double *)malloc(sizeof(double) * window_rows);
+	err = el_window_run(doc, &win, field);
+	free(win.ring);
+
+	return err;
+}
+
+/**
+ * Calculates the exponentially weighted moving average of a numeric field.
+ * Null values are skipped and their rows get the current average.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the numeric field.
+ * @param alpha Smoothing factor between 0 and 1. Higher values discount older
+ *              rows faster.
+ * @param out   Array of at least row_count elements to store the results,
+ *              indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field or smoothing factor are invalid.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_window_ewma(eld_handle_t *doc, uint8_t field, double alpha,
+						double *out) {
+	el_window_t win;
+
+	/* Check if the smoothing factor makes sense. */
+	if ((alpha <= 0) || (alpha > 1)) {
+		el_error_msg_set(EMSG("EWMA smoothing factor must be in the (0, 1] "
+							  "range."));
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Set up the state and run the operation. */
+	memset(&win, 0, sizeof(el_window_t));
+	win.op = EL_WINDOW_EWMA;
+	win.out = out;
+	win.alpha = alpha;
+
+	return el_window_run(doc, &win, field);
+}
+
+/**
+ * Calculates the rate of change of a numeric field in relation to another
+ * (usually a time) field between each row and the one before it. The first row
+ * and rows where the time didn't change or either value is null have a rate
+ * of 0.
+ *
+ * @param doc        Document handle.
+ * @param field      Index of the numeric field.
+ * @param time_field Index of the numeric field to be used as the time base.
+ * @param out        Array of at least row_count elements to store the results,
+ *                   indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if one of the fields is invalid.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_window_rate(eld_handle_t *doc, uint8_t field, uint8_t time_field,
+						double *out) {
+	el_window_t win;
+
+	/* Check if the time field is valid. */
+	if ((time_field >= doc->header.field_desc_count) ||
+		el_util_is_string(&(doc->field_defs[time_field])) ||
+		el_util_is_array(&(doc->field_defs[time_field]))) {
+		el_error_msg_format(EMSG("Field %u can't be used as a time base."),
+							time_field);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Set up the state and run the operation. */
+	memset(&win, 0, sizeof(el_window_t));
+	win.op = EL_WINDOW_RATE;
+	win.out = out;
+	win.time_field = &(doc->field_defs[time_field]);
+	win.time_index = time_field;
+	win.time_offset = el_util_field_offset(doc, time_field);
+
+	return el_window_run(doc, &win, field);
+}
+
+/**
+ * Calculates the difference between the value of a numeric field in each row
+ * and the one before it. The first row and rows with a null value have a
+ * difference of 0.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the numeric field.
+ * @param out   Array of at least row_count elements to store the results,
+ *              indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field is invalid.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_window_delta(eld_handle_t *doc, uint8_t field, double *out) {
+	el_window_t win;
+
+	/* Set up the state and run the operation. */
+	memset(&win, 0, sizeof(el_window_t));
+	win.op = EL_WINDOW_DELTA;
+	win.out = out;
+
+	return el_window_run(doc, &win, field);
+}
+
+/**
+ * Validates the field of a window operation and runs it over every row in the
+ * document.
+ *
+ * @param doc   Document handle.
+ * @param win   Prepared window operation state.
+ * @param field Index of the numeric field.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field is invalid.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_window_run(eld_handle_t *doc, el_window_t *win, uint8_t field) {
+	/* Check if the field is valid. */
+	if ((field >= doc->header.field_desc_count) ||
+		el_util_is_string(&(doc->field_defs[field])) ||
+		el_util_is_array(&(doc->field_defs[field]))) {
+		el_error_msg_format(EMSG("Field %u isn't a numeric field."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Locate the field in the row and go through the rows. */
+	win->field = &(doc->field_defs[field]);
+	win->field_index = field;
+	win->offset = el_util_field_offset(doc, field);
+
+	return el_doc_scan_blocks(doc, 0, doc->header.row_count, NULL,
+							  el_window_block, win);
+}
+
+/**
+ * Updates the state of a window operation with a block of rows and stores the
+ * results. Each row costs a constant amount of work regardless of the window.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Window operation state.
+ *
+ * @return Always true since we want to go through the entire document.
+ */
+bool el_window_block(eld_handle_t *doc, const char *block, uint32_t first,
+					 uint32_t count, void *arg) {
+	el_window_t *win = (el_window_t *)arg;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		const char *raw = block + ((size_t)doc->header.row_len * i);
+		uint32_t index = first + i;
+		uint32_t slot;
+		double value;
+		el_number_t now;
+
+		/* Deleted rows aren't part of the window. */
+		if (el_doc_row_deleted(doc, index))
+			continue;
+
+		/* Null rows keep the state as it was, like in aggregates. */
+		if (el_doc_raw_null(doc, raw, win->field_index) ||
+			((win->op == EL_WINDOW_RATE) &&
+			 el_doc_raw_null(doc, raw, win->time_index))) {
+			win->out[index] = el_window_current(win);
+			continue;
+		}
+
+		/* The window starts at the first row that we see, which isn't the
+		   first row of the document after it has been truncated. */
+		value = el_doc_raw_number(doc, win->field, raw + win->offset, index);
+		switch (win->op) {
+			case EL_WINDOW_MOVING_AVG:
+				/* Swap the oldest value in the window with the new one. */
+				slot = win->seen % win->window_rows;
+				if (win->seen >= win->window_rows)
+					win->sum -= win->ring[slot];
+				win->ring[slot] = value;
+				win->sum += value;
+
+				win->out[index] = win->sum / ((win->seen < win->window_rows) ?
+					(win->seen + 1) : win->window_rows);
+				break;
+			case EL_WINDOW_EWMA:
+				if (win->seen == 0) {
+					win->last = value;
+				} else {
+					win->last += win->alpha * (value - win->last);
+				}
+
+				win->out[index] = win->last;
+				break;
+			case EL_WINDOW_RATE:
+				el_doc_raw_exact(doc, win->time_field, raw + win->time_offset,
+								 index, &now);
+				if ((win->seen == 0) ||
+					el_util_number_equal(&now, &(win->last_time))) {
+					win->out[index] = 0;
+				} else {
+					win->out[index] = (value - win->last) /
+						el_util_number_sub(&now, &(win->last_time));
+				}
+
+				win->last = value;
+				win->last_time = now;
+				break;
+			case EL_WINDOW_DELTA:
+				win->out[index] = (win->seen == 0) ? 0 : (value - win->last);
+				win->last = value;
+				break;
+		}
+
+		win->seen++;
+	}
+
+	return true;
+}
+
+/**
+ * Gets the result of a window operation as it stands, which is what rows that
+ * don't change its state get.
+ *
+ * @param win Window operation state.
+ *
+ * @return Current average of the averaging operations or 0 for the ones that
+ *         compare a row with the one before it.
+ */
+double el_window_current(const el_window_t *win) {
+	if (win->seen == 0)
+		return 0;
+
+	switch (win->op) {
+		case EL_WINDOW_MOVING_AVG:
+			return win->sum / ((win->seen < win->window_rows) ?
+				win->seen : win->window_rows);
+		case EL_WINDOW_EWMA:
+			return win->last;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Calculates the root mean square of the array field of every row.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the array field.
+ * @param out   Array of at least row_count elements to store the results,
+ *              indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field isn't an array.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_array_rms(eld_handle_t *doc, uint8_t field, double *out) {
+	return el_array_run(doc, EL_ARRAY_RMS, field, out);
+}
+
+/**
+ * Finds the peak (largest absolute value) of the array field of every row.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the array field.
+ * @param out   Array of at least row_count elements to store the results,
+ *              indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field isn't an array.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_array_peak(eld_handle_t *doc, uint8_t field, double *out) {
+	return el_array_run(doc, EL_ARRAY_PEAK, field, out);
+}
+
+/**
+ * Calculates the root mean square of an array cell.
+ *
+ * @param cell Array cell.
+ *
+ * @return Root mean square of the elements or 0 if the cell isn't an array.
+ */
+double el_cell_array_rms(const el_cell_t *cell) {
+	if (!el_util_is_array(cell->field))
+		return 0;
+
+	return el_array_reduce(cell->field, (const char *)cell->value.array.data,
+						   EL_ARRAY_RMS);
+}
+
+/**
+ * Finds the peak (largest absolute value) of an array cell.
+ *
+ * @param cell Array cell.
+ *
+ * @return Peak of the elements or 0 if the cell isn't an array.
+ */
+double el_cell_array_peak(const el_cell_t *cell) {
+	if (!el_util_is_array(cell->field))
+		return 0;
+
+	return el_array_reduce(cell->field, (const char *)cell->value.array.data,
+						   EL_ARRAY_PEAK);
+}
+
+/**
+ * Validates the field of an array reduction and runs it over every row in the
+ * document straight from the raw rows.
+ *
+ * @param doc   Document handle.
+ * @param op    Reduction to be calculated.
+ * @param field Index of the array field.
+ * @param out   Array of at least row_count elements to store the results,
+ *              indexed by row. Entries of deleted rows are left alone.
+ *
+ * @return EL_OK if everything went fine.
+ *         EL_ERROR_ARGUMENT if the field isn't an array.
+ *         EL_ERROR_FILE if an error occurred while operating on the file.
+ */
+el_err_t el_array_run(eld_handle_t *doc, el_array_op_t op, uint8_t field,
+					  double *out) {
+	el_array_t arr;
+
+	/* Check if the field is valid. */
+	if ((field >= doc->header.field_desc_count) ||
+		!el_util_is_array(&(doc->field_defs[field]))) {
+		el_error_msg_format(EMSG("Field %u isn't an array field."), field);
+		return EL_ERROR_ARGUMENT;
+	}
+
+	/* Locate the field in the row and go through the rows. */
+	arr.op = op;
+	arr.field = &(doc->field_defs[field]);
+	arr.offset = el_util_field_offset(doc, field);
+	arr.out = out;
+
+	return el_doc_scan_blocks(doc, 0, doc->header.row_count, NULL,
+							  el_array_block, &arr);
+}
+
+/**
+ * Reduces the arrays of a block of rows.
+ *
+ * @param doc   Document handle.
+ * @param block Raw rows read from the file.
+ * @param first Index of the first row in the block.
+ * @param count Number of rows in the block.
+ * @param arg   Array reduction state.
+ *
+ * @return Always true since we want to go through the entire document.
+ */
+bool el_array_block(eld_handle_t *doc, const char *block, uint32_t first,
+					uint32_t count, void *arg) {
+	el_array_t *arr = (el_array_t *)arg;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (el_doc_row_deleted(doc, first + i))
+			continue;
+
+		arr->out[first + i] = el_array_reduce(arr->field, block +
+			((size_t)doc->header.row_len * i) + arr->offset, arr->op);
+	}
+
+	return true;
+}
+
+/**
+ * Reduces the elements of an array. Each case is a tight loop over the raw
+ * elements that compilers are able to vectorise.
+ *
+ * @param field Array field definition.
+ * @param raw   Raw bytes of the array. (Don't need to be aligned)
+ * @param op    Reduction to be calculated.
+ *
+ * @return Result of the reduction.
+ */
+double el_array_reduce(const el_field_def_t *field, const char *raw,
+					   el_array_op_t op) {
+	uint16_t len;
+	uint16_t i;
+	double acc = 0;
+
+	len = field->size_bytes / el_util_sizeof((el_type_t)field->type);
+	if (len == 0)
+		return 0;
+
+	if (field->type == EL_FIELD_FLOAT_ARRAY) {
+		float value;
+
+		if (op == EL_ARRAY_RMS) {
+			for (i = 0; i < len; i++) {
+				memcpy(&value, raw + (i * sizeof(float)), sizeof(float));
+				acc += (double)value * value;
+			}
+		} else {
+			float peak = 0;
+
+			for (i = 0; i < len; i++) {
+				memcpy(&value, raw + (i * sizeof(float)), sizeof(float));
+				value = (value < 0) ? -value : value;
+				peak = (value > peak) ? value : peak;
+			}
+			acc = peak;
+		}
+	} else {
+		int32_t value;
+
+		if (op == EL_ARRAY_RMS) {
+			for (i = 0; i < len; i++) {
+				memcpy(&value, raw + (i * sizeof(int32_t)), sizeof(int32_t));
+				acc += (double)value * value;
+			}
+		} else {
+			double peak = 0;
+
+			for (i = 0; i < len; i++) {
+				memcpy(&value, raw + (i * sizeof(int32_t)), sizeof(int32_t));
+				acc = (value < 0) ? -(double)value : (double)value;
+				peak = (acc > peak) ? acc : peak;
+			}
+			acc = peak;
+		}
+	}
+
+	/* The square root is worked out with Newton's method to avoid libm. */
+	if ((op == EL_ARRAY_RMS) && (acc > 0)) {
+		double mean = acc / len;
+		double root = (mean > 1) ? mean : 1;
+
+		for (i = 0; i < 64; i++) {
+			double next = (root + (mean / root)) / 2;
+			if (next >= root)
+				break;
+			root = next;
+		}
+		acc = root;
+	}
+
+	return acc;
+}
+
+/**
+ * Calculates the length of the file header based on the field descriptor length
+ * and the number of fields defined.
+ *
+ * @param doc Document handle.
+ */
+void el_util_calc_header_len(eld_handle_t *doc) {
+	doc->header.header_len =
+		(sizeof(el_field_def_t) * doc->header.field_desc_count) +
+		sizeof(eld_header_t);
+	if (doc->header.reserved[0] == EL_HEADER_EXT)
+		doc->header.header_len += doc->ext.ext_len;
+}
+
+/**
+ * Calculates the fixed length of a single row in a document given its header
+ * parameters.
+ *
+ * @param doc Document handle.
+ */
+void el_util_calc_row_len(eld_handle_t *doc) {
+	uint8_t i;
+
+	/* Check if we have the necessary data to perform calculations. */
+	if (doc->field_defs == NULL) {
+		doc->header.row_len = 0;
+		doc->header.row_count = 0;
+
+		return;
+	}
+
+	/* Go through field definitions calculating their individual lengths. */
+	doc->header.row_len = el_util_null_len(doc->ext.flags,
+										   doc->header.field_desc_count);
+	for (i = 0; i < doc->header.field_desc_count; i++) {
+		doc->header.row_len += doc->field_defs[i].size_bytes;
+	}
+}
+
+/**
+ * Calculates the offset of a field from the beginning of a row.
+ *
+ * @param doc   Document handle.
+ * @param field Index of the field.
+ *
+ * @return Offset in bytes of the field inside a row.
+ */
+size_t el_util_field_offset(const eld_handle_t *doc, uint8_t field) {
+	size_t offset = el_util_null_len(doc->ext.flags,
+									 doc->header.field_desc_count);
+	uint8_t i;
+
+	for (i = 0; i < field; i++) {
+		offset += doc->field_defs[i].size_bytes;
+	}
+
+	/* Booleans without a size live in the byte before them. */
+	if ((doc->field_defs[field].type == EL_FIELD_BOOL) &&
+		(doc->field_defs[field].size_bytes == 0))
+		offset--;
+
+	return offset;
+}
+
+/**
+ * Calculates the FNV-1a hash of a buffer.
+ *
+ * @param buf Buffer to be hashed.
+ * @param len Length of the buffer in bytes.
+ *
+ * @return Hash of the buffer.
+ */
+uint32_t el_util_hash(const char *buf, size_t len) {
+	uint32_t hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)buf[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+/**
+ * Counts the number of bits set in a word.
+ *
+ * @param word Word to be checked.
+ *
+ * @return Number of bits set.
+ */
+uint32_t el_util_popcount(uint32_t word) {
+	word = word - ((word >> 1) & 0x55555555UL);
+	word = (word & 0x33333333UL) + ((word >> 2) & 0x33333333UL);
+	word = (word + (word >> 4)) & 0x0F0F0F0FUL;
+
+	return (uint32_t)((word * 0x01010101UL) & 0xFFFFFFFFUL) >> 24;
+}
+
+/**
+ * Calculates the hash of a key straight from its raw bytes in a row. Numeric
+ * keys are hashed by value so that integers and floats can be matched.
+ *
+ * @param field Field definition of the key.
+ * @param raw   Pointer to the first byte of the key.
+ *
+ * @return Hash of the key.
+ */
+uint32_t el_util_key_hash(const el_field_def_t *field, const char *raw) {
+	el_number_t value;
+	const char *end;
+
+	/* Only hash the actual contents of strings. */
+	if (field->type == EL_FIELD_STRING) {
+		end = (const char *)memchr(raw, '\0', field->size_bytes);
+		return el_util_hash(raw, (end == NULL) ? field->size_bytes :
+							(size_t)(end - raw));
+	}
+
+	el_util_raw_exact(field, raw, &value);
+	return el_util_number_hash(&value);
+}
+
+/**
+ * Calculates the hash of a numeric key. Integers that a double can hold get
+ * the same hash as the equal floats.
+ *
+ * @param value Value of the key.
+ *
+ * @return Hash of the key.
+ */
+uint32_t el_util_number_hash(const el_number_t *value) {
+	double real = value->real;
+#ifdef EL_HAS_INT64
+	const int64_t limit = (int64_t)1 << 53;
+
+	/* Integers that a double can't hold are hashed as they are. */
+	if ((value->kind == EL_NUMBER_UINT) ||
+		((value->kind == EL_NUMBER_INT) &&
+		 ((value->integer > limit) || (value->integer < -limit)))) {
+		return el_util_hash((const char *)&(value->integer), sizeof(int64_t));
+	}
+#endif /* EL_HAS_INT64 */
+
+	/* Make sure that both zeros end up with the same hash. */
+	if (real == 0)
+		real = 0;
+
+	return el_util_hash((const char *)&real, sizeof(double));
+}
+
+/**
+ * Checks if two keys are equal straight from their raw bytes in a row.
+ *
+ * @param a_field Field definition of the first key.
+ * @param a       Pointer to the first byte of the first key.
+ * @param b_field Field definition of the second key.
+ * @param b       Pointer to the first byte of the second key.
+ *
+ * @return Are the keys equal?
+ */
+bool el_util_key_equal(const el_field_def_t *a_field, const char *a,
+					   const el_field_def_t *b_field, const char *b) {
+	el_number_t a_value;
+	el_number_t b_value;
+	size_t len;
+
+	/* Numbers are compared by value. */
+	if (a_field->type != EL_FIELD_STRING) {
+#ifdef EL_HAS_INT64
+		/* Decimals with the same scale can be compared as they are. */
+		if ((a_field->type == EL_FIELD_DECIMAL) &&
+			(b_field->type == EL_FIELD_DECIMAL) &&
+			(a_field->reserved == b_field->reserved))
+			return memcmp(a, b, sizeof(int64_t)) == 0;
+#endif /* EL_HAS_INT64 */
+
+		el_util_raw_exact(a_field, a, &a_value);
+		el_util_raw_exact(b_field, b, &b_value);
+		return el_util_number_equal(&a_value, &b_value);
+	}
+
+	/* Strings of different widths are equal if the longer one ends early. */
+	len = (a_field->size_bytes < b_field->size_bytes) ? a_field->size_bytes :
+		b_field->size_bytes;
+	if (strncmp(a, b, len) != 0)
+		return false;
+	if ((a_field->size_bytes > len) && (memchr(a, '\0', len) == NULL))
+		return a[len] == '\0';
+	if ((b_field->size_bytes > len) && (memchr(b, '\0', len) == NULL))
+		return b[len] == '\0';
+
+	return true;
+}
+
+/**
+ * Gets the value of a numeric cell straight from its raw bytes in a row.
+ *
+ * @param field Field definition of the cell.
+ * @param raw   Pointer to the first byte of the cell. (The shared byte for
+ *              booleans)
+ *
+ * @return Value of the cell or 0 if the field isn't numeric.
+ */
+double el_util_raw_number(const el_field_def_t *field, const char *raw) {
+	el_cell_t cell;
+
+	/* Implicit fields don't have anything stored in the row. */
+	if (el_util_field_implicit(field))
+		return 0;
+
+	switch ((el_type_t)field->type) {
+		case EL_FIELD_STRING:
+		case EL_FIELD_VARCHAR:
+		case EL_FIELD_FLOAT_ARRAY:
+		case EL_FIELD_INT_ARRAY:
+			return 0;
+		case EL_FIELD_BOOL:
+			return ((uint8_t)raw[0] >> field->reserved) & 1;
+		default:
+			memcpy(&(cell.value), raw, el_util_sizeof((el_type_t)field->type));
+			break;
+	}
+
+	switch ((el_type_t)field->type) {
+		case EL_FIELD_INT:
+			return (double)cell.value.integer;
+		case EL_FIELD_FLOAT:
+			return (double)cell.value.number;
+		case EL_FIELD_INT8:
+			return (double)cell.value.int8;
+		case EL_FIELD_INT16:
+			return (double)cell.value.int16;
+		case EL_FIELD_UINT8:
+			return (double)cell.value.uint8;
+		case EL_FIELD_UINT16:
+			return (double)cell.value.uint16;
+		case EL_FIELD_UINT32:
+			return (double)cell.value.uint32;
+#ifdef EL_HAS_INT64
+		case EL_FIELD_INT64:
+			return (double)cell.value.int64;
+		case EL_FIELD_UINT64:
+			return (double)cell.value.uint64;
+		case EL_FIELD_TIMESTAMP:
+			return (double)cell.value.timestamp;
+		case EL_FIELD_DECIMAL:
+			/* Dividing gets the double closest to the decimal value. */
+			return (double)cell.value.decimal /
+				(double)el_util_decimal_factor(field);
+#endif /* EL_HAS_INT64 */
+		case EL_FIELD_DOUBLE:
+			return cell.value.real;
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+/**
+ * Gets the value of a numeric cell of a row, working it out from the index of
+ * the row if it's an implicit timestamp.
+ *
+ * @param doc   Document handle.
+ * @param field Field definition of the cell.
+ * @param raw   Pointer to the first byte of the cell. (The shared byte for
+ *              booleans)
+ * @param index Index of the row.
+ *
+ * @return Value of the cell or 0 if the field isn't numeric.
+ */
+double el_doc_raw_number(const eld_handle_t *doc, const el_field_def_t *field,
+						 const char *raw, uint32_t index) {
+#ifdef EL_HAS_INT64
+	if (el_util_field_implicit(field))
+		return (double)el_doc_row_time(doc, index);
+#endif /* EL_HAS_INT64 */
+
+	return el_util_raw_number(field, raw);
+}
+
+/**
+ * Gets the exact value of a numeric cell straight from its raw bytes in a row.
+ * 64-bit integers and timestamps are kept as they are, so only floats and
+ * decimals with a fractional part are reduced to a double.
+ *
+ * @param field Field definition of the cell.
+ * @param raw   Pointer to the first byte of the cell. (The shared byte for
+ *              booleans)
+ * @param num   Pointer to store the value of the cell. (0 if the field isn't
+ *              numeric)
+ */
+void el_util_raw_exact(const el_field_def_t *field, const char *raw,
+					   el_number_t *num) {
+#ifdef EL_HAS_INT64
+	int64_t value;
+	int64_t factor;
+
+	if (!el_util_field_implicit(field)) {
+		switch ((el_type_t)field->type) {
+			case EL_FIELD_INT64:
+			case EL_FIELD_TIMESTAMP:
+				memcpy(&value, raw, sizeof(int64_t));
+				num->real = (double)value;
+				num->kind = EL_NUMBER_INT;
+				num->integer = value;
+				return;
+			case EL_FIELD_UINT64:
+				memcpy(&value, raw, sizeof(int64_t));
+				num->real = (double)(uint64_t)value;
+				num->kind = (value < 0) ? EL_NUMBER_UINT : EL_NUMBER_INT;
+				num->integer = value;
+				return;
+			case EL_FIELD_DECIMAL:
+				memcpy(&value, raw, sizeof(int64_t));
+				factor = el_util_decimal_factor(field);
+				num->real = el_util_raw_number(field, raw);
+				num->kind = EL_NUMBER_REAL;
+				num->integer = 0;
+
+				/* Only whole decimals can be matched exactly with integers. */
+				if ((value % factor) == 0) {
+					num->real = (double)(value / factor);
+					num->kind = EL_NUMBER_INT;
+					num->integer = value / factor;
+				}
+				return;
+			default:
+				break;
+		}
+	}
+#endif /* EL_HAS_INT64 */
+
+	el_util_number_set(num, el_util_raw_number(field, raw));
+}
+
+/**
+ * Gets the exact value of a numeric cell of a row, working it out from the
+ * index of the row if it's an implicit timestamp.
+ *
+ * @param doc   Document handle.
+ * @param field Field definition of the cell.
+ * @param raw   Pointer to the first byte of the cell. (The shared byte for
+ *              booleans)
+ * @param index Index of the row.
+ * @param num   Pointer to store the value of the cell.
+ */
+void el_doc_raw_exact(const eld_handle_t *doc, const el_field_def_t *field,
+					  const char *raw, uint32_t index, el_number_t *num) {
+#ifdef EL_HAS_INT64
+	if (el_util_field_implicit(field)) {
+		num->integer = el_doc_row_time(doc, index);
+		num->real = (double)num->integer;
+		num->kind = EL_NUMBER_INT;
+		return;
+	}
+#endif /* EL_HAS_INT64 */
+
+	el_util_raw_exact(field, raw, num);
+}
+
+/**
+ * Sets a numeric value from a double, keeping whole numbers as integers so
+ * that they can be matched with the exact ones.
+ *
+ * @param num   Numeric value to be set.
+ * @param value Value to be stored.
+ */
+void el_util_number_set(el_number_t *num, double value) {
+	num->real = value;
+#ifdef EL_HAS_INT64
+	num->kind = EL_NUMBER_REAL;
+	num->integer = 0;
+
+	if ((value >= -9223372036854775808.0) && (value < 9223372036854775808.0)) {
+		if ((double)(int64_t)value == value) {
+			num->kind = EL_NUMBER_INT;
+			num->integer = (int64_t)value;
+		}
+	} else if ((value > 0) && (value < 18446744073709551616.0)) {
+		/* Doubles this large are always whole. */
+		num->kind = EL_NUMBER_UINT;
+		num->integer = (int64_t)(uint64_t)value;
+	}
+#endif /* EL_HAS_INT64 */
+}
+
+/**
+ * Parses a numeric literal. Integer literals are kept exact even if a double
+ * can't hold them.
+ *
+ * @param num Numeric value to store the literal in.
+ * @param str Literal to be parsed.
+ *
+ * @return Pointer to the character after the literal or str if there wasn't
+ *         a number to be parsed.
+ */
+const char *el_util_number_parse(el_number_t *num, const char *str) {
+	char *end;
+	double value;
+#ifdef EL_HAS_INT64
+	const char *pos = str;
+	uint64_t magnitude = 0;
+	bool negative = false;
+#endif /* EL_HAS_INT64 */
+
+	/* Parse it as a double first. */
+	value = strtod(str, &end);
+	if (end == str)
+		return str;
+	el_util_number_set(num, value);
+
+#ifdef EL_HAS_INT64
+	/* Check if it's made up only of digits. */
+	if ((*pos == '-') || (*pos == '+'))
+		negative = *pos++ == '-';
+	while ((pos < end) && (*pos >= '0') && (*pos <= '9')) {
+		if (magnitude > ((~(uint64_t)0 - (uint64_t)(*pos - '0')) / 10))
+			return end;
+		magnitude = (magnitude * 10) + (uint64_t)(*pos++ - '0');
+	}
+	if (pos != end)
+		return end;
+
+	/* Store it exactly if it fits. */
+	if (!negative) {
+		num->kind = (magnitude >> 63) ? EL_NUMBER_UINT : EL_NUMBER_INT;
+		num->integer = (int64_t)magnitude;
+	} else if (magnitude <= ((uint64_t)1 << 63)) {
+		num->kind = EL_NUMBER_INT;
+		num->integer = (magnitude == 0) ? 0 : -(int64_t)(magnitude - 1) - 1;
+	}
+#endif /* EL_HAS_INT64 */
+
+	return end;
+}
+
+/**
+ * Compares two numeric values, exactly if both of them are integers.
  *
- * @param type   Type of the field data.
- * @param name   Name of the field.
- * @param length Length of the field. Set to 1 always, except for strings.
+ * @param a First value.
+ * @param b Second value.
  *
- * @return A populated field definition structure.
+ * @return Negative, zero or positive if a is less than, equal to or greater
+ *         than b.
  */
-el_field_def_t el_field_def_new(el_type_t type, const char *name, uint16_t length) {
-	el_field_def_t field;
+int el_util_number_cmp(const el_number_t *a, const el_number_t *b) {
+#ifdef EL_HAS_INT64
+	if ((a->kind != EL_NUMBER_REAL) && (b->kind != EL_NUMBER_REAL)) {
+		/* Unsigned integers that don't fit an int64_t are always larger. */
+		if (a->kind != b->kind)
+			return (a->kind == EL_NUMBER_UINT) ? 1 : -1;
+		if (a->kind == EL_NUMBER_UINT) {
+			return ((uint64_t)a->integer > (uint64_t)b->integer) -
+				((uint64_t)a->integer < (uint64_t)b->integer);
+		}
 
-	/* Set the basics. */
-	field.reserved = '@';
-	field.type = (uint8_t)type;
-	field.size_bytes = el_util_sizeof(type) * length;
+		return (a->integer > b->integer) - (a->integer < b->integer);
+	}
+#endif /* EL_HAS_INT64 */
 
-	/* Make sure we allocate enough space for strings. */
-	if (field.type == EL_FIELD_STRING)
-		field.size_bytes += el_util_sizeof(type);
+	return (a->real > b->real) - (a->real < b->real);
+}
 
-	/* Copy the name over. */
-	memset(field.name, '\0', EL_FIELD_NAME_LEN + 1);
-	strncpy(field.name, name, EL_FIELD_NAME_LEN);
+/**
+ * Checks if two numeric values are equal, exactly if both of them are
+ * integers.
+ *
+ * @param a First value.
+ * @param b Second value.
+ *
+ * @return Are the values equal? (Never for NaNs)
+ */
+bool el_util_number_equal(const el_number_t *a, const el_number_t *b) {
+#ifdef EL_HAS_INT64
+	if ((a->kind != EL_NUMBER_REAL) && (b->kind != EL_NUMBER_REAL))
+		return (a->kind == b->kind) && (a->integer == b->integer);
+#endif /* EL_HAS_INT64 */
 
-	return field;
+	return a->real == b->real;
 }
 
 /**
- * Creates a brand new allocated row object.
- * @warning This function allocates memory that you are responsible for freeing.
- *
- * @param doc Document handle.
+ * Subtracts two numeric values, exactly if both of them are integers, so that
+ * nearby timestamps still have a difference.
  *
- * @return Brand new allocated row object.
+ * @param a Value to be subtracted from.
+ * @param b Value to subtract.
  *
- * @see el_row_get
+ * @return Difference between the values.
  */
-el_row_t *el_row_new(const eld_handle_t *doc) {
-	el_row_t *row;
-	uint8_t i;
+double el_util_number_sub(const el_number_t *a, const el_number_t *b) {
+#ifdef EL_HAS_INT64
+	if ((a->kind != EL_NUMBER_REAL) && (b->kind != EL_NUMBER_REAL))
+		return (double)(int64_t)((uint64_t)a->integer - (uint64_t)b->integer);
+#endif /* EL_HAS_INT64 */
 
-	/* Allocate memory for our row structure and populate some of it. */
-	row = (el_row_t *)malloc(sizeof(el_row_t));
-	row->index = doc->header.row_count;
-	row->cell_count = doc->header.field_desc_count;
+	return a->real - b->real;
+}
 
-	/* Allocate memory for our cells and prepare them to receive data. */
-	row->cells = (el_cell_t *)malloc(sizeof(el_cell_t) * row->cell_count);
-	for (i = 0; i < row->cell_count; i++) {
-		el_cell_t *cell = &(row->cells[i]);
+/**
+ * Checks if a field of a row is null.
+ *
+ * @param doc   Document handle.
+ * @param row   Raw bytes of the row.
+ * @param field Index of the field.
+ *
+ * @return True if the document has a null bitmap and the field is null.
+ */
+bool el_doc_raw_null(const eld_handle_t *doc, const char *row, uint8_t field) {
+	if (!(doc->ext.flags & EL_EXT_NULLS))
+		return false;
 
-		/* Populate the field definition. */
-		cell->field = &(doc->field_defs[i]);
+	return ((uint8_t)row[field >> 3] >> (field & 7)) & 1;
+}
 
-		/* Allocate space for types that need it. */
-		switch (cell->field->type) {
-			case EL_FIELD_STRING:
-				cell->value.string = (char *)malloc(cell->field->size_bytes);
-				memset(cell->value.string, '\0', cell->field->size_bytes);
-				break;
-			default:
-				break;
-		}
-	}
+/**
+ * Calculates the length of the null bitmap at the beginning of each row.
+ *
+ * @param flags Header extension flags the rows were written with.
+ * @param count Number of fields in the rows.
+ *
+ * @return Length of the null bitmap in bytes or 0 if the rows don't have one.
+ */
+uint16_t el_util_null_len(uint16_t flags, uint8_t count) {
+	if (!(flags & EL_EXT_NULLS))
+		return 0;
 
-	return row;
+	return (count + 7) / 8;
 }
 
 /**
- * Seeks to the beginning of a row in the file given its index.
+ * Checks if a field is implicit, meaning it takes no space in the rows and its
+ * value is worked out from the row index.
  *
- * @param doc   Opened document object.
- * @param index Index of the row to seek to.
+ * @param field Field definition.
  *
- * @return TRUE if the operation was successful.
- *         FALSE otherwise (check ferror for more information).
+ * @return True if the field is an implicit timestamp.
  */
-bool el_row_seek(eld_handle_t *doc, uint32_t index) {
-	/* Determine the offset that the row is located at. */
-	size_t offset = doc->header.header_len + (doc->header.row_len * index);
-
-	/* Try to seek to the row offset. */
-	if (fseek(doc->fh, offset, SEEK_SET) != 0) {
-		el_error_msg_format(
-			EMSG("Couldn't seek in file \"%s\": %s."),
-			doc->fname, strerror(errno));
-		return false;
-	}
+bool el_util_field_implicit(const el_field_def_t *field) {
+	return (field->type == EL_FIELD_TIMESTAMP) && (field->size_bytes == 0);
+}
 
-	return true;
+/**
+ * Checks if a field holds strings, either fixed or variable-length ones.
+ *
+ * @param field Field definition.
+ *
+ * @return True if the field holds strings.
+ */
+bool el_util_is_string(const el_field_def_t *field) {
+	return (field->type == EL_FIELD_STRING) ||
+		(field->type == EL_FIELD_VARCHAR);
 }
 
 /**
- * Reads the contents of a row from the file into a row object.
- * @warning This function allocates memory that you are responsible for freeing.
+ * Rounds a length up so that whatever comes after it is suitably aligned for
+ * any of the types that we store.
  *
- * @param row   Prepared row object.
- * @param doc   Document object.
- * @param index Index of the row to be read.
+ * @param len Length to be rounded up.
  *
- * @return EL_OK if everything went fine.
- *         EL_ERROR_FILE if an error occurred while operating on the file.
+ * @return Aligned length.
+ */
+size_t el_util_align(size_t len) {
+	return (len + 7) & ~(size_t)7;
+}
+
+/**
+ * Checks if a field holds an array of numbers.
  *
- * @see el_row_get
+ * @param field Field definition.
+ *
+ * @return True if the field holds arrays.
  */
-el_err_t el_row_read(el_row_t *row, eld_handle_t *doc, uint32_t index) {
-	el_err_t err;
-	uint8_t i;
+bool el_util_is_array(const el_field_def_t *field) {
+	return (field->type == EL_FIELD_FLOAT_ARRAY) ||
+		(field->type == EL_FIELD_INT_ARRAY);
+}
 
-	/* Open the document. */
-	err = el_doc_fopen(doc, NULL, "rb");
-	IF_EL_ERROR(err) {
-		return err;
-	}
+#ifdef EL_HAS_INT64
+/**
+ * Gets the factor that the values of a decimal field are scaled by.
+ *
+ * @param field Decimal field definition.
+ *
+ * @return 10 to the power of the number of decimal places of the field.
+ */
+int64_t el_util_decimal_factor(const el_field_def_t *field) {
+	int64_t factor = 1;
+	char i;
 
-	/* Seek to the beginning of the rows section. */
-	if (!el_row_seek(doc, index))
-		return EL_ERROR_FILE;
+	for (i = 0; i < field->reserved; i++)
+		factor *= 10;
 
-	/* Populate the cells */
-	for (i = 0; i < row->cell_count; i++) {
-		size_t len;
-		el_cell_t *cell = &(row->cells[i]);
+	return factor;
+}
+#endif /* EL_HAS_INT64 */
 
-		/* Read the cell into our structure. */
-		len = cell->field->size_bytes;
-		switch ((el_type_t)cell->field->type) {
-			case EL_FIELD_INT:
-				fread(&(cell->value.integer), len, 1, doc->fh);
-				break;
-			case EL_FIELD_FLOAT:
-				fread(&(cell->value.number), len, 1, doc->fh);
-				break;
-			case EL_FIELD_STRING:
-				fread(cell->value.string, len, 1, doc->fh);
-				break;
-		}
+/**
+ * Stores a number in the raw bytes of a numeric cell.
+ *
+ * @param field Field definition of the cell.
+ * @param raw   Pointer to the first byte of the cell. (The shared byte for
+ *              booleans)
+ * @param value Value to be stored. (Truncated for integer fields)
+ */
+void el_util_raw_number_set(const el_field_def_t *field, char *raw,
+							double value) {
+	el_cell_t cell;
 
-		/* Check if the read operation was successful. */
-		if (feof(doc->fh)) {
-			/* EOF reached. */
-			el_error_msg_format(
-				EMSG("End-of-file reached before we could finish reading "
-						"cell %u at row %lu."), i, index);
-			return EL_ERROR_FILE;
-		} else if (ferror(doc->fh)) {
-			/* Error reading. */
-			el_error_msg_format(
-				EMSG("Error occurred while trying to read cell %u at row "
-						"%lu: %s."), i, index, strerror(errno));
-			return EL_ERROR_FILE;
-		}
+	switch ((el_type_t)field->type) {
+		case EL_FIELD_INT:
+			cell.value.integer = (int32_t)value;
+			break;
+		case EL_FIELD_FLOAT:
+			cell.value.number = (float)value;
+			break;
+		case EL_FIELD_INT8:
+			cell.value.int8 = (int8_t)value;
+			break;
+		case EL_FIELD_INT16:
+			cell.value.int16 = (int16_t)value;
+			break;
+		case EL_FIELD_UINT8:
+			cell.value.uint8 = (uint8_t)value;
+			break;
+		case EL_FIELD_UINT16:
+			cell.value.uint16 = (uint16_t)value;
+			break;
+		case EL_FIELD_UINT32:
+			cell.value.uint32 = (uint32_t)value;
+			break;
+#ifdef EL_HAS_INT64
+		case EL_FIELD_INT64:
+			cell.value.int64 = (int64_t)value;
+			break;
+		case EL_FIELD_UINT64:
+			cell.value.uint64 = (uint64_t)value;
+			break;
+		case EL_FIELD_TIMESTAMP:
+			if (el_util_field_implicit(field))
+				return;
+			cell.value.timestamp = (int64_t)value;
+			break;
+		case EL_FIELD_DECIMAL:
+			value *= (double)el_util_decimal_factor(field);
+			cell.value.decimal = (int64_t)((value < 0) ? (value - 0.5) :
+										   (value + 0.5));
+			break;
+#endif /* EL_HAS_INT64 */
+		case EL_FIELD_DOUBLE:
+			cell.value.real = value;
+			break;
+		case EL_FIELD_BOOL:
+			if (value != 0) {
+				raw[0] |= 1 << field->reserved;
+			} else {
+				raw[0] &= ~(1 << field->reserved);
+			}
+			return;
+		default:
+			return;
 	}
 
-	/* Close the document and return. */
-	err = el_doc_fclose(doc);
-	return err;
+	memcpy(raw, &(cell.value), el_util_sizeof((el_type_t)field->type));
 }
 
 /**
- * Gets a row from a document at a specified index.
+ * Builds the path of a sidecar file that lives next to the document file.
  * @warning This function allocates memory that you are responsible for freeing.
  *
- * @param doc   Document handle.
- * @param index Index of the row.
+ * @param doc    Document handle.
+ * @param suffix Suffix appended to the document file name.
  *
- * @return Requested row (allocated memory) or NULL if one wasn't found.
- *
- * @see el_row_new
+ * @return Path of the sidecar file.
  */
-el_row_t *el_row_get(eld_handle_t *doc, uint32_t index) {
-	el_err_t err;
-	el_row_t *row;
-
-	/* Check if the index is valid. */
-	if (index >= doc->header.row_count) {
-		el_error_msg_format(EMSG("Requested index %lu is greater than the "
-								 "number of rows (%lu) in the document."),
-							index, doc->header.row_count);
-		return NULL;
-	}
+char *el_util_sidecar_name(const eld_handle_t *doc, const char *suffix) {
+	return el_util_path_suffix(doc->fname, suffix);
+}
 
-	/* Create a new row object and set its index. */
-	row = el_row_new(doc);
-	row->index = index;
+/**
+ * Appends a suffix to a file path.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param fname  File path.
+ * @param suffix Suffix appended to the path.
+ *
+ * @return Path with the suffix.
+ */
+char *el_util_path_suffix(const char *fname, const char *suffix) {
+	char *path;
 
-	/* Populate the row object with cells. */
-	err = el_row_read(row, doc, index);
-	IF_EL_ERROR(err) {
-		el_row_free(row);
-		return NULL;
-	}
+	path = (char *)malloc(strlen(fname) + strlen(suffix) + 1);
+	strcpy(path, fname);
+	strcat(path, suffix);
 
-	return row;
+	return path;
 }
 
 /**
- * Frees up any resources allocated by a row object.
+ * Opens a sidecar file that lives next to the document file.
  *
- * @param row Row object to be free'd.
+ * @param doc    Document handle.
+ * @param suffix Suffix appended to the document file name.
+ * @param fmode  File opening mode string. (see fopen)
+ *
+ * @return File handle or NULL if the file couldn't be opened.
  */
-void el_row_free(el_row_t *row) {
-	uint8_t i;
-
-	/* Should we do anything? */
-	if (row == NULL)
-		return;
+FILE *el_util_sidecar_fopen(const eld_handle_t *doc, const char *suffix,
+							const char *fmode) {
+	char *fname;
+	FILE *fh;
 
-	/* Free any cell contents that were allocated. */
-	for (i = 0; i < row->cell_count; i++) {
-		switch (row->cells[i].field->type) {
-			case EL_FIELD_STRING:
-				/* Strings are allocated */
-				free(row->cells[i].value.string);
-				row->cells[i].value.string = NULL;
+	fname = el_util_sidecar_name(doc, suffix);
+	fh = fopen(fname, fmode);
+	free(fname);
 
-				break;
-			default:
-				break;
-		}
-	}
+	return fh;
+}
 
-	/* Ensure that all of our counters are reset. */
-	row->index = 0;
-	row->cell_count = 0;
+/**
+ * Checks if a sidecar was written for a document, rather than left behind by
+ * another document that used to be at the same path.
+ *
+ * @param doc    Document handle.
+ * @param doc_id Document identity stamped in the sidecar.
+ *
+ * @return True if the sidecar belongs to the document. Sidecars of documents
+ *         that predate identities always do.
+ */
+bool el_util_sidecar_owned(const eld_handle_t *doc, uint32_t doc_id) {
+	return (doc->ext.doc_id == 0) || (doc_id == doc->ext.doc_id);
+}
 
-	/* Free the cells. */
-	if (row->cells == NULL)
-		return;
-	free(row->cells);
-	row->cells = NULL;
+/**
+ * Closes and removes a sidecar that doesn't belong to the document.
+ *
+ * @param doc    Document handle.
+ * @param suffix Suffix appended to the document file name.
+ * @param fh     Open handle of the sidecar.
+ */
+void el_util_sidecar_drop(const eld_handle_t *doc, const char *suffix,
+						  FILE *fh) {
+	char *fname;
 
-	/* Free ourselves. */
-	free(row);
-	row = NULL;
+	fclose(fh);
+	fname = el_util_sidecar_name(doc, suffix);
+	remove(fname);
+	free(fname);
 }
 
 /**
- * Calculates the length of the file header based on the field descriptor length
- * and the number of fields defined.
+ * Removes every sidecar that may exist next to the document file.
  *
  * @param doc Document handle.
  */
-void el_util_calc_header_len(eld_handle_t *doc) {
-	doc->header.header_len =
-		(sizeof(el_field_def_t) * doc->header.field_desc_count) +
-		sizeof(eld_header_t);
+void el_util_sidecars_remove(const eld_handle_t *doc) {
+	const char *suffixes[] = { ".ts", ".sv", ".vh", ".rc", NULL };
+	char suffix[8];
+	char *fname;
+	unsigned int i;
+
+	for (i = 0; suffixes[i] != NULL; i++) {
+		fname = el_util_sidecar_name(doc, suffixes[i]);
+		remove(fname);
+		free(fname);
+	}
+
+	/* Bloom filters and indexes are per field. */
+	for (i = 0; i <= UINT8_MAX; i++) {
+		sprintf(suffix, ".bf%u", i);
+		fname = el_util_sidecar_name(doc, suffix);
+		remove(fname);
+		free(fname);
+
+		sprintf(suffix, ".ix%u", i);
+		fname = el_util_sidecar_name(doc, suffix);
+		remove(fname);
+		free(fname);
+	}
 }
 
 /**
- * Calculates the fixed length of a single row in a document given its header
- * parameters.
+ * Comes up with an identity for a brand new document. It only has to tell
+ * apart documents that end up at the same path, so it doesn't need to be a
+ * good random number.
  *
  * @param doc Document handle.
+ *
+ * @return Non-zero document identity.
  */
-void el_util_calc_row_len(eld_handle_t *doc) {
-	uint8_t i;
-
-	/* Check if we have the necessary data to perform calculations. */
-	if (doc->field_defs == NULL) {
-		doc->header.row_len = 0;
-		doc->header.row_count = 0;
+uint32_t el_util_doc_id(const eld_handle_t *doc) {
+	static uint32_t count = 0;
+	char seed[sizeof(time_t) + sizeof(clock_t) + sizeof(doc) +
+			  sizeof(uint32_t)];
+	time_t now = time(NULL);
+	clock_t ticks = clock();
+	uint32_t id;
 
-		return;
-	}
+	count++;
+	memcpy(seed, &now, sizeof(time_t));
+	memcpy(seed + sizeof(time_t), &ticks, sizeof(clock_t));
+	memcpy(seed + sizeof(time_t) + sizeof(clock_t), &doc, sizeof(doc));
+	memcpy(seed + sizeof(time_t) + sizeof(clock_t) + sizeof(doc), &count,
+		   sizeof(uint32_t));
+	id = el_util_hash(seed, sizeof(seed));
 
-	/* Go through field definitions calculating their individual lengths. */
-	doc->header.row_len = 0;
-	for (i = 0; i < doc->header.field_desc_count; i++) {
-		doc->header.row_len += doc->field_defs[i].size_bytes;
-	}
+	return (id == 0) ? 1 : id;
 }
 
 /**
@@ -701,9 +9497,32 @@ uint16_t el_util_sizeof(el_type_t type) {
 		case EL_FIELD_INT:
 			return sizeof(int32_t);
 		case EL_FIELD_FLOAT:
+		case EL_FIELD_FLOAT_ARRAY:
 			return sizeof(float);
+		case EL_FIELD_INT_ARRAY:
+			return sizeof(int32_t);
 		case EL_FIELD_STRING:
+		case EL_FIELD_VARCHAR:
 			return sizeof(char);
+		case EL_FIELD_INT8:
+			return sizeof(int8_t);
+		case EL_FIELD_INT16:
+			return sizeof(int16_t);
+		case EL_FIELD_UINT8:
+		case EL_FIELD_BOOL:
+			return sizeof(uint8_t);
+		case EL_FIELD_UINT16:
+			return sizeof(uint16_t);
+		case EL_FIELD_UINT32:
+			return sizeof(uint32_t);
+		case EL_FIELD_INT64:
+		case EL_FIELD_UINT64:
+		case EL_FIELD_TIMESTAMP:
+		case EL_FIELD_DECIMAL:
+			/* Even on platforms without 64-bit integers. */
+			return 8;
+		case EL_FIELD_DOUBLE:
+			return sizeof(double);
 	}
 
 	return 0;
@@ -807,7 +9626,7 @@ size_t el_util_strstrcpy(char **dest, const char *start, const char *end) {
 	const char *src_buf;
 
 	/* Allocate space for the new string. */
-	len = (end - start) + 1;
+	len = (end - start) + 2;
 	*dest = (char *)malloc(len * sizeof(char));
 
 	/* Copy the new string over. */
@@ -877,3 +9696,72 @@ size_t el_util_strcpy(char **dest, const char *src) {
 bool el_util_file_exists(const char *fname) {
 	return access(fname, F_OK) == 0;
 }
+
+/**
+ * Sets the position of a file, going past 2 GiB where the platform allows it.
+ *
+ * @param fh     File handle.
+ * @param offset Offset relative to whence.
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+ *
+ * @return 0 if the position was set.
+ */
+int el_util_fseek(FILE *fh, el_off_t offset, int whence) {
+#ifdef __MSDOS__
+	return fseek(fh, (long)offset, whence);
+#else
+	return fseeko(fh, (off_t)offset, whence);
+#endif /* __MSDOS__ */
+}
+
+/**
+ * Gets the position of a file, going past 2 GiB where the platform allows it.
+ *
+ * @param fh File handle.
+ *
+ * @return Current position or -1 if it couldn't be determined.
+ */
+el_off_t el_util_ftell(FILE *fh) {
+#ifdef __MSDOS__
+	return (el_off_t)ftell(fh);
+#else
+	return (el_off_t)ftello(fh);
+#endif /* __MSDOS__ */
+}
+
+#ifdef EL_HAS_INT64
+/**
+ * Gets the current time with the best resolution the platform has to offer.
+ * The wall clock is only read once and the monotonic clock is added to it from
+ * then on, so that the time never steps back when the system clock is set.
+ *
+ * @return Nanoseconds since the epoch.
+ */
+int64_t el_util_time_now(void) {
+#if defined(CLOCK_MONOTONIC)
+	static int64_t base = 0;
+	static int64_t mono_base = 0;
+	struct timespec ts;
+	int64_t mono;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	mono = ((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec;
+
+	/* Anchor the monotonic clock to the wall clock on the first call. */
+	if (base == 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		base = ((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec;
+		mono_base = mono;
+	}
+
+	return base + (mono - mono_base);
+#elif defined(CLOCK_REALTIME)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec;
+#else
+	return (int64_t)time(NULL) * 1000000000L;
+#endif /* CLOCK_REALTIME */
+}
+#endif /* EL_HAS_INT64 */
@@ -19,10 +19,12 @@
 #endif /* !__MSDOS__ */
 
 #ifdef __MSDOS__
-/* Integer types. */
+/* Integer types. (There are no 64-bit integers available) */
 typedef unsigned char uint8_t;
 typedef unsigned int uint16_t;
 typedef unsigned long uint32_t;
+typedef signed char int8_t;
+typedef int int16_t;
 typedef long int32_t;
 
 /* Boolean. */
@@ -31,6 +33,10 @@ typedef uint8_t bool;
 #define false 0
 #endif /* __MSDOS__ */
 
+#ifndef __MSDOS__
+#define EL_HAS_INT64
+#endif /* !__MSDOS__ */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,23 +46,52 @@ extern "C" {
 
 /* Sizes definitions. */
 #define EL_FIELD_NAME_LEN 19
+#define EL_SCAN_BLOCK_ROWS 1024
+#define EL_BLOOM_BUCKETS 32
+#define EL_BITMAP_ARRAY_MAX 4096
+#define EL_BITMAP_WORDS 2048
+#define EL_INDEX_DELTA_ROWS 4096
+
+/* Header extension flags. */
+#define EL_EXT_NULLS 0x0001
 
 /* EntryLogger parser status codes. */
 typedef enum {
 	EL_OK = 0,
 	EL_ERROR_FILE,
 	EL_ERROR_UNKNOWN,
-	EL_ERROR_NOT_IMPL
+	EL_ERROR_NOT_IMPL,
+	EL_ERROR_ARGUMENT
 } el_err_t;
 
 /* Field types. */
 typedef enum {
 	EL_FIELD_INT = 0,
 	EL_FIELD_FLOAT,
-	EL_FIELD_STRING
+	EL_FIELD_STRING,
+	EL_FIELD_INT8,
+	EL_FIELD_INT16,
+	EL_FIELD_INT64,
+	EL_FIELD_UINT8,
+	EL_FIELD_UINT16,
+	EL_FIELD_UINT32,
+	EL_FIELD_UINT64,
+	EL_FIELD_DOUBLE,
+	EL_FIELD_BOOL,
+	EL_FIELD_TIMESTAMP,
+	EL_FIELD_VARCHAR,
+	EL_FIELD_DECIMAL,
+	EL_FIELD_FLOAT_ARRAY,
+	EL_FIELD_INT_ARRAY
 } el_type_t;
 
-/* Field descriptor. */
+/* Field descriptor. (Consecutive booleans share bytes: the first one of each
+   byte has a size of 1, the others a size of 0, and reserved holds the bit.
+   Timestamps with a size of 0 are implicit and come from the row index.
+   Variable-length strings start with their length and hold either the string
+   itself or its offset in the heap sidecar. Decimals are 64-bit integers
+   scaled by 10 to the power of the number of places kept in reserved. Arrays
+   hold their elements one after the other) */
 typedef struct {
 	char reserved;
 	uint8_t type;
@@ -64,25 +99,68 @@ typedef struct {
 	char name[EL_FIELD_NAME_LEN + 1];
 } el_field_def_t;
 
-/* Cell data abstraction. */
+/* Cell data abstraction. (Interned cells share their string with the document
+   and must not be changed) */
 typedef struct {
 	el_field_def_t *field;
+	bool null;
+	bool interned;
 
 	union {
 		int32_t integer;
 		float number;
 		char *string;
+		int8_t int8;
+		int16_t int16;
+		uint8_t uint8;
+		uint16_t uint16;
+		uint32_t uint32;
+#ifdef EL_HAS_INT64
+		int64_t int64;
+		uint64_t uint64;
+		int64_t timestamp;
+		int64_t decimal;
+#endif /* EL_HAS_INT64 */
+		double real;
+		bool boolean;
+
+		struct {
+			void *data;
+			uint16_t len;
+		} array;
 	} value;
 } el_cell_t;
 
-/* Row data abstraction. */
+/* Row data abstraction. (Interned rows share their strings with the document
+   and must not be changed) */
 typedef struct {
 	uint32_t index;
 	uint8_t cell_count;
+	bool interned;
 
 	el_cell_t *cells;
 } el_row_t;
 
+/* Structure-of-arrays set of rows. (Each column holds the values of a field
+   one after the other: booleans take a byte, implicit timestamps are filled
+   in, fixed-length strings keep their width and variable-length ones are
+   offsets into the arena) */
+typedef struct {
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t *indexes;
+
+	uint8_t field_count;
+	el_field_def_t *field_defs;
+	uint16_t *widths;
+	char **columns;
+	uint8_t **nulls;
+
+	char *arena;
+	size_t arena_len;
+	size_t arena_capacity;
+} el_rowset_t;
+
 /* EntryLogger document header. */
 typedef struct {
 	char magic[2];
@@ -97,16 +175,296 @@ typedef struct {
 	char reserved[4];
 } eld_header_t;
 
+/* EntryLogger document header extension. (Present when reserved[0] is '+')
+
+   Sidecars are stamped with doc_id, so that the ones left behind by another
+   document at the same path can be told apart. Older documents have a 0. */
+typedef struct {
+	uint16_t ext_len;
+	uint16_t flags;
+
+	uint32_t row_base;
+	uint32_t ring_rows;
+	uint32_t reserved;
+
+	/* Platforms without 64-bit integers still keep their room, so that the
+	   layout of the extension is the same everywhere. */
+#ifdef EL_HAS_INT64
+	int64_t time_start;
+	int64_t time_interval;
+#else
+	uint32_t time_start[2];
+	uint32_t time_interval[2];
+#endif /* EL_HAS_INT64 */
+
+	uint32_t doc_id;
+	uint32_t padding;
+} eld_header_ext_t;
+
+/* Roaring bitmap container. (Values sharing the same upper 16 bits) */
+typedef struct {
+	uint16_t key;
+	uint32_t cardinality;
+	uint32_t capacity;
+
+	uint16_t *array;
+	uint32_t *bits;
+} el_bitmap_container_t;
+
+/* Roaring bitmap of row indexes. */
+typedef struct {
+	uint32_t count;
+	el_bitmap_container_t *containers;
+} el_bitmap_t;
+
+/* Bitmap iteration callback. Return false to stop the iteration. */
+typedef bool (*el_bitmap_cb_t)(uint32_t value, void *arg);
+
+/* Tombstone sidecar header. */
+typedef struct {
+	char magic[2];
+	char reserved[2];
+
+	uint32_t count;
+	uint32_t doc_id;
+} el_tomb_header_t;
+
+/* Replication cursor sidecar header. (Followed by the hash of each block of
+   rows that was copied to the follower) */
+typedef struct {
+	char magic[2];
+	uint16_t header_len;
+
+	uint16_t row_len;
+	uint16_t reserved;
+
+	uint32_t block_count;
+	uint32_t doc_id;
+
+#ifdef EL_HAS_INT64
+	uint64_t data_len;
+	uint64_t heap_len;
+#else
+	uint32_t data_len;
+	uint32_t heap_len;
+#endif /* EL_HAS_INT64 */
+} el_repl_header_t;
+
+/* Bloom filter sidecar header. */
+typedef struct {
+	char magic[2];
+	uint8_t field;
+	uint8_t buckets;
+
+	uint32_t block_rows;
+	uint32_t block_count;
+	uint32_t doc_id;
+} el_bloom_header_t;
+
+/* String index sidecar header. */
+typedef struct {
+	char magic[2];
+	uint8_t field;
+	uint8_t reserved;
+
+	uint16_t key_len;
+	uint16_t entry_len;
+	uint32_t key_count;
+	uint32_t row_count;
+	uint32_t doc_id;
+} el_index_header_t;
+
+/* Schema versions sidecar entry. (Followed by its field definitions) */
+typedef struct {
+	uint32_t first_row;
+
+	uint16_t row_len;
+	uint8_t field_count;
+	uint8_t flags;
+
+#ifdef EL_HAS_INT64
+	uint64_t offset;
+#else
+	uint32_t offset;
+#endif /* EL_HAS_INT64 */
+} el_schema_header_t;
+
+/* Schema that the rows from a point of the document on were written with. */
+typedef struct {
+	el_schema_header_t header;
+	el_field_def_t *field_defs;
+} el_schema_t;
+
+/* String index over a field. (Sorted keys with their row posting lists) */
+typedef struct {
+	el_index_header_t header;
+
+	char *entries;
+	uint32_t *postings;
+
+	uint32_t delta_count;
+	uint32_t delta_capacity;
+	char *delta;
+	el_bitmap_t *stale;
+} el_index_t;
+
+/* String index callback. Return false to stop the lookup. */
+typedef bool (*el_index_cb_t)(const char *key, const uint32_t *rows,
+							  uint32_t count, void *arg);
+
+/* String intern pool. (Open addressing table of immutable strings) */
+typedef struct {
+	uint32_t count;
+	uint32_t capacity;
+	char **strings;
+} el_intern_t;
+
+/* Progress callback for long operations. Return false to cancel. */
+typedef bool (*el_progress_cb_t)(uint32_t done, uint32_t total, void *arg);
+
 /* EntryLogger document handle. */
 typedef struct {
 	char *fname;
 	FILE *fh;
 	char fmode[4];
+	FILE *heap;
 
 	eld_header_t header;
 	el_field_def_t *field_defs;
+	eld_header_ext_t ext;
+
+	uint16_t field_hash_len;
+	uint8_t *field_hash;
+
+	uint8_t bloom_count;
+	uint8_t *bloom_fields;
+
+	uint8_t index_count;
+	el_index_t **indexes;
+
+	el_bitmap_t *deleted;
+	el_intern_t *interns;
+
+	uint16_t schema_count;
+	el_schema_t *schemas;
+
+#ifdef EL_HAS_INT64
+	int64_t time_last;
+#endif /* EL_HAS_INT64 */
 } eld_handle_t;
 
+/* Filter expression instruction codes. */
+typedef enum {
+	EL_EXPR_CMP = 0,
+	EL_EXPR_AND,
+	EL_EXPR_OR,
+	EL_EXPR_NOT
+} el_expr_code_t;
+
+/* Filter expression comparison operators. */
+typedef enum {
+	EL_CMP_EQ = 0,
+	EL_CMP_NE,
+	EL_CMP_LT,
+	EL_CMP_LE,
+	EL_CMP_GT,
+	EL_CMP_GE,
+	EL_CMP_IS_NULL,
+	EL_CMP_NOT_NULL
+} el_cmp_t;
+
+/* Kinds of numeric values. */
+typedef enum {
+	EL_NUMBER_REAL = 0,
+	EL_NUMBER_INT,
+	EL_NUMBER_UINT
+} el_number_kind_t;
+
+/* Numeric value. (Integers are also kept as they are, since a double can't
+   tell apart the ones above 2^53. Unsigned ones that don't fit an int64_t are
+   kept as its bits with the EL_NUMBER_UINT kind) */
+typedef struct {
+	double real;
+#ifdef EL_HAS_INT64
+	uint8_t kind;
+	int64_t integer;
+#endif /* EL_HAS_INT64 */
+} el_number_t;
+
+/* Filter expression instruction. */
+typedef struct {
+	uint8_t code;
+	uint8_t cmp;
+	uint8_t field;
+	uint16_t offset;
+
+	el_number_t number;
+	char *string;
+} el_expr_inst_t;
+
+/* Compiled filter expression. (Postfix program bound to field offsets) */
+typedef struct {
+	uint16_t len;
+	uint8_t depth;
+
+	el_expr_inst_t *code;
+
+	uint16_t term_count;
+	uint16_t *terms;
+} el_expr_t;
+
+/* Scan callback. Return false to stop the scan. */
+typedef bool (*el_scan_cb_t)(eld_handle_t *doc, const el_row_t *row,
+							 void *arg);
+
+/* Join callback. Return false to stop the join. */
+typedef bool (*el_join_cb_t)(const el_row_t *left, const el_row_t *right,
+							 void *arg);
+
+/* Batch of rows flowing through a query pipeline. */
+typedef struct {
+	eld_handle_t *doc;
+	uint32_t first;
+	uint16_t count;
+	const char *raw;
+	const size_t *offsets;
+
+	uint16_t sel_count;
+	uint16_t *sel;
+
+	double **columns;
+	uint8_t **nulls;
+	uint8_t *decoded;
+
+	const uint8_t *fields;
+	uint8_t field_count;
+} el_batch_t;
+
+/* Query pipeline operator. Return false from push to stop the query. */
+typedef struct el_op_s el_op_t;
+struct el_op_s {
+	bool (*push)(el_op_t *op, el_batch_t *batch);
+	void (*free)(el_op_t *op);
+
+	el_op_t *next;
+	void *state;
+};
+
+/* Aggregated group of rows. (Null values aren't counted or accumulated) */
+typedef struct {
+	el_number_t key;
+	char *key_string;
+	bool key_null;
+
+	uint32_t count;
+	double sum;
+	double min;
+	double max;
+#ifdef EL_HAS_INT64
+	int64_t decimal_sum;
+#endif /* EL_HAS_INT64 */
+} el_group_t;
+
 /* EntryLogger document operations. */
 eld_handle_t *el_doc_new(void);
 el_err_t el_doc_fopen(eld_handle_t *doc, const char *fname, const char *fmode);
@@ -115,8 +473,26 @@ el_err_t el_doc_free(eld_handle_t *doc);
 el_err_t el_doc_read(eld_handle_t *doc, const char *fname);
 el_err_t el_doc_save(eld_handle_t *doc, const char *fname);
 el_err_t el_doc_field_add(eld_handle_t *doc, el_field_def_t field);
+el_err_t el_doc_field_drop(eld_handle_t *doc, uint8_t field);
+el_err_t el_doc_field_widen(eld_handle_t *doc, uint8_t field, uint16_t length);
+int el_doc_field_index(const eld_handle_t *doc, const char *name);
 el_err_t el_doc_row_add(eld_handle_t *doc, el_row_t *row);
 el_err_t el_doc_row_update(eld_handle_t *doc, const el_row_t *row);
+el_err_t el_doc_row_delete(eld_handle_t *doc, uint32_t index);
+bool el_doc_row_deleted(const eld_handle_t *doc, uint32_t index);
+el_err_t el_doc_compact(eld_handle_t *doc, el_progress_cb_t progress,
+						void *arg);
+el_err_t el_doc_truncate_front(eld_handle_t *doc, uint32_t n_rows);
+el_err_t el_doc_ring(eld_handle_t *doc, uint32_t rows);
+el_err_t el_doc_replicate(eld_handle_t *src, const char *dst_path);
+el_err_t el_doc_nullable(eld_handle_t *doc, bool nullable);
+void el_doc_intern(eld_handle_t *doc, bool enable);
+const char *el_doc_intern_string(eld_handle_t *doc, const char *str);
+#ifdef EL_HAS_INT64
+el_err_t el_doc_time_implicit(eld_handle_t *doc, const char *name,
+							  int64_t start, int64_t interval);
+int64_t el_doc_row_time(const eld_handle_t *doc, uint32_t index);
+#endif /* EL_HAS_INT64 */
 
 /* Header operations. */
 el_field_def_t el_field_def_new(el_type_t type, const char *name, uint16_t length);
@@ -124,11 +500,107 @@ el_field_def_t el_field_def_new(el_type_t type, const char *name, uint16_t lengt
 /* Row operations. */
 el_row_t *el_row_new(const eld_handle_t *doc);
 el_row_t *el_row_get(eld_handle_t *doc, uint32_t index);
+el_cell_t *el_row_cell(const eld_handle_t *doc, el_row_t *row,
+					   const char *name);
 void el_row_free(el_row_t *row);
+el_err_t el_cell_string_set(el_cell_t *cell, const char *str);
+
+/* Row sets. */
+el_rowset_t *el_rowset_new(const eld_handle_t *doc, uint32_t capacity);
+void el_rowset_clear(el_rowset_t *set);
+el_err_t el_rowset_add(el_rowset_t *set);
+el_err_t el_rowset_read(eld_handle_t *doc, uint32_t start, uint32_t n,
+						el_rowset_t *set);
+el_err_t el_doc_rowset_append(eld_handle_t *doc, const el_rowset_t *set);
+void *el_rowset_column(const el_rowset_t *set, uint8_t field);
+const char *el_rowset_string(const el_rowset_t *set, uint8_t field,
+							 uint32_t row);
+void el_rowset_string_set(el_rowset_t *set, uint8_t field, uint32_t row,
+						  const char *str);
+bool el_rowset_null(const el_rowset_t *set, uint8_t field, uint32_t row);
+void el_rowset_free(el_rowset_t *set);
+
+/* Filter expressions and scans. */
+el_expr_t *el_expr_compile(const eld_handle_t *doc, const char *src);
+void el_expr_free(el_expr_t *expr);
+el_err_t el_doc_scan(eld_handle_t *doc, const el_expr_t *expr, el_scan_cb_t cb,
+					 void *arg);
+
+/* Row bitmaps. */
+el_bitmap_t *el_bitmap_new(void);
+void el_bitmap_free(el_bitmap_t *bm);
+void el_bitmap_add(el_bitmap_t *bm, uint32_t value);
+bool el_bitmap_contains(const el_bitmap_t *bm, uint32_t value);
+uint32_t el_bitmap_cardinality(const el_bitmap_t *bm);
+el_bitmap_t *el_bitmap_and(const el_bitmap_t *a, const el_bitmap_t *b);
+el_bitmap_t *el_bitmap_or(const el_bitmap_t *a, const el_bitmap_t *b);
+el_bitmap_t *el_bitmap_andnot(const el_bitmap_t *a, const el_bitmap_t *b);
+bool el_bitmap_foreach(const el_bitmap_t *bm, el_bitmap_cb_t cb, void *arg);
+el_bitmap_t *el_doc_filter(eld_handle_t *doc, const el_expr_t *expr);
+el_err_t el_doc_scan_rows(eld_handle_t *doc, const el_bitmap_t *rows,
+						  el_scan_cb_t cb, void *arg);
+
+/* Bloom filters. */
+el_err_t el_bloom_add(eld_handle_t *doc, uint8_t field);
+
+/* String indexes. */
+el_index_t *el_index_build(eld_handle_t *doc, uint8_t field);
+el_index_t *el_index_open(const eld_handle_t *doc, uint8_t field);
+el_err_t el_index_add(eld_handle_t *doc, uint8_t field,
+					  el_progress_cb_t progress, void *arg);
+const el_index_t *el_doc_index(const eld_handle_t *doc, uint8_t field);
+el_err_t el_index_merge(eld_handle_t *doc);
+void el_index_free(el_index_t *idx);
+el_err_t el_index_prefix(const el_index_t *idx, const char *prefix,
+						 el_index_cb_t cb, void *arg);
+el_err_t el_index_range(const el_index_t *idx, const char *lo, const char *hi,
+						el_index_cb_t cb, void *arg);
+el_bitmap_t *el_index_prefix_rows(const el_index_t *idx, const char *prefix);
+el_bitmap_t *el_index_range_rows(const el_index_t *idx, const char *lo,
+								 const char *hi);
+
+/* Joins. */
+el_err_t el_doc_hash_join(eld_handle_t *left, uint8_t left_key,
+						  eld_handle_t *right, uint8_t right_key,
+						  el_join_cb_t cb, void *arg);
+
+/* Query pipelines. */
+el_err_t el_query_run(eld_handle_t *doc, uint32_t start, uint32_t count,
+					  el_op_t *pipeline);
+el_op_t *el_op_new(bool (*push)(el_op_t *op, el_batch_t *batch),
+				   void (*free)(el_op_t *op), void *state);
+el_op_t *el_op_then(el_op_t *op, el_op_t *next);
+el_op_t *el_op_filter(const el_expr_t *expr);
+el_op_t *el_op_project(const uint8_t *fields, uint8_t count);
+el_op_t *el_op_limit(uint32_t limit);
+el_op_t *el_op_aggregate(int group_field, uint8_t field);
+el_op_t *el_op_output(el_scan_cb_t cb, void *arg);
+const el_group_t *el_op_aggregate_groups(const el_op_t *op, uint32_t *count);
+void el_op_free(el_op_t *op);
+const double *el_batch_column(el_batch_t *batch, uint8_t field);
+const uint8_t *el_batch_nulls(el_batch_t *batch, uint8_t field);
+
+/* Window operations. */
+el_err_t el_window_moving_avg(eld_handle_t *doc, uint8_t field,
+							  uint32_t window_rows, double *out);
+el_err_t el_window_ewma(eld_handle_t *doc, uint8_t field, double alpha,
+						double *out);
+el_err_t el_window_rate(eld_handle_t *doc, uint8_t field, uint8_t time_field,
+						double *out);
+el_err_t el_window_delta(eld_handle_t *doc, uint8_t field, double *out);
+
+/* Array reductions. */
+el_err_t el_array_rms(eld_handle_t *doc, uint8_t field, double *out);
+el_err_t el_array_peak(eld_handle_t *doc, uint8_t field, double *out);
+double el_cell_array_rms(const el_cell_t *cell);
+double el_cell_array_peak(const el_cell_t *cell);
 
 /* Utilities. */
 uint16_t el_util_sizeof(el_type_t type);
 bool el_util_file_exists(const char *fname);
+#ifdef EL_HAS_INT64
+int64_t el_util_time_now(void);
+#endif /* EL_HAS_INT64 */
 
 /* Error handling. */
 const char *el_error_msg(void);
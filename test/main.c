@@ -17,10 +17,12 @@
 /* Private methods. */
 void error_cleanup(eld_handle_t *doc);
 el_err_t create_doc(eld_handle_t *doc, const char *fname);
+bool print_row(eld_handle_t *doc, const el_row_t *row, void *arg);
 
 int main(int argc, char **argv) {
 	el_err_t err;
 	eld_handle_t *doc;
+	el_expr_t *expr;
 	uint32_t i;
 
 	/* Quick argument check. */
@@ -77,6 +79,21 @@ int main(int argc, char **argv) {
 	printf("Rows using %u bytes in total.\n", doc->header.row_count *
 		doc->header.row_len);
 
+	/* Print the rows that match a filter. */
+	expr = el_expr_compile(doc, "Integer > 200 || \"String 10\" == 'Row 1'");
+	if (expr == NULL) {
+		error_cleanup(doc);
+		return EL_ERROR_UNKNOWN;
+	}
+	printf("\nRows matching the filter:\n");
+	err = el_doc_scan(doc, expr, print_row, NULL);
+	el_expr_free(expr);
+	IF_EL_ERROR(err) {
+		error_cleanup(doc);
+		return err;
+	}
+	printf("\n");
+
 quit:
 	/* Close everything up. */
 	err = el_doc_free(doc);
@@ -100,6 +117,23 @@ void error_cleanup(eld_handle_t *doc) {
 	el_doc_free(doc);
 }
 
+/**
+ * Prints a row found while scanning the document.
+ *
+ * @param doc EntryLogger document object.
+ * @param row Row that matched the scan filter.
+ * @param arg Unused.
+ *
+ * @return Always true since we want to see every matching row.
+ */
+bool print_row(eld_handle_t *doc, const el_row_t *row, void *arg) {
+	printf("\t%lu\t%ld\t%f\t%s\n", (unsigned long)row->index,
+		   (long)row->cells[0].value.integer,
+		   row->cells[1].value.number, row->cells[2].value.string);
+
+	return true;
+}
+
 /**
  * Creates an example document to play around with.
  *
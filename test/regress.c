@@ -0,0 +1,2313 @@
+/**
+ * libentrylogger Regression Tests
+ * Exercises every feature of the library and of the daemon, checking the
+ * results instead of printing them, so that a regression fails the build.
+ *
+ * @author Nathan Campos <nathan@innoveworkshop.com>
+ */
+
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../src/entrylog.h"
+#include "../eldd/eldd.h"
+
+/* Checks a condition and records a failure without stopping the test. */
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+/* Daemon that the tests talk to. */
+#define REGRESS_DAEMON "./eldd"
+#define REGRESS_SOCKET "regress.sock"
+
+/* Number of checks that failed. */
+static uint32_t failures = 0;
+
+/* Private methods. */
+bool check(bool cond, const char *expr, const char *file, int line);
+void doc_remove(const char *fname);
+eld_handle_t *doc_create(const char *fname);
+eld_handle_t *doc_reopen(eld_handle_t *doc);
+void doc_close(eld_handle_t *doc);
+void doc_add_ints(eld_handle_t *doc, uint32_t count, int32_t base);
+uint32_t doc_count(eld_handle_t *doc, const char *src);
+bool files_equal(const char *a, const char *b);
+double *out_new(uint32_t count);
+bool near(double a, double b);
+bool count_row(eld_handle_t *doc, const el_row_t *row, void *arg);
+bool sum_row(eld_handle_t *doc, const el_row_t *row, void *arg);
+bool check_strings(eld_handle_t *doc, const el_row_t *row, void *arg);
+bool count_value(uint32_t value, void *arg);
+bool count_keys(const char *key, const uint32_t *rows, uint32_t count,
+				void *arg);
+bool count_pairs(const el_row_t *left, const el_row_t *right, void *arg);
+bool cancel_progress(uint32_t done, uint32_t total, void *arg);
+void test_windows(void);
+void test_expressions(void);
+void test_pipelines(void);
+void test_late_strings(void);
+void test_joins(void);
+void test_blooms(void);
+void test_sidecars(void);
+void test_indexes(void);
+void test_bitmaps(void);
+void test_index_updates(void);
+void test_tombstones(void);
+void test_truncate(void);
+void test_ring(void);
+void test_schemas(void);
+void test_field_lookup(void);
+void test_types(void);
+void test_timestamps(void);
+void test_nulls(void);
+void test_varchar(void);
+void test_decimals(void);
+void test_arrays(void);
+void test_strings(void);
+void test_rowsets(void);
+void test_interning(void);
+void test_eldd_protocol(void);
+void test_eldd_daemon(void);
+void test_replication(void);
+
+int main(void) {
+	/* Show how far we got if one of the tests crashes. */
+	setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+	printf("libentrylogger Regression Tests\n\n");
+
+	test_windows();
+	test_expressions();
+	test_pipelines();
+	test_late_strings();
+	test_joins();
+	test_blooms();
+	test_sidecars();
+	test_indexes();
+	test_bitmaps();
+	test_index_updates();
+	test_tombstones();
+	test_truncate();
+	test_ring();
+	test_schemas();
+	test_field_lookup();
+	test_types();
+	test_timestamps();
+	test_nulls();
+	test_varchar();
+	test_decimals();
+	test_arrays();
+	test_strings();
+	test_rowsets();
+	test_interning();
+	test_eldd_protocol();
+	test_eldd_daemon();
+	test_replication();
+
+	if (failures > 0) {
+		printf("\n%lu checks failed.\n", (unsigned long)failures);
+		return 1;
+	}
+
+	printf("\nAll checks passed.\n");
+	return 0;
+}
+
+/**
+ * Moving averages, EWMA, rates and deltas, including documents that were
+ * truncated, have deleted rows and null values.
+ */
+void test_windows(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	double *out;
+	uint32_t i;
+
+	printf("Windows\n");
+
+	/* Straight values. */
+	doc = doc_create("regress_win.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "T", 1));
+	CHECK(el_doc_save(doc, "regress_win.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		row->cells[1].value.integer = (int32_t)(i * 2);
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	out = out_new(3000);
+	CHECK(el_window_moving_avg(doc, 0, 3, out) == EL_OK);
+	CHECK(near(out[0], 0) && near(out[1], 0.5) && near(out[5], 4));
+	CHECK(near(out[2999], 2998));
+	CHECK(el_window_ewma(doc, 0, 0.5, out) == EL_OK);
+	CHECK(near(out[0], 0) && near(out[1], 0.5) && near(out[2], 1.25));
+	CHECK(el_window_delta(doc, 0, out) == EL_OK);
+	CHECK(near(out[0], 0) && near(out[1], 1) && near(out[2999], 1));
+	CHECK(el_window_rate(doc, 0, 1, out) == EL_OK);
+	CHECK(near(out[0], 0) && near(out[1], 0.5) && near(out[2999], 0.5));
+	CHECK(el_window_moving_avg(doc, 5, 3, out) == EL_ERROR_ARGUMENT);
+	CHECK(el_window_rate(doc, 0, 5, out) == EL_ERROR_ARGUMENT);
+	free(out);
+	doc_close(doc);
+
+	/* Truncated, deleted and null rows must not be part of the window. */
+	doc = doc_create("regress_win.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "T", 1));
+	el_doc_nullable(doc, true);
+	CHECK(el_doc_save(doc, "regress_win.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = ((i == 10) || (i == 2100) ||
+									   (i == 2500)) ? 999 : 100;
+		row->cells[0].null = i == 2500;
+		row->cells[1].value.integer = (int32_t)i;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	CHECK(el_doc_truncate_front(doc, 2000) == EL_OK);
+	CHECK(el_doc_row_delete(doc, 2100) == EL_OK);
+
+	out = out_new(3000);
+	CHECK(el_window_moving_avg(doc, 0, 4, out) == EL_OK);
+	CHECK(near(out[10], -1) && near(out[2100], -1));
+	CHECK(near(out[2000], 100) && near(out[2001], 100) &&
+		  near(out[2003], 100));
+	CHECK(near(out[2500], 100) && near(out[2999], 100));
+	CHECK(el_window_ewma(doc, 0, 0.5, out) == EL_OK);
+	CHECK(near(out[2000], 100) && near(out[2500], 100) &&
+		  near(out[2999], 100));
+	CHECK(el_window_delta(doc, 0, out) == EL_OK);
+	CHECK(near(out[2000], 0) && near(out[2101], 0) && near(out[2500], 0) &&
+		  near(out[2501], 0));
+	CHECK(el_window_rate(doc, 0, 1, out) == EL_OK);
+	CHECK(near(out[2000], 0) && near(out[2101], 0) && near(out[2501], 0));
+	free(out);
+	doc_close(doc);
+	doc_remove("regress_win.eld");
+}
+
+/**
+ * Compiled filter expressions.
+ */
+void test_expressions(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	uint32_t i;
+
+	printf("Expressions\n");
+
+	doc = doc_create("regress_expr.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_FLOAT, "Val", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 8));
+	CHECK(el_doc_save(doc, "regress_expr.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 5000; i++) {
+		char tag[8];
+
+		row->cells[0].value.integer = (int32_t)i;
+		row->cells[1].value.number = (float)i / 2;
+		sprintf(tag, "T%u", (unsigned int)(i % 10));
+		el_cell_string_set(&(row->cells[2]), tag);
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	CHECK(doc_count(doc, NULL) == 5000);
+	CHECK(doc_count(doc, "Id >= 1000 && Id < 2000") == 1000);
+	CHECK(doc_count(doc, "Id >= 1000 && Tag == 'T3'") == 400);
+	CHECK(doc_count(doc, "Tag == 'T3' || Id == 0") == 501);
+	CHECK(doc_count(doc, "!(Id < 4990)") == 10);
+	CHECK(doc_count(doc, "Val <= 1.5") == 4);
+	CHECK(doc_count(doc, "Tag != 'T0'") == 4500);
+	CHECK(doc_count(doc, "Tag == 'NOPE'") == 0);
+	CHECK(el_expr_compile(doc, "Nope == 1") == NULL);
+	CHECK(el_expr_compile(doc, "Id == ") == NULL);
+
+	doc_close(doc);
+	doc_remove("regress_expr.eld");
+}
+
+/**
+ * Query pipelines, including operators at the end of the pipeline and invalid
+ * fields.
+ */
+void test_pipelines(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_expr_t *expr;
+	el_op_t *op;
+	el_op_t *agg;
+	const el_group_t *groups;
+	uint8_t fields[1];
+	uint32_t count;
+	uint32_t i;
+
+	printf("Pipelines\n");
+
+	doc = doc_create("regress_pipe.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "G", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "S", 8));
+	CHECK(el_doc_save(doc, "regress_pipe.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		row->cells[1].value.integer = (int32_t)(i % 3);
+		el_cell_string_set(&(row->cells[2]), (i % 2) ? "odd" : "even");
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	expr = el_expr_compile(doc, "V >= 1000");
+
+	/* Operators without anything after them. */
+	op = el_op_filter(expr);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	el_op_free(op);
+	op = el_op_limit(5);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	el_op_free(op);
+	fields[0] = 0;
+	op = el_op_project(fields, 1);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	el_op_free(op);
+
+	/* Filter, project and output. */
+	count = 0;
+	op = el_op_then(el_op_filter(expr), el_op_project(fields, 1));
+	el_op_then(op->next, el_op_output(count_row, &count));
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	CHECK(count == 2000);
+	el_op_free(op);
+
+	/* Limit. */
+	count = 0;
+	op = el_op_then(el_op_limit(10), el_op_output(count_row, &count));
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	CHECK(count == 10);
+	el_op_free(op);
+
+	/* Aggregate by group. */
+	agg = el_op_aggregate(1, 0);
+	op = el_op_then(el_op_filter(expr), agg);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	groups = el_op_aggregate_groups(agg, &count);
+	CHECK(count == 3);
+	if (count == 3) {
+		CHECK((groups[0].count + groups[1].count + groups[2].count) == 2000);
+		CHECK(near(groups[0].sum + groups[1].sum + groups[2].sum,
+				   (1000.0 + 2999.0) * 2000 / 2));
+	}
+	el_op_free(op);
+
+	/* Aggregate by string. */
+	agg = el_op_aggregate(2, 0);
+	CHECK(el_query_run(doc, 0, 3000, agg) == EL_OK);
+	groups = el_op_aggregate_groups(agg, &count);
+	CHECK(count == 2);
+	if (count == 2)
+		CHECK((groups[0].count == 1500) && (groups[1].count == 1500));
+	el_op_free(agg);
+
+	/* Invalid fields. */
+	op = el_op_aggregate(7, 0);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_ERROR_ARGUMENT);
+	el_op_free(op);
+	op = el_op_aggregate(-1, 9);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_ERROR_ARGUMENT);
+	el_op_free(op);
+	op = el_op_aggregate(-1, 2);
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_ERROR_ARGUMENT);
+	el_op_free(op);
+	fields[0] = 9;
+	op = el_op_then(el_op_project(fields, 1),
+					el_op_output(count_row, &count));
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_ERROR_ARGUMENT);
+	el_op_free(op);
+
+	el_expr_free(expr);
+	doc_close(doc);
+	doc_remove("regress_pipe.eld");
+}
+
+/**
+ * Strings that are only decoded for the rows that made it through a filter.
+ */
+void test_late_strings(void) {
+	eld_handle_t *doc;
+	el_expr_t *expr;
+	el_row_t *row;
+	el_op_t *op;
+	uint8_t fields[2];
+	uint32_t counts[2];
+	char buf[64];
+	uint32_t i;
+
+	printf("Late materialization\n");
+
+	doc = doc_create("regress_late.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 12));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 8));
+	CHECK(el_doc_save(doc, "regress_late.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(buf, "TAG-%04u", (unsigned int)i);
+		el_cell_string_set(&(row->cells[1]), buf);
+		sprintf(buf, "a note that lives in the heap %u", (unsigned int)i);
+		el_cell_string_set(&(row->cells[2]), buf);
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Only the projected strings of the selected rows are handed over. */
+	expr = el_expr_compile(doc, "Id >= 2990 || Tag == 'TAG-0005'");
+	fields[0] = 1;
+	fields[1] = 2;
+	counts[0] = 0;
+	counts[1] = 0;
+	op = el_op_then(el_op_filter(expr), el_op_project(fields, 2));
+	el_op_then(op->next, el_op_output(check_strings, counts));
+	CHECK(el_query_run(doc, 0, 3000, op) == EL_OK);
+	CHECK((counts[0] == 11) && (counts[1] == 0));
+	el_op_free(op);
+	el_expr_free(expr);
+
+	doc_close(doc);
+	doc_remove("regress_late.eld");
+}
+
+/**
+ * Hash joins on string and numeric keys.
+ */
+void test_joins(void) {
+	eld_handle_t *left;
+	eld_handle_t *right;
+	el_row_t *row;
+	uint32_t count;
+	uint32_t i;
+
+	printf("Joins\n");
+
+	left = doc_create("regress_jl.eld");
+	el_doc_field_add(left, el_field_def_new(EL_FIELD_STRING, "Dev", 12));
+	el_doc_field_add(left, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	CHECK(el_doc_save(left, "regress_jl.eld") == EL_OK);
+	right = doc_create("regress_jr.eld");
+	el_doc_field_add(right, el_field_def_new(EL_FIELD_STRING, "Dev", 10));
+	el_doc_field_add(right, el_field_def_new(EL_FIELD_FLOAT, "Id", 1));
+	CHECK(el_doc_save(right, "regress_jr.eld") == EL_OK);
+
+	row = el_row_new(left);
+	for (i = 0; i < 60; i++) {
+		sprintf(row->cells[0].value.string, "D%u", (unsigned int)i);
+		row->cells[1].value.integer = (int32_t)i;
+		el_doc_row_add(left, row);
+	}
+	el_row_free(row);
+	row = el_row_new(right);
+	for (i = 0; i < 3000; i++) {
+		sprintf(row->cells[0].value.string, "D%u", (unsigned int)(i % 100));
+		row->cells[1].value.number = (float)(i % 100);
+		el_doc_row_add(right, row);
+	}
+	el_row_free(row);
+
+	count = 0;
+	CHECK(el_doc_hash_join(left, 0, right, 0, count_pairs, &count) == EL_OK);
+	CHECK(count == 1800);
+	count = 0;
+	CHECK(el_doc_hash_join(right, 1, left, 1, count_pairs, &count) == EL_OK);
+	CHECK(count == 1800);
+	CHECK(el_doc_hash_join(left, 0, right, 1, count_pairs, &count) ==
+		  EL_ERROR_ARGUMENT);
+
+	doc_close(left);
+	doc_close(right);
+	doc_remove("regress_jl.eld");
+	doc_remove("regress_jr.eld");
+}
+
+/**
+ * Bloom filters skipping blocks, and keeping up with appends and updates.
+ */
+void test_blooms(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	uint32_t i;
+
+	printf("Bloom filters\n");
+
+	doc = doc_create("regress_bloom.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Dev", 10));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	CHECK(el_doc_save(doc, "regress_bloom.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 5500; i++) {
+		sprintf(row->cells[0].value.string, "D%u",
+				(unsigned int)((i / 1000 * 1000) + (i % 7)));
+		row->cells[1].value.integer = (int32_t)i;
+		el_doc_row_add(doc, row);
+		if (i == 2000)
+			CHECK(el_bloom_add(doc, 0) == EL_OK);
+		if (i == 3000)
+			CHECK(el_bloom_add(doc, 1) == EL_OK);
+	}
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	CHECK(doc->bloom_count == 2);
+	CHECK(doc_count(doc, "Dev == 'D1003'") == 143);
+	CHECK(doc_count(doc, "Dev == 'D5003' && Id > 0") == 72);
+	CHECK(doc_count(doc, "Dev == 'D3003' || Id == 1") == 143);
+	CHECK(doc_count(doc, "Dev == 'NOPE'") == 0);
+	CHECK(doc_count(doc, "Id == 4500") == 1);
+
+	/* Updates must be added to the filters. */
+	row = el_row_get(doc, 10);
+	strcpy(row->cells[0].value.string, "X1");
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+	CHECK(doc_count(doc, "Dev == 'X1'") == 1);
+	doc = doc_reopen(doc);
+	CHECK(doc_count(doc, "Dev == 'X1'") == 1);
+
+	doc_close(doc);
+	doc_remove("regress_bloom.eld");
+}
+
+/**
+ * Sidecars left behind by another document at the same path.
+ */
+void test_sidecars(void) {
+	eld_handle_t *doc;
+	uint32_t i;
+
+	printf("Sidecar identity\n");
+
+	/* A document with every kind of sidecar. */
+	doc = doc_create("regress_sc.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "S", 8));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "N", 4));
+	CHECK(el_doc_save(doc, "regress_sc.eld") == EL_OK);
+	doc_add_ints(doc, 5000, 0);
+	CHECK(el_doc_field_widen(doc, 1, 12) == EL_OK);
+	CHECK(el_bloom_add(doc, 0) == EL_OK);
+	CHECK(el_index_add(doc, 1, NULL, NULL) == EL_OK);
+	CHECK(el_doc_row_delete(doc, 107) == EL_OK);
+	doc_close(doc);
+
+	/* Recreated in place. */
+	doc = el_doc_new();
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "S", 8));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "N", 4));
+	CHECK(el_doc_save(doc, "regress_sc.eld") == EL_OK);
+	CHECK(!el_util_file_exists("regress_sc.eld.ts"));
+	CHECK(!el_util_file_exists("regress_sc.eld.bf0"));
+	CHECK(!el_util_file_exists("regress_sc.eld.ix1"));
+	CHECK(!el_util_file_exists("regress_sc.eld.sv"));
+	doc_add_ints(doc, 5000, 0);
+	doc_close(doc);
+
+	/* Sidecars from another document copied next to it. */
+	doc = doc_create("regress_sc2.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "S", 8));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "N", 4));
+	CHECK(el_doc_save(doc, "regress_sc2.eld") == EL_OK);
+	doc_add_ints(doc, 5000, 100);
+	CHECK(el_bloom_add(doc, 0) == EL_OK);
+	CHECK(el_index_add(doc, 1, NULL, NULL) == EL_OK);
+	CHECK(el_doc_row_delete(doc, 7) == EL_OK);
+	doc_close(doc);
+	rename("regress_sc2.eld.bf0", "regress_sc.eld.bf0");
+	rename("regress_sc2.eld.ix1", "regress_sc.eld.ix1");
+	rename("regress_sc2.eld.ts", "regress_sc.eld.ts");
+
+	doc = el_doc_new();
+	CHECK(el_doc_read(doc, "regress_sc.eld") == EL_OK);
+	CHECK((doc->bloom_count == 0) && (doc->index_count == 0) &&
+		  (doc->deleted == NULL));
+	CHECK(doc_count(doc, "V == 107") == 1);
+	CHECK(doc_count(doc, NULL) == 5000);
+	CHECK(!el_util_file_exists("regress_sc.eld.bf0"));
+	for (i = 0; i < 3; i++)
+		CHECK(el_doc_row_deleted(doc, i) == false);
+	doc_close(doc);
+
+	doc_remove("regress_sc.eld");
+	doc_remove("regress_sc2.eld");
+}
+
+/**
+ * String indexes with prefix and range lookups.
+ */
+void test_indexes(void) {
+	eld_handle_t *doc;
+	el_index_t *idx;
+	el_bitmap_t *rows;
+	el_row_t *row;
+	uint32_t keys;
+	uint32_t i;
+
+	printf("Indexes\n");
+
+	doc = doc_create("regress_idx.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 8));
+	CHECK(el_doc_save(doc, "regress_idx.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "PUMP-%02u",
+				(unsigned int)(i % 40));
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Built on demand. */
+	idx = el_index_build(doc, 1);
+	CHECK(idx != NULL);
+	CHECK(el_index_build(doc, 0) == NULL);
+	el_index_free(idx);
+	idx = el_index_open(doc, 1);
+	CHECK(idx != NULL);
+	if (idx != NULL) {
+		CHECK(idx->header.key_count == 40);
+		keys = 0;
+		CHECK(el_index_prefix(idx, "PUMP-0", count_keys, &keys) == EL_OK);
+		CHECK(keys == 10);
+		keys = 0;
+		CHECK(el_index_range(idx, "PUMP-10", "PUMP-12", count_keys, &keys) ==
+			  EL_OK);
+		CHECK(keys == 2);
+		rows = el_index_prefix_rows(idx, "PUMP-03");
+		CHECK(el_bitmap_cardinality(rows) == 75);
+		CHECK(el_bitmap_contains(rows, 3) && el_bitmap_contains(rows, 43));
+		el_bitmap_free(rows);
+		el_index_free(idx);
+	}
+
+	doc_close(doc);
+	doc_remove("regress_idx.eld");
+}
+
+/**
+ * Roaring bitmap operations and scans over a set of rows, including rows that
+ * aren't in the document.
+ */
+void test_bitmaps(void) {
+	eld_handle_t *doc;
+	el_bitmap_t *a;
+	el_bitmap_t *b;
+	el_bitmap_t *c;
+	el_expr_t *expr;
+	uint32_t count;
+	uint32_t i;
+	bool ok;
+
+	printf("Bitmaps\n");
+
+	/* Sparse and dense containers. */
+	a = el_bitmap_new();
+	b = el_bitmap_new();
+	for (i = 0; i < 200000; i += 3)
+		el_bitmap_add(a, i);
+	for (i = 0; i < 200000; i += 5)
+		el_bitmap_add(b, i);
+	el_bitmap_add(a, 3);
+	CHECK(el_bitmap_cardinality(a) == 66667);
+
+	c = el_bitmap_and(a, b);
+	CHECK(el_bitmap_cardinality(c) == 13334);
+	el_bitmap_free(c);
+	c = el_bitmap_or(a, b);
+	CHECK(el_bitmap_cardinality(c) == 93333);
+	count = 0;
+	el_bitmap_foreach(c, count_value, &count);
+	CHECK(count == 93333);
+	el_bitmap_free(c);
+	c = el_bitmap_andnot(a, b);
+	CHECK(el_bitmap_cardinality(c) == 53333);
+	ok = true;
+	for (i = 0; i < 200000; i++) {
+		if (el_bitmap_contains(c, i) != ((i % 3 == 0) && (i % 5 != 0)))
+			ok = false;
+	}
+	CHECK(ok);
+	el_bitmap_free(a);
+	el_bitmap_free(b);
+	el_bitmap_free(c);
+
+	/* Filters and scans of a set of rows. */
+	doc = doc_create("regress_bm.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	CHECK(el_doc_save(doc, "regress_bm.eld") == EL_OK);
+	doc_add_ints(doc, 5000, 0);
+	expr = el_expr_compile(doc, "Id >= 4000");
+	a = el_doc_filter(doc, expr);
+	CHECK(el_bitmap_cardinality(a) == 1000);
+	el_bitmap_free(a);
+	el_expr_free(expr);
+
+	a = el_bitmap_new();
+	for (i = 2040; i < 2050; i++)
+		el_bitmap_add(a, i);
+	el_bitmap_add(a, 4999);
+	el_bitmap_add(a, 5000);
+	el_bitmap_add(a, 70000);
+	count = 0;
+	CHECK(el_doc_scan_rows(doc, a, count_row, &count) == EL_OK);
+	CHECK(count == 11);
+
+	/* Rows that were truncated away. */
+	CHECK(el_doc_truncate_front(doc, 2045) == EL_OK);
+	count = 0;
+	CHECK(el_doc_scan_rows(doc, a, count_row, &count) == EL_OK);
+	CHECK(count == 6);
+	el_bitmap_free(a);
+
+	doc_close(doc);
+	doc_remove("regress_bm.eld");
+}
+
+/**
+ * String indexes that are kept up to date as rows are added and updated.
+ */
+void test_index_updates(void) {
+	eld_handle_t *doc;
+	el_bitmap_t *rows;
+	el_row_t *row;
+	uint32_t i;
+
+	printf("Index maintenance\n");
+
+	doc = doc_create("regress_idx.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 8));
+	CHECK(el_doc_save(doc, "regress_idx.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "PUMP-%02u",
+				(unsigned int)(i % 40));
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Built in the background and kept up to date. */
+	CHECK(el_index_add(doc, 1, cancel_progress, NULL) != EL_OK);
+	CHECK(el_index_add(doc, 1, NULL, NULL) == EL_OK);
+	row = el_row_new(doc);
+	for (i = 3000; i < 5000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "PUMP-%02u",
+				(unsigned int)(i % 40));
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	row = el_row_get(doc, 3);
+	strcpy(row->cells[1].value.string, "NEW");
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "PUMP-03");
+	CHECK(el_bitmap_cardinality(rows) == 124);
+	CHECK(!el_bitmap_contains(rows, 3) && el_bitmap_contains(rows, 4963));
+	el_bitmap_free(rows);
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "NEW");
+	CHECK((el_bitmap_cardinality(rows) == 1) && el_bitmap_contains(rows, 3));
+	el_bitmap_free(rows);
+
+	/* And on disk. */
+	doc = doc_reopen(doc);
+	CHECK(doc->index_count == 1);
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "PUMP-03");
+	CHECK(el_bitmap_cardinality(rows) == 124);
+	el_bitmap_free(rows);
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "NEW");
+	CHECK(el_bitmap_cardinality(rows) == 1);
+	el_bitmap_free(rows);
+
+	doc_close(doc);
+	doc_remove("regress_idx.eld");
+}
+
+/**
+ * Deleted rows, their tombstones and compaction.
+ */
+void test_tombstones(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_bitmap_t *rows;
+	double sum;
+	double expected = 0;
+	uint32_t i;
+
+	printf("Tombstones and compaction\n");
+
+	doc = doc_create("regress_del.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 4));
+	CHECK(el_doc_save(doc, "regress_del.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 5000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "K%02u", (unsigned int)(i % 20));
+		el_doc_row_add(doc, row);
+		if (i % 3)
+			expected += i;
+	}
+	el_row_free(row);
+	CHECK(el_index_add(doc, 1, NULL, NULL) == EL_OK);
+	CHECK(el_bloom_add(doc, 1) == EL_OK);
+
+	/* Delete every third row. */
+	for (i = 0; i < 5000; i += 3)
+		CHECK(el_doc_row_delete(doc, i) == EL_OK);
+	CHECK(el_doc_row_delete(doc, 3) == EL_OK);
+	CHECK(el_doc_row_delete(doc, 99999) == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_row_deleted(doc, 3) && !el_doc_row_deleted(doc, 4));
+	CHECK(el_row_get(doc, 3) == NULL);
+	row = el_row_get(doc, 4);
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	row->index = 6;
+	CHECK(el_doc_row_update(doc, row) == EL_ERROR_ARGUMENT);
+	el_row_free(row);
+
+	sum = 0;
+	CHECK(el_doc_scan(doc, NULL, sum_row, &sum) == EL_OK);
+	CHECK(near(sum, expected));
+	CHECK(doc_count(doc, "Id >= 0") == 3333);
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "K05");
+	CHECK(el_bitmap_cardinality(rows) == 167);
+	el_bitmap_free(rows);
+
+	/* Tombstones are kept on disk. */
+	doc = doc_reopen(doc);
+	CHECK(el_doc_row_deleted(doc, 3));
+	CHECK(doc_count(doc, NULL) == 3333);
+
+	/* Compaction can be cancelled without losing anything. */
+	CHECK(el_doc_compact(doc, cancel_progress, NULL) != EL_OK);
+	CHECK(doc->header.row_count == 5000);
+	CHECK(doc_count(doc, NULL) == 3333);
+
+	/* Compaction. */
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	CHECK(doc->header.row_count == 3333);
+	CHECK(!el_doc_row_deleted(doc, 0));
+	row = el_row_get(doc, 2);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 4));
+	el_row_free(row);
+	sum = 0;
+	CHECK(el_doc_scan(doc, NULL, sum_row, &sum) == EL_OK);
+	CHECK(near(sum, expected));
+	CHECK(doc_count(doc, "Tag == 'K05'") == 167);
+	rows = el_index_prefix_rows(el_doc_index(doc, 1), "K05");
+	CHECK(el_bitmap_cardinality(rows) == 167);
+	el_bitmap_free(rows);
+
+	/* The compacted document is the one on disk. */
+	doc = doc_reopen(doc);
+	CHECK(doc->header.row_count == 3333);
+	CHECK(doc_count(doc, NULL) == 3333);
+	CHECK(doc_count(doc, "Tag == 'K05'") == 167);
+	doc_add_ints(doc, 10, 10000);
+	CHECK(doc_count(doc, "Id >= 10000") == 10);
+
+	doc_close(doc);
+	doc_remove("regress_del.eld");
+}
+
+/**
+ * Dropping the oldest rows of a document without rewriting it.
+ */
+void test_truncate(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	double sum;
+	uint32_t i;
+
+	printf("Truncation\n");
+
+	doc = doc_create("regress_trunc.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	CHECK(el_doc_save(doc, "regress_trunc.eld") == EL_OK);
+	doc_add_ints(doc, 3000, 0);
+
+	CHECK(el_doc_truncate_front(doc, 1000) == EL_OK);
+	CHECK(el_doc_truncate_front(doc, 0) == EL_OK);
+	CHECK(el_doc_row_deleted(doc, 999) && !el_doc_row_deleted(doc, 1000));
+	CHECK(el_row_get(doc, 500) == NULL);
+	CHECK(el_doc_row_delete(doc, 500) == EL_OK);
+	row = el_row_get(doc, 1000);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 1000));
+	el_row_free(row);
+	CHECK(doc_count(doc, NULL) == 2000);
+	CHECK(doc_count(doc, "Id < 1500") == 500);
+
+	/* Row indexes stay the same after reopening. */
+	doc = doc_reopen(doc);
+	CHECK(doc->header.row_count == 3000);
+	CHECK(doc_count(doc, NULL) == 2000);
+	doc_add_ints(doc, 10, 3000);
+	row = el_row_get(doc, 3005);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 3005));
+	el_row_free(row);
+
+	/* Compaction reclaims the space and renumbers the rows. */
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	CHECK(doc->header.row_count == 2010);
+	row = el_row_get(doc, 0);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 1000));
+	el_row_free(row);
+	sum = 0;
+	el_doc_scan(doc, NULL, sum_row, &sum);
+	for (i = 1000; i < 3010; i++)
+		sum -= i;
+	CHECK(near(sum, 0));
+
+	/* Dropping more rows than there are empties the document. */
+	CHECK(el_doc_truncate_front(doc, 100000) == EL_OK);
+	CHECK(doc_count(doc, NULL) == 0);
+	doc_add_ints(doc, 1, 5000);
+	CHECK(doc_count(doc, "Id == 5000") == 1);
+
+	doc_close(doc);
+	doc_remove("regress_trunc.eld");
+}
+
+/**
+ * Documents with a fixed number of rows that wrap around.
+ */
+void test_ring(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	struct stat st;
+	long size;
+
+	printf("Ring mode\n");
+
+	doc = doc_create("regress_ring.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	CHECK(el_doc_save(doc, "regress_ring.eld") == EL_OK);
+	doc_add_ints(doc, 2000, 0);
+	CHECK(el_doc_ring(doc, 1000) == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_ring(doc, 3000) == EL_OK);
+	stat("regress_ring.eld", &st);
+	size = (long)st.st_size;
+
+	doc_add_ints(doc, 2500, 2000);
+	CHECK(doc->header.row_count == 4500);
+	CHECK(doc_count(doc, NULL) == 3000);
+	CHECK(doc_count(doc, "Id < 1500") == 0);
+	row = el_row_get(doc, 1500);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 1500));
+	el_row_free(row);
+	row = el_row_get(doc, 4499);
+	CHECK((row != NULL) && (row->cells[0].value.integer == 4499));
+	el_row_free(row);
+	stat("regress_ring.eld", &st);
+	CHECK((long)st.st_size == size + (1000 * doc->header.row_len));
+
+	/* The ring survives being reopened. */
+	doc = doc_reopen(doc);
+	doc_add_ints(doc, 10, 4500);
+	CHECK(doc_count(doc, NULL) == 3000);
+	CHECK(doc_count(doc, "Id >= 4500") == 10);
+	row = el_row_get(doc, 1509);
+	CHECK(row == NULL);
+	el_row_free(row);
+	CHECK(el_bloom_add(doc, 0) == EL_ERROR_ARGUMENT);
+
+	doc_close(doc);
+	doc_remove("regress_ring.eld");
+}
+
+/**
+ * Fields that are added, widened and dropped while the document has rows.
+ */
+void test_schemas(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	uint32_t i;
+
+	printf("Schema versions\n");
+
+	doc = doc_create("regress_schema.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 9));
+	CHECK(el_doc_save(doc, "regress_schema.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 1500; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "T%05u", (unsigned int)i);
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Add a field. */
+	CHECK(el_doc_field_add(doc, el_field_def_new(EL_FIELD_FLOAT, "Val", 1)) ==
+		  EL_OK);
+	CHECK(doc->schema_count == 2);
+	row = el_row_new(doc);
+	for (i = 1500; i < 2500; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "T%05u", (unsigned int)i);
+		row->cells[2].value.number = 1.5f;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Widen a field. */
+	CHECK(el_doc_field_widen(doc, 1, 30) == EL_OK);
+	row = el_row_new(doc);
+	for (i = 2500; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		sprintf(row->cells[1].value.string, "LONGTAGVALUE_%05u",
+				(unsigned int)i);
+		row->cells[2].value.number = 2.5f;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Old rows are migrated as they're read. */
+	doc = doc_reopen(doc);
+	CHECK(doc->schema_count == 3);
+	row = el_row_get(doc, 10);
+	CHECK((row->cells[0].value.integer == 10) &&
+		  (strcmp(row->cells[1].value.string, "T00010") == 0) &&
+		  near(row->cells[2].value.number, 0));
+	el_row_free(row);
+	row = el_row_get(doc, 1600);
+	CHECK(near(row->cells[2].value.number, 1.5));
+	el_row_free(row);
+	row = el_row_get(doc, 2999);
+	CHECK(strcmp(row->cells[1].value.string, "LONGTAGVALUE_02999") == 0);
+	el_row_free(row);
+	CHECK(doc_count(doc, "Val > 1") == 1500);
+	CHECK(doc_count(doc, "Tag == 'T00042'") == 1);
+
+	/* Only rows with the current schema can be updated in place. */
+	row = el_row_get(doc, 5);
+	row->cells[2].value.number = 9.0f;
+	CHECK(el_doc_row_update(doc, row) == EL_ERROR_ARGUMENT);
+	el_row_free(row);
+	row = el_row_get(doc, 2600);
+	row->cells[2].value.number = 9.0f;
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+	CHECK(doc_count(doc, "Val > 5") == 1);
+
+	/* Drop a field. */
+	CHECK(el_doc_field_drop(doc, 2) == EL_OK);
+	CHECK(el_expr_compile(doc, "Val > 1") == NULL);
+	doc_add_ints(doc, 100, 3000);
+	CHECK(doc_count(doc, NULL) == 3100);
+	row = el_row_get(doc, 3050);
+	CHECK((row->cells[0].value.integer == 3050) && (row->cell_count == 2));
+	el_row_free(row);
+
+	/* Compaction rewrites everything with the last schema. */
+	CHECK(el_doc_truncate_front(doc, 1000) == EL_OK);
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	CHECK(doc->schema_count <= 1);
+	row = el_row_get(doc, 0);
+	CHECK((row->cells[0].value.integer == 1000) &&
+		  (strcmp(row->cells[1].value.string, "T01000") == 0));
+	el_row_free(row);
+	doc = doc_reopen(doc);
+	CHECK(doc->header.row_count == 2100);
+	row = el_row_get(doc, 1999);
+	CHECK(strcmp(row->cells[1].value.string, "LONGTAGVALUE_02999") == 0);
+	el_row_free(row);
+
+	doc_close(doc);
+	doc_remove("regress_schema.eld");
+}
+
+/**
+ * Looking up fields by their names.
+ */
+void test_field_lookup(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_cell_t *cell;
+	char name[EL_FIELD_NAME_LEN + 1];
+	uint32_t i;
+	bool ok;
+
+	printf("Field lookup\n");
+
+	doc = el_doc_new();
+	for (i = 0; i < 40; i++) {
+		sprintf(name, "Field%u", (unsigned int)i);
+		el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, name, 1));
+	}
+
+	ok = true;
+	for (i = 0; i < 40; i++) {
+		sprintf(name, "Field%u", (unsigned int)i);
+		if (el_doc_field_index(doc, name) != (int)i)
+			ok = false;
+	}
+	CHECK(ok);
+	CHECK(el_doc_field_index(doc, "Nope") == -1);
+	CHECK(el_doc_field_index(doc, "Field") == -1);
+
+	row = el_row_new(doc);
+	cell = el_row_cell(doc, row, "Field17");
+	CHECK(cell == &(row->cells[17]));
+	CHECK(el_row_cell(doc, row, "Nope") == NULL);
+	el_row_free(row);
+
+	doc_close(doc);
+}
+
+/**
+ * Compact numeric types and booleans that share bytes.
+ */
+void test_types(void) {
+	eld_handle_t *doc;
+	eld_handle_t *other;
+	el_row_t *row;
+	el_op_t *agg;
+	uint32_t count;
+	uint32_t i;
+
+	printf("Field types\n");
+
+	doc = doc_create("regress_types.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT8, "I8", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT16, "I16", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT64, "I64", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_UINT8, "U8", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_UINT16, "U16", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_UINT32, "U32", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_UINT64, "U64", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_DOUBLE, "D", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_BOOL, "B0", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_BOOL, "B1", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_BOOL, "B2", 1));
+	CHECK(el_doc_save(doc, "regress_types.eld") == EL_OK);
+	CHECK(doc->header.row_len == (1 + 2 + 8 + 1 + 2 + 4 + 8 + 8 + 1));
+
+	row = el_row_new(doc);
+	for (i = 0; i < 100; i++) {
+		row->cells[0].value.int8 = (int8_t)(-(int)i);
+		row->cells[1].value.int16 = (int16_t)(-1000 * (int)i);
+		row->cells[2].value.int64 = -((int64_t)i << 40);
+		row->cells[3].value.uint8 = (uint8_t)(200 + (i % 50));
+		row->cells[4].value.uint16 = (uint16_t)(60000 + i);
+		row->cells[5].value.uint32 = 4000000000UL + i;
+		row->cells[6].value.uint64 = ((uint64_t)i << 60) | 1;
+		row->cells[7].value.real = 1.0 / (i + 1);
+		row->cells[8].value.boolean = (i % 2) == 0;
+		row->cells[9].value.boolean = (i % 3) == 0;
+		row->cells[10].value.boolean = (i % 5) == 0;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	row = el_row_get(doc, 15);
+	CHECK(row->cells[0].value.int8 == -15);
+	CHECK(row->cells[1].value.int16 == -15000);
+	CHECK(row->cells[2].value.int64 == -((int64_t)15 << 40));
+	CHECK(row->cells[3].value.uint8 == 215);
+	CHECK(row->cells[4].value.uint16 == 60015);
+	CHECK(row->cells[5].value.uint32 == 4000000015UL);
+	CHECK(row->cells[6].value.uint64 == (((uint64_t)15 << 60) | 1));
+	CHECK(near(row->cells[7].value.real, 1.0 / 16));
+	CHECK(!row->cells[8].value.boolean && row->cells[9].value.boolean &&
+		  row->cells[10].value.boolean);
+	el_row_free(row);
+	CHECK(doc_count(doc, "B1 == 1 && B2 == 1") == 7);
+	CHECK(doc_count(doc, "U32 > 4000000090") == 9);
+	CHECK(doc_count(doc, "I8 < -97") == 2);
+	CHECK(doc_count(doc, "U64 == 1152921504606846976") == 0);
+	CHECK(doc_count(doc, "U64 > 17293822569102704640") == 6);
+	doc_close(doc);
+	doc_remove("regress_types.eld");
+
+	/* 64-bit keys above 2^53 must not be rounded to the same double. */
+	doc = doc_create("regress_big.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT64, "K", 1));
+	CHECK(el_doc_save(doc, "regress_big.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.int64 = ((int64_t)1 << 60) + i;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	CHECK(el_bloom_add(doc, 0) == EL_OK);
+	CHECK(doc_count(doc, "K == 1152921504606846979") == 1);
+	CHECK(doc_count(doc, "K > 1152921504606846976") == 2999);
+	CHECK(doc_count(doc, "K <= 1152921504606846985") == 10);
+
+	other = doc_create("regress_big2.eld");
+	el_doc_field_add(other, el_field_def_new(EL_FIELD_UINT64, "K", 1));
+	CHECK(el_doc_save(other, "regress_big2.eld") == EL_OK);
+	row = el_row_new(other);
+	for (i = 0; i < 10; i++) {
+		row->cells[0].value.uint64 = ((uint64_t)1 << 60) + (i * 2);
+		el_doc_row_add(other, row);
+	}
+	el_row_free(row);
+	count = 0;
+	CHECK(el_doc_hash_join(doc, 0, other, 0, count_pairs, &count) == EL_OK);
+	CHECK(count == 10);
+
+	agg = el_op_aggregate(0, 0);
+	CHECK(el_query_run(other, 0, 10, agg) == EL_OK);
+	el_op_aggregate_groups(agg, &count);
+	CHECK(count == 10);
+	el_op_free(agg);
+
+	doc_close(doc);
+	doc_close(other);
+	doc_remove("regress_big.eld");
+	doc_remove("regress_big2.eld");
+}
+
+/**
+ * Timestamps, including implicit ones that come from the row index.
+ */
+void test_timestamps(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	double *out;
+	int64_t last = 0;
+	int64_t stamp;
+	uint32_t count;
+	uint32_t id;
+	uint32_t i;
+	char ext[40];
+	FILE *fh;
+	bool ok = true;
+
+	printf("Timestamps\n");
+
+	doc = doc_create("regress_time.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_TIMESTAMP, "Stamp", 1));
+	CHECK(el_doc_time_implicit(doc, "T", 1000000000LL, 250000000LL) ==
+		  EL_OK);
+	CHECK(el_doc_save(doc, "regress_time.eld") == EL_OK);
+
+	/* The header extension has the same layout on every platform. */
+	CHECK(sizeof(eld_header_ext_t) == 40);
+	CHECK(offsetof(eld_header_ext_t, time_start) == 16);
+	CHECK(offsetof(eld_header_ext_t, time_interval) == 24);
+	CHECK(offsetof(eld_header_ext_t, doc_id) == 32);
+	fh = fopen("regress_time.eld", "rb");
+	CHECK(fh != NULL);
+	if (fh != NULL) {
+		fseek(fh, sizeof(eld_header_t) +
+			  (sizeof(el_field_def_t) * doc->header.field_desc_count),
+			  SEEK_SET);
+		CHECK(fread(ext, 1, sizeof(ext), fh) == sizeof(ext));
+		memcpy(&stamp, ext + 24, sizeof(int64_t));
+		memcpy(&id, ext + 32, sizeof(uint32_t));
+		CHECK((stamp == 250000000LL) && (id == doc->ext.doc_id));
+		fclose(fh);
+	}
+
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)(i * 2);
+		row->cells[1].value.timestamp = 0;
+		el_doc_row_add(doc, row);
+		if (row->cells[1].value.timestamp <= last)
+			ok = false;
+		last = row->cells[1].value.timestamp;
+	}
+	el_row_free(row);
+	CHECK(ok);
+
+	doc = doc_reopen(doc);
+	CHECK(el_doc_row_time(doc, 2000) == 1000000000LL + 2000 * 250000000LL);
+	row = el_row_get(doc, 2000);
+	CHECK(row->cells[2].value.timestamp ==
+		  1000000000LL + 2000 * 250000000LL);
+	el_row_free(row);
+	CHECK(doc_count(doc, "T >= 500000000000 && T < 501000000000") == 4);
+
+	out = out_new(3000);
+	CHECK(el_window_rate(doc, 0, 2, out) == EL_OK);
+	CHECK(near(out[1], 2 / 250000000.0));
+	free(out);
+
+	/* Implicit times follow the rows through truncation and compaction. */
+	CHECK(el_doc_truncate_front(doc, 1000) == EL_OK);
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	row = el_row_get(doc, 1000);
+	CHECK((row->cells[0].value.integer == 4000) &&
+		  (row->cells[2].value.timestamp ==
+		   1000000000LL + 2000 * 250000000LL));
+	el_row_free(row);
+	doc_close(doc);
+	doc_remove("regress_time.eld");
+
+	/* Nanoseconds apart must still be told apart around the current time. */
+	doc = doc_create("regress_ns.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_TIMESTAMP, "At", 1));
+	CHECK(el_doc_time_implicit(doc, "T", 1700000000000000000LL, 1) == EL_OK);
+	CHECK(el_doc_save(doc, "regress_ns.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		row->cells[1].value.timestamp = 1700000000000000000LL + i;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	CHECK(el_bloom_add(doc, 1) == EL_OK);
+	CHECK(doc_count(doc, "At == 1700000000000000005") == 1);
+	CHECK(doc_count(doc, "At > 1700000000000000000") == 2999);
+	CHECK(doc_count(doc, "T == 1700000000000000005") == 1);
+	CHECK(doc_count(doc, "T < 1700000000000000010") == 10);
+	count = 0;
+	CHECK(el_doc_hash_join(doc, 1, doc, 1, count_pairs, &count) == EL_OK);
+	CHECK(count == 3000);
+
+	out = out_new(3000);
+	CHECK(el_window_rate(doc, 0, 1, out) == EL_OK);
+	CHECK(near(out[1], 1) && near(out[2999], 1));
+	CHECK(el_window_rate(doc, 0, 2, out) == EL_OK);
+	CHECK(near(out[1], 1) && near(out[2999], 1));
+	free(out);
+
+	doc_close(doc);
+	doc_remove("regress_ns.eld");
+}
+
+/**
+ * Null values in filters, aggregates and documents that became nullable.
+ */
+void test_nulls(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_op_t *agg;
+	const el_group_t *groups;
+	uint32_t count;
+	uint32_t i;
+
+	printf("Nulls\n");
+
+	doc = doc_create("regress_null.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "K", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_FLOAT, "F", 1));
+	CHECK(el_doc_save(doc, "regress_null.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 100; i++) {
+		row->cells[0].value.integer = (int32_t)(i % 3);
+		row->cells[1].value.number = (float)i;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	/* Rows from before being nullable don't have nulls. */
+	CHECK(el_doc_nullable(doc, true) == EL_OK);
+	row = el_row_new(doc);
+	for (i = 100; i < 200; i++) {
+		row->cells[0].value.integer = (int32_t)(i % 3);
+		row->cells[0].null = (i % 10) == 0;
+		row->cells[1].value.number = (float)i;
+		row->cells[1].null = (i % 2) == 0;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	CHECK(doc->ext.flags & EL_EXT_NULLS);
+	row = el_row_get(doc, 50);
+	CHECK(!row->cells[1].null && near(row->cells[1].value.number, 50));
+	el_row_free(row);
+	row = el_row_get(doc, 102);
+	CHECK(row->cells[1].null && !row->cells[0].null);
+	el_row_free(row);
+	CHECK(doc_count(doc, "F >= 0") == 150);
+	CHECK(doc_count(doc, "F == NULL") == 50);
+	CHECK(doc_count(doc, "K == NULL") == 10);
+	CHECK(doc_count(doc, "F != NULL && K == NULL") == 0);
+
+	/* Nulls aren't aggregated. */
+	agg = el_op_aggregate(-1, 1);
+	CHECK(el_query_run(doc, 0, doc->header.row_count, agg) == EL_OK);
+	groups = el_op_aggregate_groups(agg, &count);
+	CHECK((count == 1) && (groups[0].count == 150));
+	el_op_free(agg);
+
+	/* New fields are null in the old rows. */
+	CHECK(el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "New", 1)) ==
+		  EL_OK);
+	CHECK(doc_count(doc, "New == NULL") == 200);
+
+	doc_close(doc);
+	doc_remove("regress_null.eld");
+}
+
+/**
+ * Variable-length strings stored in the heap sidecar.
+ */
+void test_varchar(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	char buf[256];
+	char src[128];
+	uint32_t i;
+
+	printf("Variable-length strings\n");
+
+	doc = doc_create("regress_vc.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "I", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 8));
+	CHECK(el_doc_save(doc, "regress_vc.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 100; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		if (i % 3 == 0) {
+			sprintf(buf, "s%u", (unsigned int)(i % 5));
+		} else {
+			memset(buf, 'a' + (i % 4), 40 + i);
+			buf[40 + i] = '\0';
+		}
+		el_cell_string_set(&(row->cells[1]), buf);
+		CHECK(el_doc_row_add(doc, row) == EL_OK);
+	}
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	row = el_row_get(doc, 3);
+	CHECK(strcmp(row->cells[1].value.string, "s3") == 0);
+	el_row_free(row);
+	row = el_row_get(doc, 5);
+	CHECK(strlen(row->cells[1].value.string) == 45);
+	el_row_free(row);
+	CHECK(doc_count(doc, "Note == 's0'") == 7);
+	memset(buf, 'b', 45);
+	buf[45] = '\0';
+	sprintf(src, "Note == '%.45s'", buf);
+	CHECK(doc_count(doc, src) == 1);
+
+	/* Updates. */
+	row = el_row_get(doc, 5);
+	el_cell_string_set(&(row->cells[1]), "short");
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+	row = el_row_get(doc, 6);
+	memset(buf, 'z', 200);
+	buf[200] = '\0';
+	el_cell_string_set(&(row->cells[1]), buf);
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	row = el_row_get(doc, 5);
+	CHECK(strcmp(row->cells[1].value.string, "short") == 0);
+	el_row_free(row);
+	row = el_row_get(doc, 6);
+	CHECK(strcmp(row->cells[1].value.string, buf) == 0);
+	el_row_free(row);
+
+	/* Compaction keeps the strings. */
+	CHECK(el_doc_row_delete(doc, 0) == EL_OK);
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	row = el_row_get(doc, 5);
+	CHECK(strcmp(row->cells[1].value.string, buf) == 0);
+	el_row_free(row);
+
+	doc_close(doc);
+	doc_remove("regress_vc.eld");
+}
+
+/**
+ * Fixed-point decimals, which must add up exactly.
+ */
+void test_decimals(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_op_t *agg;
+	el_op_t *op;
+	el_expr_t *expr;
+	const el_group_t *groups;
+	int64_t expected = 0;
+	uint32_t count;
+	uint32_t i;
+
+	printf("Decimals\n");
+
+	doc = doc_create("regress_dec.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "G", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_DECIMAL, "kWh", 3));
+	CHECK(el_doc_save(doc, "regress_dec.eld") == EL_OK);
+	CHECK(doc->field_defs[1].reserved == 3);
+	row = el_row_new(doc);
+	for (i = 0; i < 100000; i++) {
+		row->cells[0].value.integer = (int32_t)(i % 2);
+		row->cells[1].value.decimal = 100 + (i % 7);
+		expected += 100 + (i % 7);
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	agg = el_op_aggregate(-1, 1);
+	CHECK(el_query_run(doc, 0, doc->header.row_count, agg) == EL_OK);
+	groups = el_op_aggregate_groups(agg, &count);
+	CHECK((count == 1) && (groups[0].decimal_sum == expected));
+	CHECK(near(groups[0].min, 0.1) && near(groups[0].max, 0.106));
+	el_op_free(agg);
+
+	expr = el_expr_compile(doc, "kWh == 0.103");
+	CHECK(expr != NULL);
+	agg = el_op_aggregate(0, 1);
+	op = el_op_then(el_op_filter(expr), agg);
+	CHECK(el_query_run(doc, 0, doc->header.row_count, op) == EL_OK);
+	groups = el_op_aggregate_groups(agg, &count);
+	CHECK(count == 2);
+	if (count == 2) {
+		CHECK((groups[0].count + groups[1].count) == 14286);
+		CHECK((groups[0].decimal_sum + groups[1].decimal_sum) ==
+			  (int64_t)14286 * 103);
+	}
+	el_op_free(op);
+	el_expr_free(expr);
+
+	doc_close(doc);
+	doc_remove("regress_dec.eld");
+}
+
+/**
+ * Array fields and their reductions.
+ */
+void test_arrays(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	double *rms;
+	double *peak;
+	uint32_t i;
+	uint16_t j;
+
+	printf("Arrays\n");
+
+	doc = doc_create("regress_arr.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "N", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_FLOAT_ARRAY, "Wave", 256));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT_ARRAY, "Counts", 4));
+	CHECK(el_doc_save(doc, "regress_arr.eld") == EL_OK);
+	CHECK(doc->header.row_len == (4 + (256 * 4) + (4 * 4)));
+	row = el_row_new(doc);
+	for (i = 0; i < 3000; i++) {
+		row->cells[0].value.integer = (int32_t)i;
+		for (j = 0; j < row->cells[1].value.array.len; j++) {
+			((float *)row->cells[1].value.array.data)[j] = (j % 2) ?
+				-(float)(i % 10) : (float)(i % 10) / 2;
+		}
+		for (j = 0; j < row->cells[2].value.array.len; j++) {
+			((int32_t *)row->cells[2].value.array.data)[j] =
+				(int32_t)(j * i) - 5;
+		}
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+	CHECK(el_doc_row_delete(doc, 17) == EL_OK);
+
+	rms = out_new(3000);
+	peak = out_new(3000);
+	CHECK(el_array_rms(doc, 1, rms) == EL_OK);
+	CHECK(el_array_peak(doc, 1, peak) == EL_OK);
+	CHECK(near(rms[7] * rms[7], (49 + 12.25) / 2) && near(peak[7], 7));
+	CHECK(near(rms[17], -1) && near(peak[17], -1));
+	CHECK(el_array_rms(doc, 2, rms) == EL_OK);
+	CHECK(el_array_peak(doc, 2, peak) == EL_OK);
+	CHECK(near(rms[3] * rms[3], (25.0 + 4 + 1 + 16) / 4) && near(peak[3], 5));
+	CHECK(el_array_rms(doc, 0, rms) == EL_ERROR_ARGUMENT);
+	CHECK(el_window_delta(doc, 1, rms) == EL_ERROR_ARGUMENT);
+	CHECK(el_expr_compile(doc, "Wave > 1") == NULL);
+
+	doc = doc_reopen(doc);
+	row = el_row_get(doc, 7);
+	CHECK(row->cells[1].value.array.len == 256);
+	CHECK(near(el_cell_array_peak(&(row->cells[1])), 7));
+	CHECK(near(((int32_t *)row->cells[2].value.array.data)[3], 16));
+	el_row_free(row);
+
+	free(rms);
+	free(peak);
+	doc_close(doc);
+	doc_remove("regress_arr.eld");
+}
+
+/**
+ * Fixed-length strings that fit in the cell and ones that don't.
+ */
+void test_strings(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	char buf[64];
+	uint32_t i;
+	bool ok;
+
+	printf("Strings\n");
+
+	doc = doc_create("regress_str.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Short", 4));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Long", 40));
+	CHECK(el_doc_save(doc, "regress_str.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 100; i++) {
+		sprintf(buf, "S%02u", (unsigned int)i);
+		el_cell_string_set(&(row->cells[0]), buf);
+		sprintf(buf, "a long string that goes on for row %03u",
+				(unsigned int)i);
+		el_cell_string_set(&(row->cells[1]), buf);
+		el_doc_row_add(doc, row);
+	}
+
+	/* Strings are cut to the size of the field. */
+	el_cell_string_set(&(row->cells[0]), "TOOLONG");
+	CHECK(strlen(row->cells[0].value.string) < 8);
+	el_row_free(row);
+
+	doc = doc_reopen(doc);
+	ok = true;
+	for (i = 0; i < 100; i++) {
+		row = el_row_get(doc, i);
+		sprintf(buf, "S%02u", (unsigned int)i);
+		if (strcmp(row->cells[0].value.string, buf) != 0)
+			ok = false;
+		sprintf(buf, "a long string that goes on for row %03u",
+				(unsigned int)i);
+		if (strcmp(row->cells[1].value.string, buf) != 0)
+			ok = false;
+		el_row_free(row);
+	}
+	CHECK(ok);
+
+	doc_close(doc);
+	doc_remove("regress_str.eld");
+}
+
+/**
+ * Moving rows in and out of documents in sets.
+ */
+void test_rowsets(void) {
+	eld_handle_t *doc;
+	eld_handle_t *other;
+	el_rowset_t *set;
+	el_row_t *row;
+	char buf[96];
+	uint32_t i;
+	bool ok;
+
+	printf("Row sets\n");
+
+	doc = doc_create("regress_rs.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 16));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_BOOL, "Ok", 1));
+	el_doc_nullable(doc, true);
+	CHECK(el_doc_save(doc, "regress_rs.eld") == EL_OK);
+
+	/* Append. */
+	set = el_rowset_new(doc, 3000);
+	for (i = 0; i < 3000; i++) {
+		CHECK(el_rowset_add(set) == EL_OK);
+		((int32_t *)el_rowset_column(set, 0))[i] = (int32_t)i;
+		sprintf(buf, "a string that is longer than the field %u",
+				(unsigned int)i);
+		el_rowset_string_set(set, 1, i, buf);
+		((uint8_t *)el_rowset_column(set, 2))[i] = (uint8_t)(i % 2);
+		set->nulls[0][i] = (i % 100) == 0;
+	}
+	CHECK(el_rowset_add(set) == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_rowset_append(doc, set) == EL_OK);
+	CHECK(doc->header.row_count == 3000);
+	el_rowset_free(set);
+
+	/* Read back. */
+	doc = doc_reopen(doc);
+	row = el_row_get(doc, 1234);
+	CHECK((row->cells[0].value.integer == 1234) &&
+		  (strcmp(row->cells[1].value.string,
+				  "a string that is longer than the field 1234") == 0) &&
+		  !row->cells[2].value.boolean);
+	el_row_free(row);
+	CHECK(doc_count(doc, "Id == NULL") == 30);
+	CHECK(el_doc_row_delete(doc, 10) == EL_OK);
+
+	set = el_rowset_new(doc, 100);
+	CHECK(el_rowset_read(doc, 0, 100, set) == EL_OK);
+	CHECK((set->count == 99) && (set->indexes[10] == 11));
+	ok = true;
+	for (i = 0; i < set->count; i++) {
+		sprintf(buf, "a string that is longer than the field %u",
+				(unsigned int)set->indexes[i]);
+		if (strcmp(el_rowset_string(set, 1, i), buf) != 0)
+			ok = false;
+		if (((uint8_t *)el_rowset_column(set, 2))[i] !=
+			(set->indexes[i] % 2))
+			ok = false;
+		if (el_rowset_null(set, 0, i) != ((set->indexes[i] % 100) == 0))
+			ok = false;
+	}
+	CHECK(ok);
+
+	/* Sets that don't match the document. */
+	other = el_doc_new();
+	el_doc_field_add(other, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(other, el_field_def_new(EL_FIELD_STRING, "Note", 4));
+	el_doc_field_add(other, el_field_def_new(EL_FIELD_BOOL, "Ok", 1));
+	CHECK(el_doc_rowset_append(other, set) == EL_ERROR_ARGUMENT);
+	el_rowset_free(set);
+	set = el_rowset_new(other, 10);
+	CHECK(el_rowset_read(doc, 0, 10, set) == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_rowset_append(doc, set) == EL_ERROR_ARGUMENT);
+	el_rowset_free(set);
+	doc_close(other);
+
+	doc_close(doc);
+	doc_remove("regress_rs.eld");
+}
+
+/**
+ * Rows that share their strings with the document.
+ */
+void test_interning(void) {
+	eld_handle_t *doc;
+	el_row_t *row;
+	el_row_t *other;
+	const char *ok;
+	char buf[16];
+	uint32_t i;
+
+	printf("Interning\n");
+
+	doc = doc_create("regress_intern.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Dev", 10));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "St", 4));
+	CHECK(el_doc_save(doc, "regress_intern.eld") == EL_OK);
+	row = el_row_new(doc);
+	for (i = 0; i < 100; i++) {
+		sprintf(buf, "dev%u", (unsigned int)(i % 3));
+		el_cell_string_set(&(row->cells[0]), buf);
+		el_cell_string_set(&(row->cells[1]), (i % 2) ? "OK-long-status" :
+						   "ERR");
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+
+	el_doc_intern(doc, true);
+	ok = el_doc_intern_string(doc, "OK-long-status");
+	row = el_row_get(doc, 1);
+	other = el_row_get(doc, 4);
+	CHECK(row->interned && other->interned);
+	CHECK(row->cells[0].value.string == other->cells[0].value.string);
+	CHECK(row->cells[1].value.string == ok);
+	CHECK(strcmp(other->cells[1].value.string, "ERR") == 0);
+	el_row_free(row);
+	el_row_free(other);
+	for (i = 0; i < 100; i++)
+		el_row_free(el_row_get(doc, i));
+	CHECK(doc->interns->count == 5);
+
+	/* Interned rows are read-only. */
+	row = el_row_get(doc, 1);
+	other = el_row_get(doc, 4);
+	CHECK(el_cell_string_set(&(row->cells[0]), "a longer device") ==
+		  EL_ERROR_ARGUMENT);
+	CHECK(el_cell_string_set(&(row->cells[1]), "a much longer status") ==
+		  EL_ERROR_ARGUMENT);
+	CHECK((strcmp(other->cells[0].value.string, "dev1") == 0) &&
+		  (strcmp(row->cells[1].value.string, "OK-long-status") == 0));
+	CHECK(el_doc_row_update(doc, row) == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_row_add(doc, row) == EL_ERROR_ARGUMENT);
+	CHECK(doc->header.row_count == 100);
+	el_row_free(row);
+	el_row_free(other);
+
+	el_doc_intern(doc, false);
+	row = el_row_get(doc, 1);
+	CHECK(!row->interned &&
+		  (strcmp(row->cells[1].value.string, "OK-long-status") == 0));
+	el_row_free(row);
+
+	doc_close(doc);
+	doc_remove("regress_intern.eld");
+}
+
+/**
+ * Encoding of row sets for the daemon, without a daemon.
+ */
+void test_eldd_protocol(void) {
+	eld_handle_t *doc;
+	el_rowset_t *set;
+	el_rowset_t *decoded;
+	char str[64];
+	char *buf;
+	size_t len;
+	uint32_t i;
+	bool ok;
+
+	printf("Daemon protocol\n");
+
+	doc = el_doc_new();
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 8));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_STRING, "Tag", 8));
+	el_doc_nullable(doc, true);
+
+	set = el_rowset_new(doc, 100);
+	for (i = 0; i < 100; i++) {
+		el_rowset_add(set);
+		((int32_t *)el_rowset_column(set, 0))[i] = (int32_t)i;
+		sprintf(str, "note number %u", (unsigned int)i);
+		el_rowset_string_set(set, 1, i, str);
+		el_rowset_string_set(set, 2, i, "tag");
+		set->nulls[0][i] = (i % 7) == 0;
+	}
+
+	/* A range of the rows. */
+	len = eldd_rowset_len(set, 40, 30);
+	buf = (char *)malloc(len);
+	eldd_rowset_encode(set, 40, 30, buf);
+	decoded = el_rowset_new(doc, 20);
+	CHECK(eldd_rowset_check(decoded, buf, len));
+	CHECK(!eldd_rowset_check(decoded, buf, len - 1));
+	CHECK(eldd_rowset_decode(decoded, buf, 0) == 20);
+	CHECK(eldd_rowset_decode(decoded, buf, 20) == 0);
+	ok = decoded->count == 20;
+	for (i = 0; ok && (i < decoded->count); i++) {
+		int32_t id = ((int32_t *)el_rowset_column(decoded, 0))[i];
+
+		sprintf(str, "note number %u", (unsigned int)(40 + i));
+		if ((id != (int32_t)(40 + i)) ||
+			(strcmp(el_rowset_string(decoded, 1, i), str) != 0) ||
+			(strcmp(el_rowset_string(decoded, 2, i), "tag") != 0) ||
+			(el_rowset_null(decoded, 0, i) != (((40 + i) % 7) == 0)))
+			ok = false;
+	}
+	CHECK(ok);
+
+	/* The rest of the range. */
+	el_rowset_clear(decoded);
+	CHECK(eldd_rowset_decode(decoded, buf, 20) == 10);
+	CHECK(((int32_t *)el_rowset_column(decoded, 0))[9] == 69);
+
+	/* Strings pointing outside of the arena. */
+	i = (uint32_t)len;
+	memcpy(buf + (sizeof(uint32_t) * 2) + (sizeof(int32_t) * 30), &i,
+		   sizeof(uint32_t));
+	CHECK(!eldd_rowset_check(decoded, buf, len));
+
+	free(buf);
+	el_rowset_free(decoded);
+	el_rowset_free(set);
+	doc_close(doc);
+}
+
+/**
+ * Writing through the daemon, including row sets larger than a message and
+ * errors that happen after the rows were handed over.
+ */
+void test_eldd_daemon(void) {
+	eld_handle_t *doc;
+	eldd_client_t *client;
+	el_rowset_t *set;
+	el_row_t *row;
+	char *big;
+	pid_t pid;
+	uint32_t i;
+	int tries;
+
+	printf("Daemon\n");
+
+	/* Start the daemon. */
+	if (!el_util_file_exists(REGRESS_DAEMON)) {
+		printf("  Skipped: the daemon wasn't built.\n");
+		return;
+	}
+	remove(REGRESS_SOCKET);
+	pid = fork();
+	if (pid == 0) {
+		execl(REGRESS_DAEMON, REGRESS_DAEMON, "-s", REGRESS_SOCKET, "-i",
+			  "100", (char *)NULL);
+		_exit(127);
+	}
+	for (tries = 0; (tries < 100) && !el_util_file_exists(REGRESS_SOCKET);
+		 tries++) {
+		usleep(20000);
+	}
+	CHECK(el_util_file_exists(REGRESS_SOCKET));
+
+	/* A row set larger than a single message. */
+	doc = doc_create("regress_dd.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "V", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "S", 16));
+	CHECK(el_doc_save(doc, "regress_dd.eld") == EL_OK);
+	doc_close(doc);
+
+	client = eldd_open(REGRESS_SOCKET, "regress_dd.eld");
+	CHECK(client != NULL);
+	if (client != NULL) {
+		big = (char *)malloc(10001);
+		memset(big, 'x', 10000);
+		big[10000] = '\0';
+		set = el_rowset_new(client->doc, 2000);
+		for (i = 0; i < 2000; i++) {
+			el_rowset_add(set);
+			((int32_t *)el_rowset_column(set, 0))[i] = (int32_t)i;
+			big[0] = (char)('a' + (i % 26));
+			el_rowset_string_set(set, 1, i, big);
+		}
+		CHECK(eldd_rowset_len(set, 0, set->count) > ELDD_MSG_MAX);
+		CHECK(eldd_rowset_add(client, set) == EL_OK);
+		el_rowset_free(set);
+
+		row = el_row_new(client->doc);
+		for (i = 2000; i < 2300; i++) {
+			row->cells[0].value.integer = (int32_t)i;
+			el_cell_string_set(&(row->cells[1]), "short");
+			CHECK(eldd_row_add(client, row) == EL_OK);
+		}
+		el_row_free(row);
+		CHECK(eldd_sync(client) == EL_OK);
+		CHECK(eldd_close(client) == EL_OK);
+		free(big);
+
+		doc = el_doc_new();
+		CHECK(el_doc_read(doc, "regress_dd.eld") == EL_OK);
+		CHECK(doc->header.row_count == 2300);
+		row = el_row_get(doc, 1999);
+		CHECK((row != NULL) && (row->cells[0].value.integer == 1999) &&
+			  (row->cells[1].value.string[0] == 'a' + (1999 % 26)) &&
+			  (strlen(row->cells[1].value.string) == 10000));
+		el_row_free(row);
+		row = el_row_get(doc, 2299);
+		CHECK((row != NULL) &&
+			  (strcmp(row->cells[1].value.string, "short") == 0));
+		el_row_free(row);
+		doc_close(doc);
+	}
+
+	/* Rows that the daemon couldn't write are reported on the next sync. */
+	client = eldd_open(REGRESS_SOCKET, "regress_dd.eld");
+	CHECK(client != NULL);
+	if (client != NULL) {
+		row = el_row_new(client->doc);
+		for (i = 0; i < 10; i++) {
+			row->cells[0].value.integer = (int32_t)i;
+			el_cell_string_set(&(row->cells[1]), "lost");
+			eldd_row_add(client, row);
+		}
+		el_row_free(row);
+		CHECK(eldd_flush(client) == EL_OK);
+		rename("regress_dd.eld", "regress_dd.old");
+		mkdir("regress_dd.eld", 0755);
+		usleep(300000);
+		CHECK(eldd_sync(client) != EL_OK);
+		CHECK(strstr(eldd_error_msg(), "Dropped") != NULL);
+		CHECK(eldd_sync(client) == EL_OK);
+		eldd_close(client);
+		rmdir("regress_dd.eld");
+		rename("regress_dd.old", "regress_dd.eld");
+	}
+
+	/* Stop the daemon. */
+	kill(pid, SIGINT);
+	waitpid(pid, NULL, 0);
+	remove(REGRESS_SOCKET);
+	doc_remove("regress_dd.eld");
+}
+
+/**
+ * Followers that are kept up to date with their documents.
+ */
+void test_replication(void) {
+	eld_handle_t *doc;
+	eld_handle_t *follower;
+	el_rowset_t *set;
+	el_row_t *row;
+	FILE *fh;
+	char buf[96];
+	uint32_t i;
+
+	printf("Replication\n");
+
+	doc = doc_create("regress_rp.eld");
+	doc_remove("regress_rpf.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 16));
+	CHECK(el_doc_replicate(doc, "regress_rpf.eld") == EL_ERROR_ARGUMENT);
+	CHECK(el_doc_save(doc, "regress_rp.eld") == EL_OK);
+	set = el_rowset_new(doc, 3000);
+	for (i = 0; i < 3000; i++) {
+		el_rowset_add(set);
+		((int32_t *)el_rowset_column(set, 0))[i] = (int32_t)i;
+		sprintf(buf, "a string that wouldn't fit in the row %u",
+				(unsigned int)i);
+		el_rowset_string_set(set, 1, i, buf);
+	}
+	CHECK(el_doc_rowset_append(doc, set) == EL_OK);
+	el_rowset_free(set);
+
+	/* Full copy. */
+	CHECK(el_doc_replicate(doc, "regress_rpf.eld") == EL_OK);
+	CHECK(files_equal("regress_rp.eld", "regress_rpf.eld"));
+	CHECK(files_equal("regress_rp.eld.vh", "regress_rpf.eld.vh"));
+
+	/* Blocks that changed behind our back are copied again. */
+	fh = fopen("regress_rpf.eld", "r+b");
+	fseek(fh, 20000, SEEK_SET);
+	fputc(0x7f, fh);
+	fclose(fh);
+	row = el_row_get(doc, 5);
+	row->cells[0].value.integer = 555;
+	CHECK(el_doc_row_update(doc, row) == EL_OK);
+	el_row_free(row);
+	doc_add_ints(doc, 10, 3000);
+	CHECK(el_doc_row_delete(doc, 7) == EL_OK);
+	CHECK(el_doc_replicate(doc, "regress_rpf.eld") == EL_OK);
+	CHECK(files_equal("regress_rp.eld", "regress_rpf.eld"));
+	CHECK(files_equal("regress_rp.eld.vh", "regress_rpf.eld.vh"));
+	CHECK(files_equal("regress_rp.eld.ts", "regress_rpf.eld.ts"));
+
+	/* Compaction shrinks the document. */
+	CHECK(el_doc_compact(doc, NULL, NULL) == EL_OK);
+	CHECK(el_doc_replicate(doc, "regress_rpf.eld") == EL_OK);
+	CHECK(files_equal("regress_rp.eld", "regress_rpf.eld"));
+	CHECK(!el_util_file_exists("regress_rpf.eld.ts"));
+
+	follower = el_doc_new();
+	CHECK(el_doc_read(follower, "regress_rpf.eld") == EL_OK);
+	CHECK(follower->header.row_count == 3009);
+	row = el_row_get(follower, 5);
+	CHECK((row->cells[0].value.integer == 555) &&
+		  (strcmp(row->cells[1].value.string,
+				  "a string that wouldn't fit in the row 5") == 0));
+	el_row_free(row);
+	doc_close(follower);
+
+	/* Another document at the same path starts over. */
+	doc_close(doc);
+	doc = doc_create("regress_rp.eld");
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_INT, "Id", 1));
+	el_doc_field_add(doc, el_field_def_new(EL_FIELD_VARCHAR, "Note", 16));
+	CHECK(el_doc_save(doc, "regress_rp.eld") == EL_OK);
+	doc_add_ints(doc, 3500, 100000);
+	CHECK(el_doc_replicate(doc, "regress_rpf.eld") == EL_OK);
+	CHECK(files_equal("regress_rp.eld", "regress_rpf.eld"));
+
+	doc_close(doc);
+	doc_remove("regress_rp.eld");
+	doc_remove("regress_rpf.eld");
+}
+
+/**
+ * Checks a condition and reports it if it failed.
+ *
+ * @param cond Result of the condition.
+ * @param expr Source of the condition.
+ * @param file File where the check is.
+ * @param line Line where the check is.
+ *
+ * @return The result of the condition.
+ */
+bool check(bool cond, const char *expr, const char *file, int line) {
+	if (!cond) {
+		printf("  FAILED %s:%d: %s\n", file, line, expr);
+		failures++;
+	}
+
+	return cond;
+}
+
+/**
+ * Removes a document and all of its sidecars.
+ *
+ * @param fname Path to the document.
+ */
+void doc_remove(const char *fname) {
+	const char *suffixes[] = { "", ".ts", ".sv", ".vh", ".rc", NULL };
+	char path[256];
+	uint16_t i;
+
+	for (i = 0; suffixes[i] != NULL; i++) {
+		sprintf(path, "%s%s", fname, suffixes[i]);
+		remove(path);
+	}
+	for (i = 0; i < 16; i++) {
+		sprintf(path, "%s.bf%u", fname, (unsigned int)i);
+		remove(path);
+		sprintf(path, "%s.ix%u", fname, (unsigned int)i);
+		remove(path);
+	}
+}
+
+/**
+ * Creates a new document handle for a document that doesn't exist yet.
+ *
+ * @param fname Path where the document will be saved.
+ *
+ * @return Brand new document handle.
+ */
+eld_handle_t *doc_create(const char *fname) {
+	doc_remove(fname);
+	return el_doc_new();
+}
+
+/**
+ * Closes a document and opens it again from its file.
+ *
+ * @param doc Document handle, which is free'd.
+ *
+ * @return New handle of the document.
+ */
+eld_handle_t *doc_reopen(eld_handle_t *doc) {
+	char fname[256];
+
+	strcpy(fname, doc->fname);
+	doc_close(doc);
+
+	doc = el_doc_new();
+	if (el_doc_read(doc, fname) != EL_OK)
+		el_error_print();
+
+	return doc;
+}
+
+/**
+ * Frees a document handle.
+ *
+ * @param doc Document handle.
+ */
+void doc_close(eld_handle_t *doc) {
+	el_doc_free(doc);
+	free(doc);
+}
+
+/**
+ * Adds rows with consecutive values in their first field.
+ *
+ * @param doc   Document handle.
+ * @param count Number of rows to be added.
+ * @param base  Value of the first row.
+ */
+void doc_add_ints(eld_handle_t *doc, uint32_t count, int32_t base) {
+	el_row_t *row;
+	uint32_t i;
+
+	row = el_row_new(doc);
+	for (i = 0; i < count; i++) {
+		row->cells[0].value.integer = base + (int32_t)i;
+		el_doc_row_add(doc, row);
+	}
+	el_row_free(row);
+}
+
+/**
+ * Counts the rows that match a filter expression.
+ *
+ * @param doc Document handle.
+ * @param src Filter expression or NULL to count every row.
+ *
+ * @return Number of rows that matched or (uint32_t)-1 if the expression is
+ *         invalid.
+ */
+uint32_t doc_count(eld_handle_t *doc, const char *src) {
+	el_expr_t *expr = NULL;
+	uint32_t count = 0;
+
+	if (src != NULL) {
+		expr = el_expr_compile(doc, src);
+		if (expr == NULL)
+			return (uint32_t)-1;
+	}
+
+	if (el_doc_scan(doc, expr, count_row, &count) != EL_OK)
+		count = (uint32_t)-1;
+	el_expr_free(expr);
+
+	return count;
+}
+
+/**
+ * Checks if two files have the same contents.
+ *
+ * @param a Path to a file.
+ * @param b Path to the other file.
+ *
+ * @return True if both exist and are the same.
+ */
+bool files_equal(const char *a, const char *b) {
+	FILE *fa;
+	FILE *fb;
+	int ca;
+	int cb;
+
+	fa = fopen(a, "rb");
+	fb = fopen(b, "rb");
+	if ((fa == NULL) || (fb == NULL)) {
+		if (fa != NULL)
+			fclose(fa);
+		if (fb != NULL)
+			fclose(fb);
+		return false;
+	}
+
+	do {
+		ca = fgetc(fa);
+		cb = fgetc(fb);
+	} while ((ca == cb) && (ca != EOF));
+
+	fclose(fa);
+	fclose(fb);
+
+	return ca == cb;
+}
+
+/**
+ * Allocates an array of results with every entry set to -1, so that entries
+ * that were left alone can be told apart.
+ * @warning This function allocates memory that you are responsible for freeing.
+ *
+ * @param count Number of entries.
+ *
+ * @return Brand new array.
+ */
+double *out_new(uint32_t count) {
+	double *out;
+	uint32_t i;
+
+	out = (double *)malloc(sizeof(double) * count);
+	for (i = 0; i < count; i++)
+		out[i] = -1;
+
+	return out;
+}
+
+/**
+ * Compares two numbers allowing for rounding errors.
+ *
+ * @param a A number.
+ * @param b Another number.
+ *
+ * @return True if they are close enough.
+ */
+bool near(double a, double b) {
+	double diff = a - b;
+	double scale = (b < 0) ? -b : b;
+
+	if (diff < 0)
+		diff = -diff;
+
+	return diff <= (1e-6 * ((scale > 1) ? scale : 1));
+}
+
+/**
+ * Scan callback that counts the rows.
+ */
+bool count_row(eld_handle_t *doc, const el_row_t *row, void *arg) {
+	(void)doc;
+	(void)row;
+
+	(*(uint32_t *)arg)++;
+	return true;
+}
+
+/**
+ * Scan callback that adds up the integers in the first field.
+ */
+bool sum_row(eld_handle_t *doc, const el_row_t *row, void *arg) {
+	(void)doc;
+
+	*(double *)arg += row->cells[0].value.integer;
+	return true;
+}
+
+/**
+ * Output callback that checks the projected strings of a row against its
+ * index, counting the rows and the mismatches.
+ */
+bool check_strings(eld_handle_t *doc, const el_row_t *row, void *arg) {
+	uint32_t *counts = (uint32_t *)arg;
+	char buf[64];
+
+	(void)doc;
+
+	counts[0]++;
+	sprintf(buf, "TAG-%04u", (unsigned int)row->index);
+	if ((row->cell_count != 2) ||
+		(strcmp(row->cells[0].value.string, buf) != 0)) {
+		counts[1]++;
+		return true;
+	}
+	sprintf(buf, "a note that lives in the heap %u", (unsigned int)row->index);
+	if (strcmp(row->cells[1].value.string, buf) != 0)
+		counts[1]++;
+
+	return true;
+}
+
+/**
+ * Bitmap callback that counts the values.
+ */
+bool count_value(uint32_t value, void *arg) {
+	(void)value;
+
+	(*(uint32_t *)arg)++;
+	return true;
+}
+
+/**
+ * Index callback that counts the keys.
+ */
+bool count_keys(const char *key, const uint32_t *rows, uint32_t count,
+				void *arg) {
+	(void)key;
+	(void)rows;
+	(void)count;
+
+	(*(uint32_t *)arg)++;
+	return true;
+}
+
+/**
+ * Join callback that counts the pairs of rows.
+ */
+bool count_pairs(const el_row_t *left, const el_row_t *right, void *arg) {
+	(void)left;
+	(void)right;
+
+	(*(uint32_t *)arg)++;
+	return true;
+}
+
+/**
+ * Progress callback that cancels the operation.
+ */
+bool cancel_progress(uint32_t done, uint32_t total, void *arg) {
+	(void)done;
+	(void)total;
+	(void)arg;
+
+	return false;
+}
@@ -12,6 +12,7 @@ PLATFORM := $(shell uname -s)
 # Directories and Paths
 SRCDIR     := src
 TESTDIR    := test
+ELDDDIR    := eldd
 BUILDDIR   := build
 ELDEXAMPLE ?= example.eld
 